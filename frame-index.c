@@ -0,0 +1,330 @@
+#include "frame-index.h"
+
+#include <string.h>
+
+/* Frames are collected in a staging block. Once it is full, the block is encoded and sealed.
+ * Each field of a frame is stored as zigzag varint of the difference to the previous frame
+ * of the block (the first frame to zero), the end and dangling B frame offsets relative to
+ * the start of the frame. The frame number is implicit.
+ *
+ * Readers of a frame in the staging block copy it and check afterwards that the block was not
+ * sealed in the meantime, as the writer only reuses the staging block after sealing it. */
+#define FRAME_INDEX_BLOCK_SHIFT (6)
+#define FRAME_INDEX_BLOCK_SIZE (1 << FRAME_INDEX_BLOCK_SHIFT)
+#define FRAME_INDEX_BLOCK_MASK (FRAME_INDEX_BLOCK_SIZE - 1)
+/* Eight fields of at most ten bytes. */
+#define FRAME_INDEX_FRAME_MAX_ENCODED (80)
+
+/* Table segment k holds FRAME_INDEX_TABLE_BASE << k block pointers, enough for all guint32
+ * frame ids. Segments never move, so readers need no lock. */
+#define FRAME_INDEX_TABLE_BASE (64)
+#define FRAME_INDEX_TABLE_SEGMENTS (21)
+
+typedef struct {
+    gsize size;
+    guint8 data[];
+} FrameIndexBlock;
+
+struct _FrameIndex {
+    FrameIndexBlock **table[FRAME_INDEX_TABLE_SEGMENTS];
+    PESFrameInfo staging[FRAME_INDEX_BLOCK_SIZE];
+    gint count; /* guint32, published frames, only accessed atomically */
+    gint sealed; /* guint32, published blocks, only accessed atomically */
+
+    GList *retired; /* [FrameIndexBlock *] Blocks of a cleared index. */
+    gsize memory_size;
+    guint8 scratch[FRAME_INDEX_BLOCK_SIZE * FRAME_INDEX_FRAME_MAX_ENCODED];
+};
+
+static inline FrameIndexBlock **frame_index_table_slot(FrameIndex *index, guint32 block, gboolean alloc)
+{
+    guint64 n = (guint64)block / FRAME_INDEX_TABLE_BASE + 1;
+    guint k = 63 - __builtin_clzll(n);
+    guint32 offset = block - FRAME_INDEX_TABLE_BASE * ((1u << k) - 1);
+    if (G_UNLIKELY(index->table[k] == NULL)) {
+        if (!alloc)
+            return NULL;
+        index->table[k] = g_new0(FrameIndexBlock *, (gsize)FRAME_INDEX_TABLE_BASE << k);
+        index->memory_size += ((gsize)FRAME_INDEX_TABLE_BASE << k) * sizeof(FrameIndexBlock *);
+    }
+    return &index->table[k][offset];
+}
+
+static inline guint8 *frame_index_put_varint(guint8 *p, guint64 value)
+{
+    while (value >= 0x80) {
+        *p++ = (guint8)value | 0x80;
+        value >>= 7;
+    }
+    *p++ = (guint8)value;
+    return p;
+}
+
+static inline guint8 *frame_index_put_delta(guint8 *p, guint64 value, guint64 reference)
+{
+    gint64 delta = (gint64)(value - reference);
+    return frame_index_put_varint(p, ((guint64)delta << 1) ^ (guint64)(delta >> 63));
+}
+
+static inline const guint8 *frame_index_get_varint(const guint8 *p, guint64 *value)
+{
+    guint64 result = 0;
+    guint shift = 0;
+    while (*p & 0x80) {
+        result |= (guint64)(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    *value = result | ((guint64)*p++ << shift);
+    return p;
+}
+
+static inline const guint8 *frame_index_get_delta(const guint8 *p, guint64 *value, guint64 reference)
+{
+    guint64 zigzag;
+    p = frame_index_get_varint(p, &zigzag);
+    *value = reference + (guint64)((gint64)(zigzag >> 1) ^ -(gint64)(zigzag & 1));
+    return p;
+}
+
+static guint8 *frame_index_encode_frame(guint8 *p, const PESFrameInfo *fi, const PESFrameInfo *prev)
+{
+    p = frame_index_put_delta(p, fi->pts, prev->pts);
+    p = frame_index_put_delta(p, fi->dts, prev->dts);
+    p = frame_index_put_delta(p, fi->pcr, prev->pcr);
+    p = frame_index_put_delta(p, fi->stream_offset_start, prev->stream_offset_start);
+    p = frame_index_put_delta(p, fi->stream_offset_end, fi->stream_offset_start);
+    p = frame_index_put_delta(p, fi->stream_offset_dangling_bframe, fi->stream_offset_start);
+    p = frame_index_put_delta(p, (guint64)fi->pidtype, (guint64)prev->pidtype);
+    p = frame_index_put_delta(p, fi->pid, prev->pid);
+    return p;
+}
+
+/* fi holds the previous frame and is overwritten with the next one. */
+static const guint8 *frame_index_decode_frame(const guint8 *p, PESFrameInfo *fi)
+{
+    guint64 value;
+    p = frame_index_get_delta(p, &fi->pts, fi->pts);
+    p = frame_index_get_delta(p, &fi->dts, fi->dts);
+    p = frame_index_get_delta(p, &fi->pcr, fi->pcr);
+    p = frame_index_get_delta(p, &value, fi->stream_offset_start);
+    fi->stream_offset_start = value;
+    p = frame_index_get_delta(p, &value, fi->stream_offset_start);
+    fi->stream_offset_end = value;
+    p = frame_index_get_delta(p, &value, fi->stream_offset_start);
+    fi->stream_offset_dangling_bframe = value;
+    p = frame_index_get_delta(p, &value, (guint64)fi->pidtype);
+    fi->pidtype = (PidType)value;
+    p = frame_index_get_delta(p, &value, fi->pid);
+    fi->pid = (guint16)value;
+    return p;
+}
+
+FrameIndex *frame_index_new(void)
+{
+    FrameIndex *index = g_new0(FrameIndex, 1);
+    index->memory_size = sizeof(FrameIndex);
+    return index;
+}
+
+static void frame_index_retire_blocks(FrameIndex *index)
+{
+    guint32 sealed = (guint32)g_atomic_int_get(&index->sealed);
+    guint32 j;
+    for (j = 0; j < sealed; ++j)
+        index->retired = g_list_prepend(index->retired, *frame_index_table_slot(index, j, FALSE));
+}
+
+void frame_index_free(FrameIndex *index)
+{
+    if (index) {
+        frame_index_retire_blocks(index);
+        g_list_free_full(index->retired, g_free);
+        guint k;
+        for (k = 0; k < FRAME_INDEX_TABLE_SEGMENTS; ++k)
+            g_free(index->table[k]);
+        g_free(index);
+    }
+}
+
+void frame_index_clear(FrameIndex *index)
+{
+    g_return_if_fail(index != NULL);
+
+    frame_index_retire_blocks(index);
+
+    g_atomic_int_set(&index->count, 0);
+    g_atomic_int_set(&index->sealed, 0);
+}
+
+static void frame_index_seal(FrameIndex *index, guint32 block)
+{
+    PESFrameInfo zero;
+    memset(&zero, 0, sizeof(PESFrameInfo));
+
+    guint8 *p = index->scratch;
+    guint j;
+    for (j = 0; j < FRAME_INDEX_BLOCK_SIZE; ++j)
+        p = frame_index_encode_frame(p, &index->staging[j], j ? &index->staging[j - 1] : &zero);
+
+    gsize size = p - index->scratch;
+    FrameIndexBlock *b = g_malloc(sizeof(FrameIndexBlock) + size);
+    b->size = size;
+    memcpy(b->data, index->scratch, size);
+    index->memory_size += sizeof(FrameIndexBlock) + size;
+
+    *frame_index_table_slot(index, block, TRUE) = b;
+
+    /* The staging block may be reused from now on. */
+    g_atomic_int_set(&index->sealed, (gint)(block + 1));
+}
+
+/* Store without publishing. Only called by the writer. */
+static void frame_index_store(FrameIndex *index, guint32 frame_id, const PESFrameInfo *frame_info)
+{
+    guint32 j = frame_id & FRAME_INDEX_BLOCK_MASK;
+    index->staging[j] = *frame_info;
+    index->staging[j].frame_number = frame_id;
+    if (j == FRAME_INDEX_BLOCK_MASK)
+        frame_index_seal(index, frame_id >> FRAME_INDEX_BLOCK_SHIFT);
+}
+
+guint32 frame_index_append(FrameIndex *index, const PESFrameInfo *frame_info)
+{
+    g_return_val_if_fail(index != NULL, PES_FRAME_ID_INVALID);
+    g_return_val_if_fail(frame_info != NULL, PES_FRAME_ID_INVALID);
+
+    /* We are the only writer, nobody else changes the count. */
+    guint32 frame_id = (guint32)g_atomic_int_get(&index->count);
+    g_return_val_if_fail(frame_id != PES_FRAME_ID_INVALID, PES_FRAME_ID_INVALID);
+
+    frame_index_store(index, frame_id, frame_info);
+
+    /* Publish, the frame is complete before the count is visible (full barrier). */
+    g_atomic_int_set(&index->count, (gint)(frame_id + 1));
+
+    return frame_id;
+}
+
+void frame_index_append_vals(FrameIndex *index, const PESFrameInfo *frame_infos, guint32 count)
+{
+    g_return_if_fail(index != NULL);
+    g_return_if_fail(frame_infos != NULL || count == 0);
+
+    guint32 start = (guint32)g_atomic_int_get(&index->count);
+    guint32 j;
+
+    g_return_if_fail(count < PES_FRAME_ID_INVALID - start);
+
+    for (j = 0; j < count; ++j)
+        frame_index_store(index, start + j, &frame_infos[j]);
+
+    g_atomic_int_set(&index->count, (gint)(start + count));
+}
+
+guint32 frame_index_get_count(FrameIndex *index)
+{
+    return index ? (guint32)g_atomic_int_get(&index->count) : 0;
+}
+
+/* Decode frames [first, first + count) of a sealed block. */
+static gboolean frame_index_decode_block(FrameIndex *index,
+                                         guint32 block,
+                                         guint32 first,
+                                         guint32 count,
+                                         FrameIndexForeachFunc func,
+                                         gpointer userdata)
+{
+    const FrameIndexBlock *b = *frame_index_table_slot(index, block, FALSE);
+    const guint8 *p = b->data;
+    PESFrameInfo fi;
+    guint32 j;
+
+    memset(&fi, 0, sizeof(PESFrameInfo));
+    for (j = 0; j < first + count; ++j) {
+        p = frame_index_decode_frame(p, &fi);
+        if (j >= first) {
+            fi.frame_number = (block << FRAME_INDEX_BLOCK_SHIFT) + j;
+            if (!func(&fi, userdata))
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/* Copy frames from the staging block. Returns FALSE if the block was sealed meanwhile, the
+ * copy may be garbage then. */
+static gboolean frame_index_copy_staging(FrameIndex *index,
+                                         guint32 block,
+                                         guint32 first,
+                                         guint32 count,
+                                         PESFrameInfo *frame_infos)
+{
+    if ((guint32)g_atomic_int_get(&index->sealed) > block)
+        return FALSE;
+    memcpy(frame_infos, &index->staging[first], count * sizeof(PESFrameInfo));
+    return (guint32)g_atomic_int_get(&index->sealed) <= block;
+}
+
+static gboolean _frame_index_get_cb(const PESFrameInfo *fi, PESFrameInfo *frame_info)
+{
+    *frame_info = *fi;
+    return FALSE;
+}
+
+gboolean frame_index_get(FrameIndex *index, guint32 frame_id, PESFrameInfo *frame_info)
+{
+    if (!index || frame_id >= (guint32)g_atomic_int_get(&index->count))
+        return FALSE;
+
+    PESFrameInfo fi;
+    if (!frame_info)
+        frame_info = &fi;
+
+    guint32 block = frame_id >> FRAME_INDEX_BLOCK_SHIFT;
+    if (!frame_index_copy_staging(index, block, frame_id & FRAME_INDEX_BLOCK_MASK, 1, frame_info))
+        frame_index_decode_block(index, block, frame_id & FRAME_INDEX_BLOCK_MASK, 1,
+                                 (FrameIndexForeachFunc)_frame_index_get_cb, frame_info);
+    return TRUE;
+}
+
+void frame_index_foreach(FrameIndex *index,
+                         guint32 first,
+                         guint32 count,
+                         FrameIndexForeachFunc func,
+                         gpointer userdata)
+{
+    g_return_if_fail(index != NULL);
+    g_return_if_fail(func != NULL);
+
+    guint32 published = (guint32)g_atomic_int_get(&index->count);
+    if (first >= published)
+        return;
+    count = MIN(count, published - first);
+
+    PESFrameInfo staged[FRAME_INDEX_BLOCK_SIZE];
+    guint32 block, offset, n, j;
+
+    while (count > 0) {
+        block = first >> FRAME_INDEX_BLOCK_SHIFT;
+        offset = first & FRAME_INDEX_BLOCK_MASK;
+        n = MIN(count, FRAME_INDEX_BLOCK_SIZE - offset);
+
+        if (frame_index_copy_staging(index, block, offset, n, staged)) {
+            for (j = 0; j < n; ++j) {
+                if (!func(&staged[j], userdata))
+                    return;
+            }
+        }
+        else if (!frame_index_decode_block(index, block, offset, n, func, userdata)) {
+            return;
+        }
+
+        first += n;
+        count -= n;
+    }
+}
+
+gsize frame_index_get_memory_size(FrameIndex *index)
+{
+    return index ? index->memory_size : 0;
+}
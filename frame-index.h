@@ -0,0 +1,61 @@
+#pragma once
+
+#include <glib.h>
+#include "pes-frame-info.h"
+
+/** @brief Append-only index of the I frames of a stream.
+ *  Frames are stored in blocks of 64, delta and varint encoded, and decoded on access.
+ *  There may only be one writer at a time. Readers never block: the number of frames is
+ *  published atomically after a frame was stored.
+ */
+typedef struct _FrameIndex FrameIndex;
+
+/** @brief Called for every frame by frame_index_foreach().
+ *  @return FALSE to stop.
+ */
+typedef gboolean (*FrameIndexForeachFunc)(const PESFrameInfo *frame_info, gpointer userdata);
+
+/** @brief Create a new, empty index.
+ */
+FrameIndex *frame_index_new(void);
+
+/** @brief Free the index. There must be no readers left.
+ */
+void frame_index_free(FrameIndex *index);
+
+/** @brief Remove all frames. Memory still used by readers is kept until the index is freed,
+ *  but they may see frames of the new index.
+ */
+void frame_index_clear(FrameIndex *index);
+
+/** @brief Append a frame and publish it. The frame number is set to its position.
+ *  @return The frame number.
+ */
+guint32 frame_index_append(FrameIndex *index, const PESFrameInfo *frame_info);
+
+/** @brief Append several frames, e.g., from a cache, and publish them at once.
+ */
+void frame_index_append_vals(FrameIndex *index, const PESFrameInfo *frame_infos, guint32 count);
+
+/** @brief Get the number of published frames.
+ */
+guint32 frame_index_get_count(FrameIndex *index);
+
+/** @brief Get a published frame.
+ *  @param[out] frame_info The decoded frame.
+ *  @return FALSE if frame_id is not published yet.
+ */
+gboolean frame_index_get(FrameIndex *index, guint32 frame_id, PESFrameInfo *frame_info);
+
+/** @brief Decode the published frames [first, first + count) in order. Faster than
+ *  calling frame_index_get() for each frame.
+ */
+void frame_index_foreach(FrameIndex *index,
+                         guint32 first,
+                         guint32 count,
+                         FrameIndexForeachFunc func,
+                         gpointer userdata);
+
+/** @brief Get the memory used by the index in bytes.
+ */
+gsize frame_index_get_memory_size(FrameIndex *index);
@@ -0,0 +1,339 @@
+#include "index-cache.h"
+
+#include <glib/gstdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#define INDEX_CACHE_MAGIC "TSNIDX\0\0"
+#define INDEX_CACHE_VERSION (5)
+#define INDEX_CACHE_BYTE_ORDER (0x01020304)
+#define INDEX_CACHE_SUFFIX ".tsidx"
+
+/* The file consists of the header, the path of the input, the frame infos and the entries of
+ * the PCR seek table as they are in memory, the serialized timeline, and the signal markers
+ * and clock samples as they are in memory. The cache is only valid on the same host, so byte order and record layout are only
+ * checked, not converted. */
+typedef struct {
+    gchar magic[8];
+    guint32 version;
+    guint32 byte_order;
+    guint32 header_size;
+    guint32 record_size; /* sizeof(PESFrameInfo) */
+
+    /* Key of the input. */
+    guint64 input_size;
+    gint64 input_mtime;
+    gint64 input_mtime_nsec;
+    guint64 input_inode;
+    guint64 input_device;
+    guint32 path_length; /* Follows the header, padded to 8 bytes. */
+
+    guint32 frame_count;
+    guint32 video_pid;
+    gint32 video_pidtype;
+    guint64 pcr_first;
+    guint64 pts_first;
+    gchar sha1[48];
+    guint32 pcr_count; /* Follows the frames. */
+    guint32 pcr_record_size; /* sizeof(PcrMapEntry) */
+    guint64 timeline_size; /* Follows the PCR entries. */
+    guint32 marker_count; /* Follow the timeline padded to 8 bytes, then the clock samples. */
+    guint32 marker_record_size; /* sizeof(SignalMarker) */
+    guint32 clock_count;
+    guint32 clock_record_size; /* sizeof(SignalClock) */
+} IndexCacheHeader;
+
+static gsize index_cache_records_offset(guint32 path_length)
+{
+    return sizeof(IndexCacheHeader) + ((path_length + 7) & ~7u);
+}
+
+static gsize index_cache_pcrs_offset(guint32 path_length, guint32 frame_count)
+{
+    return index_cache_records_offset(path_length) + (gsize)frame_count * sizeof(PESFrameInfo);
+}
+
+static gsize index_cache_timeline_offset(guint32 path_length, guint32 frame_count, guint32 pcr_count)
+{
+    return index_cache_pcrs_offset(path_length, frame_count) + (gsize)pcr_count * sizeof(PcrMapEntry);
+}
+
+static gsize index_cache_markers_offset(const IndexCacheHeader *header)
+{
+    return index_cache_timeline_offset(header->path_length, header->frame_count, header->pcr_count) +
+           ((header->timeline_size + 7) & ~G_GUINT64_CONSTANT(7));
+}
+
+static gsize index_cache_clocks_offset(const IndexCacheHeader *header)
+{
+    return index_cache_markers_offset(header) + (gsize)header->marker_count * sizeof(SignalMarker);
+}
+
+static gsize index_cache_get_size(const IndexCacheHeader *header)
+{
+    return index_cache_clocks_offset(header) + (gsize)header->clock_count * sizeof(SignalClock);
+}
+
+static gboolean index_cache_get_key(const gchar *input_filename, IndexCacheHeader *header)
+{
+    struct stat st;
+    if (g_stat(input_filename, &st) != 0)
+        return FALSE;
+
+    header->input_size = st.st_size;
+    header->input_mtime = st.st_mtim.tv_sec;
+    header->input_mtime_nsec = st.st_mtim.tv_nsec;
+    header->input_inode = st.st_ino;
+    header->input_device = st.st_dev;
+    header->path_length = strlen(input_filename);
+
+    return TRUE;
+}
+
+/* Candidates for the cache file, the sidecar first. */
+static gchar *index_cache_get_filename(const gchar *input_filename, gboolean sidecar)
+{
+    if (sidecar)
+        return g_strconcat(input_filename, INDEX_CACHE_SUFFIX, NULL);
+
+    gchar *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, input_filename, -1);
+    gchar *basename = g_strconcat(hash, INDEX_CACHE_SUFFIX, NULL);
+    gchar *filename = g_build_filename(g_get_user_cache_dir(), "ts-snip", basename, NULL);
+    g_free(basename);
+    g_free(hash);
+
+    return filename;
+}
+
+static gboolean _index_cache_write_record(const PESFrameInfo *frame_info, PESFrameInfo **record)
+{
+    *(*record)++ = *frame_info;
+    return TRUE;
+}
+
+gboolean index_cache_write(const gchar *input_filename,
+                           const IndexCacheInfo *info,
+                           FrameIndex *frames,
+                           PcrMap *pcrs,
+                           StreamTimeline *timeline,
+                           SignalIndex *signals)
+{
+    g_return_val_if_fail(input_filename != NULL, FALSE);
+    g_return_val_if_fail(info != NULL, FALSE);
+    g_return_val_if_fail(frames != NULL, FALSE);
+    g_return_val_if_fail(pcrs != NULL, FALSE);
+    g_return_val_if_fail(timeline != NULL, FALSE);
+    g_return_val_if_fail(signals != NULL, FALSE);
+
+    guint32 frame_count = frame_index_get_count(frames);
+    guint32 pcr_count = pcr_map_get_count(pcrs);
+
+    IndexCacheHeader header;
+    memset(&header, 0, sizeof(IndexCacheHeader));
+    if (!index_cache_get_key(input_filename, &header))
+        return FALSE;
+
+    memcpy(header.magic, INDEX_CACHE_MAGIC, 8);
+    header.version = INDEX_CACHE_VERSION;
+    header.byte_order = INDEX_CACHE_BYTE_ORDER;
+    header.header_size = sizeof(IndexCacheHeader);
+    header.record_size = sizeof(PESFrameInfo);
+    header.frame_count = frame_count;
+    header.video_pid = info->video_pid;
+    header.video_pidtype = info->video_pidtype;
+    header.pcr_first = info->pcr_first;
+    header.pts_first = info->pts_first;
+    g_strlcpy(header.sha1, info->sha1, sizeof(header.sha1));
+    header.pcr_count = pcr_count;
+    header.pcr_record_size = sizeof(PcrMapEntry);
+
+    gsize timeline_size;
+    guint8 *timeline_data = stream_timeline_save(timeline, &timeline_size);
+    header.timeline_size = timeline_size;
+    header.marker_count = signal_index_get_marker_count(signals);
+    header.marker_record_size = sizeof(SignalMarker);
+    header.clock_count = signal_index_get_clock_count(signals);
+    header.clock_record_size = sizeof(SignalClock);
+
+    gsize records_offset = index_cache_records_offset(header.path_length);
+    gsize pcrs_offset = index_cache_pcrs_offset(header.path_length, frame_count);
+    gsize timeline_offset = index_cache_timeline_offset(header.path_length, frame_count, pcr_count);
+    gsize size = index_cache_get_size(&header);
+    guint8 *buffer = g_malloc0(size);
+    memcpy(buffer, &header, sizeof(IndexCacheHeader));
+    memcpy(buffer + sizeof(IndexCacheHeader), input_filename, header.path_length);
+    PESFrameInfo *records = (PESFrameInfo *)(buffer + records_offset);
+    frame_index_foreach(frames, 0, frame_count,
+                        (FrameIndexForeachFunc)_index_cache_write_record, &records);
+    PcrMapEntry *pcr_records = (PcrMapEntry *)(buffer + pcrs_offset);
+    guint32 j;
+    for (j = 0; j < pcr_count; ++j)
+        pcr_map_get(pcrs, j, &pcr_records[j]);
+    memcpy(buffer + timeline_offset, timeline_data, timeline_size);
+    g_free(timeline_data);
+    SignalMarker *markers = (SignalMarker *)(buffer + index_cache_markers_offset(&header));
+    for (j = 0; j < header.marker_count; ++j)
+        signal_index_get_marker(signals, j, &markers[j]);
+    SignalClock *clocks = (SignalClock *)(buffer + index_cache_clocks_offset(&header));
+    for (j = 0; j < header.clock_count; ++j)
+        signal_index_get_clock(signals, j, &clocks[j]);
+
+    /* Written atomically, a concurrent reader either sees the old or the new cache. */
+    gchar *filename = index_cache_get_filename(input_filename, TRUE);
+    gboolean success = g_file_set_contents(filename, (const gchar *)buffer, size, NULL);
+    g_free(filename);
+
+    if (!success) {
+        /* E.g., read-only media, use the cache directory. */
+        filename = index_cache_get_filename(input_filename, FALSE);
+        gchar *dirname = g_path_get_dirname(filename);
+        if (g_mkdir_with_parents(dirname, 0700) == 0)
+            success = g_file_set_contents(filename, (const gchar *)buffer, size, NULL);
+        g_free(dirname);
+        g_free(filename);
+    }
+
+    g_free(buffer);
+
+    return success;
+}
+
+static gboolean index_cache_validate(const guint8 *data,
+                                     gsize size,
+                                     const IndexCacheHeader *key,
+                                     const gchar *input_filename)
+{
+    if (size < sizeof(IndexCacheHeader))
+        return FALSE;
+
+    const IndexCacheHeader *header = (const IndexCacheHeader *)data;
+    if (memcmp(header->magic, INDEX_CACHE_MAGIC, 8) != 0 ||
+            header->version != INDEX_CACHE_VERSION ||
+            header->byte_order != INDEX_CACHE_BYTE_ORDER ||
+            header->header_size != sizeof(IndexCacheHeader) ||
+            header->record_size != sizeof(PESFrameInfo) ||
+            header->pcr_record_size != sizeof(PcrMapEntry) ||
+            header->marker_record_size != sizeof(SignalMarker) ||
+            header->clock_record_size != sizeof(SignalClock))
+        return FALSE;
+
+    if (header->input_size != key->input_size ||
+            header->input_mtime != key->input_mtime ||
+            header->input_mtime_nsec != key->input_mtime_nsec ||
+            header->input_inode != key->input_inode ||
+            header->input_device != key->input_device ||
+            header->path_length != key->path_length)
+        return FALSE;
+
+    if (size != index_cache_get_size(header))
+        return FALSE;
+
+    return memcmp(data + sizeof(IndexCacheHeader), input_filename, header->path_length) == 0;
+}
+
+static gboolean index_cache_read_file(const gchar *filename,
+                                      const gchar *input_filename,
+                                      const IndexCacheHeader *key,
+                                      IndexCacheInfo *info,
+                                      FrameIndex *frames,
+                                      PcrMap *pcrs,
+                                      StreamTimeline *timeline,
+                                      SignalIndex *signals)
+{
+    int fd = g_open(filename, O_RDONLY, 0);
+    if (fd < 0)
+        return FALSE;
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return FALSE;
+
+    gboolean valid = index_cache_validate(map, st.st_size, key, input_filename);
+    const IndexCacheHeader *header = map;
+    /* Loaded first, so that nothing is appended if it is invalid. */
+    if (valid)
+        valid = stream_timeline_load(timeline,
+                                     (const guint8 *)map + index_cache_timeline_offset(header->path_length,
+                                                                                       header->frame_count,
+                                                                                       header->pcr_count),
+                                     header->timeline_size);
+    if (valid) {
+        info->video_pid = header->video_pid;
+        info->video_pidtype = header->video_pidtype;
+        info->pcr_first = header->pcr_first;
+        info->pts_first = header->pts_first;
+        g_strlcpy(info->sha1, header->sha1, sizeof(info->sha1));
+
+        frame_index_append_vals(frames,
+                                (const PESFrameInfo *)((const guint8 *)map +
+                                    index_cache_records_offset(header->path_length)),
+                                header->frame_count);
+        pcr_map_append_vals(pcrs,
+                            (const PcrMapEntry *)((const guint8 *)map +
+                                index_cache_pcrs_offset(header->path_length, header->frame_count)),
+                            header->pcr_count);
+        signal_index_append_vals(signals,
+                                 (const SignalMarker *)((const guint8 *)map +
+                                     index_cache_markers_offset(header)),
+                                 header->marker_count,
+                                 (const SignalClock *)((const guint8 *)map +
+                                     index_cache_clocks_offset(header)),
+                                 header->clock_count);
+    }
+
+    munmap(map, st.st_size);
+
+    return valid;
+}
+
+gboolean index_cache_read(const gchar *input_filename,
+                          IndexCacheInfo *info,
+                          FrameIndex *frames,
+                          PcrMap *pcrs,
+                          StreamTimeline *timeline,
+                          SignalIndex *signals)
+{
+    g_return_val_if_fail(input_filename != NULL, FALSE);
+    g_return_val_if_fail(info != NULL, FALSE);
+    g_return_val_if_fail(frames != NULL, FALSE);
+    g_return_val_if_fail(pcrs != NULL, FALSE);
+    g_return_val_if_fail(timeline != NULL, FALSE);
+    g_return_val_if_fail(signals != NULL, FALSE);
+
+    IndexCacheHeader key;
+    if (!index_cache_get_key(input_filename, &key))
+        return FALSE;
+
+    gboolean success = FALSE;
+    gchar *filename;
+    guint j;
+    for (j = 0; j < 2 && !success; ++j) {
+        filename = index_cache_get_filename(input_filename, j == 0);
+        success = index_cache_read_file(filename, input_filename, &key, info, frames, pcrs, timeline, signals);
+        g_free(filename);
+    }
+
+    return success;
+}
+
+void index_cache_remove(const gchar *input_filename)
+{
+    g_return_if_fail(input_filename != NULL);
+
+    gchar *filename;
+    guint j;
+    for (j = 0; j < 2; ++j) {
+        filename = index_cache_get_filename(input_filename, j == 0);
+        g_unlink(filename);
+        g_free(filename);
+    }
+}
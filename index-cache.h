@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glib.h>
+#include "pes-frame-info.h"
+#include "frame-index.h"
+#include "pcr-map.h"
+#include "stream-timeline.h"
+#include "signal-index.h"
+
+/** @brief Stream properties stored next to the frame index. */
+typedef struct {
+    guint16 video_pid;
+    PidType video_pidtype;
+    guint64 pcr_first; /**< First pcr/pts pair of the stream. */
+    guint64 pts_first;
+    gchar sha1[41]; /**< SHA-1 of the input as hex string, empty if unknown. */
+} IndexCacheInfo;
+
+/** @brief Write the frame index, the PCR seek table, the timeline and the signals of the input
+ *  to its cache file.
+ *  The cache is stored as <input>.tsidx next to the input, or in the user cache directory
+ *  if that is not writable. It is keyed on path, size, mtime and inode of the input.
+ *  @return TRUE on success.
+ */
+gboolean index_cache_write(const gchar *input_filename,
+                           const IndexCacheInfo *info,
+                           FrameIndex *frames,
+                           PcrMap *pcrs,
+                           StreamTimeline *timeline,
+                           SignalIndex *signals);
+
+/** @brief Read the frame index, the PCR seek table, the timeline and the signals of the input
+ *  from its cache file.
+ *  @param[out] info The stored stream properties.
+ *  @param[out] frames The frames are appended to this index.
+ *  @param[out] pcrs The entries of the seek table are appended to this map.
+ *  @param[out] timeline Replaced by the stored timeline.
+ *  @param[out] signals The markers and clock samples are appended to this index.
+ *  @return TRUE if a valid cache for the current input was found.
+ */
+gboolean index_cache_read(const gchar *input_filename,
+                          IndexCacheInfo *info,
+                          FrameIndex *frames,
+                          PcrMap *pcrs,
+                          StreamTimeline *timeline,
+                          SignalIndex *signals);
+
+/** @brief Remove all cache files of the input.
+ */
+void index_cache_remove(const gchar *input_filename);
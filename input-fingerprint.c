@@ -0,0 +1,147 @@
+#include "input-fingerprint.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/* Version 1: size, head, tail and INPUT_FINGERPRINT_STRIDED windows evenly spread in between.
+ * Changing any of these values or the hash requires a new version. */
+#define INPUT_FINGERPRINT_WINDOW_SIZE (64 * 1024)
+#define INPUT_FINGERPRINT_STRIDED (16)
+
+#define FP_PRIME1 0x9e3779b185ebca87ULL
+#define FP_PRIME2 0xc2b2ae3d27d4eb4fULL
+
+static inline guint64 fp_rotl(guint64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline guint64 fp_mix(guint64 h, guint64 word)
+{
+    return fp_rotl(h ^ (word * FP_PRIME1), 31) * FP_PRIME2;
+}
+
+static guint64 fp_finalize(guint64 h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Words are read little endian, so the hash is the same on all hosts. */
+static guint64 fp_hash_block(guint64 h, const guint8 *data, gsize length)
+{
+    guint64 word;
+    gsize j;
+
+    for (j = 0; j + 8 <= length; j += 8) {
+        memcpy(&word, data + j, 8);
+        h = fp_mix(h, GUINT64_FROM_LE(word));
+    }
+
+    word = 0;
+    for (; j < length; ++j)
+        word = (word << 8) | data[j];
+
+    return fp_mix(h, word ^ ((guint64)length << 56));
+}
+
+struct FingerprintWindow {
+    guint8 *buffer;
+    gsize filled;
+    gsize length;
+};
+
+static gboolean _fp_read_window(const guint8 *data, gsize length, struct FingerprintWindow *window)
+{
+    length = MIN(length, window->length - window->filled);
+    memcpy(window->buffer + window->filled, data, length);
+    window->filled += length;
+    return window->filled < window->length;
+}
+
+static int _fp_compare_offsets(const void *a, const void *b)
+{
+    guint64 x = *(const guint64 *)a;
+    guint64 y = *(const guint64 *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+gboolean input_fingerprint_compute(TsInput *input, InputFingerprint *fingerprint)
+{
+    g_return_val_if_fail(input != NULL, FALSE);
+    g_return_val_if_fail(fingerprint != NULL, FALSE);
+
+    guint64 size = ts_input_get_size(input);
+    guint64 offsets[INPUT_FINGERPRINT_STRIDED + 2];
+    guint count = 0;
+    guint j;
+    guint64 h = fp_mix(FP_PRIME2, size);
+
+    if (size > 0) {
+        /* Window starts, clamped so that each window lies within the file. */
+        guint64 last = size > INPUT_FINGERPRINT_WINDOW_SIZE ? size - INPUT_FINGERPRINT_WINDOW_SIZE : 0;
+        offsets[count++] = 0;
+        for (j = 1; j <= INPUT_FINGERPRINT_STRIDED; ++j)
+            offsets[count++] = MIN(size * j / (INPUT_FINGERPRINT_STRIDED + 1), last);
+        offsets[count++] = last;
+        qsort(offsets, count, sizeof(guint64), _fp_compare_offsets);
+    }
+
+    struct FingerprintWindow window = {
+        .buffer = g_malloc(INPUT_FINGERPRINT_WINDOW_SIZE)
+    };
+    gboolean success = TRUE;
+
+    for (j = 0; j < count; ++j) {
+        window.filled = 0;
+        window.length = MIN(INPUT_FINGERPRINT_WINDOW_SIZE, size - offsets[j]);
+        ts_input_read(input, offsets[j], TsInputAccessRandom, (TsInputReadFunc)_fp_read_window, &window);
+        if (window.filled != window.length) {
+            success = FALSE;
+            break;
+        }
+        h = fp_hash_block(h, window.buffer, window.length);
+    }
+
+    g_free(window.buffer);
+
+    if (!success)
+        return FALSE;
+
+    fingerprint->version = INPUT_FINGERPRINT_VERSION;
+    fingerprint->size = size;
+    fingerprint->hash = fp_finalize(h);
+
+    return TRUE;
+}
+
+gboolean input_fingerprint_equal(const InputFingerprint *a, const InputFingerprint *b)
+{
+    g_return_val_if_fail(a != NULL && b != NULL, FALSE);
+    return a->version == b->version && a->size == b->size && a->hash == b->hash;
+}
+
+gchar *input_fingerprint_hash_to_string(const InputFingerprint *fingerprint)
+{
+    g_return_val_if_fail(fingerprint != NULL, NULL);
+    return g_strdup_printf("%016" G_GINT64_MODIFIER "x", fingerprint->hash);
+}
+
+gboolean input_fingerprint_hash_from_string(InputFingerprint *fingerprint, const gchar *str)
+{
+    g_return_val_if_fail(fingerprint != NULL, FALSE);
+    if (str == NULL || strlen(str) != 16)
+        return FALSE;
+
+    gchar *end = NULL;
+    guint64 hash = g_ascii_strtoull(str, &end, 16);
+    if (end == NULL || *end != '\0')
+        return FALSE;
+
+    fingerprint->hash = hash;
+    return TRUE;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <glib.h>
+#include "ts-input.h"
+
+/** @brief Current version of the fingerprint algorithm. */
+#define INPUT_FINGERPRINT_VERSION (1)
+
+/** @brief Quick fingerprint of an input.
+ *  Covers the file size and sampled windows (head, tail and strided windows in between),
+ *  hashed with a fast non-cryptographic hash. It detects a different or modified recording,
+ *  but unlike the SHA-1 not every change of the content.
+ */
+typedef struct {
+    guint version; /**< Version of the algorithm, fingerprints of different versions cannot be compared. */
+    guint64 size; /**< Size of the input. */
+    guint64 hash; /**< Hash of the sampled windows. */
+} InputFingerprint;
+
+/** @brief Compute the fingerprint of the input with the current version.
+ *  @return TRUE on success.
+ */
+gboolean input_fingerprint_compute(TsInput *input, InputFingerprint *fingerprint);
+
+/** @brief Compare two fingerprints.
+ *  @return TRUE if both have the same version and match.
+ */
+gboolean input_fingerprint_equal(const InputFingerprint *a, const InputFingerprint *b);
+
+/** @brief Format the hash as hex string for storing it.
+ *  @return A newly allocated string.
+ */
+gchar *input_fingerprint_hash_to_string(const InputFingerprint *fingerprint);
+
+/** @brief Parse a hash formatted with input_fingerprint_hash_to_string().
+ *  @return TRUE if the string is valid.
+ */
+gboolean input_fingerprint_hash_from_string(InputFingerprint *fingerprint, const gchar *str);
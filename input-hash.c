@@ -0,0 +1,289 @@
+#include "input-hash.h"
+
+#define INPUT_HASH_PACKET_SIZE (188)
+/* Maximum number of fed buffers waiting for the hash thread. */
+#define INPUT_HASH_QUEUE_MAX (64)
+
+struct _InputHash {
+    GThread *thread;
+    TsInput *input;
+    gboolean feed;
+
+    GMutex lock;
+    GCond cond;
+    GQueue pending; /* [GBytes], buffers fed but not hashed yet */
+    gsize bytes_fed;
+    gsize bytes_hashed;
+    gsize bytes_total;
+    gboolean feed_done;
+    gboolean cancelled;
+    gboolean failed; /* Ended before bytes_total bytes were hashed. */
+    gboolean done;
+
+    gchar *digest; /* Set once done, read-only afterwards. */
+
+    InputHashDoneFunc done_func;
+    gpointer done_data;
+};
+
+InputHash *input_hash_new(void)
+{
+    InputHash *hash = g_new0(InputHash, 1);
+    g_mutex_init(&hash->lock);
+    g_cond_init(&hash->cond);
+    g_queue_init(&hash->pending);
+    return hash;
+}
+
+void input_hash_set_done_func(InputHash *hash, InputHashDoneFunc func, gpointer userdata)
+{
+    g_return_if_fail(hash != NULL);
+    hash->done_func = func;
+    hash->done_data = userdata;
+}
+
+void input_hash_free(InputHash *hash)
+{
+    if (hash) {
+        input_hash_stop(hash);
+        g_free(hash->digest);
+        g_cond_clear(&hash->cond);
+        g_mutex_clear(&hash->lock);
+        g_free(hash);
+    }
+}
+
+/* Returns FALSE if the hash was cancelled. */
+static gboolean input_hash_update(InputHash *hash, GChecksum *checksum, const guint8 *data, gsize length)
+{
+    g_checksum_update(checksum, data, length);
+
+    g_mutex_lock(&hash->lock);
+    hash->bytes_hashed += length;
+    gboolean cancelled = hash->cancelled;
+    g_mutex_unlock(&hash->lock);
+
+    return !cancelled;
+}
+
+static void input_hash_finish(InputHash *hash, GChecksum *checksum)
+{
+    g_mutex_lock(&hash->lock);
+    /* A short read or an early end of feeding must not pass for the digest of the input. */
+    gboolean done = !hash->cancelled && hash->bytes_hashed == hash->bytes_total;
+    if (done) {
+        hash->digest = g_strdup(g_checksum_get_string(checksum));
+        hash->done = TRUE;
+    }
+    else if (!hash->cancelled) {
+        hash->failed = TRUE;
+    }
+    g_cond_broadcast(&hash->cond);
+    g_mutex_unlock(&hash->lock);
+
+    /* The digest stays valid until the hash is restarted, which joins this thread first. */
+    if (done && hash->done_func)
+        hash->done_func(hash->digest, hash->done_data);
+}
+
+struct InputHashReadContext {
+    InputHash *hash;
+    GChecksum *checksum;
+    gsize bytes_left;
+};
+
+static gboolean _input_hash_read_cb(const guint8 *data, gsize length, struct InputHashReadContext *ctx)
+{
+    length = MIN(length, ctx->bytes_left);
+    ctx->bytes_left -= length;
+    return input_hash_update(ctx->hash, ctx->checksum, data, length) && ctx->bytes_left > 0;
+}
+
+static gpointer input_hash_read_thread(InputHash *hash)
+{
+    struct InputHashReadContext ctx = {
+        .hash = hash,
+        .checksum = g_checksum_new(G_CHECKSUM_SHA1),
+        .bytes_left = hash->bytes_total
+    };
+
+    if (ctx.bytes_left > 0)
+        ts_input_read(hash->input, 0, TsInputAccessSequential, (TsInputReadFunc)_input_hash_read_cb, &ctx);
+
+    input_hash_finish(hash, ctx.checksum);
+    g_checksum_free(ctx.checksum);
+
+    return NULL;
+}
+
+static gpointer input_hash_feed_thread(InputHash *hash)
+{
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    GBytes *bytes;
+    gsize length;
+    gconstpointer data;
+
+    while (TRUE) {
+        g_mutex_lock(&hash->lock);
+        while (g_queue_is_empty(&hash->pending) && !hash->feed_done && !hash->cancelled)
+            g_cond_wait(&hash->cond, &hash->lock);
+        bytes = hash->cancelled ? NULL : g_queue_pop_head(&hash->pending);
+        /* There is room for the feeder again. */
+        g_cond_broadcast(&hash->cond);
+        g_mutex_unlock(&hash->lock);
+
+        if (!bytes)
+            break;
+
+        data = g_bytes_get_data(bytes, &length);
+        gboolean resume = input_hash_update(hash, checksum, data, length);
+        g_bytes_unref(bytes);
+        if (!resume)
+            break;
+    }
+
+    input_hash_finish(hash, checksum);
+    g_checksum_free(checksum);
+
+    return NULL;
+}
+
+void input_hash_stop(InputHash *hash)
+{
+    g_return_if_fail(hash != NULL);
+
+    if (hash->thread) {
+        g_mutex_lock(&hash->lock);
+        hash->cancelled = TRUE;
+        g_cond_broadcast(&hash->cond);
+        g_mutex_unlock(&hash->lock);
+
+        g_thread_join(hash->thread);
+        hash->thread = NULL;
+    }
+
+    g_queue_clear_full(&hash->pending, (GDestroyNotify)g_bytes_unref);
+    hash->input = NULL;
+}
+
+gboolean input_hash_start(InputHash *hash, TsInput *input, gboolean feed)
+{
+    g_return_val_if_fail(hash != NULL, FALSE);
+    g_return_val_if_fail(input != NULL, FALSE);
+
+    input_hash_stop(hash);
+
+    gsize size = ts_input_get_size(input);
+
+    g_free(hash->digest);
+    hash->digest = NULL;
+    hash->input = input;
+    hash->feed = feed;
+    hash->bytes_fed = 0;
+    hash->bytes_hashed = 0;
+    hash->bytes_total = size - size % INPUT_HASH_PACKET_SIZE;
+    hash->feed_done = FALSE;
+    hash->cancelled = FALSE;
+    hash->failed = FALSE;
+    hash->done = FALSE;
+
+    hash->thread = g_thread_new("input-hash",
+                                (GThreadFunc)(hash->feed ? input_hash_feed_thread : input_hash_read_thread),
+                                hash);
+
+    return hash->feed;
+}
+
+void input_hash_set_digest(InputHash *hash, const gchar *digest)
+{
+    g_return_if_fail(hash != NULL);
+    g_return_if_fail(digest != NULL);
+
+    input_hash_stop(hash);
+
+    g_mutex_lock(&hash->lock);
+    g_free(hash->digest);
+    hash->digest = g_strdup(digest);
+    hash->failed = FALSE;
+    hash->done = TRUE;
+    hash->bytes_hashed = hash->bytes_total;
+    g_cond_broadcast(&hash->cond);
+    g_mutex_unlock(&hash->lock);
+}
+
+void input_hash_feed(InputHash *hash, const guint8 *data, gsize length)
+{
+    g_return_if_fail(hash != NULL);
+
+    if (!hash->thread || !hash->feed)
+        return;
+
+    g_mutex_lock(&hash->lock);
+    length = MIN(length, hash->bytes_total - hash->bytes_fed);
+    while (length > 0 && g_queue_get_length(&hash->pending) >= INPUT_HASH_QUEUE_MAX && !hash->cancelled)
+        g_cond_wait(&hash->cond, &hash->lock);
+    if (length > 0 && !hash->cancelled && !hash->feed_done) {
+        g_queue_push_tail(&hash->pending, g_bytes_new(data, length));
+        hash->bytes_fed += length;
+        g_cond_broadcast(&hash->cond);
+    }
+    g_mutex_unlock(&hash->lock);
+}
+
+void input_hash_end_feed(InputHash *hash)
+{
+    g_return_if_fail(hash != NULL);
+
+    g_mutex_lock(&hash->lock);
+    hash->feed_done = TRUE;
+    g_cond_broadcast(&hash->cond);
+    g_mutex_unlock(&hash->lock);
+}
+
+gchar *input_hash_wait(InputHash *hash)
+{
+    g_return_val_if_fail(hash != NULL, NULL);
+
+    g_mutex_lock(&hash->lock);
+    while (hash->thread && !hash->done && !hash->cancelled && !hash->failed)
+        g_cond_wait(&hash->cond, &hash->lock);
+    g_mutex_unlock(&hash->lock);
+
+    return input_hash_get_digest(hash);
+}
+
+gchar *input_hash_get_digest(InputHash *hash)
+{
+    g_return_val_if_fail(hash != NULL, NULL);
+
+    /* A restart frees the digest, do not hand out a pointer to it. */
+    g_mutex_lock(&hash->lock);
+    gchar *digest = hash->done ? g_strdup(hash->digest) : NULL;
+    g_mutex_unlock(&hash->lock);
+
+    return digest;
+}
+
+gboolean input_hash_has_failed(InputHash *hash)
+{
+    g_return_val_if_fail(hash != NULL, TRUE);
+
+    g_mutex_lock(&hash->lock);
+    gboolean failed = !hash->done && (hash->failed || hash->cancelled || !hash->thread);
+    g_mutex_unlock(&hash->lock);
+
+    return failed;
+}
+
+gboolean input_hash_get_status(InputHash *hash, gsize *bytes_hashed, gsize *bytes_total)
+{
+    g_return_val_if_fail(hash != NULL, FALSE);
+
+    g_mutex_lock(&hash->lock);
+    if (bytes_hashed) *bytes_hashed = hash->bytes_hashed;
+    if (bytes_total) *bytes_total = hash->bytes_total;
+    gboolean done = hash->done;
+    g_mutex_unlock(&hash->lock);
+
+    return done;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <glib.h>
+#include "ts-input.h"
+
+/* What the digest covers. 1: the packets accepted by the analyzer, 2: the first
+ * size - size % 188 bytes of the input. */
+#define INPUT_HASH_VERSION (2)
+
+/** @brief SHA-1 of an input, computed on a separate thread.
+ *  The hash thread either reads the input itself, or the reader hands over its buffers
+ *  with input_hash_feed().
+ */
+typedef struct _InputHash InputHash;
+
+/** @brief Called from the hash thread once the hash is done, not if it was cancelled or failed. */
+typedef void (*InputHashDoneFunc)(const gchar *digest, gpointer userdata);
+
+/** @brief Create a new, idle hash.
+ */
+InputHash *input_hash_new(void);
+
+/** @brief Set a function called when a hash is done.
+ */
+void input_hash_set_done_func(InputHash *hash, InputHashDoneFunc func, gpointer userdata);
+
+/** @brief Stop a running hash thread and free the hash.
+ */
+void input_hash_free(InputHash *hash);
+
+/** @brief Start hashing the input, a previous run is cancelled.
+ *  Only complete packets are hashed, i.e., the first size - size % 188 bytes.
+ *  @param[in] input The input to hash. Must stay open until the hash is done or stopped.
+ *  @param[in] feed If TRUE, the data is expected from input_hash_feed(), otherwise the
+ *             hash thread reads the input itself.
+ *  @return TRUE if data has to be fed to the hash.
+ */
+gboolean input_hash_start(InputHash *hash, TsInput *input, gboolean feed);
+
+/** @brief Use a known digest, e.g., from a cache, instead of computing it.
+ *  A running hash is cancelled.
+ */
+void input_hash_set_digest(InputHash *hash, const gchar *digest);
+
+/** @brief Cancel a running hash and wait for the thread.
+ */
+void input_hash_stop(InputHash *hash);
+
+/** @brief Pass the next buffer of the input to the hash thread. The data is copied.
+ *  Blocks if the hash thread falls too far behind. Ignored if the hash reads the input itself.
+ */
+void input_hash_feed(InputHash *hash, const guint8 *data, gsize length);
+
+/** @brief No more data will be fed. If fewer than the expected bytes were fed, the hash fails.
+ */
+void input_hash_end_feed(InputHash *hash);
+
+/** @brief Block until the running hash is done or has failed.
+ *  @return A copy of the digest as hex string or NULL if no hash was computed. Free with g_free().
+ */
+gchar *input_hash_wait(InputHash *hash);
+
+/** @brief Get the digest without blocking.
+ *  @return A copy of the digest as hex string or NULL if it is not done yet. Free with g_free().
+ */
+gchar *input_hash_get_digest(InputHash *hash);
+
+/** @brief Check whether the hash will not be done, because it was not started, was cancelled,
+ *  or could not hash the whole input, e.g., after a short read.
+ */
+gboolean input_hash_has_failed(InputHash *hash);
+
+/** @brief Get the progress of the hash.
+ *  @return TRUE if the hash is done.
+ */
+gboolean input_hash_get_status(InputHash *hash, gsize *bytes_hashed, gsize *bytes_total);
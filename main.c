@@ -42,9 +42,14 @@ struct TsSnipApp {
     SnipperSlice motion_slice;
 
     TsSnipperProject *project;
+
+    gboolean follow; /* Follow growing inputs. */
+    guint validate_source; /* Waits for the hash to validate the project, 0 if none. */
+    guint32 iframe_count_shown; /* Number of I frames the slider was adjusted to while analyzing. */
 } app;
 
 static void rebuild_surface(void);
+static void main_validate_project_stop(void);
 
 void main_app_init(void)
 {
@@ -57,8 +62,13 @@ void main_app_init(void)
 void main_app_set_file(const char *filename)
 {
     g_mutex_lock(&app.snipper_lock);
+    main_validate_project_stop();
+    if (app.tsn)
+        ts_snipper_set_follow(app.tsn, FALSE);
     ts_snipper_unref(app.tsn);
     app.tsn = ts_snipper_new(filename);
+    if (app.tsn)
+        ts_snipper_set_follow(app.tsn, app.follow);
     if (app.project)
         ts_snipper_project_set_snipper(app.project, app.tsn);
     g_mutex_unlock(&app.snipper_lock);
@@ -67,11 +77,16 @@ void main_app_set_file(const char *filename)
 void main_app_set_project_file(const char *filename)
 {
     g_mutex_lock(&app.snipper_lock);
+    main_validate_project_stop();
+    if (app.tsn)
+        ts_snipper_set_follow(app.tsn, FALSE);
     ts_snipper_unref(app.tsn);
     ts_snipper_project_destroy(app.project);
     app.project = ts_snipper_project_new_from_file(filename);
     app.tsn = ts_snipper_project_get_snipper(app.project);
     ts_snipper_ref(app.tsn);
+    if (app.tsn)
+        ts_snipper_set_follow(app.tsn, app.follow);
     g_mutex_unlock(&app.snipper_lock);
 }
 
@@ -84,6 +99,9 @@ void main_app_cleanup(void)
         cairo_surface_destroy(app.current_iframe_surf);
     if (app.current_iframe)
         av_frame_free(&app.current_iframe);
+    main_validate_project_stop();
+    if (app.tsn)
+        ts_snipper_set_follow(app.tsn, FALSE);
     ts_snipper_unref(app.tsn);
 }
 
@@ -209,9 +227,71 @@ static gboolean main_display_progress(gpointer nil)
         gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(app.progress_bar),
                 ((gdouble)done) / ((gdouble)full));
     }
+    /* Frames can be viewed while the analysis is still running, e.g., when following the input. */
+    if (state == TsSnipperStateAnalyzing) {
+        guint32 iframe_count = ts_snipper_get_iframe_count(app.tsn);
+        if (iframe_count > 0 && iframe_count != app.iframe_count_shown) {
+            main_adjust_slider();
+            if (app.iframe_count_shown == 0)
+                rebuild_surface();
+            app.iframe_count_shown = iframe_count;
+        }
+    }
     return (state == TsSnipperStateAnalyzing || state == TsSnipperStateWriting);
 }
 
+/* The project and snipper analyzed, the source is removed before either changes. */
+typedef struct {
+    TsSnipperProject *project;
+    TsSnipper *tsn;
+} MainValidate;
+
+/* The hash of the input may take longer than the analysis, do not block the ui. */
+static gboolean main_validate_project(MainValidate *validate)
+{
+    if (ts_snipper_project_validate_needs_sha1(validate->project) &&
+            !ts_snipper_get_sha1_status(validate->tsn, NULL, NULL)) {
+        if (!ts_snipper_get_sha1_failed(validate->tsn))
+            return TRUE;
+        fprintf(stderr, "WARNING: Could not compute the SHA-1 of the input.\n");
+    }
+    else if (!ts_snipper_project_validate(validate->project)) {
+        fprintf(stderr, "WARNING: Input has changed.\n");
+    }
+    app.validate_source = 0;
+    return FALSE;
+}
+
+static void main_validate_free(MainValidate *validate)
+{
+    ts_snipper_unref(validate->tsn);
+    g_free(validate);
+}
+
+static void main_validate_project_start(void)
+{
+    main_validate_project_stop();
+
+    MainValidate *validate = g_new0(MainValidate, 1);
+    validate->project = app.project;
+    validate->tsn = ts_snipper_project_get_snipper(app.project);
+    ts_snipper_ref(validate->tsn);
+
+    app.validate_source = g_timeout_add_full(G_PRIORITY_DEFAULT,
+                                             200,
+                                             (GSourceFunc)main_validate_project,
+                                             validate,
+                                             (GDestroyNotify)main_validate_free);
+}
+
+static void main_validate_project_stop(void)
+{
+    if (app.validate_source) {
+        g_source_remove(app.validate_source);
+        app.validate_source = 0;
+    }
+}
+
 static void main_file_analyze_result_func(GObject *source_object,
                                           GAsyncResult *res,
                                           gpointer userdata)
@@ -226,8 +306,7 @@ static void main_file_analyze_result_func(GObject *source_object,
     gtk_adjustment_set_value(GTK_ADJUSTMENT(app.adjust_stream_pos), 0.0);
 
     if (app.project) {
-        if (!ts_snipper_project_validate(app.project))
-            fprintf(stderr, "WARNING: Input has changed.\n");
+        main_validate_project_start();
         ts_snipper_project_apply_slices(app.project);
         main_slider_refresh_slice_markers();
     }
@@ -237,6 +316,7 @@ static void main_file_analyze_result_func(GObject *source_object,
 
 static void main_analyze_file_async(void)
 {
+    app.iframe_count_shown = 0;
     file_read_async(app.tsn,
                     NULL,
                     main_file_analyze_result_func,
@@ -487,6 +567,7 @@ void main_menu_file_open_project(void)
         char *filename;
 
         filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+        main_validate_project_stop();
         if (app.project)
             ts_snipper_project_destroy(app.project);
         ts_snipper_unref(app.tsn);
@@ -594,6 +675,17 @@ void main_menu_file_export(void)
     gtk_widget_destroy(dialog);
 }
 
+void main_menu_file_follow(GtkCheckMenuItem *item)
+{
+    app.follow = gtk_check_menu_item_get_active(item);
+    if (!app.tsn)
+        return;
+    ts_snipper_set_follow(app.tsn, app.follow);
+    /* Already done, analyze again to follow the input. */
+    if (app.follow && ts_snipper_get_state(app.tsn) == TsSnipperStateReady)
+        main_analyze_file_async();
+}
+
 void main_menu_file_quit(void)
 {
     /* TODO: query really quit */
@@ -648,6 +740,14 @@ GtkWidget *main_create_main_menu(void)
     item = gtk_separator_menu_item_new();
     gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
 
+    item = gtk_check_menu_item_new_with_label(_("Follow input"));
+    g_signal_connect(G_OBJECT(item), "toggled",
+            G_CALLBACK(main_menu_file_follow), NULL);
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+
+    item = gtk_separator_menu_item_new();
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+
     item = gtk_menu_item_new_with_label(_("Quit"));
     g_signal_connect_swapped(G_OBJECT(item), "activate",
             G_CALLBACK(main_menu_file_quit), NULL);
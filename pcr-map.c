@@ -0,0 +1,227 @@
+#include "pcr-map.h"
+
+struct _PcrMap {
+    GArray *entries; /* [PcrMapEntry] */
+    guint64 wrap_base; /* Added to the PCR read from the stream. */
+    guint64 interval;
+    GMutex lock;
+};
+
+PcrMap *pcr_map_new(void)
+{
+    PcrMap *map = g_new0(PcrMap, 1);
+    map->entries = g_array_new(FALSE, FALSE, sizeof(PcrMapEntry));
+    g_mutex_init(&map->lock);
+    return map;
+}
+
+void pcr_map_free(PcrMap *map)
+{
+    if (map) {
+        g_array_free(map->entries, TRUE);
+        g_mutex_clear(&map->lock);
+        g_free(map);
+    }
+}
+
+void pcr_map_set_interval(PcrMap *map, guint64 interval)
+{
+    g_return_if_fail(map != NULL);
+
+    g_mutex_lock(&map->lock);
+    map->interval = interval;
+    g_mutex_unlock(&map->lock);
+}
+
+void pcr_map_clear(PcrMap *map)
+{
+    g_return_if_fail(map != NULL);
+
+    g_mutex_lock(&map->lock);
+    g_array_set_size(map->entries, 0);
+    map->wrap_base = 0;
+    g_mutex_unlock(&map->lock);
+}
+
+gboolean pcr_map_add(PcrMap *map, gsize offset, guint64 pcr)
+{
+    g_return_val_if_fail(map != NULL, FALSE);
+    g_return_val_if_fail(pcr < PCR_MAP_WRAP, FALSE);
+
+    gboolean added = FALSE;
+
+    g_mutex_lock(&map->lock);
+    PcrMapEntry entry = { .offset = offset, .pcr = pcr + map->wrap_base };
+    if (map->entries->len > 0) {
+        PcrMapEntry *last = &g_array_index(map->entries, PcrMapEntry, map->entries->len - 1);
+        /* A jump back by more than half the period is a wraparound, not a discontinuity. */
+        if (entry.pcr + PCR_MAP_WRAP / 2 < last->pcr) {
+            map->wrap_base += PCR_MAP_WRAP;
+            entry.pcr += PCR_MAP_WRAP;
+        }
+        if (entry.pcr < last->pcr + map->interval || entry.offset <= last->offset)
+            goto out;
+    }
+    g_array_append_val(map->entries, entry);
+    added = TRUE;
+
+out:
+    g_mutex_unlock(&map->lock);
+    return added;
+}
+
+void pcr_map_append_vals(PcrMap *map, const PcrMapEntry *entries, guint count)
+{
+    g_return_if_fail(map != NULL);
+    g_return_if_fail(entries != NULL || count == 0);
+
+    g_mutex_lock(&map->lock);
+    g_array_append_vals(map->entries, entries, count);
+    /* Continue behind the last wraparound. */
+    if (map->entries->len > 0) {
+        guint64 last = g_array_index(map->entries, PcrMapEntry, map->entries->len - 1).pcr;
+        map->wrap_base = last - last % PCR_MAP_WRAP;
+    }
+    g_mutex_unlock(&map->lock);
+}
+
+guint pcr_map_get_count(PcrMap *map)
+{
+    g_return_val_if_fail(map != NULL, 0);
+
+    g_mutex_lock(&map->lock);
+    guint count = map->entries->len;
+    g_mutex_unlock(&map->lock);
+
+    return count;
+}
+
+gboolean pcr_map_get(PcrMap *map, guint index, PcrMapEntry *entry)
+{
+    g_return_val_if_fail(map != NULL, FALSE);
+
+    g_mutex_lock(&map->lock);
+    gboolean found = index < map->entries->len;
+    if (found && entry)
+        *entry = g_array_index(map->entries, PcrMapEntry, index);
+    g_mutex_unlock(&map->lock);
+
+    return found;
+}
+
+guint64 pcr_map_get_duration(PcrMap *map)
+{
+    g_return_val_if_fail(map != NULL, 0);
+
+    g_mutex_lock(&map->lock);
+    guint64 duration = 0;
+    if (map->entries->len > 1)
+        duration = g_array_index(map->entries, PcrMapEntry, map->entries->len - 1).pcr
+                   - g_array_index(map->entries, PcrMapEntry, 0).pcr;
+    g_mutex_unlock(&map->lock);
+
+    return duration;
+}
+
+/* Index of the last entry at or before pcr, 0 if there is none. Called with the lock held. */
+static guint pcr_map_search(PcrMap *map, guint64 pcr)
+{
+    PcrMapEntry *entries = (PcrMapEntry *)map->entries->data;
+    guint lo = 0, hi = map->entries->len, mid;
+
+    /* First entry after pcr. */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (entries[mid].pcr <= pcr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 ? lo - 1 : 0;
+}
+
+gboolean pcr_map_lookup(PcrMap *map, guint64 time, PcrMapEntry *entry)
+{
+    g_return_val_if_fail(map != NULL, FALSE);
+
+    g_mutex_lock(&map->lock);
+    gboolean found = map->entries->len > 0;
+    if (found && entry) {
+        guint64 pcr = g_array_index(map->entries, PcrMapEntry, 0).pcr + time;
+        *entry = g_array_index(map->entries, PcrMapEntry, pcr_map_search(map, pcr));
+    }
+    g_mutex_unlock(&map->lock);
+
+    return found;
+}
+
+gboolean pcr_map_time_to_offset(PcrMap *map, guint64 time, gsize *offset)
+{
+    g_return_val_if_fail(map != NULL, FALSE);
+
+    g_mutex_lock(&map->lock);
+    guint count = map->entries->len;
+    if (count < 2) {
+        g_mutex_unlock(&map->lock);
+        return FALSE;
+    }
+
+    PcrMapEntry *entries = (PcrMapEntry *)map->entries->data;
+    guint64 pcr = entries[0].pcr + time;
+
+    /* Last sample at or before pcr, clamped so that there is a next one. */
+    guint lo = MIN(pcr_map_search(map, pcr), count - 2);
+
+    PcrMapEntry a = entries[lo];
+    PcrMapEntry b = entries[lo + 1];
+    g_mutex_unlock(&map->lock);
+
+    if (pcr <= a.pcr || b.pcr == a.pcr)
+        pcr = a.pcr;
+    else if (pcr > b.pcr)
+        pcr = b.pcr;
+
+    if (offset)
+        *offset = a.offset + (gsize)((gdouble)(b.offset - a.offset) * (pcr - a.pcr)
+                                     / (b.pcr > a.pcr ? b.pcr - a.pcr : 1));
+
+    return TRUE;
+}
+
+gboolean pcr_map_offset_to_time(PcrMap *map, gsize offset, guint64 *time)
+{
+    g_return_val_if_fail(map != NULL, FALSE);
+
+    g_mutex_lock(&map->lock);
+    guint count = map->entries->len;
+    if (count < 2) {
+        g_mutex_unlock(&map->lock);
+        return FALSE;
+    }
+
+    PcrMapEntry *entries = (PcrMapEntry *)map->entries->data;
+    guint lo = 0, hi = count, mid;
+
+    /* First entry after offset, the offsets increase like the PCR. */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (entries[mid].offset <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    /* Last entry at or before offset, clamped so that there is a next one. */
+    lo = MIN(lo > 0 ? lo - 1 : 0, count - 2);
+
+    PcrMapEntry first = entries[0];
+    PcrMapEntry a = entries[lo];
+    PcrMapEntry b = entries[lo + 1];
+    g_mutex_unlock(&map->lock);
+
+    offset = CLAMP(offset, a.offset, b.offset);
+    if (time)
+        *time = a.pcr - first.pcr + (guint64)((gdouble)(b.pcr - a.pcr) * (offset - a.offset)
+                                              / (b.offset - a.offset));
+
+    return TRUE;
+}
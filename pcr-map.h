@@ -0,0 +1,76 @@
+#pragma once
+
+#include <glib.h>
+
+/** @brief Period of the program clock reference in 27 MHz ticks (33 bit base times 300). */
+#define PCR_MAP_WRAP (G_GUINT64_CONSTANT(300) << 33)
+
+/** @brief A sample of the program clock. */
+typedef struct {
+    gsize offset; /**< Offset of the packet carrying the PCR. */
+    guint64 pcr; /**< PCR in 27 MHz ticks, continued across wraparounds. */
+} PcrMapEntry;
+
+/** @brief Map from the program clock to offsets in the stream, from samples in stream order.
+ *  Wraparounds of the PCR are unwrapped, so that the map is monotonic. Samples going backwards
+ *  otherwise, e.g., at discontinuities, are dropped. Samples may be added while the map is read.
+ */
+typedef struct _PcrMap PcrMap;
+
+/** @brief Create a new, empty map.
+ */
+PcrMap *pcr_map_new(void);
+
+/** @brief Free the map.
+ */
+void pcr_map_free(PcrMap *map);
+
+/** @brief Thin the map: drop samples less than interval (27 MHz ticks) after the last one.
+ *  0 keeps all samples (default).
+ */
+void pcr_map_set_interval(PcrMap *map, guint64 interval);
+
+/** @brief Remove all samples.
+ */
+void pcr_map_clear(PcrMap *map);
+
+/** @brief Add a sample behind all others.
+ *  @param[in] pcr The PCR as read from the stream (base * 300 + extension).
+ *  @return TRUE if the sample was added.
+ */
+gboolean pcr_map_add(PcrMap *map, gsize offset, guint64 pcr);
+
+/** @brief Append samples from pcr_map_get(), e.g., from a cache. They are not checked.
+ */
+void pcr_map_append_vals(PcrMap *map, const PcrMapEntry *entries, guint count);
+
+/** @brief Get the number of samples.
+ */
+guint pcr_map_get_count(PcrMap *map);
+
+/** @brief Get a sample.
+ *  @return FALSE if there is no such sample.
+ */
+gboolean pcr_map_get(PcrMap *map, guint index, PcrMapEntry *entry);
+
+/** @brief Get the time between the first and the last sample in 27 MHz ticks.
+ */
+guint64 pcr_map_get_duration(PcrMap *map);
+
+/** @brief Find the last sample at or before a point in time.
+ *  @param[in] time Time since the first sample in 27 MHz ticks.
+ *  @return FALSE if the map is empty.
+ */
+gboolean pcr_map_lookup(PcrMap *map, guint64 time, PcrMapEntry *entry);
+
+/** @brief Estimate the offset of a point in time, interpolated between the samples around it.
+ *  @param[in] time Time since the first sample in 27 MHz ticks.
+ *  @return FALSE if there are less than two samples.
+ */
+gboolean pcr_map_time_to_offset(PcrMap *map, guint64 time, gsize *offset);
+
+/** @brief Estimate the time of an offset, interpolated between the samples around it.
+ *  @param[out] time Time since the first sample in 27 MHz ticks.
+ *  @return FALSE if there are less than two samples.
+ */
+gboolean pcr_map_offset_to_time(PcrMap *map, gsize offset, guint64 *time);
@@ -0,0 +1,173 @@
+#include "pes-arena.h"
+
+#include <string.h>
+
+/* Size classes from 128 bytes to 1 GiB. */
+#define PES_ARENA_MIN_SHIFT (7)
+#define PES_ARENA_CLASSES (24)
+
+typedef struct _PesArenaChunk PesArenaChunk;
+
+/* Precedes the memory of every chunk. */
+struct _PesArenaChunk {
+    PesArenaChunk *next; /* All chunks of the arena. */
+    PesArenaChunk *next_free; /* Free list of the size class. */
+    guint size_class;
+    gboolean in_use;
+};
+
+/* Keep the memory 16 byte aligned. */
+#define PES_ARENA_HEADER_SIZE ((sizeof(PesArenaChunk) + 15) & ~(gsize)15)
+#define PES_ARENA_CHUNK(mem) ((PesArenaChunk *)((guint8 *)(mem) - PES_ARENA_HEADER_SIZE))
+#define PES_ARENA_MEM(chunk) ((gpointer)((guint8 *)(chunk) + PES_ARENA_HEADER_SIZE))
+
+struct _PesArena {
+    PesArenaChunk *chunks;
+    PesArenaChunk *free[PES_ARENA_CLASSES];
+    gsize size; /* Bytes held, in use or free. */
+    GMutex lock;
+};
+
+static inline gsize pes_arena_class_size(guint size_class)
+{
+    return (gsize)1 << (PES_ARENA_MIN_SHIFT + size_class);
+}
+
+static guint pes_arena_get_class(gsize size)
+{
+    guint size_class = 0;
+    while (size_class + 1 < PES_ARENA_CLASSES && pes_arena_class_size(size_class) < size)
+        ++size_class;
+    return size_class;
+}
+
+PesArena *pes_arena_new(void)
+{
+    PesArena *arena = g_new0(PesArena, 1);
+    g_mutex_init(&arena->lock);
+    return arena;
+}
+
+void pes_arena_free(PesArena *arena)
+{
+    if (arena) {
+        PesArenaChunk *chunk, *next;
+        for (chunk = arena->chunks; chunk; chunk = next) {
+            next = chunk->next;
+            g_free(chunk);
+        }
+        g_mutex_clear(&arena->lock);
+        g_free(arena);
+    }
+}
+
+gpointer pes_arena_alloc(PesArena *arena, gsize size)
+{
+    g_return_val_if_fail(arena != NULL, NULL);
+    g_return_val_if_fail(size <= pes_arena_class_size(PES_ARENA_CLASSES - 1), NULL);
+
+    guint size_class = pes_arena_get_class(size);
+    PesArenaChunk *chunk;
+
+    g_mutex_lock(&arena->lock);
+    chunk = arena->free[size_class];
+    if (chunk) {
+        arena->free[size_class] = chunk->next_free;
+    }
+    else {
+        chunk = g_malloc(PES_ARENA_HEADER_SIZE + pes_arena_class_size(size_class));
+        chunk->size_class = size_class;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->size += pes_arena_class_size(size_class);
+    }
+    chunk->next_free = NULL;
+    chunk->in_use = TRUE;
+    g_mutex_unlock(&arena->lock);
+
+    return PES_ARENA_MEM(chunk);
+}
+
+gpointer pes_arena_alloc0(PesArena *arena, gsize size)
+{
+    gpointer mem = pes_arena_alloc(arena, size);
+    if (mem)
+        memset(mem, 0, size);
+    return mem;
+}
+
+gpointer pes_arena_realloc(PesArena *arena, gpointer mem, gsize size)
+{
+    g_return_val_if_fail(arena != NULL, NULL);
+
+    if (mem && pes_arena_get_capacity(mem) >= size)
+        return mem;
+
+    gpointer grown = pes_arena_alloc(arena, size);
+    if (grown && mem) {
+        memcpy(grown, mem, pes_arena_get_capacity(mem));
+        pes_arena_release(arena, mem);
+    }
+    return grown;
+}
+
+void pes_arena_release(PesArena *arena, gpointer mem)
+{
+    g_return_if_fail(arena != NULL);
+
+    if (!mem)
+        return;
+
+    PesArenaChunk *chunk = PES_ARENA_CHUNK(mem);
+
+    g_mutex_lock(&arena->lock);
+    chunk->in_use = FALSE;
+    chunk->next_free = arena->free[chunk->size_class];
+    arena->free[chunk->size_class] = chunk;
+    g_mutex_unlock(&arena->lock);
+}
+
+gsize pes_arena_get_capacity(gconstpointer mem)
+{
+    g_return_val_if_fail(mem != NULL, 0);
+    return pes_arena_class_size(PES_ARENA_CHUNK(mem)->size_class);
+}
+
+void pes_arena_reset(PesArena *arena, gsize keep)
+{
+    g_return_if_fail(arena != NULL);
+
+    PesArenaChunk *chunk, *next;
+    PesArenaChunk *kept = NULL;
+    gsize size;
+
+    g_mutex_lock(&arena->lock);
+    memset(arena->free, 0, sizeof(arena->free));
+    for (chunk = arena->chunks; chunk; chunk = next) {
+        next = chunk->next;
+        size = pes_arena_class_size(chunk->size_class);
+        if (arena->size > keep) {
+            arena->size -= size;
+            g_free(chunk);
+            continue;
+        }
+        chunk->in_use = FALSE;
+        chunk->next_free = arena->free[chunk->size_class];
+        arena->free[chunk->size_class] = chunk;
+        chunk->next = kept;
+        kept = chunk;
+    }
+    arena->chunks = kept;
+    g_mutex_unlock(&arena->lock);
+}
+
+gsize pes_arena_get_size(PesArena *arena)
+{
+    g_return_val_if_fail(arena != NULL, 0);
+
+    g_mutex_lock(&arena->lock);
+    gsize size = arena->size;
+    g_mutex_unlock(&arena->lock);
+
+    return size;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glib.h>
+
+/** @brief Pool for PES reassembly buffers and PES states.
+ *  Memory is handed out in chunks of power of two size classes, released chunks are kept
+ *  on a free list of their class and reused, so that a steady state does not allocate.
+ *  An arena belongs to one operation, e.g., the analysis, and everything allocated from it is
+ *  released at once when the operation ends. Allocation and release are thread-safe.
+ */
+typedef struct _PesArena PesArena;
+
+/** @brief Create a new, empty arena.
+ */
+PesArena *pes_arena_new(void);
+
+/** @brief Free the arena and all memory allocated from it.
+ */
+void pes_arena_free(PesArena *arena);
+
+/** @brief Allocate memory of at least size bytes. Not initialized.
+ */
+gpointer pes_arena_alloc(PesArena *arena, gsize size);
+
+/** @brief Allocate zeroed memory of at least size bytes.
+ */
+gpointer pes_arena_alloc0(PesArena *arena, gsize size);
+
+/** @brief Grow memory to at least size bytes, keeping its contents. mem may be NULL.
+ */
+gpointer pes_arena_realloc(PesArena *arena, gpointer mem, gsize size);
+
+/** @brief Return memory to the arena for reuse. mem may be NULL.
+ */
+void pes_arena_release(PesArena *arena, gpointer mem);
+
+/** @brief Get the usable size of memory from the arena.
+ */
+gsize pes_arena_get_capacity(gconstpointer mem);
+
+/** @brief Release everything allocated from the arena at once, at the end of an operation.
+ *  Nothing allocated before may be used anymore.
+ *  @param[in] keep Free chunks are kept for the next operation up to this many bytes, the rest
+ *                  is freed. This bounds the memory of idle arenas.
+ */
+void pes_arena_reset(PesArena *arena, gsize keep);
+
+/** @brief Get the number of bytes held by the arena, in use or free.
+ */
+gsize pes_arena_get_size(PesArena *arena);
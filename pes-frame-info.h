@@ -15,6 +15,7 @@ typedef struct {
     gsize stream_offset_dangling_bframe;
     gsize stream_offset_end;
     PidType pidtype;
+    guint16 pid; /* The video may move to another pid with a new PMT. */
 } PESFrameInfo;
 
 
@@ -1,4 +1,5 @@
 #include "project.h"
+#include "input-hash.h"
 #include <json-glib/json-glib.h>
 #include <json-glib/json-gobject.h>
 
@@ -10,6 +11,11 @@ typedef struct {
 struct _TsSnipperProject {
     gchar *input_filename;
     gchar *sha1sum; /* The sha1 saved in the project file for validation. */
+    gint64 sha1_version; /* INPUT_HASH_VERSION of sha1sum. */
+    InputFingerprint fingerprint; /* The fingerprint saved in the project file. */
+    gboolean have_fingerprint;
+
+    TsSnipperProjectValidatePolicy validate_policy;
 
     TsSnipper *tsn;
 
@@ -37,6 +43,22 @@ void ts_snipper_project_destroy(TsSnipperProject *project)
     }
 }
 
+static void _ts_snipper_project_read_fingerprint(TsSnipperProject *project, JsonNode *node)
+{
+    if (!JSON_NODE_HOLDS_OBJECT(node))
+        return;
+    JsonObject *obj = json_node_get_object(node);
+    if (!json_object_has_member(obj, "version") ||
+            !json_object_has_member(obj, "size") ||
+            !json_object_has_member(obj, "hash"))
+        return;
+
+    project->fingerprint.version = json_object_get_int_member(obj, "version");
+    project->fingerprint.size = json_object_get_int_member(obj, "size");
+    project->have_fingerprint = input_fingerprint_hash_from_string(&project->fingerprint,
+            json_object_get_string_member(obj, "hash"));
+}
+
 static void _ts_snipper_project_read_input(TsSnipperProject *project, JsonNode *node)
 {
     if (!JSON_NODE_HOLDS_OBJECT(node))
@@ -47,6 +69,13 @@ static void _ts_snipper_project_read_input(TsSnipperProject *project, JsonNode *
     }
     if (json_object_has_member(obj, "sha1")) {
         project->sha1sum = g_strdup(json_object_get_string_member(obj, "sha1"));
+        /* Projects without a version hashed what the analyzer accepted. */
+        project->sha1_version = json_object_has_member(obj, "sha1_version")
+            ? json_object_get_int_member(obj, "sha1_version")
+            : 1;
+    }
+    if (json_object_has_member(obj, "fingerprint")) {
+        _ts_snipper_project_read_fingerprint(project, json_object_get_member(obj, "fingerprint"));
     }
 }
 
@@ -157,12 +186,86 @@ TsSnipper *ts_snipper_project_get_snipper(TsSnipperProject *project)
     return project ? project->tsn : NULL;
 }
 
+void ts_snipper_project_set_validate_policy(TsSnipperProject *project,
+                                            TsSnipperProjectValidatePolicy policy)
+{
+    g_return_if_fail(project != NULL);
+    project->validate_policy = policy;
+}
+
+/* Fingerprints of an unknown (newer) version cannot be checked. */
+static gboolean ts_snipper_project_can_use_fingerprint(TsSnipperProject *project)
+{
+    return project->have_fingerprint &&
+           project->fingerprint.version == INPUT_FINGERPRINT_VERSION;
+}
+
+/* A sha1 of a newer version covers unknown bytes, it cannot be compared. Version 1 hashed
+ * the packets the analyzer accepted, which equals the current digest unless the input has
+ * junk or a partial packet, so it is compared as well. */
+static gboolean ts_snipper_project_can_use_sha1(TsSnipperProject *project)
+{
+    return project->sha1sum != NULL &&
+           project->sha1_version >= 1 &&
+           project->sha1_version <= INPUT_HASH_VERSION;
+}
+
+gboolean ts_snipper_project_validate_needs_sha1(TsSnipperProject *project)
+{
+    g_return_val_if_fail(project != NULL, FALSE);
+    if (!ts_snipper_project_can_use_sha1(project))
+        return FALSE;
+    switch (project->validate_policy) {
+        case TsSnipperProjectValidateFingerprint:
+            return !ts_snipper_project_can_use_fingerprint(project);
+        case TsSnipperProjectValidateSha1:
+        case TsSnipperProjectValidateBoth:
+        default:
+            return TRUE;
+    }
+}
+
+static gboolean ts_snipper_project_validate_fingerprint(TsSnipperProject *project)
+{
+    InputFingerprint fingerprint;
+    if (!ts_snipper_get_fingerprint(project->tsn, &fingerprint))
+        return FALSE;
+    return input_fingerprint_equal(&project->fingerprint, &fingerprint);
+}
+
+static gboolean ts_snipper_project_validate_sha1(TsSnipperProject *project)
+{
+    if (project->sha1sum == NULL) /* allow any sum if not set in project */
+        return TRUE;
+    if (!ts_snipper_project_can_use_sha1(project)) {
+        g_warning("Unknown sha1_version %" G_GINT64_FORMAT " of the project, cannot validate the input",
+                  project->sha1_version);
+        return FALSE;
+    }
+
+    gchar *sha1sum = ts_snipper_wait_sha1sum(project->tsn);
+    gboolean valid = 0 == g_strcmp0(project->sha1sum, sha1sum);
+    g_free(sha1sum);
+
+    if (!valid && project->sha1_version < INPUT_HASH_VERSION)
+        g_warning("The project has a sha1 of version %" G_GINT64_FORMAT ", it also differs "
+                  "for an unchanged input with junk or a partial packet",
+                  project->sha1_version);
+    return valid;
+}
+
 gboolean ts_snipper_project_validate(TsSnipperProject *project)
 {
     g_return_val_if_fail(project != NULL, FALSE);
-    return (project->sha1sum == NULL || /* allow any sum if not set in project */
-            0 == g_strcmp0(project->sha1sum,
-                           ts_snipper_get_sha1sum(project->tsn)));
+
+    gboolean use_fingerprint = project->validate_policy != TsSnipperProjectValidateSha1 &&
+                               ts_snipper_project_can_use_fingerprint(project);
+
+    if (use_fingerprint && !ts_snipper_project_validate_fingerprint(project))
+        return FALSE;
+    if (use_fingerprint && project->validate_policy == TsSnipperProjectValidateFingerprint)
+        return TRUE;
+    return ts_snipper_project_validate_sha1(project);
 }
 
 void ts_snipper_project_apply_slices(TsSnipperProject *project)
@@ -181,10 +284,31 @@ static void _ts_snipper_project_write_input(TsSnipperProject *project, JsonBuild
     json_builder_set_member_name(builder, "path");
     json_builder_add_string_value(builder, ts_snipper_get_filename(project->tsn));
 
-    const gchar *sha1sum = ts_snipper_get_sha1sum(project->tsn);
+    /* The sha1 is optional if the fingerprint is sufficient, do not wait for it then. */
+    gchar *sha1sum = project->validate_policy == TsSnipperProjectValidateFingerprint
+        ? ts_snipper_get_sha1sum(project->tsn)
+        : ts_snipper_wait_sha1sum(project->tsn);
     if (sha1sum) {
         json_builder_set_member_name(builder, "sha1");
         json_builder_add_string_value(builder, sha1sum);
+        json_builder_set_member_name(builder, "sha1_version");
+        json_builder_add_int_value(builder, INPUT_HASH_VERSION);
+    }
+    g_free(sha1sum);
+
+    InputFingerprint fingerprint;
+    if (ts_snipper_get_fingerprint(project->tsn, &fingerprint)) {
+        gchar *hash = input_fingerprint_hash_to_string(&fingerprint);
+        json_builder_set_member_name(builder, "fingerprint");
+        json_builder_begin_object(builder);
+        json_builder_set_member_name(builder, "version");
+        json_builder_add_int_value(builder, fingerprint.version);
+        json_builder_set_member_name(builder, "size");
+        json_builder_add_int_value(builder, fingerprint.size);
+        json_builder_set_member_name(builder, "hash");
+        json_builder_add_string_value(builder, hash);
+        json_builder_end_object(builder);
+        g_free(hash);
     }
 }
 
@@ -28,7 +28,26 @@ void ts_snipper_project_set_snipper(TsSnipperProject *project, TsSnipper *snippe
  */
 TsSnipper *ts_snipper_project_get_snipper(TsSnipperProject *project);
 
+/** @brief How the input of a project is validated. */
+typedef enum {
+    TsSnipperProjectValidateFingerprint = 0, /**< Fingerprint if stored, SHA-1 otherwise (default). */
+    TsSnipperProjectValidateSha1 = 1, /**< Only the SHA-1, always write it. */
+    TsSnipperProjectValidateBoth = 2 /**< Both fingerprint and SHA-1 have to match if stored. */
+} TsSnipperProjectValidatePolicy;
+
+/** @brief Set the policy for ts_snipper_project_validate() and which checksums
+ *  ts_snipper_project_write() waits for.
+ */
+void ts_snipper_project_set_validate_policy(TsSnipperProject *project,
+                                            TsSnipperProjectValidatePolicy policy);
+
+/** @brief Whether ts_snipper_project_validate() has to wait for the SHA-1 of the input.
+ */
+gboolean ts_snipper_project_validate_needs_sha1(TsSnipperProject *project);
+
 /** @brief Validate the snipper after analyzing.
+ *  Blocks until the SHA-1 of the input is done if it is needed, see
+ *  ts_snipper_project_validate_needs_sha1().
  */
 gboolean ts_snipper_project_validate(TsSnipperProject *project);
 
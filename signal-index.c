@@ -0,0 +1,494 @@
+#include "signal-index.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <bitstream/mpeg/ts.h>
+#include <bitstream/mpeg/psi.h>
+
+#define SIGNAL_PTS_INVALID ((guint64)(-1))
+#define SIGNAL_PTS_MASK ((G_GUINT64_CONSTANT(1) << 33) - 1)
+
+#define SIGNAL_EIT_PID (0x12)
+#define SIGNAL_TDT_PID (0x14)
+#define SIGNAL_TABLE_EIT_PF_ACTUAL (0x4e)
+#define SIGNAL_TABLE_TDT (0x70)
+#define SIGNAL_TABLE_TOT (0x73)
+#define SIGNAL_TABLE_SCTE35 (0xfc)
+
+#define SIGNAL_SCTE35_SPLICE_INSERT (0x05)
+#define SIGNAL_SCTE35_TIME_SIGNAL (0x06)
+
+struct _SignalIndex {
+    GArray *markers; /* [SignalMarker] */
+    GArray *clocks; /* [SignalClock] */
+    GMutex lock;
+};
+
+/* Section assembly of a pid. */
+typedef struct {
+    uint8_t *buffer;
+    uint16_t used;
+    gint16 last_cc; /* -1 if no packet was seen yet. */
+} SignalSection;
+
+struct _SignalParser {
+    SignalIndex *index;
+    guint32 pids[8192 / 32]; /* Bitmap of the pids in sections. */
+    GHashTable *sections; /* [pid -> SignalSection *] */
+};
+
+SignalIndex *signal_index_new(void)
+{
+    SignalIndex *index = g_new0(SignalIndex, 1);
+    index->markers = g_array_new(FALSE, FALSE, sizeof(SignalMarker));
+    index->clocks = g_array_new(FALSE, FALSE, sizeof(SignalClock));
+    g_mutex_init(&index->lock);
+    return index;
+}
+
+void signal_index_free(SignalIndex *index)
+{
+    if (index) {
+        g_array_free(index->markers, TRUE);
+        g_array_free(index->clocks, TRUE);
+        g_mutex_clear(&index->lock);
+        g_free(index);
+    }
+}
+
+void signal_index_clear(SignalIndex *index)
+{
+    g_return_if_fail(index != NULL);
+
+    g_mutex_lock(&index->lock);
+    g_array_set_size(index->markers, 0);
+    g_array_set_size(index->clocks, 0);
+    g_mutex_unlock(&index->lock);
+}
+
+/* Called with the lock held. */
+static gboolean signal_index_is_repeated(SignalIndex *index, const SignalMarker *marker)
+{
+    SignalMarker *other;
+    guint j;
+
+    for (j = index->markers->len; j > 0; --j) {
+        other = &g_array_index(index->markers, SignalMarker, j - 1);
+        if (marker->type == SignalMarkerEvent) {
+            /* Only the present event of the service matters. */
+            if (other->type == SignalMarkerEvent && other->service_id == marker->service_id)
+                return other->id == marker->id;
+        }
+        else if (other->type == marker->type && other->pid == marker->pid &&
+                 other->id == marker->id && other->pts == marker->pts) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+gboolean signal_index_add_marker(SignalIndex *index, const SignalMarker *marker)
+{
+    g_return_val_if_fail(index != NULL, FALSE);
+    g_return_val_if_fail(marker != NULL, FALSE);
+
+    g_mutex_lock(&index->lock);
+    gboolean added = !signal_index_is_repeated(index, marker);
+    if (added)
+        g_array_append_vals(index->markers, marker, 1);
+    g_mutex_unlock(&index->lock);
+
+    return added;
+}
+
+void signal_index_add_clock(SignalIndex *index, const SignalClock *clock)
+{
+    g_return_if_fail(index != NULL);
+    g_return_if_fail(clock != NULL);
+
+    g_mutex_lock(&index->lock);
+    if (index->clocks->len == 0 ||
+            g_array_index(index->clocks, SignalClock, index->clocks->len - 1).offset < clock->offset)
+        g_array_append_vals(index->clocks, clock, 1);
+    g_mutex_unlock(&index->lock);
+}
+
+void signal_index_append(SignalIndex *index, SignalIndex *src)
+{
+    g_return_if_fail(index != NULL);
+    g_return_if_fail(src != NULL);
+
+    guint j;
+
+    g_mutex_lock(&src->lock);
+    for (j = 0; j < src->markers->len; ++j)
+        signal_index_add_marker(index, &g_array_index(src->markers, SignalMarker, j));
+    for (j = 0; j < src->clocks->len; ++j)
+        signal_index_add_clock(index, &g_array_index(src->clocks, SignalClock, j));
+    g_mutex_unlock(&src->lock);
+}
+
+void signal_index_append_vals(SignalIndex *index,
+                              const SignalMarker *markers,
+                              guint marker_count,
+                              const SignalClock *clocks,
+                              guint clock_count)
+{
+    g_return_if_fail(index != NULL);
+    g_return_if_fail(markers != NULL || marker_count == 0);
+    g_return_if_fail(clocks != NULL || clock_count == 0);
+
+    g_mutex_lock(&index->lock);
+    g_array_append_vals(index->markers, markers, marker_count);
+    g_array_append_vals(index->clocks, clocks, clock_count);
+    g_mutex_unlock(&index->lock);
+}
+
+guint signal_index_get_marker_count(SignalIndex *index)
+{
+    g_return_val_if_fail(index != NULL, 0);
+
+    g_mutex_lock(&index->lock);
+    guint count = index->markers->len;
+    g_mutex_unlock(&index->lock);
+
+    return count;
+}
+
+gboolean signal_index_get_marker(SignalIndex *index, guint position, SignalMarker *marker)
+{
+    g_return_val_if_fail(index != NULL, FALSE);
+
+    g_mutex_lock(&index->lock);
+    gboolean found = position < index->markers->len;
+    if (found && marker)
+        *marker = g_array_index(index->markers, SignalMarker, position);
+    g_mutex_unlock(&index->lock);
+
+    return found;
+}
+
+guint signal_index_get_clock_count(SignalIndex *index)
+{
+    g_return_val_if_fail(index != NULL, 0);
+
+    g_mutex_lock(&index->lock);
+    guint count = index->clocks->len;
+    g_mutex_unlock(&index->lock);
+
+    return count;
+}
+
+gboolean signal_index_get_clock(SignalIndex *index, guint position, SignalClock *clock)
+{
+    g_return_val_if_fail(index != NULL, FALSE);
+
+    g_mutex_lock(&index->lock);
+    gboolean found = position < index->clocks->len;
+    if (found && clock)
+        *clock = g_array_index(index->clocks, SignalClock, position);
+    g_mutex_unlock(&index->lock);
+
+    return found;
+}
+
+gboolean signal_index_find_clock(SignalIndex *index, gint64 utc, SignalClock *clock)
+{
+    g_return_val_if_fail(index != NULL, FALSE);
+
+    SignalClock *best = NULL;
+    SignalClock *sample;
+    guint j;
+
+    g_mutex_lock(&index->lock);
+    for (j = 0; j < index->clocks->len; ++j) {
+        sample = &g_array_index(index->clocks, SignalClock, j);
+        if (!best || ABS(sample->utc - utc) < ABS(best->utc - utc))
+            best = sample;
+    }
+    if (best && clock)
+        *clock = *best;
+    g_mutex_unlock(&index->lock);
+
+    return best != NULL;
+}
+
+/* Decoding of the sections. */
+
+static guint signal_decode_bcd(guint8 bcd)
+{
+    return (bcd >> 4) * 10 + (bcd & 0x0f);
+}
+
+/* 16 bit MJD followed by hours, minutes and seconds as BCD. */
+static gint64 signal_decode_utc(const guint8 *data)
+{
+    gint64 mjd = (data[0] << 8) | data[1];
+    return (mjd - 40587) * 86400 + signal_decode_bcd(data[2]) * 3600 +
+           signal_decode_bcd(data[3]) * 60 + signal_decode_bcd(data[4]);
+}
+
+static guint64 signal_decode_pts(const guint8 *data)
+{
+    return ((guint64)(data[0] & 0x01) << 32) | ((guint64)data[1] << 24) | (data[2] << 16) |
+           (data[3] << 8) | data[4];
+}
+
+static void signal_parse_eit(SignalParser *parser, const guint8 *section, gsize offset)
+{
+    /* Section 0 holds the present event. */
+    if (section[6] != 0 || !psi_check_crc((uint8_t *)section))
+        return;
+
+    const guint8 *event = section + 14;
+    const guint8 *end = section + 3 + psi_get_length(section) - PSI_CRC_SIZE;
+    if (event + 12 > end)
+        return;
+
+    SignalMarker marker = {
+        .type = SignalMarkerEvent,
+        .pid = SIGNAL_EIT_PID,
+        .service_id = (section[3] << 8) | section[4],
+        .id = (event[0] << 8) | event[1],
+        .offset = offset,
+        .utc_start = signal_decode_utc(event + 2),
+        .pts = SIGNAL_PTS_INVALID,
+        .duration = (signal_decode_bcd(event[7]) * 3600 + signal_decode_bcd(event[8]) * 60 +
+                     signal_decode_bcd(event[9])) * G_GUINT64_CONSTANT(90000)
+    };
+    signal_index_add_marker(parser->index, &marker);
+}
+
+static void signal_parse_time(SignalParser *parser, const guint8 *section, gsize offset)
+{
+    if (psi_get_length(section) < 5)
+        return;
+    if (psi_get_tableid(section) == SIGNAL_TABLE_TOT && !psi_check_crc((uint8_t *)section))
+        return;
+
+    SignalClock clock = {
+        .offset = offset,
+        .utc = signal_decode_utc(section + 3)
+    };
+    signal_index_add_clock(parser->index, &clock);
+}
+
+/* splice_time(), returns the size or 0 if it is truncated. */
+static gsize signal_parse_splice_time(const guint8 *data, const guint8 *end, guint64 *pts)
+{
+    if (data >= end)
+        return 0;
+    if (!(data[0] & 0x80)) {
+        *pts = SIGNAL_PTS_INVALID;
+        return 1;
+    }
+    if (data + 5 > end)
+        return 0;
+    *pts = signal_decode_pts(data);
+    return 5;
+}
+
+static void signal_parse_scte35(SignalParser *parser, guint16 pid, const guint8 *section, gsize offset)
+{
+    gsize length = 3 + psi_get_length(section);
+    gsize size;
+
+    if (length < 14 + PSI_CRC_SIZE || !psi_check_crc((uint8_t *)section))
+        return;
+    /* Encrypted commands cannot be read. */
+    if (section[4] & 0x80)
+        return;
+
+    guint64 pts_adjustment = signal_decode_pts(section + 4);
+    const guint8 *command = section + 14;
+    const guint8 *end = section + length - PSI_CRC_SIZE;
+
+    SignalMarker marker = {
+        .pid = pid,
+        .offset = offset,
+        .utc_start = -1,
+        .pts = SIGNAL_PTS_INVALID
+    };
+
+    if (section[13] == SIGNAL_SCTE35_TIME_SIGNAL) {
+        marker.type = SignalMarkerTimeSignal;
+        if (!signal_parse_splice_time(command, end, &marker.pts))
+            return;
+    }
+    else if (section[13] == SIGNAL_SCTE35_SPLICE_INSERT) {
+        if (command + 5 > end)
+            return;
+        marker.id = ((guint32)command[0] << 24) | (command[1] << 16) | (command[2] << 8) | command[3];
+        /* Cancelled splice. */
+        if (command[4] & 0x80)
+            return;
+        if (command + 6 > end)
+            return;
+        guint8 flags = command[5];
+        gboolean program_splice = flags & 0x40;
+        gboolean has_duration = flags & 0x20;
+        gboolean immediate = flags & 0x10;
+        const guint8 *p = command + 6;
+
+        marker.type = (flags & 0x80) ? SignalMarkerSpliceOut : SignalMarkerSpliceIn;
+        if (program_splice) {
+            if (!immediate) {
+                if (!(size = signal_parse_splice_time(p, end, &marker.pts)))
+                    return;
+                p += size;
+            }
+        }
+        else {
+            /* Per component, the time of the first one is taken. */
+            if (p >= end)
+                return;
+            guint count = *p++;
+            guint j;
+            guint64 pts;
+            for (j = 0; j < count; ++j) {
+                if (++p > end)
+                    return;
+                if (!immediate) {
+                    if (!(size = signal_parse_splice_time(p, end, &pts)))
+                        return;
+                    if (j == 0)
+                        marker.pts = pts;
+                    p += size;
+                }
+            }
+        }
+        if (has_duration) {
+            if (p + 5 > end)
+                return;
+            marker.duration = signal_decode_pts(p);
+        }
+    }
+    else {
+        return;
+    }
+
+    if (marker.pts != SIGNAL_PTS_INVALID)
+        marker.pts = (marker.pts + pts_adjustment) & SIGNAL_PTS_MASK;
+
+    signal_index_add_marker(parser->index, &marker);
+}
+
+static void signal_parser_handle_section(SignalParser *parser, guint16 pid, guint8 *section, gsize offset)
+{
+    if (psi_validate(section)) {
+        switch (psi_get_tableid(section)) {
+            case SIGNAL_TABLE_EIT_PF_ACTUAL:
+                if (pid == SIGNAL_EIT_PID)
+                    signal_parse_eit(parser, section, offset);
+                break;
+            case SIGNAL_TABLE_TDT:
+            case SIGNAL_TABLE_TOT:
+                if (pid == SIGNAL_TDT_PID)
+                    signal_parse_time(parser, section, offset);
+                break;
+            case SIGNAL_TABLE_SCTE35:
+                signal_parse_scte35(parser, pid, section, offset);
+                break;
+            default:
+                break;
+        }
+    }
+    free(section);
+}
+
+static void signal_section_free(SignalSection *section)
+{
+    if (section) {
+        psi_assemble_reset(&section->buffer, &section->used);
+        g_free(section);
+    }
+}
+
+SignalParser *signal_parser_new(SignalIndex *index)
+{
+    g_return_val_if_fail(index != NULL, NULL);
+
+    SignalParser *parser = g_new0(SignalParser, 1);
+    parser->index = index;
+    parser->sections = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                             (GDestroyNotify)signal_section_free);
+    signal_parser_reset(parser);
+    return parser;
+}
+
+void signal_parser_free(SignalParser *parser)
+{
+    if (parser) {
+        g_hash_table_destroy(parser->sections);
+        g_free(parser);
+    }
+}
+
+void signal_parser_reset(SignalParser *parser)
+{
+    g_return_if_fail(parser != NULL);
+
+    g_hash_table_remove_all(parser->sections);
+    memset(parser->pids, 0, sizeof(parser->pids));
+    parser->pids[SIGNAL_EIT_PID / 32] |= 1u << (SIGNAL_EIT_PID % 32);
+    parser->pids[SIGNAL_TDT_PID / 32] |= 1u << (SIGNAL_TDT_PID % 32);
+}
+
+/* Start of a SCTE-35 section, which is not a PES start (00 00 01) either. */
+static gboolean signal_is_scte35_start(const guint8 *packet)
+{
+    if (!ts_get_unitstart(packet) || !ts_has_payload(packet))
+        return FALSE;
+    const guint8 *payload = ts_payload((uint8_t *)packet);
+    if (payload >= packet + TS_SIZE)
+        return FALSE;
+    const guint8 *table = payload + 1 + payload[0];
+    return table < packet + TS_SIZE && *table == SIGNAL_TABLE_SCTE35;
+}
+
+void signal_parser_push_packet(SignalParser *parser, const guint8 *packet, gsize offset)
+{
+    guint16 pid = ts_get_pid(packet);
+
+    if (!(parser->pids[pid / 32] & (1u << (pid % 32)))) {
+        if (G_LIKELY(!signal_is_scte35_start(packet)))
+            return;
+        parser->pids[pid / 32] |= 1u << (pid % 32);
+    }
+
+    SignalSection *state = g_hash_table_lookup(parser->sections, GUINT_TO_POINTER(pid));
+    if (!state) {
+        state = g_new0(SignalSection, 1);
+        psi_assemble_init(&state->buffer, &state->used);
+        state->last_cc = -1;
+        g_hash_table_insert(parser->sections, GUINT_TO_POINTER(pid), state);
+    }
+
+    uint8_t cc = ts_get_cc(packet);
+    if (!ts_has_payload(packet) || (state->last_cc >= 0 && ts_check_duplicate(cc, state->last_cc)))
+        return;
+    if (state->last_cc >= 0 && ts_check_discontinuity(cc, state->last_cc))
+        psi_assemble_reset(&state->buffer, &state->used);
+    state->last_cc = cc;
+
+    const uint8_t *payload = ts_section((uint8_t *)packet);
+    uint8_t length = packet + TS_SIZE - payload;
+    uint8_t *section;
+
+    /* The rest of a section started before. */
+    if (!psi_assemble_empty(&state->buffer, &state->used)) {
+        section = psi_assemble_payload(&state->buffer, &state->used, &payload, &length);
+        if (section)
+            signal_parser_handle_section(parser, pid, section, offset);
+    }
+
+    /* Sections starting in this packet. */
+    payload = ts_next_section((uint8_t *)packet);
+    length = packet + TS_SIZE - payload;
+    while (length) {
+        section = psi_assemble_payload(&state->buffer, &state->used, &payload, &length);
+        if (section)
+            signal_parser_handle_section(parser, pid, section, offset);
+    }
+}
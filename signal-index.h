@@ -0,0 +1,101 @@
+#pragma once
+
+#include <glib.h>
+
+/** @brief Kind of a signal in the stream. */
+typedef enum {
+    SignalMarkerEvent = 0, /**< EIT present/following: a new present event. */
+    SignalMarkerSpliceOut = 1, /**< SCTE-35 splice_insert out of the network. */
+    SignalMarkerSpliceIn = 2, /**< SCTE-35 splice_insert back into the network. */
+    SignalMarkerTimeSignal = 3 /**< SCTE-35 time_signal. */
+} SignalMarkerType;
+
+/** @brief A signalled point of the stream. */
+typedef struct {
+    SignalMarkerType type;
+    guint16 pid;
+    guint16 service_id; /**< EIT only. */
+    guint32 id; /**< event_id or splice_event_id. */
+    gsize offset; /**< Offset of the packet completing the section. */
+    gint64 utc_start; /**< EIT only, start of the event in seconds since the epoch. */
+    guint64 pts; /**< SCTE-35 splice time incl. pts_adjustment, ((guint64)-1) if immediate. */
+    guint64 duration; /**< Duration of the event or break in 90 kHz, 0 if unknown. */
+} SignalMarker;
+
+/** @brief A sample of the UTC time of the stream from TDT or TOT. */
+typedef struct {
+    gsize offset;
+    gint64 utc; /**< Seconds since the epoch. */
+} SignalClock;
+
+/** @brief Signals found in a stream, in stream order.
+ *  Repetitions are dropped: an EIT event is only added when it becomes present, a splice only
+ *  once per id and time. Markers may be added while the index is read.
+ */
+typedef struct _SignalIndex SignalIndex;
+
+/** @brief Decodes EIT present/following, TDT/TOT and SCTE-35 sections from packets in stream
+ *  order and adds what it finds to an index. SCTE-35 pids are found by the table id of their
+ *  sections, so all packets may be passed. A parser is used by one thread only.
+ */
+typedef struct _SignalParser SignalParser;
+
+/** @brief Create a new, empty index.
+ */
+SignalIndex *signal_index_new(void);
+
+/** @brief Free the index. There must be no parsers left.
+ */
+void signal_index_free(SignalIndex *index);
+
+/** @brief Remove all markers and clock samples.
+ */
+void signal_index_clear(SignalIndex *index);
+
+/** @brief Add a marker behind all others, unless it repeats an earlier one.
+ *  @return TRUE if the marker was added.
+ */
+gboolean signal_index_add_marker(SignalIndex *index, const SignalMarker *marker);
+
+/** @brief Add a clock sample behind all others.
+ */
+void signal_index_add_clock(SignalIndex *index, const SignalClock *clock);
+
+/** @brief Add everything of src behind all others, e.g., from a later part of the stream.
+ */
+void signal_index_append(SignalIndex *index, SignalIndex *src);
+
+/** @brief Append markers and clock samples, e.g., from a cache. They are not checked.
+ */
+void signal_index_append_vals(SignalIndex *index,
+                              const SignalMarker *markers,
+                              guint marker_count,
+                              const SignalClock *clocks,
+                              guint clock_count);
+
+guint signal_index_get_marker_count(SignalIndex *index);
+gboolean signal_index_get_marker(SignalIndex *index, guint position, SignalMarker *marker);
+
+guint signal_index_get_clock_count(SignalIndex *index);
+gboolean signal_index_get_clock(SignalIndex *index, guint position, SignalClock *clock);
+
+/** @brief Find the clock sample closest to a UTC time.
+ *  @return FALSE if there are no samples.
+ */
+gboolean signal_index_find_clock(SignalIndex *index, gint64 utc, SignalClock *clock);
+
+/** @brief Create a parser adding to the index.
+ */
+SignalParser *signal_parser_new(SignalIndex *index);
+
+/** @brief Free the parser. Incomplete sections are dropped.
+ */
+void signal_parser_free(SignalParser *parser);
+
+/** @brief Drop incomplete sections and forget the pids found, e.g., before a new analysis.
+ */
+void signal_parser_reset(SignalParser *parser);
+
+/** @brief Handle a packet, packets of other pids are ignored quickly.
+ */
+void signal_parser_push_packet(SignalParser *parser, const guint8 *packet, gsize offset);
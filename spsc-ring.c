@@ -0,0 +1,122 @@
+#include "spsc-ring.h"
+
+/* head and tail count the slots pushed and popped so far, the slot of a count is
+ * count & mask. A side that has to wait registers in waiters before checking the other index
+ * once more, and the other side looks at waiters after publishing its index. Both are
+ * sequentially consistent atomics, so a wakeup cannot get lost. */
+struct _SpscRing {
+    guint8 *slots;
+    gsize slot_size;
+    guint capacity;
+    guint mask;
+
+    gint head; /* guint32, only accessed atomically */
+    gint tail; /* guint32, only accessed atomically */
+    gint closed; /* only accessed atomically */
+    gint waiters; /* only accessed atomically */
+
+    GMutex lock;
+    GCond cond;
+};
+
+SpscRing *spsc_ring_new(guint capacity, gsize slot_size)
+{
+    g_return_val_if_fail(capacity > 0 && capacity <= (1u << 30), NULL);
+
+    SpscRing *ring = g_new0(SpscRing, 1);
+    ring->capacity = 1;
+    while (ring->capacity < capacity)
+        ring->capacity <<= 1;
+    ring->mask = ring->capacity - 1;
+    ring->slot_size = slot_size;
+    ring->slots = g_malloc((gsize)ring->capacity * slot_size);
+    g_mutex_init(&ring->lock);
+    g_cond_init(&ring->cond);
+
+    return ring;
+}
+
+void spsc_ring_free(SpscRing *ring)
+{
+    if (ring) {
+        g_cond_clear(&ring->cond);
+        g_mutex_clear(&ring->lock);
+        g_free(ring->slots);
+        g_free(ring);
+    }
+}
+
+static void spsc_ring_wake(SpscRing *ring)
+{
+    if (g_atomic_int_get(&ring->waiters) > 0) {
+        g_mutex_lock(&ring->lock);
+        g_cond_broadcast(&ring->cond);
+        g_mutex_unlock(&ring->lock);
+    }
+}
+
+static inline guint32 spsc_ring_filled(SpscRing *ring)
+{
+    return (guint32)g_atomic_int_get(&ring->head) - (guint32)g_atomic_int_get(&ring->tail);
+}
+
+gpointer spsc_ring_push_begin(SpscRing *ring)
+{
+    g_return_val_if_fail(ring != NULL, NULL);
+
+    if (spsc_ring_filled(ring) >= ring->capacity) {
+        g_mutex_lock(&ring->lock);
+        g_atomic_int_inc(&ring->waiters);
+        while (spsc_ring_filled(ring) >= ring->capacity)
+            g_cond_wait(&ring->cond, &ring->lock);
+        g_atomic_int_add(&ring->waiters, -1);
+        g_mutex_unlock(&ring->lock);
+    }
+
+    return ring->slots + ((guint32)g_atomic_int_get(&ring->head) & ring->mask) * ring->slot_size;
+}
+
+void spsc_ring_push_end(SpscRing *ring)
+{
+    g_return_if_fail(ring != NULL);
+
+    g_atomic_int_inc(&ring->head);
+    spsc_ring_wake(ring);
+}
+
+void spsc_ring_close(SpscRing *ring)
+{
+    g_return_if_fail(ring != NULL);
+
+    g_atomic_int_set(&ring->closed, 1);
+    g_mutex_lock(&ring->lock);
+    g_cond_broadcast(&ring->cond);
+    g_mutex_unlock(&ring->lock);
+}
+
+gpointer spsc_ring_pop_begin(SpscRing *ring)
+{
+    g_return_val_if_fail(ring != NULL, NULL);
+
+    if (spsc_ring_filled(ring) == 0) {
+        g_mutex_lock(&ring->lock);
+        g_atomic_int_inc(&ring->waiters);
+        while (spsc_ring_filled(ring) == 0 && !g_atomic_int_get(&ring->closed))
+            g_cond_wait(&ring->cond, &ring->lock);
+        g_atomic_int_add(&ring->waiters, -1);
+        g_mutex_unlock(&ring->lock);
+    }
+    /* Closed, but slots pushed before are still handed out. */
+    if (spsc_ring_filled(ring) == 0)
+        return NULL;
+
+    return ring->slots + ((guint32)g_atomic_int_get(&ring->tail) & ring->mask) * ring->slot_size;
+}
+
+void spsc_ring_pop_end(SpscRing *ring)
+{
+    g_return_if_fail(ring != NULL);
+
+    g_atomic_int_inc(&ring->tail);
+    spsc_ring_wake(ring);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <glib.h>
+
+/** @brief Bounded ring of fixed-size slots between one producer and one consumer thread.
+ *  Slots are owned by the ring and reused, so passing data does not allocate. The indices are
+ *  only accessed atomically, a side only takes the lock to wait when the ring is full or empty.
+ */
+typedef struct _SpscRing SpscRing;
+
+/** @brief Create a new ring.
+ *  @param[in] capacity Number of slots, rounded up to a power of two.
+ *  @param[in] slot_size Size of a slot in bytes.
+ */
+SpscRing *spsc_ring_new(guint capacity, gsize slot_size);
+
+/** @brief Free the ring. Neither side may use it anymore.
+ */
+void spsc_ring_free(SpscRing *ring);
+
+/** @brief Get the next free slot, blocks while the ring is full.
+ */
+gpointer spsc_ring_push_begin(SpscRing *ring);
+
+/** @brief Hand the slot from spsc_ring_push_begin() to the consumer.
+ */
+void spsc_ring_push_end(SpscRing *ring);
+
+/** @brief Producer side: no more slots will be pushed.
+ */
+void spsc_ring_close(SpscRing *ring);
+
+/** @brief Get the next filled slot, blocks while the ring is empty.
+ *  @return The slot or NULL if the ring is closed and empty.
+ */
+gpointer spsc_ring_pop_begin(SpscRing *ring);
+
+/** @brief Return the slot from spsc_ring_pop_begin() to the producer.
+ */
+void spsc_ring_pop_end(SpscRing *ring);
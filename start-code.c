@@ -0,0 +1,100 @@
+#include "start-code.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define START_CODE_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+typedef const guint8 *(*StartCodeFindFunc)(const guint8 *, gsize);
+
+static const guint8 *start_code_find_scalar(const guint8 *data, gsize length)
+{
+    gsize j;
+    for (j = 0; j + 2 < length; ++j) {
+        /* If the third byte is not 0x01 or 0x00, no prefix can start at j, j+1 or j+2. */
+        if (data[j + 2] > 1) {
+            j += 2;
+            continue;
+        }
+        if (data[j] == 0x00 && data[j + 1] == 0x00 && data[j + 2] == 0x01)
+            return data + j;
+    }
+    return NULL;
+}
+
+#ifdef START_CODE_HAVE_X86
+/* Compare three overlapping loads at p, p+1, p+2 against 00, 00, 01. Bit k of the resulting
+ * mask is set iff a prefix starts at p+k. */
+__attribute__((target("sse2")))
+static const guint8 *start_code_find_sse2(const guint8 *data, gsize length)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    gsize j = 0;
+    guint32 mask;
+
+    for (; j + 18 <= length; j += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(data + j));
+        __m128i b = _mm_loadu_si128((const __m128i *)(data + j + 1));
+        __m128i c = _mm_loadu_si128((const __m128i *)(data + j + 2));
+        __m128i m = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(a, zero),
+                                                _mm_cmpeq_epi8(b, zero)),
+                                  _mm_cmpeq_epi8(c, one));
+        mask = (guint32)_mm_movemask_epi8(m);
+        if (mask)
+            return data + j + __builtin_ctz(mask);
+    }
+
+    return start_code_find_scalar(data + j, length - j);
+}
+
+__attribute__((target("avx2")))
+static const guint8 *start_code_find_avx2(const guint8 *data, gsize length)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    gsize j = 0;
+    guint32 mask;
+
+    for (; j + 34 <= length; j += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(data + j));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(data + j + 1));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(data + j + 2));
+        __m256i m = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(a, zero),
+                                                      _mm256_cmpeq_epi8(b, zero)),
+                                     _mm256_cmpeq_epi8(c, one));
+        mask = (guint32)_mm256_movemask_epi8(m);
+        if (mask)
+            return data + j + __builtin_ctz(mask);
+    }
+
+    return start_code_find_sse2(data + j, length - j);
+}
+#endif
+
+static StartCodeFindFunc start_code_find_select(void)
+{
+#ifdef START_CODE_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return start_code_find_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return start_code_find_sse2;
+#endif
+    return start_code_find_scalar;
+}
+
+const guint8 *start_code_find(const guint8 *data, gsize length)
+{
+    /* Selecting twice from different threads is harmless, the result is the same. */
+    static StartCodeFindFunc find_impl = NULL;
+    StartCodeFindFunc impl = g_atomic_pointer_get(&find_impl);
+    if (G_UNLIKELY(impl == NULL)) {
+        impl = start_code_find_select();
+        g_atomic_pointer_set(&find_impl, impl);
+    }
+
+    if (data == NULL || length < 3)
+        return NULL;
+    return impl(data, length);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <glib.h>
+
+/** @brief Find the next start code prefix (0x00 0x00 0x01) in the buffer.
+ *  Uses SSE2/AVX2 if the cpu supports it, the implementation is chosen at runtime.
+ *  @param[in] data The buffer to search.
+ *  @param[in] length The number of bytes in the buffer.
+ *  @return Pointer to the first byte of the prefix or NULL if there is no complete prefix.
+ */
+const guint8 *start_code_find(const guint8 *data, gsize length);
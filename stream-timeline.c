@@ -0,0 +1,332 @@
+#include "stream-timeline.h"
+
+#include <string.h>
+
+struct _StreamTimeline {
+    gsize bucket_size;
+    guint bucket_count;
+    GArray *iframes; /* [guint32] per bucket */
+    GArray *pids[STREAM_TIMELINE_PIDS]; /* [StreamTimelineCounts] per bucket, NULL if not seen.
+                                           May be shorter than bucket_count, the rest is 0. */
+    GMutex lock;
+};
+
+struct _StreamTimelineWriter {
+    StreamTimeline *timeline;
+    guint bucket;
+    gboolean active; /* Something was counted in bucket. */
+    guint32 iframes;
+    guint pid_count;
+    guint16 pids[STREAM_TIMELINE_PIDS]; /* Pids with counts, in the order seen. */
+    StreamTimelineCounts counts[STREAM_TIMELINE_PIDS];
+};
+
+/* Layout of stream_timeline_save(): the header, the I frames of each bucket, and for each pid
+ * its number followed by its counts of each bucket. */
+typedef struct {
+    guint64 bucket_size;
+    guint32 bucket_count;
+    guint32 pid_count;
+} StreamTimelineHeader;
+
+StreamTimeline *stream_timeline_new(gsize bucket_size)
+{
+    g_return_val_if_fail(bucket_size > 0, NULL);
+
+    StreamTimeline *timeline = g_new0(StreamTimeline, 1);
+    timeline->bucket_size = bucket_size;
+    timeline->iframes = g_array_new(FALSE, TRUE, sizeof(guint32));
+    g_mutex_init(&timeline->lock);
+    return timeline;
+}
+
+/* Called with the lock held. */
+static void stream_timeline_clear_unlocked(StreamTimeline *timeline)
+{
+    guint pid;
+    for (pid = 0; pid < STREAM_TIMELINE_PIDS; ++pid) {
+        if (timeline->pids[pid]) {
+            g_array_free(timeline->pids[pid], TRUE);
+            timeline->pids[pid] = NULL;
+        }
+    }
+    g_array_set_size(timeline->iframes, 0);
+    timeline->bucket_count = 0;
+}
+
+void stream_timeline_free(StreamTimeline *timeline)
+{
+    if (timeline) {
+        stream_timeline_clear_unlocked(timeline);
+        g_array_free(timeline->iframes, TRUE);
+        g_mutex_clear(&timeline->lock);
+        g_free(timeline);
+    }
+}
+
+void stream_timeline_clear(StreamTimeline *timeline)
+{
+    g_return_if_fail(timeline != NULL);
+
+    g_mutex_lock(&timeline->lock);
+    stream_timeline_clear_unlocked(timeline);
+    g_mutex_unlock(&timeline->lock);
+}
+
+gsize stream_timeline_get_bucket_size(StreamTimeline *timeline)
+{
+    g_return_val_if_fail(timeline != NULL, 0);
+    return timeline->bucket_size;
+}
+
+guint stream_timeline_get_bucket_count(StreamTimeline *timeline)
+{
+    g_return_val_if_fail(timeline != NULL, 0);
+
+    g_mutex_lock(&timeline->lock);
+    guint count = timeline->bucket_count;
+    g_mutex_unlock(&timeline->lock);
+
+    return count;
+}
+
+gboolean stream_timeline_get_counts(StreamTimeline *timeline,
+                                    guint bucket,
+                                    guint16 pid,
+                                    StreamTimelineCounts *counts)
+{
+    g_return_val_if_fail(timeline != NULL, FALSE);
+    g_return_val_if_fail(counts != NULL, FALSE);
+    g_return_val_if_fail(pid < STREAM_TIMELINE_PIDS || pid == STREAM_TIMELINE_ALL_PIDS, FALSE);
+
+    guint first = pid == STREAM_TIMELINE_ALL_PIDS ? 0 : pid;
+    guint last = pid == STREAM_TIMELINE_ALL_PIDS ? STREAM_TIMELINE_PIDS - 1 : pid;
+    guint j;
+
+    memset(counts, 0, sizeof(StreamTimelineCounts));
+
+    g_mutex_lock(&timeline->lock);
+    gboolean found = bucket < timeline->bucket_count;
+    for (j = first; found && j <= last; ++j) {
+        if (!timeline->pids[j] || bucket >= timeline->pids[j]->len)
+            continue;
+        counts->packets += g_array_index(timeline->pids[j], StreamTimelineCounts, bucket).packets;
+        counts->units += g_array_index(timeline->pids[j], StreamTimelineCounts, bucket).units;
+    }
+    g_mutex_unlock(&timeline->lock);
+
+    return found;
+}
+
+guint32 stream_timeline_get_iframes(StreamTimeline *timeline, guint bucket)
+{
+    g_return_val_if_fail(timeline != NULL, 0);
+
+    g_mutex_lock(&timeline->lock);
+    guint32 iframes = bucket < timeline->iframes->len
+        ? g_array_index(timeline->iframes, guint32, bucket)
+        : 0;
+    g_mutex_unlock(&timeline->lock);
+
+    return iframes;
+}
+
+guint16 *stream_timeline_get_pids(StreamTimeline *timeline, guint *count)
+{
+    g_return_val_if_fail(timeline != NULL, NULL);
+
+    guint16 *pids = g_new(guint16, STREAM_TIMELINE_PIDS);
+    guint n = 0;
+    guint pid;
+
+    g_mutex_lock(&timeline->lock);
+    for (pid = 0; pid < STREAM_TIMELINE_PIDS; ++pid) {
+        if (timeline->pids[pid])
+            pids[n++] = pid;
+    }
+    g_mutex_unlock(&timeline->lock);
+
+    if (count)
+        *count = n;
+    return g_renew(guint16, pids, MAX(n, 1));
+}
+
+guint8 *stream_timeline_save(StreamTimeline *timeline, gsize *size)
+{
+    g_return_val_if_fail(timeline != NULL, NULL);
+    g_return_val_if_fail(size != NULL, NULL);
+
+    StreamTimelineHeader header = { .bucket_size = timeline->bucket_size };
+    guint32 pid;
+    guint8 *data, *p;
+
+    g_mutex_lock(&timeline->lock);
+    header.bucket_count = timeline->bucket_count;
+    for (pid = 0; pid < STREAM_TIMELINE_PIDS; ++pid) {
+        if (timeline->pids[pid])
+            ++header.pid_count;
+    }
+
+    gsize pid_size = sizeof(guint32) + (gsize)header.bucket_count * sizeof(StreamTimelineCounts);
+    *size = sizeof(StreamTimelineHeader) + (gsize)header.bucket_count * sizeof(guint32) +
+            header.pid_count * pid_size;
+    /* Zeroed, so that the buckets missing at the end of a pid are 0. */
+    p = data = g_malloc0(*size);
+
+    memcpy(p, &header, sizeof(StreamTimelineHeader));
+    p += sizeof(StreamTimelineHeader);
+    memcpy(p, timeline->iframes->data, MIN(timeline->iframes->len, header.bucket_count) * sizeof(guint32));
+    p += header.bucket_count * sizeof(guint32);
+
+    for (pid = 0; pid < STREAM_TIMELINE_PIDS; ++pid) {
+        if (!timeline->pids[pid])
+            continue;
+        memcpy(p, &pid, sizeof(guint32));
+        memcpy(p + sizeof(guint32), timeline->pids[pid]->data,
+               MIN(timeline->pids[pid]->len, header.bucket_count) * sizeof(StreamTimelineCounts));
+        p += pid_size;
+    }
+    g_mutex_unlock(&timeline->lock);
+
+    return data;
+}
+
+gboolean stream_timeline_load(StreamTimeline *timeline, const guint8 *data, gsize size)
+{
+    g_return_val_if_fail(timeline != NULL, FALSE);
+
+    StreamTimelineHeader header;
+    guint32 pid;
+    guint j;
+    gboolean valid = FALSE;
+
+    g_mutex_lock(&timeline->lock);
+    stream_timeline_clear_unlocked(timeline);
+
+    if (!data || size < sizeof(StreamTimelineHeader))
+        goto out;
+    memcpy(&header, data, sizeof(StreamTimelineHeader));
+    if (header.bucket_size != timeline->bucket_size || header.pid_count > STREAM_TIMELINE_PIDS)
+        goto out;
+
+    gsize pid_size = sizeof(guint32) + (gsize)header.bucket_count * sizeof(StreamTimelineCounts);
+    if (size != sizeof(StreamTimelineHeader) + (gsize)header.bucket_count * sizeof(guint32) +
+            header.pid_count * pid_size)
+        goto out;
+
+    data += sizeof(StreamTimelineHeader);
+    g_array_set_size(timeline->iframes, header.bucket_count);
+    memcpy(timeline->iframes->data, data, header.bucket_count * sizeof(guint32));
+    data += header.bucket_count * sizeof(guint32);
+
+    for (j = 0; j < header.pid_count; ++j, data += pid_size) {
+        memcpy(&pid, data, sizeof(guint32));
+        if (pid >= STREAM_TIMELINE_PIDS || timeline->pids[pid]) {
+            stream_timeline_clear_unlocked(timeline);
+            goto out;
+        }
+        timeline->pids[pid] = g_array_sized_new(FALSE, TRUE, sizeof(StreamTimelineCounts),
+                                                header.bucket_count);
+        g_array_append_vals(timeline->pids[pid], data + sizeof(guint32), header.bucket_count);
+    }
+    timeline->bucket_count = header.bucket_count;
+    valid = TRUE;
+
+out:
+    g_mutex_unlock(&timeline->lock);
+    return valid;
+}
+
+StreamTimelineWriter *stream_timeline_writer_new(StreamTimeline *timeline)
+{
+    g_return_val_if_fail(timeline != NULL, NULL);
+
+    StreamTimelineWriter *writer = g_new0(StreamTimelineWriter, 1);
+    writer->timeline = timeline;
+    return writer;
+}
+
+void stream_timeline_writer_free(StreamTimelineWriter *writer)
+{
+    if (writer) {
+        stream_timeline_writer_flush(writer);
+        g_free(writer);
+    }
+}
+
+void stream_timeline_writer_reset(StreamTimelineWriter *writer)
+{
+    g_return_if_fail(writer != NULL);
+
+    guint j;
+    for (j = 0; j < writer->pid_count; ++j)
+        memset(&writer->counts[writer->pids[j]], 0, sizeof(StreamTimelineCounts));
+    writer->pid_count = 0;
+    writer->iframes = 0;
+    writer->active = FALSE;
+}
+
+void stream_timeline_writer_flush(StreamTimelineWriter *writer)
+{
+    g_return_if_fail(writer != NULL);
+
+    if (!writer->active)
+        return;
+
+    StreamTimeline *timeline = writer->timeline;
+    StreamTimelineCounts *counts;
+    guint16 pid;
+    guint j;
+
+    g_mutex_lock(&timeline->lock);
+    if (timeline->iframes->len <= writer->bucket)
+        g_array_set_size(timeline->iframes, writer->bucket + 1);
+    g_array_index(timeline->iframes, guint32, writer->bucket) += writer->iframes;
+
+    for (j = 0; j < writer->pid_count; ++j) {
+        pid = writer->pids[j];
+        if (!timeline->pids[pid])
+            timeline->pids[pid] = g_array_new(FALSE, TRUE, sizeof(StreamTimelineCounts));
+        if (timeline->pids[pid]->len <= writer->bucket)
+            g_array_set_size(timeline->pids[pid], writer->bucket + 1);
+        counts = &g_array_index(timeline->pids[pid], StreamTimelineCounts, writer->bucket);
+        counts->packets += writer->counts[pid].packets;
+        counts->units += writer->counts[pid].units;
+    }
+    timeline->bucket_count = MAX(timeline->bucket_count, writer->bucket + 1);
+    g_mutex_unlock(&timeline->lock);
+
+    stream_timeline_writer_reset(writer);
+}
+
+/* Switch to the bucket of offset, flushing the last one. */
+static inline void stream_timeline_writer_seek(StreamTimelineWriter *writer, gsize offset)
+{
+    guint bucket = offset / writer->timeline->bucket_size;
+    if (writer->active && bucket == writer->bucket)
+        return;
+    stream_timeline_writer_flush(writer);
+    writer->bucket = bucket;
+    writer->active = TRUE;
+}
+
+void stream_timeline_writer_add_packet(StreamTimelineWriter *writer,
+                                       gsize offset,
+                                       guint16 pid,
+                                       gboolean unit_start)
+{
+    stream_timeline_writer_seek(writer, offset);
+
+    pid &= STREAM_TIMELINE_PIDS - 1;
+    if (writer->counts[pid].packets == 0)
+        writer->pids[writer->pid_count++] = pid;
+    ++writer->counts[pid].packets;
+    if (unit_start)
+        ++writer->counts[pid].units;
+}
+
+void stream_timeline_writer_add_iframe(StreamTimelineWriter *writer, gsize offset)
+{
+    stream_timeline_writer_seek(writer, offset);
+    ++writer->iframes;
+}
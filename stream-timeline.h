@@ -0,0 +1,103 @@
+#pragma once
+
+#include <glib.h>
+
+/** @brief Number of pids in a transport stream. */
+#define STREAM_TIMELINE_PIDS (8192)
+/** @brief Pass to stream_timeline_get_counts() for the sum over all pids. */
+#define STREAM_TIMELINE_ALL_PIDS (0xffff)
+
+/** @brief What was seen of a pid in a bucket. */
+typedef struct {
+    guint32 packets;
+    guint32 units; /**< Packets with the unit start indicator, i.e., PES or sections started. */
+} StreamTimelineCounts;
+
+/** @brief Downsampled statistics of a stream, in buckets of a fixed number of bytes.
+ *  For every bucket, the packets and units of each pid and the I frames of the video starting
+ *  in it are counted. Counts are added by writers, of which there may be several at a time.
+ */
+typedef struct _StreamTimeline StreamTimeline;
+
+/** @brief Collects the counts of one bucket before they are added to the timeline, so that
+ *  the timeline is only locked once per bucket. A writer is used by one thread only.
+ */
+typedef struct _StreamTimelineWriter StreamTimelineWriter;
+
+/** @brief Create a new, empty timeline.
+ *  @param[in] bucket_size Size of a bucket in bytes.
+ */
+StreamTimeline *stream_timeline_new(gsize bucket_size);
+
+/** @brief Free the timeline. There must be no writers left.
+ */
+void stream_timeline_free(StreamTimeline *timeline);
+
+/** @brief Remove all counts. Writers have to be reset as well.
+ */
+void stream_timeline_clear(StreamTimeline *timeline);
+
+/** @brief Get the size of a bucket in bytes.
+ */
+gsize stream_timeline_get_bucket_size(StreamTimeline *timeline);
+
+/** @brief Get the number of buckets, i.e., the last bucket with counts plus one.
+ */
+guint stream_timeline_get_bucket_count(StreamTimeline *timeline);
+
+/** @brief Get the counts of a pid in a bucket.
+ *  @param[in] pid The pid or STREAM_TIMELINE_ALL_PIDS.
+ *  @return FALSE if there is no such bucket.
+ */
+gboolean stream_timeline_get_counts(StreamTimeline *timeline,
+                                    guint bucket,
+                                    guint16 pid,
+                                    StreamTimelineCounts *counts);
+
+/** @brief Get the number of I frames starting in a bucket.
+ */
+guint32 stream_timeline_get_iframes(StreamTimeline *timeline, guint bucket);
+
+/** @brief Get the pids seen so far in ascending order.
+ *  @return Newly allocated array, free with g_free().
+ */
+guint16 *stream_timeline_get_pids(StreamTimeline *timeline, guint *count);
+
+/** @brief Serialize the timeline, e.g., for a cache. The format is only valid on the same host.
+ *  @return Newly allocated data, free with g_free().
+ */
+guint8 *stream_timeline_save(StreamTimeline *timeline, gsize *size);
+
+/** @brief Replace the timeline with data from stream_timeline_save().
+ *  @return FALSE if the data is invalid, the timeline is empty then.
+ */
+gboolean stream_timeline_load(StreamTimeline *timeline, const guint8 *data, gsize size);
+
+/** @brief Create a writer adding to the timeline.
+ */
+StreamTimelineWriter *stream_timeline_writer_new(StreamTimeline *timeline);
+
+/** @brief Flush and free the writer.
+ */
+void stream_timeline_writer_free(StreamTimelineWriter *writer);
+
+/** @brief Discard the counts not flushed yet.
+ */
+void stream_timeline_writer_reset(StreamTimelineWriter *writer);
+
+/** @brief Add the counts collected so far to the timeline.
+ */
+void stream_timeline_writer_flush(StreamTimelineWriter *writer);
+
+/** @brief Count a packet.
+ *  @param[in] offset Offset of the packet in the stream.
+ */
+void stream_timeline_writer_add_packet(StreamTimelineWriter *writer,
+                                       gsize offset,
+                                       guint16 pid,
+                                       gboolean unit_start);
+
+/** @brief Count an I frame.
+ *  @param[in] offset Offset of the first packet of the frame.
+ */
+void stream_timeline_writer_add_iframe(StreamTimelineWriter *writer, gsize offset);
@@ -0,0 +1,149 @@
+/* Check the delta and varint encoding of the frame index against the frames stored. Built and
+ * run by make check. */
+#include "frame-index.c"
+
+#define TEST_FRAME_COUNT (1000)
+
+/* Deltas of every sign and size, including the wrap of 64 bits. */
+static void test_delta(void)
+{
+    static const guint64 values[] = {
+        0, 1, 2, 63, 64, 127, 128, 0x7fff, 0x1ffffffffULL, G_MAXINT64,
+        (guint64)G_MAXINT64 + 1, G_MAXUINT64 - 1, PES_FRAME_TS_INVALID
+    };
+    guint8 buffer[16];
+    const guint8 *end;
+    guint8 *p;
+    guint64 value;
+    guint j, k;
+
+    for (j = 0; j < G_N_ELEMENTS(values); ++j) {
+        for (k = 0; k < G_N_ELEMENTS(values); ++k) {
+            p = frame_index_put_delta(buffer, values[j], values[k]);
+            g_assert_cmpint(p - buffer, <=, 10);
+            end = frame_index_get_delta(buffer, &value, values[k]);
+            g_assert_true(end == p);
+            g_assert_cmpuint(value, ==, values[j]);
+        }
+    }
+
+    /* Small deltas of either sign take one byte. */
+    g_assert_true(frame_index_put_delta(buffer, 100, 140) == buffer + 1);
+    g_assert_true(frame_index_put_delta(buffer, 140, 100) == buffer + 1);
+}
+
+static void test_make_frame(guint32 j, PESFrameInfo *fi)
+{
+    memset(fi, 0, sizeof(PESFrameInfo));
+    fi->pts = j % 97 == 5 ? PES_FRAME_TS_INVALID : ((guint64)j * 3600 + (1ULL << 33) - 360000) & ((1ULL << 33) - 1);
+    fi->dts = j % 3 ? fi->pts - 3600 : PES_FRAME_TS_INVALID;
+    /* Not monotonic, e.g., after a PCR discontinuity. */
+    fi->pcr = j % 50 == 49 ? 27000 : (guint64)j * 27000000 / 25;
+    fi->stream_offset_start = (gsize)j * 188 * 1000 + (j % 7) * 188;
+    fi->stream_offset_end = fi->stream_offset_start + 188 * (1 + j % 400);
+    fi->stream_offset_dangling_bframe = j % 4 ? fi->stream_offset_end + 188 * (j % 13) : fi->stream_offset_start;
+    fi->pidtype = j % 2 ? PID_TYPE_VIDEO_13818 : PID_TYPE_VIDEO_14496;
+    fi->pid = j < TEST_FRAME_COUNT / 2 ? 0x100 : 0x1FFE;
+}
+
+static void test_check_frame(guint32 j, const PESFrameInfo *fi)
+{
+    PESFrameInfo expected;
+    test_make_frame(j, &expected);
+    g_assert_cmpuint(fi->frame_number, ==, j);
+    g_assert_cmpuint(fi->pts, ==, expected.pts);
+    g_assert_cmpuint(fi->dts, ==, expected.dts);
+    g_assert_cmpuint(fi->pcr, ==, expected.pcr);
+    g_assert_cmpuint(fi->stream_offset_start, ==, expected.stream_offset_start);
+    g_assert_cmpuint(fi->stream_offset_end, ==, expected.stream_offset_end);
+    g_assert_cmpuint(fi->stream_offset_dangling_bframe, ==, expected.stream_offset_dangling_bframe);
+    g_assert_cmpint(fi->pidtype, ==, expected.pidtype);
+    g_assert_cmpuint(fi->pid, ==, expected.pid);
+}
+
+typedef struct {
+    guint32 next;
+    guint32 stop;
+} TestForeach;
+
+static gboolean _test_foreach_cb(const PESFrameInfo *fi, TestForeach *state)
+{
+    test_check_frame(state->next, fi);
+    ++state->next;
+    return state->next < state->stop;
+}
+
+static void test_check_index(FrameIndex *index, guint32 count)
+{
+    PESFrameInfo fi;
+    TestForeach state;
+    guint32 j;
+
+    g_assert_cmpuint(frame_index_get_count(index), ==, count);
+    for (j = 0; j < count; ++j) {
+        g_assert_true(frame_index_get(index, j, &fi));
+        test_check_frame(j, &fi);
+    }
+    g_assert_false(frame_index_get(index, count, &fi));
+
+    /* Starting inside a block, across sealed blocks into the staging block. */
+    state = (TestForeach){ 33, G_MAXUINT32 };
+    frame_index_foreach(index, 33, G_MAXUINT32, (FrameIndexForeachFunc)_test_foreach_cb, &state);
+    g_assert_cmpuint(state.next, ==, count);
+
+    /* Stopped by the callback. */
+    state = (TestForeach){ 70, 200 };
+    frame_index_foreach(index, 70, count, (FrameIndexForeachFunc)_test_foreach_cb, &state);
+    g_assert_cmpuint(state.next, ==, 200);
+}
+
+static void test_append(void)
+{
+    FrameIndex *index = frame_index_new();
+    PESFrameInfo fi;
+    guint32 j;
+
+    for (j = 0; j < TEST_FRAME_COUNT; ++j) {
+        test_make_frame(j, &fi);
+        fi.frame_number = 12345;
+        g_assert_cmpuint(frame_index_append(index, &fi), ==, j);
+    }
+    /* The last block is only partly filled. */
+    g_assert_cmpuint(TEST_FRAME_COUNT % FRAME_INDEX_BLOCK_SIZE, !=, 0);
+    test_check_index(index, TEST_FRAME_COUNT);
+
+    frame_index_free(index);
+}
+
+static void test_append_vals(void)
+{
+    FrameIndex *index = frame_index_new();
+    PESFrameInfo *frames = g_new(PESFrameInfo, TEST_FRAME_COUNT);
+    guint32 j;
+
+    for (j = 0; j < TEST_FRAME_COUNT; ++j)
+        test_make_frame(j, &frames[j]);
+
+    /* Refilled after a clear, the old blocks are only retired. */
+    frame_index_append_vals(index, frames, 300);
+    frame_index_clear(index);
+    g_assert_cmpuint(frame_index_get_count(index), ==, 0);
+
+    frame_index_append_vals(index, frames, 100);
+    frame_index_append_vals(index, frames + 100, TEST_FRAME_COUNT - 100);
+    test_check_index(index, TEST_FRAME_COUNT);
+
+    g_free(frames);
+    frame_index_free(index);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/frame-index/delta", test_delta);
+    g_test_add_func("/frame-index/append", test_append);
+    g_test_add_func("/frame-index/append-vals", test_append_vals);
+
+    return g_test_run();
+}
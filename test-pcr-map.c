@@ -0,0 +1,141 @@
+/* Check the unwrapping and interpolation of the PCR seek table. Built and run by make check. */
+#include "pcr-map.c"
+
+/* Samples 40 ms and 1000 packets apart. */
+#define TEST_STEP (G_GUINT64_CONSTANT(27000000) / 25)
+#define TEST_PACKETS_PER_STEP (1000)
+
+static gsize test_offset(guint j)
+{
+    return (gsize)j * TEST_PACKETS_PER_STEP * 188;
+}
+
+/* Samples running over the 33 bit wrap twice stay monotonic. */
+static void test_wrap(void)
+{
+    PcrMap *map = pcr_map_new();
+    PcrMapEntry entry, prev;
+    guint64 start = PCR_MAP_WRAP - 10 * TEST_STEP;
+    guint count = 20, j;
+
+    for (j = 0; j < count; ++j)
+        g_assert_true(pcr_map_add(map, test_offset(j), (start + j * TEST_STEP) % PCR_MAP_WRAP));
+    g_assert_cmpuint(pcr_map_get_count(map), ==, count);
+    g_assert_cmpuint(pcr_map_get_duration(map), ==, (count - 1) * TEST_STEP);
+
+    g_assert_true(pcr_map_get(map, 0, &prev));
+    for (j = 1; j < count; ++j) {
+        g_assert_true(pcr_map_get(map, j, &entry));
+        g_assert_cmpuint(entry.pcr, ==, prev.pcr + TEST_STEP);
+        prev = entry;
+    }
+    g_assert_cmpuint(entry.pcr, >=, PCR_MAP_WRAP);
+    g_assert_false(pcr_map_get(map, count, &entry));
+
+    /* Second wrap, seen through large steps, each less than half the period. */
+    for (j = 0; j < 3; ++j) {
+        g_assert_true(pcr_map_add(map,
+                                  test_offset(count + j),
+                                  (entry.pcr + (j + 1) * (PCR_MAP_WRAP / 3)) % PCR_MAP_WRAP));
+    }
+    g_assert_true(pcr_map_get(map, count + 2, &entry));
+    g_assert_cmpuint(entry.pcr, ==, prev.pcr + PCR_MAP_WRAP);
+    g_assert_cmpuint(pcr_map_get_duration(map), ==, entry.pcr - start);
+
+    pcr_map_free(map);
+}
+
+/* Small jumps back are discontinuities, dropped like samples within the interval or at offsets
+ * not behind the last one. */
+static void test_drop(void)
+{
+    PcrMap *map = pcr_map_new();
+
+    pcr_map_set_interval(map, TEST_STEP);
+    g_assert_true(pcr_map_add(map, test_offset(0), 5 * TEST_STEP));
+    g_assert_false(pcr_map_add(map, test_offset(1), 4 * TEST_STEP));
+    g_assert_false(pcr_map_add(map, test_offset(1), 5 * TEST_STEP + TEST_STEP / 2));
+    g_assert_false(pcr_map_add(map, test_offset(0), 7 * TEST_STEP));
+    g_assert_true(pcr_map_add(map, test_offset(1), 6 * TEST_STEP));
+    g_assert_cmpuint(pcr_map_get_count(map), ==, 2);
+
+    pcr_map_clear(map);
+    g_assert_cmpuint(pcr_map_get_count(map), ==, 0);
+    g_assert_cmpuint(pcr_map_get_duration(map), ==, 0);
+    g_assert_true(pcr_map_add(map, test_offset(0), TEST_STEP));
+
+    pcr_map_free(map);
+}
+
+/* Lookups of times and offsets across a wrap. */
+static void test_interpolate(void)
+{
+    PcrMap *map = pcr_map_new();
+    guint64 start = PCR_MAP_WRAP - 2 * TEST_STEP;
+    PcrMapEntry entry;
+    guint64 time;
+    gsize offset;
+    guint j;
+
+    g_assert_false(pcr_map_lookup(map, 0, &entry));
+    g_assert_true(pcr_map_add(map, test_offset(0), start));
+    g_assert_false(pcr_map_time_to_offset(map, 0, &offset));
+    g_assert_false(pcr_map_offset_to_time(map, 0, &time));
+
+    for (j = 1; j < 5; ++j)
+        g_assert_true(pcr_map_add(map, test_offset(j), (start + j * TEST_STEP) % PCR_MAP_WRAP));
+
+    /* Half way between the samples around the wrap. */
+    g_assert_true(pcr_map_time_to_offset(map, 2 * TEST_STEP + TEST_STEP / 2, &offset));
+    g_assert_cmpuint(offset, ==, test_offset(2) + test_offset(1) / 2);
+    g_assert_true(pcr_map_offset_to_time(map, test_offset(2) + test_offset(1) / 2, &time));
+    g_assert_cmpuint(time, ==, 2 * TEST_STEP + TEST_STEP / 2);
+
+    g_assert_true(pcr_map_lookup(map, 3 * TEST_STEP - 1, &entry));
+    g_assert_cmpuint(entry.offset, ==, test_offset(2));
+    g_assert_true(pcr_map_lookup(map, 3 * TEST_STEP, &entry));
+    g_assert_cmpuint(entry.offset, ==, test_offset(3));
+
+    /* Clamped to the first and last sample. */
+    g_assert_true(pcr_map_time_to_offset(map, 100 * TEST_STEP, &offset));
+    g_assert_cmpuint(offset, ==, test_offset(4));
+    g_assert_true(pcr_map_offset_to_time(map, test_offset(100), &time));
+    g_assert_cmpuint(time, ==, 4 * TEST_STEP);
+    g_assert_true(pcr_map_offset_to_time(map, 0, &time));
+    g_assert_cmpuint(time, ==, 0);
+
+    pcr_map_free(map);
+}
+
+/* A map restored from a cache continues behind its last wrap. */
+static void test_append_vals(void)
+{
+    PcrMap *map = pcr_map_new();
+    PcrMapEntry entries[3];
+    PcrMapEntry entry;
+    guint j;
+
+    for (j = 0; j < 3; ++j) {
+        entries[j].offset = test_offset(j);
+        entries[j].pcr = PCR_MAP_WRAP - TEST_STEP + j * TEST_STEP;
+    }
+    pcr_map_append_vals(map, entries, 3);
+
+    g_assert_true(pcr_map_add(map, test_offset(3), 2 * TEST_STEP));
+    g_assert_true(pcr_map_get(map, 3, &entry));
+    g_assert_cmpuint(entry.pcr, ==, PCR_MAP_WRAP + 2 * TEST_STEP);
+
+    pcr_map_free(map);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/pcr-map/wrap", test_wrap);
+    g_test_add_func("/pcr-map/drop", test_drop);
+    g_test_add_func("/pcr-map/interpolate", test_interpolate);
+    g_test_add_func("/pcr-map/append-vals", test_append_vals);
+
+    return g_test_run();
+}
@@ -0,0 +1,165 @@
+/* Check the size classes, reuse and reset of the PES arena. Built and run by make check. */
+#include "pes-arena.c"
+
+/* Sizes are rounded up to their class, memory stays aligned. */
+static void test_classes(void)
+{
+    PesArena *arena = pes_arena_new();
+    static const gsize sizes[] = { 0, 1, 127, 128, 129, 4096, 4097, 188 * 1000 };
+    static const gsize capacities[] = { 128, 128, 128, 128, 256, 4096, 8192, 262144 };
+    gsize total = 0;
+    gpointer mem;
+    guint j;
+
+    for (j = 0; j < G_N_ELEMENTS(sizes); ++j) {
+        mem = pes_arena_alloc(arena, sizes[j]);
+        g_assert_nonnull(mem);
+        g_assert_cmpuint((guintptr)mem % 16, ==, 0);
+        g_assert_cmpuint(pes_arena_get_capacity(mem), ==, capacities[j]);
+        memset(mem, 0xA5, pes_arena_get_capacity(mem));
+        total += capacities[j];
+    }
+    g_assert_cmpuint(pes_arena_get_size(arena), ==, total);
+
+    pes_arena_free(arena);
+}
+
+/* A released chunk is handed out again for its class, only for its class. */
+static void test_reuse(void)
+{
+    PesArena *arena = pes_arena_new();
+    guint8 *a = pes_arena_alloc(arena, 1000);
+    guint8 *b = pes_arena_alloc(arena, 1000);
+    guint8 *c;
+    gsize size = pes_arena_get_size(arena);
+
+    pes_arena_release(arena, a);
+    pes_arena_release(arena, NULL);
+    c = pes_arena_alloc(arena, 2000);
+    g_assert_true(c != a);
+    g_assert_true(pes_arena_alloc(arena, 600) == a);
+    g_assert_cmpuint(pes_arena_get_size(arena), ==, size + 2048);
+
+    /* Zeroed even when reused. */
+    memset(b, 0xFF, 1024);
+    pes_arena_release(arena, b);
+    b = pes_arena_alloc0(arena, 1024);
+    g_assert_cmpuint(b[0], ==, 0);
+    g_assert_cmpuint(b[1023], ==, 0);
+
+    pes_arena_free(arena);
+}
+
+/* Growing keeps the contents and releases the old chunk. */
+static void test_realloc(void)
+{
+    PesArena *arena = pes_arena_new();
+    guint8 *mem = pes_arena_realloc(arena, NULL, 100);
+    guint8 *grown;
+    guint j;
+
+    for (j = 0; j < 128; ++j)
+        mem[j] = j;
+
+    g_assert_true(pes_arena_realloc(arena, mem, 128) == mem);
+    grown = pes_arena_realloc(arena, mem, 129);
+    g_assert_true(grown != mem);
+    g_assert_cmpuint(pes_arena_get_capacity(grown), ==, 256);
+    for (j = 0; j < 128; ++j)
+        g_assert_cmpuint(grown[j], ==, j);
+
+    g_assert_true(pes_arena_alloc(arena, 1) == mem);
+
+    pes_arena_free(arena);
+}
+
+/* A reset releases everything, and keeps free chunks up to the limit. */
+static void test_reset(void)
+{
+    PesArena *arena = pes_arena_new();
+    gpointer mem[8];
+    guint j;
+
+    for (j = 0; j < G_N_ELEMENTS(mem); ++j)
+        mem[j] = pes_arena_alloc(arena, 4096);
+    g_assert_cmpuint(pes_arena_get_size(arena), ==, 8 * 4096);
+
+    pes_arena_reset(arena, 3 * 4096);
+    g_assert_cmpuint(pes_arena_get_size(arena), ==, 3 * 4096);
+
+    /* The kept chunks are reused without growing the arena. */
+    for (j = 0; j < 3; ++j)
+        g_assert_nonnull(pes_arena_alloc(arena, 4000));
+    g_assert_cmpuint(pes_arena_get_size(arena), ==, 3 * 4096);
+    g_assert_nonnull(pes_arena_alloc(arena, 4000));
+    g_assert_cmpuint(pes_arena_get_size(arena), ==, 4 * 4096);
+
+    pes_arena_reset(arena, 0);
+    g_assert_cmpuint(pes_arena_get_size(arena), ==, 0);
+
+    pes_arena_free(arena);
+}
+
+typedef struct {
+    PesArena *arena;
+    guint seed;
+} TestWorker;
+
+static gpointer test_worker_thread(TestWorker *worker)
+{
+    GRand *rand = g_rand_new_with_seed(worker->seed);
+    guint8 *held[16] = { NULL };
+    gsize size;
+    guint j, k;
+
+    for (j = 0; j < 20000; ++j) {
+        k = g_rand_int_range(rand, 0, G_N_ELEMENTS(held));
+        if (held[k]) {
+            /* Nobody else wrote to the chunk while it was held. */
+            g_assert_cmpuint(held[k][0], ==, (guint8)worker->seed);
+            pes_arena_release(worker->arena, held[k]);
+            held[k] = NULL;
+        }
+        else {
+            size = g_rand_int_range(rand, 1, 20000);
+            held[k] = pes_arena_alloc(worker->arena, size);
+            memset(held[k], (guint8)worker->seed, size);
+        }
+    }
+    for (k = 0; k < G_N_ELEMENTS(held); ++k)
+        pes_arena_release(worker->arena, held[k]);
+
+    g_rand_free(rand);
+    return NULL;
+}
+
+/* Threads allocating and releasing concurrently never share a chunk. */
+static void test_threads(void)
+{
+    PesArena *arena = pes_arena_new();
+    TestWorker workers[4];
+    GThread *threads[4];
+    guint j;
+
+    for (j = 0; j < G_N_ELEMENTS(workers); ++j) {
+        workers[j] = (TestWorker){ arena, j + 1 };
+        threads[j] = g_thread_new("test-worker", (GThreadFunc)test_worker_thread, &workers[j]);
+    }
+    for (j = 0; j < G_N_ELEMENTS(workers); ++j)
+        g_thread_join(threads[j]);
+
+    pes_arena_free(arena);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/pes-arena/classes", test_classes);
+    g_test_add_func("/pes-arena/reuse", test_reuse);
+    g_test_add_func("/pes-arena/realloc", test_realloc);
+    g_test_add_func("/pes-arena/reset", test_reset);
+    g_test_add_func("/pes-arena/threads", test_threads);
+
+    return g_test_run();
+}
@@ -0,0 +1,327 @@
+/* Check the decoding of SCTE-35 splices, in particular the component loop of splice_insert, and
+ * the dropping of repetitions. Built and run by make check. The sections are built by hand here,
+ * independent of biTStream. */
+#include "signal-index.c"
+
+#define TEST_SCTE35_PID (0x1f0)
+#define TEST_PTS_WRAP (G_GUINT64_CONSTANT(1) << 33)
+
+typedef struct {
+    guint8 data[TS_SIZE * 4];
+    gsize length;
+    guint8 cc;
+} TestPackets;
+
+/* CRC-32/MPEG-2 */
+static guint32 test_crc32(const guint8 *data, gsize length)
+{
+    guint32 crc = 0xffffffff;
+    gsize j;
+    guint k;
+    for (j = 0; j < length; ++j) {
+        crc ^= (guint32)data[j] << 24;
+        for (k = 0; k < 8; ++k)
+            crc = crc & 0x80000000 ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+    return crc;
+}
+
+static guint8 *test_put_time(guint8 *p, guint64 pts)
+{
+    *p++ = 0xfe | (pts >> 32);
+    *p++ = pts >> 24;
+    *p++ = pts >> 16;
+    *p++ = pts >> 8;
+    *p++ = pts;
+    return p;
+}
+
+/* A splice_info_section around a command. Without the descriptor loop the command ends right
+ * before the CRC, so that a truncated command cannot read into the loop. */
+static gsize test_scte35_section(guint8 *section,
+                                 guint64 pts_adjustment,
+                                 gboolean encrypted,
+                                 guint8 command_type,
+                                 const guint8 *command,
+                                 gsize command_length,
+                                 gboolean descriptor_loop)
+{
+    gsize n = 0;
+    guint32 crc;
+
+    section[n++] = SIGNAL_TABLE_SCTE35;
+    n += 2;
+    section[n++] = 0x00; /* protocol_version */
+    section[n++] = (encrypted ? 0x80 : 0x00) | (pts_adjustment >> 32);
+    section[n++] = pts_adjustment >> 24;
+    section[n++] = pts_adjustment >> 16;
+    section[n++] = pts_adjustment >> 8;
+    section[n++] = pts_adjustment;
+    section[n++] = 0x00; /* cw_index */
+    section[n++] = 0xff; /* tier */
+    section[n++] = 0xf0 | (command_length >> 8);
+    section[n++] = command_length;
+    section[n++] = command_type;
+    memcpy(section + n, command, command_length);
+    n += command_length;
+    if (descriptor_loop) {
+        section[n++] = 0x00;
+        section[n++] = 0x00;
+    }
+
+    section[1] = 0x30 | ((n + 4 - 3) >> 8);
+    section[2] = (n + 4 - 3) & 0xff;
+    crc = test_crc32(section, n);
+    section[n++] = crc >> 24;
+    section[n++] = crc >> 16;
+    section[n++] = crc >> 8;
+    section[n++] = crc;
+    return n;
+}
+
+/* A section in as many packets as needed, the rest is stuffed. */
+static void test_packets_add_section(TestPackets *packets, guint16 pid, const guint8 *section, gsize length)
+{
+    guint8 *packet;
+    gsize take;
+    gboolean first = TRUE;
+
+    while (first || length > 0) {
+        g_assert_cmpuint(packets->length + TS_SIZE, <=, sizeof(packets->data));
+        packet = packets->data + packets->length;
+        packets->length += TS_SIZE;
+        memset(packet, 0xff, TS_SIZE);
+        packet[0] = 0x47;
+        packet[1] = (first ? 0x40 : 0x00) | (pid >> 8);
+        packet[2] = pid & 0xff;
+        packet[3] = 0x10 | (packets->cc++ & 0x0f);
+        if (first)
+            packet[4] = 0x00; /* pointer_field */
+        take = MIN(length, TS_SIZE - (first ? 5 : 4));
+        memcpy(packet + (first ? 5 : 4), section, take);
+        section += take;
+        length -= take;
+        first = FALSE;
+    }
+}
+
+/* Push a section through a parser and get the markers added. */
+static guint test_parse(SignalIndex *index, const guint8 *section, gsize length, gsize offset)
+{
+    static guint8 cc = 0;
+    SignalParser *parser = signal_parser_new(index);
+    TestPackets packets = { .length = 0, .cc = cc };
+    guint before = signal_index_get_marker_count(index);
+    gsize j;
+
+    test_packets_add_section(&packets, TEST_SCTE35_PID, section, length);
+    for (j = 0; j < packets.length; j += TS_SIZE)
+        signal_parser_push_packet(parser, packets.data + j, offset + j);
+    cc = packets.cc;
+    signal_parser_free(parser);
+
+    return signal_index_get_marker_count(index) - before;
+}
+
+/* splice_insert header: event id, not cancelled, flags. */
+static guint8 *test_put_insert(guint8 *p, guint32 id, guint8 flags)
+{
+    *p++ = id >> 24;
+    *p++ = id >> 16;
+    *p++ = id >> 8;
+    *p++ = id;
+    *p++ = 0x7f;
+    *p++ = flags | 0x0f;
+    return p;
+}
+
+/* The time of the first component is taken, in a section spanning two packets. */
+static void test_components(void)
+{
+    SignalIndex *index = signal_index_new();
+    guint8 command[512], section[1024];
+    SignalMarker marker;
+    guint8 *p;
+    gsize length;
+    guint j;
+
+    p = test_put_insert(command, 1234, 0x80 | 0x20); /* out of network, with duration */
+    *p++ = 40;
+    for (j = 0; j < 40; ++j) {
+        *p++ = j; /* component_tag */
+        p = test_put_time(p, TEST_PTS_WRAP - 900 + j * 3000);
+    }
+    p = test_put_time(p, 30 * 90000); /* break_duration with auto_return */
+    length = test_scte35_section(section, 1800, FALSE, SIGNAL_SCTE35_SPLICE_INSERT, command, p - command, TRUE);
+    g_assert_cmpuint(length, >, TS_SIZE);
+
+    g_assert_cmpuint(test_parse(index, section, length, 10 * TS_SIZE), ==, 1);
+    g_assert_true(signal_index_get_marker(index, 0, &marker));
+    g_assert_cmpint(marker.type, ==, SignalMarkerSpliceOut);
+    g_assert_cmpuint(marker.pid, ==, TEST_SCTE35_PID);
+    g_assert_cmpuint(marker.id, ==, 1234);
+    /* The adjustment wraps around 33 bits. */
+    g_assert_cmpuint(marker.pts, ==, 900);
+    g_assert_cmpuint(marker.duration, ==, 30 * 90000);
+    /* Offset of the packet completing the section. */
+    g_assert_cmpuint(marker.offset, ==, 11 * TS_SIZE);
+
+    /* Repeated: dropped. */
+    g_assert_cmpuint(test_parse(index, section, length, 20 * TS_SIZE), ==, 0);
+
+    /* Immediate components carry only their tags. */
+    p = test_put_insert(command, 1235, 0x10);
+    *p++ = 3;
+    *p++ = 1;
+    *p++ = 2;
+    *p++ = 3;
+    length = test_scte35_section(section, 0, FALSE, SIGNAL_SCTE35_SPLICE_INSERT, command, p - command, TRUE);
+    g_assert_cmpuint(test_parse(index, section, length, 30 * TS_SIZE), ==, 1);
+    g_assert_true(signal_index_get_marker(index, 1, &marker));
+    g_assert_cmpint(marker.type, ==, SignalMarkerSpliceIn);
+    g_assert_cmpuint(marker.id, ==, 1235);
+    g_assert_cmpuint(marker.pts, ==, SIGNAL_PTS_INVALID);
+    g_assert_cmpuint(marker.duration, ==, 0);
+
+    /* No components at all. */
+    p = test_put_insert(command, 1236, 0x00);
+    *p++ = 0;
+    length = test_scte35_section(section, 0, FALSE, SIGNAL_SCTE35_SPLICE_INSERT, command, p - command, TRUE);
+    g_assert_cmpuint(test_parse(index, section, length, 40 * TS_SIZE), ==, 1);
+    g_assert_true(signal_index_get_marker(index, 2, &marker));
+    g_assert_cmpuint(marker.pts, ==, SIGNAL_PTS_INVALID);
+
+    signal_index_free(index);
+}
+
+/* Component loops and times cut off by the end of the section add nothing. */
+static void test_components_truncated(void)
+{
+    SignalIndex *index = signal_index_new();
+    guint8 command[64], section[256];
+    guint8 *p;
+    gsize length;
+
+    /* Three components announced, two present. */
+    p = test_put_insert(command, 1, 0x80);
+    *p++ = 3;
+    *p++ = 1;
+    p = test_put_time(p, 1000);
+    *p++ = 2;
+    p = test_put_time(p, 2000);
+    length = test_scte35_section(section, 0, FALSE, SIGNAL_SCTE35_SPLICE_INSERT, command, p - command, FALSE);
+    g_assert_cmpuint(test_parse(index, section, length, 0), ==, 0);
+
+    /* The time of the last component is cut. */
+    p = test_put_insert(command, 2, 0x80);
+    *p++ = 2;
+    *p++ = 1;
+    p = test_put_time(p, 1000);
+    *p++ = 2;
+    p = test_put_time(p, 2000) - 2;
+    length = test_scte35_section(section, 0, FALSE, SIGNAL_SCTE35_SPLICE_INSERT, command, p - command, FALSE);
+    g_assert_cmpuint(test_parse(index, section, length, 0), ==, 0);
+
+    /* The tag of an immediate component is missing. */
+    p = test_put_insert(command, 3, 0x90);
+    *p++ = 2;
+    *p++ = 1;
+    length = test_scte35_section(section, 0, FALSE, SIGNAL_SCTE35_SPLICE_INSERT, command, p - command, FALSE);
+    g_assert_cmpuint(test_parse(index, section, length, 0), ==, 0);
+
+    /* The component count is missing. */
+    p = test_put_insert(command, 4, 0x80);
+    length = test_scte35_section(section, 0, FALSE, SIGNAL_SCTE35_SPLICE_INSERT, command, p - command, FALSE);
+    g_assert_cmpuint(test_parse(index, section, length, 0), ==, 0);
+
+    /* The duration is cut. */
+    p = test_put_insert(command, 5, 0x80 | 0x20);
+    *p++ = 1;
+    *p++ = 1;
+    p = test_put_time(p, 1000);
+    p = test_put_time(p, 90000) - 1;
+    length = test_scte35_section(section, 0, FALSE, SIGNAL_SCTE35_SPLICE_INSERT, command, p - command, FALSE);
+    g_assert_cmpuint(test_parse(index, section, length, 0), ==, 0);
+
+    /* The same with the last component complete is fine. */
+    p = test_put_insert(command, 6, 0x80);
+    *p++ = 2;
+    *p++ = 1;
+    p = test_put_time(p, 1000);
+    *p++ = 2;
+    p = test_put_time(p, 2000);
+    length = test_scte35_section(section, 0, FALSE, SIGNAL_SCTE35_SPLICE_INSERT, command, p - command, FALSE);
+    g_assert_cmpuint(test_parse(index, section, length, 0), ==, 1);
+
+    signal_index_free(index);
+}
+
+/* Program splices, time signals, and what is skipped. */
+static void test_commands(void)
+{
+    SignalIndex *index = signal_index_new();
+    guint8 command[64], section[256];
+    SignalMarker marker;
+    guint8 *p;
+    gsize length;
+
+    p = test_put_insert(command, 7, 0x80 | 0x40);
+    p = test_put_time(p, 5000);
+    length = test_scte35_section(section, 100, FALSE, SIGNAL_SCTE35_SPLICE_INSERT, command, p - command, TRUE);
+    g_assert_cmpuint(test_parse(index, section, length, 0), ==, 1);
+    g_assert_true(signal_index_get_marker(index, 0, &marker));
+    g_assert_cmpint(marker.type, ==, SignalMarkerSpliceOut);
+    g_assert_cmpuint(marker.pts, ==, 5100);
+
+    /* Same id at another time is not a repetition. */
+    p = test_put_insert(command, 7, 0x80 | 0x40);
+    p = test_put_time(p, 6000);
+    length = test_scte35_section(section, 100, FALSE, SIGNAL_SCTE35_SPLICE_INSERT, command, p - command, TRUE);
+    g_assert_cmpuint(test_parse(index, section, length, 0), ==, 1);
+
+    p = test_put_time(command, 7000);
+    length = test_scte35_section(section, 0, FALSE, SIGNAL_SCTE35_TIME_SIGNAL, command, p - command, TRUE);
+    g_assert_cmpuint(test_parse(index, section, length, 0), ==, 1);
+    g_assert_true(signal_index_get_marker(index, 2, &marker));
+    g_assert_cmpint(marker.type, ==, SignalMarkerTimeSignal);
+    g_assert_cmpuint(marker.pts, ==, 7000);
+
+    /* Cancelled. */
+    p = test_put_insert(command, 8, 0x80 | 0x40);
+    command[4] = 0xff;
+    p = test_put_time(p, 5000);
+    length = test_scte35_section(section, 0, FALSE, SIGNAL_SCTE35_SPLICE_INSERT, command, p - command, TRUE);
+    g_assert_cmpuint(test_parse(index, section, length, 0), ==, 0);
+
+    /* Encrypted. */
+    p = test_put_insert(command, 9, 0x80 | 0x40);
+    p = test_put_time(p, 5000);
+    length = test_scte35_section(section, 0, TRUE, SIGNAL_SCTE35_SPLICE_INSERT, command, p - command, TRUE);
+    g_assert_cmpuint(test_parse(index, section, length, 0), ==, 0);
+
+    /* Bad CRC. */
+    p = test_put_insert(command, 10, 0x80 | 0x40);
+    p = test_put_time(p, 5000);
+    length = test_scte35_section(section, 0, FALSE, SIGNAL_SCTE35_SPLICE_INSERT, command, p - command, TRUE);
+    section[length - 1] ^= 0x01;
+    g_assert_cmpuint(test_parse(index, section, length, 0), ==, 0);
+
+    /* splice_null */
+    length = test_scte35_section(section, 0, FALSE, 0x00, command, 0, TRUE);
+    g_assert_cmpuint(test_parse(index, section, length, 0), ==, 0);
+
+    g_assert_cmpuint(signal_index_get_marker_count(index), ==, 3);
+
+    signal_index_free(index);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/signal-index/components", test_components);
+    g_test_add_func("/signal-index/components-truncated", test_components_truncated);
+    g_test_add_func("/signal-index/commands", test_commands);
+
+    return g_test_run();
+}
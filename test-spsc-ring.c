@@ -0,0 +1,115 @@
+/* Check the order and the wakeups of the single producer, single consumer ring. Built and run by
+ * make check. A lost wakeup makes the test hang. */
+#include "spsc-ring.c"
+
+#define TEST_ITEMS (200000)
+
+typedef struct {
+    SpscRing *ring;
+    guint count;
+    guint pause_every; /* Sleep now and then, so that the other side has to wait. */
+} TestProducer;
+
+static gpointer test_producer_thread(TestProducer *producer)
+{
+    guint32 *slot;
+    guint j;
+
+    for (j = 0; j < producer->count; ++j) {
+        slot = spsc_ring_push_begin(producer->ring);
+        *slot = j;
+        spsc_ring_push_end(producer->ring);
+        if (producer->pause_every && j % producer->pause_every == 0)
+            g_usleep(50);
+    }
+    spsc_ring_close(producer->ring);
+
+    return NULL;
+}
+
+static void test_run(guint capacity, guint producer_pause, guint consumer_pause)
+{
+    TestProducer producer = {
+        .ring = spsc_ring_new(capacity, sizeof(guint32)),
+        .count = TEST_ITEMS,
+        .pause_every = producer_pause
+    };
+    GThread *thread = g_thread_new("test-producer", (GThreadFunc)test_producer_thread, &producer);
+    guint32 *slot;
+    guint32 expected = 0;
+
+    while ((slot = spsc_ring_pop_begin(producer.ring)) != NULL) {
+        g_assert_cmpuint(*slot, ==, expected);
+        ++expected;
+        spsc_ring_pop_end(producer.ring);
+        if (consumer_pause && expected % consumer_pause == 0)
+            g_usleep(50);
+    }
+    g_assert_cmpuint(expected, ==, TEST_ITEMS);
+
+    g_thread_join(thread);
+    spsc_ring_free(producer.ring);
+}
+
+/* Slots are handed out in order, and after closing until the ring is empty. */
+static void test_single_thread(void)
+{
+    SpscRing *ring = spsc_ring_new(3, sizeof(guint64));
+    guint64 *slot;
+    guint j;
+
+    g_assert_cmpuint(ring->capacity, ==, 4);
+
+    /* The indices wrap around the slots several times. */
+    for (j = 0; j < 10; ++j) {
+        slot = spsc_ring_push_begin(ring);
+        *slot = j;
+        spsc_ring_push_end(ring);
+        slot = spsc_ring_pop_begin(ring);
+        g_assert_cmpuint(*slot, ==, j);
+        spsc_ring_pop_end(ring);
+    }
+
+    /* A full ring does not block before the last slot is taken. */
+    for (j = 0; j < 4; ++j) {
+        slot = spsc_ring_push_begin(ring);
+        *slot = 100 + j;
+        spsc_ring_push_end(ring);
+    }
+    spsc_ring_close(ring);
+    for (j = 0; j < 4; ++j) {
+        slot = spsc_ring_pop_begin(ring);
+        g_assert_nonnull(slot);
+        g_assert_cmpuint(*slot, ==, 100 + j);
+        spsc_ring_pop_end(ring);
+    }
+    g_assert_null(spsc_ring_pop_begin(ring));
+
+    spsc_ring_free(ring);
+}
+
+/* Both sides run at full speed, the ring is full or empty all the time. */
+static void test_wakeups(void)
+{
+    test_run(1, 0, 0);
+    test_run(2, 0, 0);
+    test_run(64, 0, 0);
+}
+
+/* One side is slower, so that the other one waits for it. */
+static void test_wakeups_slow_side(void)
+{
+    test_run(4, 0, 997);
+    test_run(4, 997, 0);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/spsc-ring/single-thread", test_single_thread);
+    g_test_add_func("/spsc-ring/wakeups", test_wakeups);
+    g_test_add_func("/spsc-ring/wakeups-slow-side", test_wakeups_slow_side);
+
+    return g_test_run();
+}
@@ -0,0 +1,156 @@
+/* Compare the start code kernels against the scalar one. Built and run by make check. */
+#include "start-code.c"
+
+#include <string.h>
+
+#define TEST_BUFFER_SIZE (4096)
+#define TEST_RANDOM_ROUNDS (2000)
+#define TEST_WINDOW_ROUNDS (100)
+
+typedef struct {
+    const gchar *name;
+    StartCodeFindFunc func;
+} TestKernel;
+
+static TestKernel test_kernels[3];
+static guint test_kernel_count = 0;
+
+static void test_kernels_init(void)
+{
+#ifdef START_CODE_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        test_kernels[test_kernel_count++] = (TestKernel){ "sse2", start_code_find_sse2 };
+    if (__builtin_cpu_supports("avx2"))
+        test_kernels[test_kernel_count++] = (TestKernel){ "avx2", start_code_find_avx2 };
+#endif
+    test_kernels[test_kernel_count++] = (TestKernel){ "selected", start_code_find_select() };
+}
+
+/* Byte by byte, independent of the scalar kernel's skipping. */
+static const guint8 *test_find_reference(const guint8 *data, gsize length)
+{
+    gsize j;
+    for (j = 0; j + 2 < length; ++j) {
+        if (data[j] == 0x00 && data[j + 1] == 0x00 && data[j + 2] == 0x01)
+            return data + j;
+    }
+    return NULL;
+}
+
+static void test_check(const guint8 *data, gsize length)
+{
+    const guint8 *expected = test_find_reference(data, length);
+    const guint8 *found;
+    guint k;
+
+    g_assert_true(start_code_find_scalar(data, length) == expected);
+    for (k = 0; k < test_kernel_count; ++k) {
+        found = test_kernels[k].func(data, length);
+        if (found != expected)
+            g_error("%s: length %" G_GSIZE_FORMAT ", expected offset %" G_GSSIZE_FORMAT ", got %" G_GSSIZE_FORMAT,
+                    test_kernels[k].name, length,
+                    expected ? (gssize)(expected - data) : (gssize)-1,
+                    found ? (gssize)(found - data) : (gssize)-1);
+    }
+}
+
+/* Check every offset and every length up to the end of the buffer, so that data is unaligned and
+ * tails shorter than a vector are covered. */
+static void test_check_all_windows(const guint8 *data, gsize length, gsize max_window)
+{
+    gsize offset, window;
+    for (offset = 0; offset < 33 && offset < length; ++offset) {
+        for (window = 0; window <= max_window && offset + window <= length; ++window)
+            test_check(data + offset, window);
+    }
+}
+
+static void test_random(void)
+{
+    guint8 *buffer = g_malloc(TEST_BUFFER_SIZE);
+    GRand *rand = g_rand_new_with_seed(0x47);
+    gsize length, j;
+    guint round;
+
+    for (round = 0; round < TEST_RANDOM_ROUNDS; ++round) {
+        length = g_rand_int_range(rand, 0, TEST_BUFFER_SIZE + 1);
+        for (j = 0; j < length; ++j)
+            buffer[j] = g_rand_int_range(rand, 0, 256);
+        test_check(buffer, length);
+        if (length > 0) {
+            j = g_rand_int_range(rand, 0, length);
+            test_check(buffer + j, length - j);
+        }
+    }
+
+    g_rand_free(rand);
+    g_free(buffer);
+}
+
+/* Mostly 00 and 01, so that almost every position is a candidate. */
+static void test_zeros_and_ones(void)
+{
+    guint8 *buffer = g_malloc(TEST_BUFFER_SIZE);
+    GRand *rand = g_rand_new_with_seed(0x1b);
+    gsize length, j;
+    guint32 r;
+    guint round;
+
+    for (round = 0; round < TEST_WINDOW_ROUNDS; ++round) {
+        length = g_rand_int_range(rand, 0, 256);
+        for (j = 0; j < length; ++j) {
+            r = g_rand_int_range(rand, 0, 16);
+            buffer[j] = r < 12 ? 0x00 : (r < 15 ? 0x01 : 0xff);
+        }
+        test_check_all_windows(buffer, length, length);
+    }
+
+    g_rand_free(rand);
+    g_free(buffer);
+}
+
+/* A single prefix at every position, around all 16 and 32 byte lane boundaries. */
+static void test_lane_boundaries(void)
+{
+    guint8 buffer[160];
+    gsize pos;
+
+    for (pos = 0; pos + 3 <= sizeof(buffer); ++pos) {
+        memset(buffer, 0xff, sizeof(buffer));
+        buffer[pos] = 0x00;
+        buffer[pos + 1] = 0x00;
+        buffer[pos + 2] = 0x01;
+        test_check_all_windows(buffer, sizeof(buffer), sizeof(buffer));
+    }
+}
+
+/* Long runs of 00, ending with 01, a truncated prefix or nothing. */
+static void test_zero_runs(void)
+{
+    guint8 buffer[160];
+    gsize run;
+
+    for (run = 0; run < sizeof(buffer); ++run) {
+        memset(buffer, 0x00, sizeof(buffer));
+        buffer[run] = 0x01;
+        test_check_all_windows(buffer, sizeof(buffer), sizeof(buffer));
+
+        memset(buffer, 0x00, sizeof(buffer));
+        memset(buffer + run, 0x02, sizeof(buffer) - run);
+        test_check_all_windows(buffer, sizeof(buffer), sizeof(buffer));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    test_kernels_init();
+
+    g_test_add_func("/start-code/random", test_random);
+    g_test_add_func("/start-code/zeros-and-ones", test_zeros_and_ones);
+    g_test_add_func("/start-code/lane-boundaries", test_lane_boundaries);
+    g_test_add_func("/start-code/zero-runs", test_zero_runs);
+
+    return g_test_run();
+}
@@ -0,0 +1,209 @@
+/* Check the counts of the stream timeline and the validation of saved data. Built and run by
+ * make check. */
+#include "stream-timeline.c"
+
+#define TEST_BUCKET_SIZE (188 * 100)
+
+/* Two writers, one of them for a bucket the other one also counts in. */
+static StreamTimeline *test_timeline_new(void)
+{
+    StreamTimeline *timeline = stream_timeline_new(TEST_BUCKET_SIZE);
+    StreamTimelineWriter *a = stream_timeline_writer_new(timeline);
+    StreamTimelineWriter *b = stream_timeline_writer_new(timeline);
+    gsize offset;
+
+    for (offset = 0; offset < 3 * TEST_BUCKET_SIZE; offset += 188)
+        stream_timeline_writer_add_packet(a, offset, offset % (4 * 188) ? 0x100 : 0x101, offset % 1880 == 0);
+    stream_timeline_writer_add_iframe(a, TEST_BUCKET_SIZE + 188);
+    stream_timeline_writer_add_iframe(a, TEST_BUCKET_SIZE + 376);
+
+    stream_timeline_writer_add_packet(b, 2 * TEST_BUCKET_SIZE, 0x1FFF, FALSE);
+    stream_timeline_writer_add_packet(b, 5 * TEST_BUCKET_SIZE, 0x1FFF, FALSE);
+    /* Discarded. */
+    stream_timeline_writer_add_packet(b, 6 * TEST_BUCKET_SIZE, 0x200, TRUE);
+    stream_timeline_writer_reset(b);
+
+    stream_timeline_writer_free(a);
+    stream_timeline_writer_free(b);
+
+    return timeline;
+}
+
+static void test_check_timeline(StreamTimeline *timeline)
+{
+    StreamTimelineCounts counts;
+    guint16 *pids;
+    guint count;
+
+    g_assert_cmpuint(stream_timeline_get_bucket_count(timeline), ==, 6);
+
+    g_assert_true(stream_timeline_get_counts(timeline, 0, 0x100, &counts));
+    g_assert_cmpuint(counts.packets, ==, 75);
+    g_assert_true(stream_timeline_get_counts(timeline, 0, 0x101, &counts));
+    g_assert_cmpuint(counts.packets, ==, 25);
+    g_assert_true(stream_timeline_get_counts(timeline, 0, STREAM_TIMELINE_ALL_PIDS, &counts));
+    g_assert_cmpuint(counts.packets, ==, 100);
+    g_assert_cmpuint(counts.units, ==, 10);
+
+    g_assert_true(stream_timeline_get_counts(timeline, 2, STREAM_TIMELINE_ALL_PIDS, &counts));
+    g_assert_cmpuint(counts.packets, ==, 101);
+    g_assert_true(stream_timeline_get_counts(timeline, 4, STREAM_TIMELINE_ALL_PIDS, &counts));
+    g_assert_cmpuint(counts.packets, ==, 0);
+    g_assert_true(stream_timeline_get_counts(timeline, 5, 0x1FFF, &counts));
+    g_assert_cmpuint(counts.packets, ==, 1);
+    g_assert_true(stream_timeline_get_counts(timeline, 5, 0x100, &counts));
+    g_assert_cmpuint(counts.packets, ==, 0);
+    g_assert_false(stream_timeline_get_counts(timeline, 6, STREAM_TIMELINE_ALL_PIDS, &counts));
+
+    g_assert_cmpuint(stream_timeline_get_iframes(timeline, 0), ==, 0);
+    g_assert_cmpuint(stream_timeline_get_iframes(timeline, 1), ==, 2);
+
+    pids = stream_timeline_get_pids(timeline, &count);
+    g_assert_cmpuint(count, ==, 3);
+    g_assert_cmpuint(pids[0], ==, 0x100);
+    g_assert_cmpuint(pids[1], ==, 0x101);
+    g_assert_cmpuint(pids[2], ==, 0x1FFF);
+    g_free(pids);
+}
+
+static void test_check_empty(StreamTimeline *timeline)
+{
+    guint count;
+    g_free(stream_timeline_get_pids(timeline, &count));
+    g_assert_cmpuint(count, ==, 0);
+    g_assert_cmpuint(stream_timeline_get_bucket_count(timeline), ==, 0);
+}
+
+static void test_counts(void)
+{
+    StreamTimeline *timeline = test_timeline_new();
+    test_check_timeline(timeline);
+
+    stream_timeline_clear(timeline);
+    test_check_empty(timeline);
+
+    stream_timeline_free(timeline);
+}
+
+static void test_save_load(void)
+{
+    StreamTimeline *timeline = test_timeline_new();
+    StreamTimeline *loaded = stream_timeline_new(TEST_BUCKET_SIZE);
+    gsize size;
+    guint8 *data = stream_timeline_save(timeline, &size);
+
+    g_assert_true(stream_timeline_load(loaded, data, size));
+    test_check_timeline(loaded);
+
+    /* Loading replaces what was there. */
+    g_assert_true(stream_timeline_load(loaded, data, size));
+    test_check_timeline(loaded);
+    g_free(data);
+
+    stream_timeline_clear(timeline);
+    data = stream_timeline_save(timeline, &size);
+    g_assert_cmpuint(size, ==, sizeof(StreamTimelineHeader));
+    g_assert_true(stream_timeline_load(loaded, data, size));
+    test_check_empty(loaded);
+    g_free(data);
+
+    stream_timeline_free(loaded);
+    stream_timeline_free(timeline);
+}
+
+/* Load data and expect it to be rejected, leaving an empty timeline. */
+static void test_load_invalid(StreamTimeline *timeline, const guint8 *data, gsize size)
+{
+    g_assert_false(stream_timeline_load(timeline, data, size));
+    test_check_empty(timeline);
+
+    /* A valid load afterwards still works. */
+    StreamTimeline *valid = test_timeline_new();
+    gsize valid_size;
+    guint8 *valid_data = stream_timeline_save(valid, &valid_size);
+    g_assert_true(stream_timeline_load(timeline, valid_data, valid_size));
+    g_free(valid_data);
+    stream_timeline_free(valid);
+}
+
+static guint8 *test_copy(const guint8 *data, gsize size)
+{
+    guint8 *copy = g_malloc(size);
+    memcpy(copy, data, size);
+    return copy;
+}
+
+/* Data that does not match its header is rejected without reading beyond it. */
+static void test_load_size(void)
+{
+    StreamTimeline *source = test_timeline_new();
+    StreamTimeline *timeline = stream_timeline_new(TEST_BUCKET_SIZE);
+    StreamTimeline *other = stream_timeline_new(2 * TEST_BUCKET_SIZE);
+    StreamTimelineHeader header;
+    gsize size;
+    guint8 *data = stream_timeline_save(source, &size);
+    /* Copies, so that reads beyond the size are caught by memory checkers. */
+    guint8 *copy;
+    guint32 pid;
+
+    test_load_invalid(timeline, NULL, 0);
+    test_load_invalid(timeline, data, sizeof(StreamTimelineHeader) - 1);
+
+    copy = test_copy(data, size - 1);
+    test_load_invalid(timeline, copy, size - 1);
+    g_free(copy);
+
+    copy = g_malloc0(size + 1);
+    memcpy(copy, data, size);
+    test_load_invalid(timeline, copy, size + 1);
+    g_free(copy);
+
+    /* Another bucket size. */
+    g_assert_false(stream_timeline_load(other, data, size));
+
+    /* Counts in the header that do not fit the data, e.g., from a corrupted cache. */
+    memcpy(&header, data, sizeof(StreamTimelineHeader));
+    header.bucket_count = G_MAXUINT32;
+    copy = test_copy(data, size);
+    memcpy(copy, &header, sizeof(StreamTimelineHeader));
+    test_load_invalid(timeline, copy, size);
+
+    memcpy(&header, data, sizeof(StreamTimelineHeader));
+    header.pid_count = STREAM_TIMELINE_PIDS + 1;
+    memcpy(copy, &header, sizeof(StreamTimelineHeader));
+    test_load_invalid(timeline, copy, size);
+
+    memcpy(&header, data, sizeof(StreamTimelineHeader));
+    header.pid_count = G_MAXUINT32;
+    memcpy(copy, &header, sizeof(StreamTimelineHeader));
+    test_load_invalid(timeline, copy, size);
+
+    /* A pid out of range, and the same pid twice. */
+    gsize pids_start = sizeof(StreamTimelineHeader) + header.bucket_count * sizeof(guint32);
+    gsize pid_size = sizeof(guint32) + header.bucket_count * sizeof(StreamTimelineCounts);
+    memcpy(copy, data, size);
+    pid = STREAM_TIMELINE_PIDS;
+    memcpy(copy + pids_start + pid_size, &pid, sizeof(guint32));
+    test_load_invalid(timeline, copy, size);
+
+    memcpy(copy, data, size);
+    memcpy(copy + pids_start + 2 * pid_size, copy + pids_start, sizeof(guint32));
+    test_load_invalid(timeline, copy, size);
+    g_free(copy);
+
+    g_free(data);
+    stream_timeline_free(other);
+    stream_timeline_free(timeline);
+    stream_timeline_free(source);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/stream-timeline/counts", test_counts);
+    g_test_add_func("/stream-timeline/save-load", test_save_load);
+    g_test_add_func("/stream-timeline/load-size", test_load_size);
+
+    return g_test_run();
+}
@@ -0,0 +1,404 @@
+/* Check the packet splitting and the PAT/PMT tracking of the write path demuxer. Built and run
+ * by make check. The PSI is built by hand here, independent of biTStream. */
+#include "ts-demux.c"
+
+#define TEST_PMT_PID (0x100)
+#define TEST_VIDEO_PID (0x101)
+#define TEST_AUDIO_PID (0x102)
+#define TEST_TELETEXT_PID (0x103)
+#define TEST_PRIVATE_PID (0x104)
+#define TEST_AUDIO2_PID (0x105)
+
+typedef struct {
+    guint8 data[TS_SIZE * 128];
+    gsize length;
+    guint8 cc[TS_DEMUX_PIDS];
+} TestStream;
+
+typedef struct {
+    guint16 pid;
+    guint8 stream_type;
+    gboolean teletext;
+} TestEs;
+
+typedef struct {
+    GArray *packets; /* [TsDemuxPacket] data is not valid anymore. */
+    guint batches;
+} TestCollect;
+
+/* CRC-32/MPEG-2 */
+static guint32 test_crc32(const guint8 *data, gsize length)
+{
+    guint32 crc = 0xffffffff;
+    gsize j;
+    guint k;
+    for (j = 0; j < length; ++j) {
+        crc ^= (guint32)data[j] << 24;
+        for (k = 0; k < 8; ++k)
+            crc = crc & 0x80000000 ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+    return crc;
+}
+
+/* Set the section length and append the CRC. length is without the CRC. */
+static gsize test_section_finish(guint8 *section, gsize length)
+{
+    guint32 crc;
+    section[1] = 0xb0 | ((length + 4 - 3) >> 8);
+    section[2] = (length + 4 - 3) & 0xff;
+    crc = test_crc32(section, length);
+    section[length++] = crc >> 24;
+    section[length++] = crc >> 16;
+    section[length++] = crc >> 8;
+    section[length++] = crc;
+    return length;
+}
+
+static gsize test_pat(guint8 *section, guint8 version, guint16 pmt_pid)
+{
+    gsize n = 0;
+    section[n++] = 0x00; /* table_id */
+    n += 2;
+    section[n++] = 0x00; /* transport_stream_id */
+    section[n++] = 0x01;
+    section[n++] = 0xc1 | (version << 1);
+    section[n++] = 0x00;
+    section[n++] = 0x00;
+    /* The NIT, which is not a PMT. */
+    section[n++] = 0x00;
+    section[n++] = 0x00;
+    section[n++] = 0xe0;
+    section[n++] = 0x10;
+    section[n++] = 0x00;
+    section[n++] = 0x01;
+    section[n++] = 0xe0 | (pmt_pid >> 8);
+    section[n++] = pmt_pid & 0xff;
+    return test_section_finish(section, n);
+}
+
+/* padding adds an unknown descriptor to every stream, to make the section longer. */
+static gsize test_pmt(guint8 *section,
+                      guint8 version,
+                      guint16 pcr_pid,
+                      const TestEs *es,
+                      guint es_count,
+                      guint8 padding)
+{
+    gsize n = 0;
+    guint8 info_length;
+    guint j;
+
+    section[n++] = 0x02; /* table_id */
+    n += 2;
+    section[n++] = 0x00; /* program_number */
+    section[n++] = 0x01;
+    section[n++] = 0xc1 | (version << 1);
+    section[n++] = 0x00;
+    section[n++] = 0x00;
+    section[n++] = 0xe0 | (pcr_pid >> 8);
+    section[n++] = pcr_pid & 0xff;
+    section[n++] = 0xf0;
+    section[n++] = 0x00;
+    for (j = 0; j < es_count; ++j) {
+        info_length = (es[j].teletext ? 7 : 0) + (padding ? padding + 2 : 0);
+        section[n++] = es[j].stream_type;
+        section[n++] = 0xe0 | (es[j].pid >> 8);
+        section[n++] = es[j].pid & 0xff;
+        section[n++] = 0xf0;
+        section[n++] = info_length;
+        if (es[j].teletext) {
+            section[n++] = TS_DEMUX_TELETEXT_DESC;
+            section[n++] = 5;
+            memcpy(section + n, "deu\x09\x00", 5);
+            n += 5;
+        }
+        if (padding) {
+            section[n++] = 0xfe;
+            section[n++] = padding;
+            memset(section + n, 0x20, padding);
+            n += padding;
+        }
+    }
+    return test_section_finish(section, n);
+}
+
+static guint8 *test_packet_init(TestStream *stream, guint16 pid, gboolean unit_start)
+{
+    g_assert_cmpuint(stream->length + TS_SIZE, <=, sizeof(stream->data));
+    guint8 *packet = stream->data + stream->length;
+    packet[0] = 0x47;
+    packet[1] = (unit_start ? 0x40 : 0x00) | (pid >> 8);
+    packet[2] = pid & 0xff;
+    packet[3] = 0x10 | (stream->cc[pid]++ & 0x0f);
+    memset(packet + 4, 0xff, TS_SIZE - 4);
+    stream->length += TS_SIZE;
+    return packet;
+}
+
+/* A section in as many packets as needed, the rest is stuffed. */
+static void test_add_section(TestStream *stream, guint16 pid, const guint8 *section, gsize length)
+{
+    guint8 *packet = test_packet_init(stream, pid, TRUE);
+    gsize take;
+
+    packet[4] = 0x00; /* pointer_field */
+    take = MIN(length, TS_SIZE - 5);
+    memcpy(packet + 5, section, take);
+    section += take;
+    length -= take;
+    while (length > 0) {
+        packet = test_packet_init(stream, pid, FALSE);
+        take = MIN(length, TS_SIZE - 4);
+        memcpy(packet + 4, section, take);
+        section += take;
+        length -= take;
+    }
+}
+
+static void test_add_pes(TestStream *stream, guint16 pid, guint64 pts)
+{
+    guint8 *packet = test_packet_init(stream, pid, TRUE);
+    guint8 *pes = packet + 4;
+
+    pes[0] = 0x00;
+    pes[1] = 0x00;
+    pes[2] = 0x01;
+    pes[3] = 0xe0;
+    pes[4] = 0x00;
+    pes[5] = 0x00;
+    pes[6] = 0x80;
+    pes[7] = 0x80; /* PTS only */
+    pes[8] = 5;
+    pes[9] = 0x21 | ((pts >> 29) & 0x0e);
+    pes[10] = pts >> 22;
+    pes[11] = 0x01 | ((pts >> 14) & 0xfe);
+    pes[12] = pts >> 7;
+    pes[13] = 0x01 | ((pts << 1) & 0xfe);
+}
+
+static void test_add_programs(TestStream *stream, guint8 version, const TestEs *es, guint es_count)
+{
+    guint8 section[1024];
+    gsize length;
+
+    length = test_pat(section, 0, TEST_PMT_PID);
+    test_add_section(stream, TS_DEMUX_PAT_PID, section, length);
+    length = test_pmt(section, version, TEST_VIDEO_PID, es, es_count, 0);
+    test_add_section(stream, TEST_PMT_PID, section, length);
+}
+
+static const TestEs test_streams[] = {
+    { TEST_VIDEO_PID, 0x02, FALSE },
+    { TEST_AUDIO_PID, 0x04, FALSE },
+    { TEST_TELETEXT_PID, 0x06, TRUE },
+    { TEST_PRIVATE_PID, 0x06, FALSE }
+};
+
+static void _test_collect_cb(const TsDemuxPacket *packets, guint count, TestCollect *collect)
+{
+    g_assert_cmpuint(count, >, 0);
+    g_assert_cmpuint(count, <=, TS_DEMUX_BATCH);
+    g_array_append_vals(collect->packets, packets, count);
+    ++collect->batches;
+}
+
+static void test_collect_init(TestCollect *collect)
+{
+    collect->packets = g_array_new(FALSE, FALSE, sizeof(TsDemuxPacket));
+    collect->batches = 0;
+}
+
+static void test_types(void)
+{
+    TsDemux *demux = ts_demux_new();
+    TestStream stream = { .length = 0 };
+
+    g_assert_cmpint(ts_demux_get_pid_type(demux, 0x0000), ==, TsDemuxPidPat);
+    g_assert_cmpint(ts_demux_get_pid_type(demux, 0x0012), ==, TsDemuxPidOther);
+    g_assert_cmpint(ts_demux_get_pid_type(demux, 0x1FFF), ==, TsDemuxPidOther);
+    g_assert_cmpint(ts_demux_get_pid_type(demux, TEST_VIDEO_PID), ==, TsDemuxPidUnknown);
+    g_assert_false(ts_demux_has_programs(demux));
+
+    test_add_programs(&stream, 0, test_streams, G_N_ELEMENTS(test_streams));
+    ts_demux_push(demux, stream.data, stream.length, NULL, NULL);
+
+    g_assert_true(ts_demux_has_programs(demux));
+    g_assert_true(ts_demux_has_pmt(demux, TEST_PMT_PID));
+    g_assert_false(ts_demux_has_pmt(demux, TEST_VIDEO_PID));
+    g_assert_cmpint(ts_demux_get_pid_type(demux, 0x0010), ==, TsDemuxPidOther);
+    g_assert_cmpint(ts_demux_get_pid_type(demux, TEST_PMT_PID), ==, TsDemuxPidPmt);
+    g_assert_cmpint(ts_demux_get_pid_type(demux, TEST_VIDEO_PID), ==, TsDemuxPidVideo);
+    g_assert_cmpint(ts_demux_get_pid_type(demux, TEST_AUDIO_PID), ==, TsDemuxPidPes);
+    g_assert_cmpint(ts_demux_get_pid_type(demux, TEST_TELETEXT_PID), ==, TsDemuxPidPes);
+    g_assert_cmpint(ts_demux_get_pid_type(demux, TEST_PRIVATE_PID), ==, TsDemuxPidOther);
+    g_assert_cmpuint(ts_demux_get_stream_type(demux, TEST_AUDIO_PID), ==, 0x04);
+    g_assert_cmpuint(ts_demux_get_stream_type(demux, TEST_AUDIO2_PID), ==, 0);
+    g_assert_cmpuint(ts_demux_get_pmt_pid(demux, TEST_AUDIO_PID), ==, TEST_PMT_PID);
+    g_assert_cmpuint(ts_demux_get_pmt_pid(demux, TEST_AUDIO2_PID), ==, 0);
+    g_assert_cmpuint(ts_demux_get_pcr_pid(demux, TEST_AUDIO_PID), ==, TEST_VIDEO_PID);
+    g_assert_cmpuint(ts_demux_get_pcr_pid(demux, TEST_AUDIO2_PID), ==, TS_DEMUX_NO_PID);
+
+    ts_demux_free(demux);
+}
+
+/* A repeated PMT changes nothing, a new version replaces the streams of the program. */
+static void test_pmt_version(void)
+{
+    static const TestEs streams[] = {
+        { TEST_VIDEO_PID, 0x1b, FALSE },
+        { TEST_AUDIO2_PID, 0x03, FALSE }
+    };
+    TsDemux *demux = ts_demux_new();
+    TestStream stream = { .length = 0 };
+    guint8 section[1024];
+    gsize length;
+
+    test_add_programs(&stream, 3, test_streams, G_N_ELEMENTS(test_streams));
+    /* Same version, other streams. */
+    length = test_pmt(section, 3, TEST_VIDEO_PID, streams, G_N_ELEMENTS(streams), 0);
+    test_add_section(&stream, TEST_PMT_PID, section, length);
+    ts_demux_push(demux, stream.data, stream.length, NULL, NULL);
+
+    g_assert_cmpint(ts_demux_get_pid_type(demux, TEST_AUDIO_PID), ==, TsDemuxPidPes);
+    g_assert_cmpint(ts_demux_get_pid_type(demux, TEST_AUDIO2_PID), ==, TsDemuxPidUnknown);
+    g_assert_cmpuint(ts_demux_get_stream_type(demux, TEST_VIDEO_PID), ==, 0x02);
+
+    /* A new version in a section spanning three packets, with the PCR on the null pid. */
+    stream.length = 0;
+    length = test_pmt(section, 4, TS_DEMUX_NULL_PID, streams, G_N_ELEMENTS(streams), 200);
+    g_assert_cmpuint(length, >, 2 * TS_SIZE);
+    test_add_section(&stream, TEST_PMT_PID, section, length);
+    ts_demux_push(demux, stream.data, stream.length, NULL, NULL);
+
+    g_assert_cmpint(ts_demux_get_pid_type(demux, TEST_AUDIO_PID), ==, TsDemuxPidUnknown);
+    g_assert_cmpuint(ts_demux_get_pmt_pid(demux, TEST_AUDIO_PID), ==, 0);
+    g_assert_cmpint(ts_demux_get_pid_type(demux, TEST_TELETEXT_PID), ==, TsDemuxPidUnknown);
+    g_assert_cmpint(ts_demux_get_pid_type(demux, TEST_AUDIO2_PID), ==, TsDemuxPidPes);
+    g_assert_cmpuint(ts_demux_get_stream_type(demux, TEST_VIDEO_PID), ==, 0x1b);
+    g_assert_cmpuint(ts_demux_get_pcr_pid(demux, TEST_VIDEO_PID), ==, TS_DEMUX_NO_PID);
+
+    /* A corrupted section is dropped. */
+    stream.length = 0;
+    length = test_pmt(section, 5, TEST_VIDEO_PID, test_streams, G_N_ELEMENTS(test_streams), 0);
+    section[length - 1] ^= 0x01;
+    test_add_section(&stream, TEST_PMT_PID, section, length);
+    ts_demux_push(demux, stream.data, stream.length, NULL, NULL);
+    g_assert_cmpint(ts_demux_get_pid_type(demux, TEST_AUDIO_PID), ==, TsDemuxPidUnknown);
+
+    ts_demux_free(demux);
+}
+
+/* Packets are handed out with their offsets and PTS, however the input is split, and junk
+ * between them is skipped. */
+static void test_split(void)
+{
+    TestStream stream = { .length = 0 };
+    TestCollect whole, split;
+    TsDemuxPacket *a, *b;
+    TsDemux *demux;
+    gsize offsets[64];
+    guint count = 0;
+    gsize pos, step;
+    guint j;
+
+    test_add_programs(&stream, 0, test_streams, G_N_ELEMENTS(test_streams));
+    offsets[count++] = 0;
+    offsets[count++] = TS_SIZE;
+    for (j = 0; j < 20; ++j) {
+        offsets[count++] = stream.length;
+        test_add_pes(&stream, j % 2 ? TEST_AUDIO_PID : TEST_VIDEO_PID, (1ULL << 32) + j * 3600);
+        if (j == 7) {
+            /* Junk, e.g., from a damaged recording. */
+            memset(stream.data + stream.length, 0x00, 100);
+            stream.length += 100;
+        }
+    }
+    /* A payload without a PES header, and an incomplete packet at the end. */
+    offsets[count++] = stream.length;
+    test_packet_init(&stream, TEST_VIDEO_PID, FALSE);
+    stream.length += 50;
+
+    test_collect_init(&whole);
+    demux = ts_demux_new();
+    ts_demux_push(demux, stream.data, stream.length, (TsDemuxBatchFunc)_test_collect_cb, &whole);
+    ts_demux_free(demux);
+
+    g_assert_cmpuint(whole.packets->len, ==, count);
+    for (j = 0; j < count; ++j) {
+        a = &g_array_index(whole.packets, TsDemuxPacket, j);
+        g_assert_cmpuint(a->offset, ==, offsets[j]);
+        g_assert_true(a->has_payload);
+        g_assert_cmpuint(a->pes_offset, ==, 4);
+        if (j >= 2 && j < count - 1) {
+            g_assert_cmpuint(a->pid, ==, (j - 2) % 2 ? TEST_AUDIO_PID : TEST_VIDEO_PID);
+            g_assert_cmpint(a->type, ==, (j - 2) % 2 ? TsDemuxPidPes : TsDemuxPidVideo);
+            g_assert_true(a->unit_start);
+            g_assert_cmpuint(a->pts, ==, (1ULL << 32) + (j - 2) * 3600);
+        }
+    }
+    g_assert_cmpuint(g_array_index(whole.packets, TsDemuxPacket, 0).type, ==, TsDemuxPidPat);
+    g_assert_cmpuint(g_array_index(whole.packets, TsDemuxPacket, count - 1).pts, ==, PES_FRAME_TS_INVALID);
+
+    /* Split at every possible size, including through the junk and within packets. */
+    for (step = 1; step < 2 * TS_SIZE; step += 37) {
+        test_collect_init(&split);
+        demux = ts_demux_new();
+        for (pos = 0; pos < stream.length; pos += step)
+            ts_demux_push(demux, stream.data + pos, MIN(step, stream.length - pos),
+                          (TsDemuxBatchFunc)_test_collect_cb, &split);
+        ts_demux_free(demux);
+
+        g_assert_cmpuint(split.packets->len, ==, whole.packets->len);
+        for (j = 0; j < count; ++j) {
+            a = &g_array_index(whole.packets, TsDemuxPacket, j);
+            b = &g_array_index(split.packets, TsDemuxPacket, j);
+            g_assert_cmpuint(b->offset, ==, a->offset);
+            g_assert_cmpuint(b->pid, ==, a->pid);
+            g_assert_cmpint(b->type, ==, a->type);
+            g_assert_cmpuint(b->pts, ==, a->pts);
+        }
+        g_array_free(split.packets, TRUE);
+    }
+
+    g_array_free(whole.packets, TRUE);
+}
+
+/* More packets than fit in a batch, and offsets continue at a seek. */
+static void test_batches_and_seek(void)
+{
+    TestStream stream = { .length = 0 };
+    TsDemux *demux = ts_demux_new();
+    TestCollect collect;
+    guint j;
+
+    for (j = 0; j < TS_DEMUX_BATCH + 10; ++j)
+        test_packet_init(&stream, TS_DEMUX_NULL_PID, FALSE);
+
+    test_collect_init(&collect);
+    ts_demux_push(demux, stream.data, stream.length, (TsDemuxBatchFunc)_test_collect_cb, &collect);
+    g_assert_cmpuint(collect.packets->len, ==, TS_DEMUX_BATCH + 10);
+    g_assert_cmpuint(collect.batches, ==, 2);
+
+    /* The incomplete packet is dropped. */
+    ts_demux_push(demux, stream.data, 100, (TsDemuxBatchFunc)_test_collect_cb, &collect);
+    ts_demux_seek(demux, 1000 * TS_SIZE);
+    ts_demux_push(demux, stream.data, 2 * TS_SIZE, (TsDemuxBatchFunc)_test_collect_cb, &collect);
+    g_assert_cmpuint(collect.packets->len, ==, TS_DEMUX_BATCH + 12);
+    g_assert_cmpuint(g_array_index(collect.packets, TsDemuxPacket, TS_DEMUX_BATCH + 10).offset, ==, 1000 * TS_SIZE);
+    g_assert_cmpuint(g_array_index(collect.packets, TsDemuxPacket, TS_DEMUX_BATCH + 11).offset, ==, 1001 * TS_SIZE);
+
+    g_array_free(collect.packets, TRUE);
+    ts_demux_free(demux);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/ts-demux/types", test_types);
+    g_test_add_func("/ts-demux/pmt-version", test_pmt_version);
+    g_test_add_func("/ts-demux/split", test_split);
+    g_test_add_func("/ts-demux/batches-and-seek", test_batches_and_seek);
+
+    return g_test_run();
+}
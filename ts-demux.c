@@ -0,0 +1,361 @@
+#include "ts-demux.h"
+#include "pes-frame-info.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <bitstream/mpeg/ts.h>
+#include <bitstream/mpeg/pes.h>
+#include <bitstream/mpeg/psi.h>
+
+#define TS_DEMUX_PAT_PID (0x0000)
+#define TS_DEMUX_NULL_PID (0x1FFF)
+#define TS_DEMUX_TELETEXT_DESC (0x56)
+
+/* Section assembly of a pid. */
+typedef struct {
+    uint8_t *buffer;
+    uint16_t used;
+    gint16 last_cc; /* -1 if no packet was seen yet. */
+    gboolean found; /* A valid table was parsed. */
+    guint8 version; /* Of the table found. */
+    guint16 pcr_pid; /* Of a PMT found, TS_DEMUX_NO_PID if none. */
+} TsDemuxSection;
+
+struct _TsDemux {
+    guint8 types[TS_DEMUX_PIDS]; /* [TsDemuxPidType] */
+    guint8 stream_types[TS_DEMUX_PIDS]; /* From the PMT, 0 if not listed. */
+    guint16 pmt_pids[TS_DEMUX_PIDS]; /* PMT listing the pid, 0 if none. */
+    GHashTable *sections; /* [pid -> TsDemuxSection *] PAT and PMTs */
+    gboolean have_pat;
+    guint pmts_missing; /* Named in the PAT, but not found yet. */
+
+    gsize offset; /* Offset of the next byte. */
+    guint8 carry[TS_SIZE]; /* Incomplete packet at the end of the last buffer. */
+    gsize carry_len;
+
+    TsDemuxPacket batch[TS_DEMUX_BATCH];
+};
+
+static void ts_demux_section_free(TsDemuxSection *section)
+{
+    if (section) {
+        psi_assemble_reset(&section->buffer, &section->used);
+        g_free(section);
+    }
+}
+
+TsDemux *ts_demux_new(void)
+{
+    TsDemux *demux = g_new0(TsDemux, 1);
+    demux->sections = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                            (GDestroyNotify)ts_demux_section_free);
+
+    demux->types[TS_DEMUX_PAT_PID] = TsDemuxPidPat;
+    /* CAT, NIT, SDT/BAT, EIT, RST and TDT/TOT */
+    demux->types[0x01] = TsDemuxPidOther;
+    memset(&demux->types[0x10], TsDemuxPidOther, 5);
+    demux->types[TS_DEMUX_NULL_PID] = TsDemuxPidOther;
+
+    return demux;
+}
+
+void ts_demux_free(TsDemux *demux)
+{
+    if (demux) {
+        g_hash_table_destroy(demux->sections);
+        g_free(demux);
+    }
+}
+
+void ts_demux_seek(TsDemux *demux, gsize offset)
+{
+    g_return_if_fail(demux != NULL);
+
+    GHashTableIter iter;
+    TsDemuxSection *section;
+
+    demux->offset = offset;
+    demux->carry_len = 0;
+
+    /* Sections do not continue across the gap. */
+    g_hash_table_iter_init(&iter, demux->sections);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&section)) {
+        psi_assemble_reset(&section->buffer, &section->used);
+        section->last_cc = -1;
+    }
+}
+
+gboolean ts_demux_has_programs(TsDemux *demux)
+{
+    g_return_val_if_fail(demux != NULL, FALSE);
+    return demux->have_pat && demux->pmts_missing == 0;
+}
+
+TsDemuxPidType ts_demux_get_pid_type(TsDemux *demux, guint16 pid)
+{
+    g_return_val_if_fail(demux != NULL, TsDemuxPidUnknown);
+    return demux->types[pid & (TS_DEMUX_PIDS - 1)];
+}
+
+guint8 ts_demux_get_stream_type(TsDemux *demux, guint16 pid)
+{
+    g_return_val_if_fail(demux != NULL, 0);
+    return demux->stream_types[pid & (TS_DEMUX_PIDS - 1)];
+}
+
+guint16 ts_demux_get_pmt_pid(TsDemux *demux, guint16 pid)
+{
+    g_return_val_if_fail(demux != NULL, 0);
+    return demux->pmt_pids[pid & (TS_DEMUX_PIDS - 1)];
+}
+
+gboolean ts_demux_has_pmt(TsDemux *demux, guint16 pmt_pid)
+{
+    g_return_val_if_fail(demux != NULL, FALSE);
+
+    TsDemuxSection *state = g_hash_table_lookup(demux->sections, GUINT_TO_POINTER(pmt_pid));
+    return demux->types[pmt_pid & (TS_DEMUX_PIDS - 1)] == TsDemuxPidPmt && state && state->found;
+}
+
+guint16 ts_demux_get_pcr_pid(TsDemux *demux, guint16 pid)
+{
+    g_return_val_if_fail(demux != NULL, TS_DEMUX_NO_PID);
+
+    guint16 pmt_pid = demux->pmt_pids[pid & (TS_DEMUX_PIDS - 1)];
+    TsDemuxSection *state;
+
+    if (!pmt_pid)
+        return TS_DEMUX_NO_PID;
+    state = g_hash_table_lookup(demux->sections, GUINT_TO_POINTER(pmt_pid));
+    return state && state->found ? state->pcr_pid : TS_DEMUX_NO_PID;
+}
+
+static void ts_demux_handle_pat(TsDemux *demux, uint8_t *section)
+{
+    uint8_t *program;
+    guint16 pid;
+    guint n;
+
+    if (!pat_validate(section) || !psi_check_crc(section))
+        return;
+
+    for (n = 0; (program = pat_get_program(section, n)) != NULL; ++n) {
+        /* Program 0 is the NIT. */
+        if (patn_get_program(program) == 0)
+            continue;
+        pid = patn_get_pid(program);
+        if (demux->types[pid] != TsDemuxPidPmt) {
+            demux->types[pid] = TsDemuxPidPmt;
+            ++demux->pmts_missing;
+        }
+    }
+    demux->have_pat = TRUE;
+}
+
+static TsDemuxPidType ts_demux_get_es_type(uint8_t *es)
+{
+    uint8_t *descs, *desc;
+    guint n;
+
+    switch (pmtn_get_streamtype(es)) {
+        case 0x01: /* MPEG-1 video */
+        case 0x02: /* MPEG-2 video */
+        case 0x1b: /* H.264 */
+            return TsDemuxPidVideo;
+        case 0x03: /* MPEG-1 audio */
+        case 0x04: /* MPEG-2 audio */
+            return TsDemuxPidPes;
+        case 0x06:
+            /* Private PES, only teletext is handled. */
+            descs = pmtn_get_descs(es);
+            for (n = 0; (desc = descs_get_desc(descs, n)) != NULL; ++n) {
+                if (desc_get_tag(desc) == TS_DEMUX_TELETEXT_DESC)
+                    return TsDemuxPidPes;
+            }
+            return TsDemuxPidOther;
+        default:
+            return TsDemuxPidOther;
+    }
+}
+
+static void ts_demux_handle_pmt(TsDemux *demux, guint16 pmt_pid, TsDemuxSection *state, uint8_t *section)
+{
+    uint8_t *es;
+    guint16 pid;
+    guint n;
+
+    if (!pmt_validate(section) || !psi_check_crc(section))
+        return;
+    /* The PMT is repeated, only a new version changes the streams. */
+    if (state->found && state->version == psi_get_version(section))
+        return;
+
+    /* Forget the streams of the last version, e.g., after a service switch. */
+    if (state->found) {
+        for (pid = 0; pid < TS_DEMUX_PIDS; ++pid) {
+            if (demux->pmt_pids[pid] != pmt_pid)
+                continue;
+            demux->types[pid] = TsDemuxPidUnknown;
+            demux->stream_types[pid] = 0;
+            demux->pmt_pids[pid] = 0;
+        }
+    }
+
+    for (n = 0; (es = pmt_get_es(section, n)) != NULL; ++n) {
+        pid = pmtn_get_pid(es);
+        /* Do not lose track of a PMT named in the PAT. */
+        if (demux->types[pid] != TsDemuxPidPmt && pid != TS_DEMUX_PAT_PID) {
+            demux->types[pid] = ts_demux_get_es_type(es);
+            demux->stream_types[pid] = pmtn_get_streamtype(es);
+            demux->pmt_pids[pid] = pmt_pid;
+        }
+    }
+
+    state->version = psi_get_version(section);
+    pid = pmt_get_pcrpid(section);
+    state->pcr_pid = pid != TS_DEMUX_NULL_PID ? pid : TS_DEMUX_NO_PID;
+    if (!state->found) {
+        state->found = TRUE;
+        if (demux->pmts_missing > 0)
+            --demux->pmts_missing;
+    }
+}
+
+static void ts_demux_handle_section(TsDemux *demux, guint16 pid, TsDemuxSection *state, uint8_t *section)
+{
+    if (psi_validate(section)) {
+        if (demux->types[pid] == TsDemuxPidPat)
+            ts_demux_handle_pat(demux, section);
+        else if (demux->types[pid] == TsDemuxPidPmt)
+            ts_demux_handle_pmt(demux, pid, state, section);
+    }
+    free(section);
+}
+
+/* Assemble the sections of a PAT or PMT packet. */
+static void ts_demux_handle_psi(TsDemux *demux, const guint8 *packet, guint16 pid)
+{
+    TsDemuxSection *state = g_hash_table_lookup(demux->sections, GUINT_TO_POINTER(pid));
+    if (!state) {
+        state = g_new0(TsDemuxSection, 1);
+        psi_assemble_init(&state->buffer, &state->used);
+        state->last_cc = -1;
+        g_hash_table_insert(demux->sections, GUINT_TO_POINTER(pid), state);
+    }
+
+    uint8_t cc = ts_get_cc(packet);
+    if (!ts_has_payload(packet) || (state->last_cc >= 0 && ts_check_duplicate(cc, state->last_cc)))
+        return;
+    if (state->last_cc >= 0 && ts_check_discontinuity(cc, state->last_cc))
+        psi_assemble_reset(&state->buffer, &state->used);
+    state->last_cc = cc;
+
+    const uint8_t *payload = ts_section((uint8_t *)packet);
+    uint8_t length = packet + TS_SIZE - payload;
+    uint8_t *section;
+
+    /* The rest of a section started before. */
+    if (!psi_assemble_empty(&state->buffer, &state->used)) {
+        section = psi_assemble_payload(&state->buffer, &state->used, &payload, &length);
+        if (section)
+            ts_demux_handle_section(demux, pid, state, section);
+    }
+
+    /* Sections starting in this packet. */
+    payload = ts_next_section((uint8_t *)packet);
+    length = packet + TS_SIZE - payload;
+    while (length) {
+        section = psi_assemble_payload(&state->buffer, &state->used, &payload, &length);
+        if (section)
+            ts_demux_handle_section(demux, pid, state, section);
+    }
+}
+
+/* Fill the descriptor of a packet starting with the sync byte. */
+static inline void ts_demux_parse(TsDemux *demux, const guint8 *data, TsDemuxPacket *p)
+{
+    guint16 pid = ts_get_pid(data);
+
+    p->data = data;
+    p->offset = demux->offset;
+    p->pid = pid;
+    p->type = demux->types[pid];
+    p->unit_start = ts_get_unitstart(data) ? 1 : 0;
+    p->has_payload = ts_has_payload(data) ? 1 : 0;
+    p->pes_offset = ts_has_adaptation(data) ? MIN(5 + data[4], TS_SIZE) : 4;
+    p->pts = PES_FRAME_TS_INVALID;
+
+    if (G_UNLIKELY(p->type == TsDemuxPidPat || p->type == TsDemuxPidPmt)) {
+        ts_demux_handle_psi(demux, data, pid);
+    }
+    else if ((p->type == TsDemuxPidVideo || p->type == TsDemuxPidPes) && p->unit_start &&
+             p->pes_offset + PES_HEADER_SIZE_PTS <= TS_SIZE) {
+        const uint8_t *pes = data + p->pes_offset;
+        if (pes_validate(pes) && pes_has_pts(pes))
+            p->pts = pes_get_pts(pes);
+    }
+}
+
+void ts_demux_push(TsDemux *demux,
+                   const guint8 *data,
+                   gsize length,
+                   TsDemuxBatchFunc func,
+                   gpointer userdata)
+{
+    g_return_if_fail(demux != NULL);
+
+    const guint8 *end = data + length;
+    const guint8 *next;
+    gsize take;
+    guint count = 0;
+
+    if (demux->carry_len > 0) {
+        take = MIN(length, TS_SIZE - demux->carry_len);
+        memcpy(demux->carry + demux->carry_len, data, take);
+        demux->carry_len += take;
+        data += take;
+        if (demux->carry_len < TS_SIZE)
+            return;
+        /* The carry is reused, so it goes out alone. */
+        if (demux->carry[0] == 0x47) {
+            ts_demux_parse(demux, demux->carry, &demux->batch[0]);
+            if (func)
+                func(demux->batch, 1, userdata);
+        }
+        demux->offset += TS_SIZE;
+        demux->carry_len = 0;
+    }
+
+    while (end - data >= TS_SIZE) {
+        if (G_UNLIKELY(data[0] != 0x47)) {
+            /* Lost sync, continue at the next sync byte. */
+            next = memchr(data + 1, 0x47, end - data - 1);
+            take = next ? (gsize)(next - data) : (gsize)(end - data);
+            demux->offset += take;
+            data += take;
+            continue;
+        }
+        ts_demux_parse(demux, data, &demux->batch[count]);
+        demux->offset += TS_SIZE;
+        data += TS_SIZE;
+        if (++count == TS_DEMUX_BATCH) {
+            if (func)
+                func(demux->batch, count, userdata);
+            count = 0;
+        }
+    }
+    if (count > 0 && func)
+        func(demux->batch, count, userdata);
+
+    /* Carry the incomplete packet from its sync byte, junk before it would take the place of
+     * the next packet. */
+    if (data < end && data[0] != 0x47) {
+        next = memchr(data + 1, 0x47, end - data - 1);
+        take = next ? (gsize)(next - data) : (gsize)(end - data);
+        demux->offset += take;
+        data += take;
+    }
+    demux->carry_len = end - data;
+    memcpy(demux->carry, data, demux->carry_len);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <glib.h>
+
+#define TS_DEMUX_PIDS (8192)
+/* Not a pid, returned if there is none. */
+#define TS_DEMUX_NO_PID (0xFFFF)
+/* Packets handed out at once. */
+#define TS_DEMUX_BATCH (64)
+
+/** @brief What a pid carries, as far as the writer needs to know. */
+typedef enum {
+    TsDemuxPidUnknown = 0, /**< Neither in PAT/PMT nor a reserved pid. */
+    TsDemuxPidPat = 1,
+    TsDemuxPidPmt = 2,
+    TsDemuxPidVideo = 3, /**< MPEG-1/2 or H.264 video. */
+    TsDemuxPidPes = 4, /**< Other PES with timestamps: MPEG audio and teletext. */
+    TsDemuxPidOther = 5 /**< Known, but no timestamps are handled, e.g., SI tables or null packets. */
+} TsDemuxPidType;
+
+/** @brief A packet with its header parsed once. */
+typedef struct {
+    const guint8 *data; /**< Valid during the callback only. */
+    gsize offset;
+    gint64 pts; /**< PTS of a PES unit starting in the packet, PES_FRAME_TS_INVALID otherwise. */
+    guint16 pid;
+    guint8 type; /**< TsDemuxPidType */
+    guint8 unit_start : 1;
+    guint8 has_payload : 1;
+    guint8 pes_offset; /**< Start of the payload. */
+} TsDemuxPacket;
+
+/** @brief Splits buffers into packets and tracks PAT and PMT to know the type of each pid.
+ *  Packets are handed out in batches of up to TS_DEMUX_BATCH, each typed as of its position
+ *  in the stream. Used by one thread only.
+ */
+typedef struct _TsDemux TsDemux;
+
+typedef void (*TsDemuxBatchFunc)(const TsDemuxPacket *packets, guint count, gpointer userdata);
+
+/** @brief Create a new demuxer, knowing only the reserved pids.
+ */
+TsDemux *ts_demux_new(void);
+
+/** @brief Free the demuxer.
+ */
+void ts_demux_free(TsDemux *demux);
+
+/** @brief Continue reading at offset, e.g., after skipping data. An incomplete packet is dropped,
+ *  the pid types are kept.
+ */
+void ts_demux_seek(TsDemux *demux, gsize offset);
+
+/** @brief Split data into packets and pass them to func. The PSI is handled even if func is NULL.
+ *  A new version of a PMT replaces the streams it listed before.
+ */
+void ts_demux_push(TsDemux *demux,
+                   const guint8 *data,
+                   gsize length,
+                   TsDemuxBatchFunc func,
+                   gpointer userdata);
+
+/** @brief Check whether a PAT and all PMTs it names were found.
+ */
+gboolean ts_demux_has_programs(TsDemux *demux);
+
+/** @brief Get the type of a pid.
+ */
+TsDemuxPidType ts_demux_get_pid_type(TsDemux *demux, guint16 pid);
+
+/** @brief Get the stream type of an elementary stream.
+ *  @return The stream type from the PMT or 0 if the pid is not listed in a PMT.
+ */
+guint8 ts_demux_get_stream_type(TsDemux *demux, guint16 pid);
+
+/** @brief Get the pid of the PMT listing an elementary stream, i.e., its program.
+ *  @return The PMT pid or 0 if the pid is not listed in a PMT.
+ */
+guint16 ts_demux_get_pmt_pid(TsDemux *demux, guint16 pid);
+
+/** @brief Check whether a PMT was parsed.
+ */
+gboolean ts_demux_has_pmt(TsDemux *demux, guint16 pmt_pid);
+
+/** @brief Get the PCR pid of the program listing an elementary stream.
+ *  @return The PCR_PID of the PMT or TS_DEMUX_NO_PID if the pid is not listed in a PMT or the
+ *          program has no PCR.
+ */
+guint16 ts_demux_get_pcr_pid(TsDemux *demux, guint16 pid);
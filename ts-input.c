@@ -0,0 +1,574 @@
+#ifdef __linux__
+#define _GNU_SOURCE /* mremap */
+#endif
+#include "ts-input.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/* Chunks handed out from the mapping, multiples of the packet size (188). For random access
+ * the reader stops early, so keep the chunks small there. */
+#define TS_INPUT_MAP_CHUNK_SEQUENTIAL (188 * 4096)
+#define TS_INPUT_MAP_CHUNK_RANDOM (188 * 128)
+#define TS_INPUT_STDIO_BUFFER_SIZE (32768)
+/* Region around a random access that is marked as such. Keep it bounded, so that a concurrent
+ * sequential reader of the same mapping keeps its read-ahead. */
+#define TS_INPUT_RANDOM_WINDOW (8 * 1024 * 1024)
+/* Sequential reads of a mapping ask the kernel for this much data ahead of the reader,
+ * renewed whenever half of it was consumed. */
+#define TS_INPUT_MAP_READ_AHEAD (32 * 1024 * 1024)
+/* Sequential reads without a mapping keep this many large reads in flight, so that the disk
+ * is busy while the previous buffer is parsed. */
+#define TS_INPUT_READ_AHEAD_DEPTH (4)
+#define TS_INPUT_READ_AHEAD_BUFFER_SIZE (188 * 8192)
+/* Shorter ranges are read with plain pread(), a reader thread or ring does not pay off there. */
+#define TS_INPUT_READ_AHEAD_MIN (4 * TS_INPUT_READ_AHEAD_DEPTH * TS_INPUT_READ_AHEAD_BUFFER_SIZE)
+
+struct _TsInput {
+    FILE *file;
+    gsize file_size;
+
+    guint8 *map;
+    gsize map_size;
+    gboolean map_failed;
+    /* Mappings replaced when the file grew. Readers may still use them, so they are only
+     * released when the input is closed. */
+    GList *old_maps; /* [TsInputMap *] */
+    GMutex map_lock; /* Protects file_size, map and map_size. */
+
+    GMutex file_lock; /* Only needed for the stdio fallback. */
+};
+
+typedef struct {
+    guint8 *map;
+    gsize map_size;
+} TsInputMap;
+
+static gsize ts_input_page_size(void)
+{
+    static gsize page_size = 0;
+    if (page_size == 0) {
+        long sz = sysconf(_SC_PAGESIZE);
+        page_size = sz > 0 ? (gsize)sz : 4096;
+    }
+    return page_size;
+}
+
+static void ts_input_advise(guint8 *map, gsize map_size, gsize offset, gsize length, int advice)
+{
+    gsize aligned = offset & ~(ts_input_page_size() - 1);
+    if (aligned >= map_size)
+        return;
+    length += offset - aligned;
+    if (aligned + length > map_size)
+        length = map_size - aligned;
+    /* Only a hint, ignore errors. */
+    madvise(map + aligned, length, advice);
+}
+
+static void ts_input_map(TsInput *input)
+{
+    if (input->file_size == 0)
+        return;
+    void *map = mmap(NULL, input->file_size, PROT_READ, MAP_SHARED, fileno(input->file), 0);
+    if (map == MAP_FAILED) {
+        /* E.g., address space too small for the file, fall back to stdio. */
+        input->map_failed = TRUE;
+        return;
+    }
+    input->map = map;
+    input->map_size = input->file_size;
+}
+
+TsInput *ts_input_open(const gchar *filename)
+{
+    g_return_val_if_fail(filename != NULL, NULL);
+
+    struct stat st;
+    if (stat(filename, &st) != 0)
+        return NULL;
+
+    TsInput *input = g_new0(TsInput, 1);
+    if ((input->file = fopen(filename, "r")) == NULL) {
+        perror("Could not open file");
+        g_free(input);
+        return NULL;
+    }
+
+    input->file_size = st.st_size;
+    g_mutex_init(&input->file_lock);
+    g_mutex_init(&input->map_lock);
+
+    ts_input_map(input);
+
+    return input;
+}
+
+void ts_input_close(TsInput *input)
+{
+    if (input) {
+        if (input->map)
+            munmap(input->map, input->map_size);
+        GList *tmp;
+        for (tmp = input->old_maps; tmp; tmp = g_list_next(tmp)) {
+            munmap(((TsInputMap *)tmp->data)->map, ((TsInputMap *)tmp->data)->map_size);
+            g_free(tmp->data);
+        }
+        g_list_free(input->old_maps);
+        g_mutex_clear(&input->map_lock);
+        g_mutex_lock(&input->file_lock);
+        if (input->file)
+            fclose(input->file);
+        g_mutex_unlock(&input->file_lock);
+        g_mutex_clear(&input->file_lock);
+        g_free(input);
+    }
+}
+
+gsize ts_input_get_size(TsInput *input)
+{
+    if (!input)
+        return 0;
+    g_mutex_lock(&input->map_lock);
+    gsize size = input->file_size;
+    g_mutex_unlock(&input->map_lock);
+    return size;
+}
+
+gboolean ts_input_is_mapped(TsInput *input)
+{
+    if (!input)
+        return FALSE;
+    g_mutex_lock(&input->map_lock);
+    gboolean mapped = input->map != NULL;
+    g_mutex_unlock(&input->map_lock);
+    return mapped;
+}
+
+/* Map the grown file. Called with map_lock held. */
+static void ts_input_remap(TsInput *input)
+{
+    if (input->map == NULL) {
+        if (!input->map_failed)
+            ts_input_map(input);
+        return;
+    }
+
+    if (input->file_size <= input->map_size)
+        return;
+
+#ifdef __linux__
+    /* Growing in place keeps all pointers valid. */
+    void *map = mremap(input->map, input->map_size, input->file_size, 0);
+    if (map != MAP_FAILED) {
+        input->map_size = input->file_size;
+        return;
+    }
+#endif
+
+    TsInputMap *old = g_new(TsInputMap, 1);
+    old->map = input->map;
+    old->map_size = input->map_size;
+    input->old_maps = g_list_prepend(input->old_maps, old);
+
+    input->map = NULL;
+    input->map_size = 0;
+    ts_input_map(input);
+}
+
+gboolean ts_input_refresh(TsInput *input)
+{
+    g_return_val_if_fail(input != NULL, FALSE);
+
+    struct stat st;
+    if (fstat(fileno(input->file), &st) != 0)
+        return FALSE;
+
+    g_mutex_lock(&input->map_lock);
+    /* A recorder only appends, ignore a truncated file. */
+    gboolean grown = (gsize)st.st_size > input->file_size;
+    if (grown) {
+        input->file_size = st.st_size;
+        ts_input_remap(input);
+    }
+    g_mutex_unlock(&input->map_lock);
+
+    return grown;
+}
+
+static void ts_input_read_mapped(guint8 *map,
+                                 gsize offset,
+                                 gsize end,
+                                 TsInputAccess access,
+                                 TsInputReadFunc func,
+                                 gpointer userdata)
+{
+    gsize chunk_size = access == TsInputAccessRandom
+        ? TS_INPUT_MAP_CHUNK_RANDOM
+        : TS_INPUT_MAP_CHUNK_SEQUENTIAL;
+    gsize start = offset;
+    gsize length;
+
+    if (access == TsInputAccessRandom) {
+        /* Only a short read around offset is expected, do not read ahead the whole file. */
+        ts_input_advise(map, end, offset, TS_INPUT_RANDOM_WINDOW, MADV_RANDOM);
+        ts_input_advise(map, end, offset, chunk_size, MADV_WILLNEED);
+    }
+    else {
+        ts_input_advise(map, end, offset, end - offset, MADV_SEQUENTIAL);
+    }
+
+    gsize ahead = offset;
+
+    while (offset < end) {
+        if (access == TsInputAccessSequential && ahead < end &&
+                ahead - offset < TS_INPUT_MAP_READ_AHEAD / 2) {
+            /* Starts asynchronous reads, the page faults below should then be cheap. */
+            ts_input_advise(map, end, ahead, TS_INPUT_MAP_READ_AHEAD, MADV_WILLNEED);
+            ahead = MIN(ahead + TS_INPUT_MAP_READ_AHEAD, end);
+        }
+        length = MIN(chunk_size, end - offset);
+        if (!func(map + offset, length, userdata))
+            break;
+        offset += length;
+    }
+
+    /* The mapping is shared, do not leave other readers without read-ahead. */
+    if (access == TsInputAccessRandom)
+        ts_input_advise(map, end, start, TS_INPUT_RANDOM_WINDOW, MADV_NORMAL);
+}
+
+/* The lock is only held while filling the buffer, so that concurrent readers interleave. */
+static void ts_input_read_stdio(TsInput *input,
+                                gsize offset,
+                                gsize end,
+                                TsInputReadFunc func,
+                                gpointer userdata)
+{
+    guint8 buffer[TS_INPUT_STDIO_BUFFER_SIZE];
+    gsize bytes_read;
+
+    while (offset < end) {
+        g_mutex_lock(&input->file_lock);
+        if (fseeko(input->file, offset, SEEK_SET) == 0)
+            bytes_read = fread(buffer, 1, MIN(TS_INPUT_STDIO_BUFFER_SIZE, end - offset), input->file);
+        else
+            bytes_read = 0;
+        g_mutex_unlock(&input->file_lock);
+
+        if (bytes_read == 0)
+            break;
+        if (!func(buffer, bytes_read, userdata))
+            break;
+        offset += bytes_read;
+    }
+}
+
+/* Read up to length bytes at offset, retrying short reads.
+ * @return The number of bytes read, less than length only at the end of the file or on error. */
+static gsize ts_input_pread(int fd, guint8 *buffer, gsize length, gsize offset)
+{
+    gsize total = 0;
+    ssize_t rc;
+
+    while (total < length) {
+        rc = pread(fd, buffer + total, length - total, offset + total);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0)
+            break;
+        total += rc;
+    }
+
+    return total;
+}
+
+/* A short sequential read without a mapping, one buffer filled with pread(). */
+static void ts_input_read_pread(int fd,
+                                gsize offset,
+                                gsize end,
+                                TsInputReadFunc func,
+                                gpointer userdata)
+{
+    gsize buffer_size = MIN(TS_INPUT_READ_AHEAD_BUFFER_SIZE, end - offset);
+    guint8 *buffer = g_malloc(buffer_size);
+    gsize bytes_read;
+
+    while (offset < end) {
+        bytes_read = ts_input_pread(fd, buffer, MIN(buffer_size, end - offset), offset);
+        if (bytes_read == 0)
+            break;
+        if (!func(buffer, bytes_read, userdata))
+            break;
+        offset += bytes_read;
+    }
+
+    g_free(buffer);
+}
+
+/* Sequential read-ahead without a mapping. The buffers form a ring, filled in order of the
+ * file and handed to the reader in the same order. Reads use pread(), so they neither need
+ * file_lock nor disturb concurrent random access through stdio. */
+typedef struct {
+    guint8 *data;
+    gsize offset;
+    gsize length; /* Requested */
+    gsize result; /* Bytes read */
+    gboolean ready;
+} TsInputReadAheadBuffer;
+
+typedef struct {
+    int fd;
+    gsize offset; /* Next offset to read. */
+    gsize end;
+    guint8 *memory;
+    TsInputReadAheadBuffer buffers[TS_INPUT_READ_AHEAD_DEPTH];
+    guint64 filled; /* Number of buffers read so far. */
+    guint64 consumed; /* Number of buffers handed out so far. */
+    gboolean eof;
+    gboolean stop;
+    GMutex lock;
+    GCond cond;
+} TsInputReadAhead;
+
+static gpointer ts_input_read_ahead_thread(TsInputReadAhead *ra)
+{
+    TsInputReadAheadBuffer *buffer;
+
+    g_mutex_lock(&ra->lock);
+    while (!ra->stop && !ra->eof) {
+        if (ra->filled - ra->consumed >= TS_INPUT_READ_AHEAD_DEPTH) {
+            g_cond_wait(&ra->cond, &ra->lock);
+            continue;
+        }
+        /* The consumer does not touch this buffer until it is marked as filled. */
+        buffer = &ra->buffers[ra->filled % TS_INPUT_READ_AHEAD_DEPTH];
+        buffer->offset = ra->offset;
+        buffer->length = MIN(TS_INPUT_READ_AHEAD_BUFFER_SIZE, ra->end - ra->offset);
+        g_mutex_unlock(&ra->lock);
+
+        buffer->result = ts_input_pread(ra->fd, buffer->data, buffer->length, buffer->offset);
+
+        g_mutex_lock(&ra->lock);
+        ra->offset += buffer->result;
+        ++ra->filled;
+        if (buffer->result < buffer->length || ra->offset >= ra->end)
+            ra->eof = TRUE;
+        g_cond_broadcast(&ra->cond);
+    }
+    g_mutex_unlock(&ra->lock);
+
+    return NULL;
+}
+
+static void ts_input_read_ahead_threaded(int fd,
+                                         gsize offset,
+                                         gsize end,
+                                         TsInputReadFunc func,
+                                         gpointer userdata)
+{
+    TsInputReadAhead ra = {
+        .fd = fd,
+        .offset = offset,
+        .end = end,
+        .memory = g_malloc(TS_INPUT_READ_AHEAD_DEPTH * TS_INPUT_READ_AHEAD_BUFFER_SIZE)
+    };
+    guint j;
+    for (j = 0; j < TS_INPUT_READ_AHEAD_DEPTH; ++j)
+        ra.buffers[j].data = ra.memory + j * TS_INPUT_READ_AHEAD_BUFFER_SIZE;
+    g_mutex_init(&ra.lock);
+    g_cond_init(&ra.cond);
+
+    GThread *thread = g_thread_new("ts-input-read",
+                                   (GThreadFunc)ts_input_read_ahead_thread,
+                                   &ra);
+
+    TsInputReadAheadBuffer *buffer;
+    gboolean cont = TRUE;
+
+    g_mutex_lock(&ra.lock);
+    while (cont) {
+        if (ra.consumed == ra.filled) {
+            if (ra.eof)
+                break;
+            g_cond_wait(&ra.cond, &ra.lock);
+            continue;
+        }
+        buffer = &ra.buffers[ra.consumed % TS_INPUT_READ_AHEAD_DEPTH];
+        g_mutex_unlock(&ra.lock);
+
+        cont = buffer->result > 0 && func(buffer->data, buffer->result, userdata);
+
+        g_mutex_lock(&ra.lock);
+        ++ra.consumed;
+        g_cond_broadcast(&ra.cond);
+    }
+    ra.stop = TRUE;
+    g_cond_broadcast(&ra.cond);
+    g_mutex_unlock(&ra.lock);
+
+    g_thread_join(thread);
+
+    g_cond_clear(&ra.cond);
+    g_mutex_clear(&ra.lock);
+    g_free(ra.memory);
+}
+
+#ifdef HAVE_LIBURING
+/* Keep all buffers of the ring in flight with io_uring, no extra thread is needed.
+ * @return FALSE if io_uring is not available, nothing was read then. */
+static gboolean ts_input_read_ahead_uring(int fd,
+                                          gsize offset,
+                                          gsize end,
+                                          TsInputReadFunc func,
+                                          gpointer userdata)
+{
+    struct io_uring ring;
+    if (io_uring_queue_init(TS_INPUT_READ_AHEAD_DEPTH, &ring, 0) < 0)
+        return FALSE;
+
+    guint8 *memory = g_malloc(TS_INPUT_READ_AHEAD_DEPTH * TS_INPUT_READ_AHEAD_BUFFER_SIZE);
+    TsInputReadAheadBuffer buffers[TS_INPUT_READ_AHEAD_DEPTH];
+    TsInputReadAheadBuffer *buffer;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    guint64 submitted = 0;
+    guint64 consumed = 0;
+    guint pending = 0;
+    gboolean cont = TRUE;
+    int rc;
+
+    while (cont) {
+        while (submitted - consumed < TS_INPUT_READ_AHEAD_DEPTH && offset < end &&
+                (sqe = io_uring_get_sqe(&ring)) != NULL) {
+            buffer = &buffers[submitted % TS_INPUT_READ_AHEAD_DEPTH];
+            buffer->data = memory + (submitted % TS_INPUT_READ_AHEAD_DEPTH) * TS_INPUT_READ_AHEAD_BUFFER_SIZE;
+            buffer->offset = offset;
+            buffer->length = MIN(TS_INPUT_READ_AHEAD_BUFFER_SIZE, end - offset);
+            buffer->result = 0;
+            buffer->ready = FALSE;
+            io_uring_prep_read(sqe, fd, buffer->data, buffer->length, buffer->offset);
+            io_uring_sqe_set_data(sqe, buffer);
+            offset += buffer->length;
+            ++submitted;
+            ++pending;
+        }
+        if (consumed == submitted)
+            break;
+        io_uring_submit(&ring);
+
+        /* Completions may arrive out of order, hand out the buffers in order. */
+        buffer = &buffers[consumed % TS_INPUT_READ_AHEAD_DEPTH];
+        while (!buffer->ready && cont) {
+            rc = io_uring_wait_cqe(&ring, &cqe);
+            if (rc == -EINTR)
+                continue;
+            if (rc < 0) {
+                cont = FALSE;
+                break;
+            }
+            TsInputReadAheadBuffer *done = io_uring_cqe_get_data(cqe);
+            done->result = cqe->res > 0 ? (gsize)cqe->res : 0;
+            done->ready = TRUE;
+            --pending;
+            io_uring_cqe_seen(&ring, cqe);
+        }
+        if (!cont)
+            break;
+
+        /* Short reads are rare, complete them synchronously. */
+        if (buffer->result > 0 && buffer->result < buffer->length)
+            buffer->result += ts_input_pread(fd,
+                                             buffer->data + buffer->result,
+                                             buffer->length - buffer->result,
+                                             buffer->offset + buffer->result);
+
+        cont = buffer->result > 0 && func(buffer->data, buffer->result, userdata);
+        /* End of file or error. */
+        if (buffer->result < buffer->length)
+            cont = FALSE;
+        ++consumed;
+    }
+
+    /* The kernel still writes to the buffers of reads in flight. */
+    while (pending > 0) {
+        rc = io_uring_wait_cqe(&ring, &cqe);
+        if (rc == -EINTR)
+            continue;
+        if (rc < 0)
+            break;
+        --pending;
+        io_uring_cqe_seen(&ring, cqe);
+    }
+
+    io_uring_queue_exit(&ring);
+    if (pending == 0)
+        g_free(memory);
+
+    return TRUE;
+}
+#endif
+
+static void ts_input_read_ahead(TsInput *input,
+                                gsize offset,
+                                gsize end,
+                                TsInputReadFunc func,
+                                gpointer userdata)
+{
+    int fd = fileno(input->file);
+
+    if (end - offset < TS_INPUT_READ_AHEAD_MIN) {
+        ts_input_read_pread(fd, offset, end, func, userdata);
+        return;
+    }
+
+#ifdef HAVE_LIBURING
+    if (ts_input_read_ahead_uring(fd, offset, end, func, userdata))
+        return;
+#endif
+    ts_input_read_ahead_threaded(fd, offset, end, func, userdata);
+}
+
+void ts_input_read_range(TsInput *input,
+                         gsize offset,
+                         gsize length,
+                         TsInputAccess access,
+                         TsInputReadFunc func,
+                         gpointer userdata)
+{
+    g_return_if_fail(input != NULL);
+    g_return_if_fail(func != NULL);
+
+    /* Snapshot, the file may grow while we are reading. */
+    g_mutex_lock(&input->map_lock);
+    guint8 *map = input->map;
+    gsize size = input->map ? input->map_size : input->file_size;
+    g_mutex_unlock(&input->map_lock);
+
+    g_return_if_fail(offset < size);
+
+    gsize end = length < size - offset ? offset + length : size;
+
+    if (map)
+        ts_input_read_mapped(map, offset, end, access, func, userdata);
+    else if (access == TsInputAccessSequential)
+        ts_input_read_ahead(input, offset, end, func, userdata);
+    else
+        ts_input_read_stdio(input, offset, end, func, userdata);
+}
+
+void ts_input_read(TsInput *input,
+                   gsize offset,
+                   TsInputAccess access,
+                   TsInputReadFunc func,
+                   gpointer userdata)
+{
+    ts_input_read_range(input, offset, G_MAXSIZE, access, func, userdata);
+}
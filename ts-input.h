@@ -0,0 +1,63 @@
+#pragma once
+
+#include <glib.h>
+
+/** @brief Opaque type for reading the input stream. */
+typedef struct _TsInput TsInput;
+
+/** @brief Expected access pattern, used for hints to the kernel. */
+typedef enum {
+    TsInputAccessSequential = 0,
+    TsInputAccessRandom = 1
+} TsInputAccess;
+
+/** @brief Called for every chunk of data read.
+ *  @return FALSE to stop reading.
+ */
+typedef gboolean (*TsInputReadFunc)(const guint8 *data, gsize length, gpointer userdata);
+
+/** @brief Open the file for reading. The file is memory-mapped if possible,
+ *  otherwise it is read with stdio.
+ *  @return The input or NULL on error.
+ */
+TsInput *ts_input_open(const gchar *filename);
+
+/** @brief Unmap and close the input.
+ */
+void ts_input_close(TsInput *input);
+
+/** @brief Get the size of the input at the time it was opened or last refreshed.
+ */
+gsize ts_input_get_size(TsInput *input);
+
+/** @brief Whether the input is read from a memory mapping.
+ */
+gboolean ts_input_is_mapped(TsInput *input);
+
+/** @brief Check whether the file has grown, e.g., while it is still being recorded, and
+ *  make the new data available. Data handed out before stays valid.
+ *  @return TRUE if the file has grown.
+ */
+gboolean ts_input_refresh(TsInput *input);
+
+/** @brief Read the input starting at offset until the end or until func returns FALSE.
+ *  Mapped inputs hand out pointers into the mapping, the stdio fallback copies to a
+ *  buffer. Both may be read by several threads at once.
+ *  Sequential reads are read ahead, so that func runs while the next data is read: a mapping
+ *  asks the kernel for the data in advance, otherwise several reads are kept in flight with
+ *  io_uring if available, or with a reader thread.
+ */
+void ts_input_read(TsInput *input,
+                   gsize offset,
+                   TsInputAccess access,
+                   TsInputReadFunc func,
+                   gpointer userdata);
+
+/** @brief Like ts_input_read() but stop after length bytes.
+ */
+void ts_input_read_range(TsInput *input,
+                         gsize offset,
+                         gsize length,
+                         TsInputAccess access,
+                         TsInputReadFunc func,
+                         gpointer userdata);
@@ -1,4 +1,15 @@
 #include "ts-snipper.h"
+#include "ts-input.h"
+#include "start-code.h"
+#include "input-hash.h"
+#include "index-cache.h"
+#include "frame-index.h"
+#include "spsc-ring.h"
+#include "pcr-map.h"
+#include "stream-timeline.h"
+#include "signal-index.h"
+#include "pes-arena.h"
+#include "ts-demux.h"
 
 #include <ts-analyzer.h>
 
@@ -22,25 +33,45 @@ typedef enum {
     WPAIgnore = 3
 } WriterPidAction;
 
+/* Number of pids, the writer keeps a state for each in a table indexed by the pid. */
+#define TSO_PIDS (8192)
+
 typedef struct {
     WriterPidAction action;
     guint8 continuity;
+    guint8 disabled : 1; /* See ts_snipper_disable_pid(), kept between writes. */
+    guint8 seen : 1; /* Seen by the analyzer in this write. */
     gint64 pts_last; /* last pts of this pid */
 } WriterPidInfo;
 
+/* Compiled cut plan of the writer, see tsn_compile_cut_plan(). */
+typedef enum {
+    TsnCutKeep = 0, /* Written. Once all pids write again after a cut, packets are only copied. */
+    TsnCutEnter = 1, /* Start of a slice, read until all pids ignore it, the rest is skipped. */
+    TsnCutLeave = 2 /* Guard window before the end of a slice, read. */
+} TsnCutType;
+
+typedef struct {
+    TsnCutType type;
+    gsize begin;
+    gsize end;
+    gint64 pcr_delta; /* Removed before the range in 27 MHz, subtracted from PCR, PTS and DTS. */
+} TsnCutRange;
+
 typedef struct {
     GList *slices; /**< [TsSlice *] */
-    GList *active_slice; /**< Pointer to next/current slice in slices. */
-    GArray *disabled_pids; /* [guint16] */
+    GList *write_slices; /**< [TsSlice *] Copy of slices with the cuts before the first and after
+                              the last I frame, only while writing. */
+    GList *active_slice; /**< Pointer to next/current slice in write_slices. */
     guint32 next_slice_id;
 
-    guint32 writer_client_id;
-
     TsSnipperWriteFunc writer;
     gpointer writer_data;
     gboolean writer_result;
 
     gsize bytes_read;
+    GArray *plan; /* [TsnCutRange] Only while writing. */
+    const TsnCutRange *cut_range; /* Range being read. */
 
     guint8 *buffer;
     gsize buffer_size;
@@ -50,10 +81,12 @@ typedef struct {
     guint32 have_pmt : 1;
     guint32 in_slice : 1; /* Whether we are inside a slice or not. */
     guint32 pcr_present : 1;
+    guint32 copy : 1; /* All pids write in a kept range, packets are only copied and patched. */
 
-    WriterPidInfo *pid_writer_infos; /* When writing starts, set the actions for all pids. */
-    gsize pids_seen;
-    gsize pid_count;
+    WriterPidInfo *pids; /* [TSO_PIDS] When writing starts, set the actions for all pids. */
+    guint16 *pids_seen; /* [TSO_PIDS] In the order seen. */
+    guint pid_count; /* Entries of pids_seen. */
+    WriterPidAction pid_action; /* Action of pids not seen yet. */
 
     gint64 pcr_delta;
     gint64 pcr_delta_accumulator; /* During an active slice, accumulate the deltas. Necessary
@@ -69,54 +102,143 @@ typedef struct {
     gint64 pts_cut;
 } TsSnipperOutput;
 
+typedef enum {
+    TsnPictureI = 1,
+    TsnPictureP = 2,
+    TsnPictureB = 3
+} TsnPictureType;
+
+/* A picture which may change the index state, see TsnIndexer. */
+typedef struct {
+    TsnPictureType type;
+    PidType pidtype;
+    guint16 pid;
+    gsize packet_start;
+    gsize packet_end;
+    guint64 pts;
+    guint64 dts;
+    guint64 pcr;
+} TsnPictureEvent;
+
+/* Candidate for the first pcr/pts pair of the stream. */
+typedef struct {
+    guint64 pcr;
+    guint64 pts;
+} TsnTimestampEvent;
+
+/* State of the frame detection. A sequential analysis applies every picture directly to the
+ * snipper. Chunk workers do not know the state at the start of their chunk, so they only record
+ * the pictures and timestamps that may change it, and these are replayed in order afterwards. */
+typedef struct {
+    TsSnipper *tsn;
+
+    /* first B frame after an I or P frame without another one yet */
+    gsize dangling_bframe_start;
+    gboolean dangling_bframe_present;
+
+    /* Only used by chunk workers, NULL otherwise. */
+    GArray *pictures; /* [TsnPictureEvent] */
+    GArray *timestamps; /* [TsnTimestampEvent] */
+    GArray *pcrs; /* [PcrMapEntry] PCR as read from the stream, thinned like the seek table. */
+    gboolean dangling_bframe_known; /* dangling_bframe_present no longer depends on the previous chunk. */
+    guint64 pcr_first;
+    guint64 pts_first;
+} TsnIndexer;
+
+typedef struct _PESData PESData;
+typedef struct _TsnAnalyzeStep TsnAnalyzeStep;
+
+/* Distance of the entries of the PCR seek table, 100 ms. */
+#define TSN_PCR_TABLE_INTERVAL (27000000 / 10)
+/* Size of the buckets of the timeline, about 1.5 s at 8 Mbit/s. */
+#define TSN_TIMELINE_BUCKET_SIZE (188 * 8192)
+/* Memory an idle PES arena keeps for the next operation. */
+#define TSN_ARENA_KEEP (4 * 1024 * 1024)
+
 struct _TsSnipper {
-    PidInfoManager *pmgr;
+    PidInfoManager *pmgr; /* Only used by the analysis thread, random access keeps its own state. */
     uint32_t analyzer_client_id;
-    uint32_t random_access_client_id;
     TsSnipperState state;
 
     gint ref_count;
 
     gchar *filename;
-    FILE *file;
+    TsInput *input;
     gsize file_size;
     gsize bytes_read;
-    GChecksum *checksum;
-
-    GArray *frame_infos;
-    guint32 iframe_count;
+    InputHash *hash; /* SHA-1 of the input, computed next to the analysis. */
+    InputFingerprint fingerprint; /* Computed on first use, reset when the input grows. */
+    gboolean have_fingerprint;
+
+    FrameIndex *frames; /* Readers do not need data_lock. */
+    PcrMap *pcrs; /* PCR seek table, written by the analysis next to frames. */
+    StreamTimeline *timeline; /* Bitrate and GOP statistics of the analysis. */
+    StreamTimelineWriter *timeline_writer; /* Used by the thread writing the index. */
+    SignalIndex *signals; /* EIT events and SCTE-35 splices found by the analysis. */
+    SignalParser *signal_parser; /* Used by the thread writing the index. */
     guint16 video_pid;
-
-    /* first B frame after an I or P frame without another one yet */
-    gsize dangling_bframe_start;
-    gboolean dangling_bframe_present;
+    PidType video_pidtype;
+    guint16 pcr_pid; /* PCR_PID of the video's program if it is another pid, 0 otherwise. */
+    PESData *video_pes; /* PES of video_pid in the analyzer, continued by the prefilter. */
+    PESData *filter_pes; /* Started by the prefilter when the PMT moved the video, owned. */
+    TsDemux *psi; /* PAT and PMTs seen by the prefilter of the analysis. */
+    PesArena *analyze_arena; /* PES states of the analysis, released when it ends. */
+    PesArena *random_access_arena; /* PES states and payloads of ts_snipper_get_iframe_at(), which
+                                      may run while the analysis thread uses pmgr. */
+
+    TsnIndexer indexer;
+    guint analyze_threads; /* 0: one per processor */
+    TsnAnalyzeStep *step; /* State of ts_snipper_analyze_step(), NULL if not running. */
+
+    PcrMap *sparse_pcrs; /* Sampled by ts_snipper_analyze_sparse(). */
+    guint16 sparse_pcr_pid;
+    GArray *sparse_frames; /* [TsnSparseFrame] I frames found on demand, sorted. */
+
+    gboolean follow; /* Keep indexing data appended to the input, see ts_snipper_set_follow(). */
+    GCond follow_cond;
+
+    gboolean use_index_cache;
+    gboolean index_complete; /* The analysis is done, the index may be cached. */
+    gboolean index_cached; /* The index cache is up to date. */
 
     TsSnipperOutput out;
 
-    GMutex file_lock;
     GMutex data_lock;
 };
 
+/* Bytes kept between two payloads, so that start codes crossing packet boundaries are found. */
+#define PES_SCAN_CARRY_MAX (8)
+
 /* In own module? */
-typedef struct _PESData {
+struct _PESData {
+    PesArena *arena;
     size_t packet_start;
     size_t packet_end;
-    GByteArray *data;
+    uint8_t *data; /* Only used when reassembling the payload, NULL otherwise. */
+    size_t data_len;
     uint64_t pts;
     uint64_t dts;
     uint64_t pcr;
+    uint16_t pid; /* Of the current unit. */
 
     uint32_t have_start : 1;
     uint32_t complete : 1;
     uint32_t have_pts : 1;
     uint32_t have_dts : 1;
-} PESData;
+    uint32_t scan_done : 1; /* Frame type is known, ignore the rest of the payload. */
+    uint32_t is_iframe : 1;
+
+    uint8_t scan_carry[PES_SCAN_CARRY_MAX]; /* Tail of the last payload not yet scanned. */
+    uint8_t scan_carry_len;
+};
+
+/* Initial size of a reassembly buffer, grown by the size classes of the arena. */
+#define PES_DATA_SIZE_MIN (64 * 1024)
 
-PESData *pes_data_new()
+PESData *pes_data_new(PesArena *arena)
 {
-    PESData *pes = malloc(sizeof(PESData));
-    memset(pes, 0, sizeof(PESData));
-    pes->data = g_byte_array_new();
+    PESData *pes = pes_arena_alloc0(arena, sizeof(PESData));
+    pes->arena = arena;
     pes->pts = PES_FRAME_TS_INVALID;
     pes->dts = PES_FRAME_TS_INVALID;
     pes->pcr = PES_FRAME_TS_INVALID;
@@ -126,8 +248,8 @@ PESData *pes_data_new()
 void pes_data_free(PESData *pes)
 {
     if (pes) {
-        g_byte_array_free(pes->data, TRUE);
-        free(pes);
+        pes_arena_release(pes->arena, pes->data);
+        pes_arena_release(pes->arena, pes);
     }
 }
 
@@ -144,110 +266,334 @@ void pes_data_clear(PESData *pes)
         pes->complete = 0;
         pes->have_pts = 0;
         pes->have_dts = 0;
+        pes->scan_done = 0;
+        pes->is_iframe = 0;
+        pes->scan_carry_len = 0;
 
-        g_byte_array_remove_range(pes->data, 0, pes->data->len);
+        /* Keep the buffer for the next unit. */
+        pes->data_len = 0;
     }
 }
 
-void pes_data_analyze_video_13818(PESData *pes, TsSnipper *tsn)
+void pes_data_append(PESData *pes, const uint8_t *data, size_t length)
+{
+    if (!pes->data || pes->data_len + length > pes_arena_get_capacity(pes->data))
+        pes->data = pes_arena_realloc(pes->arena, pes->data, MAX(pes->data_len + length, PES_DATA_SIZE_MIN));
+    memcpy(pes->data + pes->data_len, data, length);
+    pes->data_len += length;
+}
+
+static void tso_check_first_pcr_pts(TsSnipperOutput *tso,
+                                    gint64 pcr,
+                                    gint64 pts)
 {
-    if (!pes->have_start) {
+    /* If both are set, do noting. */
+    if (tso->pts_stream_first != PES_FRAME_TS_INVALID
+            && tso->pcr_stream_first != PES_FRAME_TS_INVALID)
         return;
+    /* Update the timestamps until both are set, in order to get a pair close to each other. */
+    if (pcr != PES_FRAME_TS_INVALID)
+        tso->pcr_stream_first = pcr;
+    if (pts != PES_FRAME_TS_INVALID)
+        tso->pts_stream_first = pts;
+#if DEBUG
+    fprintf(stderr, "First pcr/pts: %" G_GINT64_FORMAT ", %" G_GINT64_FORMAT "\n",
+            tso->pcr_stream_first, tso->pts_stream_first);
+#endif
+}
+
+static void tsn_indexer_init(TsnIndexer *indexer, TsSnipper *tsn, gboolean record)
+{
+    memset(indexer, 0, sizeof(TsnIndexer));
+    indexer->tsn = tsn;
+    indexer->pcr_first = PES_FRAME_TS_INVALID;
+    indexer->pts_first = PES_FRAME_TS_INVALID;
+    if (record) {
+        indexer->pictures = g_array_new(FALSE, FALSE, sizeof(TsnPictureEvent));
+        indexer->timestamps = g_array_new(FALSE, FALSE, sizeof(TsnTimestampEvent));
+        indexer->pcrs = g_array_new(FALSE, FALSE, sizeof(PcrMapEntry));
     }
+}
 
-    size_t bytes_left = pes->data->len;
-    uint8_t *data = pes->data->data;
+static void tsn_indexer_clear(TsnIndexer *indexer)
+{
+    if (indexer->pictures)
+        g_array_free(indexer->pictures, TRUE);
+    if (indexer->timestamps)
+        g_array_free(indexer->timestamps, TRUE);
+    if (indexer->pcrs)
+        g_array_free(indexer->pcrs, TRUE);
+    indexer->pictures = NULL;
+    indexer->timestamps = NULL;
+    indexer->pcrs = NULL;
+}
 
-    while (bytes_left > 5) {
-        if (data[0] == 0x00 && data[1] == 0x00 && data[2] == 0x01 && data[3] == 0x00) { /* pic start */
-            uint8_t pictype = ((data[5] >> 3) & 0x7);
+static void tsn_indexer_timestamps(TsnIndexer *indexer, guint64 pcr, guint64 pts)
+{
+    if (!indexer->timestamps) {
+        tso_check_first_pcr_pts(&indexer->tsn->out, pcr, pts);
+        return;
+    }
+    /* Once a pair is complete in this chunk, later candidates cannot change the result. */
+    if (indexer->pcr_first != PES_FRAME_TS_INVALID && indexer->pts_first != PES_FRAME_TS_INVALID)
+        return;
+    TsnTimestampEvent ev = { .pcr = pcr, .pts = pts };
+    g_array_append_val(indexer->timestamps, ev);
+    if (pcr != PES_FRAME_TS_INVALID)
+        indexer->pcr_first = pcr;
+    if (pts != PES_FRAME_TS_INVALID)
+        indexer->pts_first = pts;
+}
 
-            if (pictype == 1) {
-                /* Found start of I frame */
-                PESFrameInfo frame_info = {
-                    .frame_number = tsn->iframe_count++,
-                    .stream_offset_start = pes->packet_start,
-                    .stream_offset_end = pes->packet_end,
-                    .stream_offset_dangling_bframe =
-                        tsn->dangling_bframe_present ? tsn->dangling_bframe_start : pes->packet_start,
-                    .pts = pes->pts,
-                    .dts = pes->dts,
-                    .pcr = pes->pcr,
-                    .pidtype = PID_TYPE_VIDEO_13818
-                };
-                g_mutex_lock(&tsn->data_lock);
-                g_array_append_val(tsn->frame_infos, frame_info);
-                g_mutex_unlock(&tsn->data_lock);
-                tsn->dangling_bframe_present = FALSE;
+/* Add the PCR to the seek table. */
+static void tsn_indexer_pcr(TsnIndexer *indexer, gsize offset, guint64 pcr)
+{
+    if (!indexer->pcrs) {
+        pcr_map_add(indexer->tsn->pcrs, offset, pcr);
+        return;
+    }
+    /* The table thins again when the chunks are stitched, this only keeps the array small. */
+    if (indexer->pcrs->len > 0) {
+        guint64 last = g_array_index(indexer->pcrs, PcrMapEntry, indexer->pcrs->len - 1).pcr;
+        if ((pcr + PCR_MAP_WRAP - last) % PCR_MAP_WRAP < TSN_PCR_TABLE_INTERVAL)
+            return;
+    }
+    PcrMapEntry entry = { .offset = offset, .pcr = pcr };
+    g_array_append_val(indexer->pcrs, entry);
+}
+
+/* Add the PCR of a packet of tsn->pcr_pid, the timestamps only come from the video. */
+static void tsn_indexer_pcr_packet(TsnIndexer *indexer, const uint8_t *packet, gsize offset)
+{
+    if (ts_has_adaptation(packet) && tsaf_has_pcr(packet))
+        tsn_indexer_pcr(indexer, offset, tsaf_get_pcr(packet) * 300 + tsaf_get_pcrext(packet));
+}
+
+/* Only called by the analysis, which is the only writer. */
+static void tsn_add_frame(TsSnipper *tsn, PESFrameInfo *frame_info)
+{
+    frame_info->frame_number = frame_index_append(tsn->frames, frame_info);
+}
+
+static void tsn_indexer_apply_picture(TsnIndexer *indexer, const TsnPictureEvent *pic)
+{
+    if (pic->type == TsnPictureI) {
+        PESFrameInfo frame_info = {
+            .stream_offset_start = pic->packet_start,
+            .stream_offset_end = pic->packet_end,
+            .stream_offset_dangling_bframe =
+                indexer->dangling_bframe_present ? indexer->dangling_bframe_start : pic->packet_start,
+            .pts = pic->pts,
+            .dts = pic->dts,
+            .pcr = pic->pcr,
+            .pidtype = pic->pidtype,
+            .pid = pic->pid
+        };
+        tsn_add_frame(indexer->tsn, &frame_info);
+        stream_timeline_writer_add_iframe(indexer->tsn->timeline_writer, pic->packet_start);
+        /* FIXME: Is there a similar concept to P frames in 14496-10? */
+        if (pic->pidtype == PID_TYPE_VIDEO_13818)
+            indexer->dangling_bframe_present = FALSE;
 #if DEBUG
-                fprintf(stderr, "I frame %" G_GINT64_FORMAT " (%u) delta to pcr %" G_GINT64_FORMAT "\n",
-                        pes->pts, frame_info.frame_number,
-                        pes->pts - (pes->pcr / 300));
+        fprintf(stderr, "I frame %" G_GINT64_FORMAT " (%u) delta to pcr %" G_GINT64_FORMAT "\n",
+                pic->pts, frame_info.frame_number,
+                pic->pts - (pic->pcr / 300));
 #endif
-                break;
+    }
+    else if (pic->type == TsnPictureP) {
+        /* P frames reset the dangling B frame also. */
+        indexer->dangling_bframe_present = FALSE;
+    }
+    else if (pic->type == TsnPictureB) {
+        /* Only remember the first dangling B frame. */
+        if (!indexer->dangling_bframe_present) {
+            indexer->dangling_bframe_start = pic->packet_start;
+            indexer->dangling_bframe_present = TRUE;
+        }
+    }
+}
+
+static void tsn_indexer_add_picture(TsnIndexer *indexer, PESData *pes, TsnPictureType type, PidType pidtype)
+{
+    TsnPictureEvent pic = {
+        .type = type,
+        .pidtype = pidtype,
+        .pid = pes->pid,
+        .packet_start = pes->packet_start,
+        .packet_end = pes->packet_end,
+        .pts = pes->pts,
+        .dts = pes->dts,
+        .pcr = pes->pcr
+    };
+
+    if (!indexer->pictures) {
+        tsn_indexer_apply_picture(indexer, &pic);
+        return;
+    }
+
+    /* Drop pictures that leave the state unchanged whatever it was at the start of the chunk. */
+    gboolean record = TRUE;
+    if (type == TsnPictureB) {
+        record = !indexer->dangling_bframe_known || !indexer->dangling_bframe_present;
+        indexer->dangling_bframe_known = TRUE;
+        indexer->dangling_bframe_present = TRUE;
+    }
+    else if (type == TsnPictureP) {
+        record = !indexer->dangling_bframe_known || indexer->dangling_bframe_present;
+        indexer->dangling_bframe_known = TRUE;
+        indexer->dangling_bframe_present = FALSE;
+    }
+    else if (pidtype == PID_TYPE_VIDEO_13818) {
+        indexer->dangling_bframe_known = TRUE;
+        indexer->dangling_bframe_present = FALSE;
+    }
+    if (record)
+        g_array_append_val(indexer->pictures, pic);
+}
+
+/* Handle all start codes in data beginning at a position p with p + need <= length.
+ * Return TRUE if the frame type is known and the rest of the payload can be ignored. */
+typedef gboolean (*PESScanFunc)(PESData *, const uint8_t *, size_t, gpointer);
+
+/* Scan the payload without reassembling the PES. The last need - 1 bytes of each payload cannot
+ * be checked yet, so they are carried over and checked together with the start of the next one. */
+static void pes_data_scan_payload(PESData *pes,
+                                  const uint8_t *data,
+                                  size_t length,
+                                  size_t need,
+                                  PESScanFunc scan,
+                                  gpointer userdata)
+{
+    if (pes->scan_done)
+        return;
+
+    if (pes->scan_carry_len > 0) {
+        uint8_t joint[2 * PES_SCAN_CARRY_MAX];
+        size_t take = MIN(length, need - 1);
+        size_t joint_len = pes->scan_carry_len + take;
+
+        memcpy(joint, pes->scan_carry, pes->scan_carry_len);
+        memcpy(joint + pes->scan_carry_len, data, take);
+
+        /* Only positions inside the carry, the others are checked in data itself. */
+        if (scan(pes, joint, MIN(joint_len, pes->scan_carry_len + need - 1), userdata)) {
+            pes->scan_done = 1;
+            return;
+        }
+        if (take < need - 1) {
+            /* Payload too short to finish the carry. Keep everything not checked yet. */
+            size_t first = joint_len >= need ? joint_len - need + 1 : 0;
+            pes->scan_carry_len = joint_len - first;
+            memcpy(pes->scan_carry, joint + first, pes->scan_carry_len);
+            return;
+        }
+    }
+
+    if (scan(pes, data, length, userdata)) {
+        pes->scan_done = 1;
+        return;
+    }
+
+    size_t first = length >= need ? length - need + 1 : 0;
+    pes->scan_carry_len = length - first;
+    memcpy(pes->scan_carry, data + first, pes->scan_carry_len);
+}
+
+/* Picture start code plus the two bytes containing the picture coding type. */
+#define PES_SCAN_NEED_13818 (6)
+/* Start code plus the NAL unit header. */
+#define PES_SCAN_NEED_14496 (4)
+
+/* The picture type is decided by the first picture header (MPEG-2) or the first slice (H.264),
+ * the scan stops there and the rest of the unit is skipped. */
+static gboolean pes_data_scan_video_13818(PESData *pes, const uint8_t *data, size_t length, TsnIndexer *indexer)
+{
+    const uint8_t *end = data + length;
+
+    while ((data = start_code_find(data, end - data)) != NULL && end - data >= PES_SCAN_NEED_13818) {
+        if (data[3] == 0x00) { /* pic start */
+            uint8_t pictype = ((data[5] >> 3) & 0x7);
+
+            if (pictype == 1) {
+                /* Found start of I frame, added when the end of the PES is known. */
+                pes->is_iframe = 1;
+                return TRUE;
             }
             else if (pictype == 2) {
-                /* P frames reset the dangling B frame also. */
-                tsn->dangling_bframe_present = FALSE;
 #if DEBUG
                 fprintf(stderr, "P frame %" G_GINT64_FORMAT "\n", pes->pts);
 #endif
+                tsn_indexer_add_picture(indexer, pes, TsnPictureP, PID_TYPE_VIDEO_13818);
+                return TRUE;
             }
             else if (pictype == 3) {
-                /* Only remember the first dangling B frame. */
 #if DEBUG
                 fprintf(stderr, "B frame %" G_GINT64_FORMAT "\n", pes->pts);
 #endif
-                if (!tsn->dangling_bframe_present) {
-                    tsn->dangling_bframe_start = pes->packet_start;
-                    tsn->dangling_bframe_present = TRUE;
-                }
+                tsn_indexer_add_picture(indexer, pes, TsnPictureB, PID_TYPE_VIDEO_13818);
+                return TRUE;
             }
         }
 
         ++data;
-        --bytes_left;
     }
+    return FALSE;
 }
 
-void pes_data_analyze_video_14496(PESData *pes, TsSnipper *tsn)
+static gboolean pes_data_scan_video_14496(PESData *pes, const uint8_t *data, size_t length, TsnIndexer *indexer)
 {
-    if (!pes->have_start)
-        return;
+    const uint8_t *end = data + length;
 
-    size_t bytes_left = pes->data->len;
-    uint8_t *data = pes->data->data;
-
-    while (bytes_left > 3) {
-        if (data[0] == 0x00 && data[1] == 0x00 && data[2] == 0x01 && (data[3] & 0x1f) == 5) {
-            if ((data[3] & 0x1f) == 5) {
-                /* IDR image start */
-                PESFrameInfo frame_info = {
-                    .frame_number = tsn->iframe_count++,
-                    .stream_offset_start = pes->packet_start,
-                    .stream_offset_end = pes->packet_end,
-                    .stream_offset_dangling_bframe =
-                        tsn->dangling_bframe_present ? tsn->dangling_bframe_start : pes->packet_start,
-                    .pts = pes->pts,
-                    .dts = pes->dts,
-                    .pcr = pes->pcr,
-                    .pidtype = PID_TYPE_VIDEO_14496
-                };
-                g_mutex_lock(&tsn->data_lock);
-                g_array_append_val(tsn->frame_infos, frame_info);
-                g_mutex_unlock(&tsn->data_lock);
-                break;
-            }
-            else {
-                /* FIXME: Is there a similar concept to P frames in 14496-10? */
-                if (!tsn->dangling_bframe_present)
-                    tsn->dangling_bframe_start = pes->packet_start;
-            }
+    uint8_t nal_type;
+
+    while ((data = start_code_find(data, end - data)) != NULL && end - data >= PES_SCAN_NEED_14496) {
+        nal_type = data[3] & 0x1f;
+        if (nal_type == 5) {
+            /* IDR image start, added when the end of the PES is known. */
+            pes->is_iframe = 1;
+            return TRUE;
+        }
+        if (nal_type >= 1 && nal_type <= 4) {
+            /* Non-IDR slice. All slices of a picture have the same type, no need to look further. */
+            return TRUE;
         }
 
         ++data;
-        --bytes_left;
     }
+    return FALSE;
+}
+
+static void pes_data_scan_payload_13818(PESData *pes, const uint8_t *data, size_t length, TsnIndexer *indexer)
+{
+    if (pes->have_start)
+        pes_data_scan_payload(pes, data, length, PES_SCAN_NEED_13818,
+                              (PESScanFunc)pes_data_scan_video_13818, indexer);
+}
+
+static void pes_data_scan_payload_14496(PESData *pes, const uint8_t *data, size_t length, TsnIndexer *indexer)
+{
+    if (pes->have_start)
+        pes_data_scan_payload(pes, data, length, PES_SCAN_NEED_14496,
+                              (PESScanFunc)pes_data_scan_video_14496, indexer);
+}
+
+/* Called when the PES is complete, i.e., when the next unit starts. */
+void pes_data_analyze_video_13818(PESData *pes, TsnIndexer *indexer)
+{
+    if (!pes->have_start || !pes->is_iframe) {
+        return;
+    }
+
+    tsn_indexer_add_picture(indexer, pes, TsnPictureI, PID_TYPE_VIDEO_13818);
+}
+
+void pes_data_analyze_video_14496(PESData *pes, TsnIndexer *indexer)
+{
+    if (!pes->have_start || !pes->is_iframe)
+        return;
+
+    /* IDR image start */
+    tsn_indexer_add_picture(indexer, pes, TsnPictureI, PID_TYPE_VIDEO_14496);
 }
 
 typedef gboolean (*TsnResumeCallback)(gpointer);
@@ -258,102 +604,109 @@ static gboolean _tsn_resume_true(gpointer nil)
     return TRUE;
 }
 
+struct TsnReadContext {
+    TsAnalyzer *analyzer;
+    InputHash *hash; /* Feed the buffers to the hash if not NULL. */
+    TsnResumeCallback resume;
+    gpointer resume_data;
+};
+
+static gboolean _tsn_read_push_buffer(const guint8 *data, gsize length, struct TsnReadContext *ctx)
+{
+    if (!ctx->resume(ctx->resume_data))
+        return FALSE;
+    if (ctx->hash)
+        input_hash_feed(ctx->hash, data, length);
+    /* The analyzer does not modify the data, so we may pass the mapping directly. */
+    ts_analyzer_push_buffer(ctx->analyzer, (uint8_t *)data, length);
+    return TRUE;
+}
+
 #define TSN_READ_BUFFER_SIZE (32768)
 static void tsn_read_buffered(TsSnipper *snipper,
                               TsAnalyzer *analyzer,
                               gsize start_offset,
+                              TsInputAccess access,
                               TsnResumeCallback resume,
-                              gpointer resume_data)
+                              gpointer resume_data,
+                              gboolean feed_hash)
 {
     g_return_if_fail(snipper != NULL);
     g_return_if_fail(analyzer != NULL);
-    g_return_if_fail(snipper->file != NULL);
+    g_return_if_fail(snipper->input != NULL);
     g_return_if_fail(start_offset < snipper->file_size);
 
-    if (resume == NULL)
-        resume = _tsn_resume_true;
-
-    g_mutex_lock(&snipper->file_lock);
-    fseek(snipper->file, start_offset, SEEK_SET);
-
-    guint8 buffer[TSN_READ_BUFFER_SIZE];
-    gsize bytes_read;
-
-    while (!feof(snipper->file) && resume(resume_data)) {
-        bytes_read = fread(buffer, 1, TSN_READ_BUFFER_SIZE, snipper->file);
-        if (bytes_read == 0)
-            break;
-        ts_analyzer_push_buffer(analyzer, buffer, bytes_read);
-    }
-    g_mutex_unlock(&snipper->file_lock);
-}
+    struct TsnReadContext ctx = {
+        .analyzer = analyzer,
+        .hash = feed_hash ? snipper->hash : NULL,
+        .resume = resume ? resume : _tsn_resume_true,
+        .resume_data = resume_data
+    };
 
-static void tso_check_first_pcr_pts(TsSnipperOutput *tso,
-                                    gint64 pcr,
-                                    gint64 pts)
-{
-    /* If both are set, do noting. */
-    if (tso->pts_stream_first != PES_FRAME_TS_INVALID
-            && tso->pcr_stream_first != PES_FRAME_TS_INVALID)
-        return;
-    /* Update the timestamps until both are set, in order to get a pair close to each other. */
-    if (pcr != PES_FRAME_TS_INVALID)
-        tso->pcr_stream_first = pcr;
-    if (pts != PES_FRAME_TS_INVALID)
-        tso->pts_stream_first = pts;
-#if DEBUG
-    fprintf(stderr, "First pcr/pts: %" G_GINT64_FORMAT ", %" G_GINT64_FORMAT "\n",
-            tso->pcr_stream_first, tso->pts_stream_first);
-#endif
+    ts_input_read(snipper->input,
+                  start_offset,
+                  access,
+                  (TsInputReadFunc)_tsn_read_push_buffer,
+                  &ctx);
 }
 
 typedef void (*PESFinishedFunc)(PESData *, gpointer);
+typedef void (*PESPayloadFunc)(PESData *, const uint8_t *, size_t, gpointer);
 
-static void _tsn_handle_pes(TsSnipper *tsn,
-                            PidInfo *pidinfo,
-                            uint32_t client_id,
-                            const uint8_t *packet,
-                            const size_t offset,
-                            PESFinishedFunc finished_cb,
-                            void *cb_data)
+static void pes_data_finish(PESData *pes, const size_t offset, PESFinishedFunc finished_cb, void *cb_data)
 {
-    PESData *pes = NULL;
-
-    pes = pid_info_get_private_data(pidinfo, client_id);
-    if (!pes) {
-        pes = pes_data_new();
-        pid_info_set_private_data(pidinfo, client_id, pes, (PidInfoPrivateDataFree)pes_data_free);
-    }
+    pes->complete = 1;
+    pes->packet_end = offset;
+    if (finished_cb)
+        finished_cb(pes, cb_data);
+}
 
+/* Track the PES units of a pid. If payload_cb is NULL, the payload is reassembled in pes->data,
+ * otherwise it is passed to payload_cb packet by packet. Timestamps are passed to the indexer
+ * if it is not NULL. */
+static void pes_data_push_packet(PESData *pes,
+                                 TsnIndexer *indexer,
+                                 const uint8_t *packet,
+                                 const size_t offset,
+                                 PESPayloadFunc payload_cb,
+                                 PESFinishedFunc finished_cb,
+                                 void *cb_data)
+{
     size_t pes_offset = 4;
     guint64 pcr = PES_FRAME_TS_INVALID;
     if (ts_has_adaptation(packet)) {
         pes_offset += 1 + packet[4];
         if (tsaf_has_pcr(packet)) {
             pcr = tsaf_get_pcr(packet) * 300 + tsaf_get_pcrext(packet);
-            tso_check_first_pcr_pts(&tsn->out, pcr, PES_FRAME_TS_INVALID);
+            if (indexer) {
+                tsn_indexer_timestamps(indexer, pcr, PES_FRAME_TS_INVALID);
+                tsn_indexer_pcr(indexer, offset, pcr);
+            }
         }
     }
 
+    /* The picture type is known, the rest of the unit is not needed. */
+    if (payload_cb && pes->scan_done && !ts_get_unitstart(packet))
+        return;
+
     size_t pes_data_len = 0;
     uint8_t *pes_data = (uint8_t *)&packet[pes_offset];
 
     if (ts_get_unitstart(packet)) {
         /* Finish last packet. */
-        pes->complete = 1;
-        pes->packet_end = offset;
-        if (finished_cb)
-            finished_cb(pes, cb_data);
+        pes_data_finish(pes, offset, finished_cb, cb_data);
 
         /* Setup new packet. */
         pes_data_clear(pes);
         pes->packet_start = offset;
+        pes->pid = ts_get_pid(packet);
         pes->have_start = 1;
         pes->pcr = pcr;
         if (pes_has_pts(pes_data)) {
             pes->pts = pes_get_pts(pes_data);
             pes->have_pts = 1;
-            tso_check_first_pcr_pts(&tsn->out, pcr, pes->pts);
+            if (indexer)
+                tsn_indexer_timestamps(indexer, pcr, pes->pts);
         }
         if (pes_has_dts(pes_data)) {
             pes->dts = pes_get_dts(pes_data);
@@ -368,7 +721,59 @@ static void _tsn_handle_pes(TsSnipper *tsn,
         pes_data_len = 188 - pes_offset;
     }
 
-    g_byte_array_append(pes->data, pes_data, pes_data_len);
+    if (payload_cb)
+        payload_cb(pes, pes_data, pes_data_len, cb_data);
+    else
+        pes_data_append(pes, pes_data, pes_data_len);
+}
+
+static void _tsn_handle_pes(TsSnipper *tsn,
+                            PidInfo *pidinfo,
+                            uint32_t client_id,
+                            PesArena *arena,
+                            TsnIndexer *indexer,
+                            const uint8_t *packet,
+                            const size_t offset,
+                            PESPayloadFunc payload_cb,
+                            PESFinishedFunc finished_cb,
+                            void *cb_data)
+{
+    PESData *pes = NULL;
+
+    pes = pid_info_get_private_data(pidinfo, client_id);
+    if (!pes) {
+        pes = pes_data_new(arena);
+        pid_info_set_private_data(pidinfo, client_id, pes, (PidInfoPrivateDataFree)pes_data_free);
+    }
+
+    pes_data_push_packet(pes, indexer, packet, offset, payload_cb, finished_cb, cb_data);
+}
+
+/* The PCR pid of the program listing video_pid, 0 if the video carries the PCR itself. */
+static guint16 tsn_get_pcr_pid(TsDemux *psi, guint16 video_pid)
+{
+    guint16 pid = video_pid ? ts_demux_get_pcr_pid(psi, video_pid) : TS_DEMUX_NO_PID;
+    return pid != TS_DEMUX_NO_PID && pid != video_pid ? pid : 0;
+}
+
+/* Pass PAT and PMT packets to tsn->psi. Returns FALSE for other packets. */
+static gboolean tsn_handle_psi(TsSnipper *tsn, const uint8_t *packet)
+{
+    TsDemuxPidType type = ts_demux_get_pid_type(tsn->psi, ts_get_pid(packet));
+    if (G_LIKELY(type != TsDemuxPidPat && type != TsDemuxPidPmt))
+        return FALSE;
+    ts_demux_push(tsn->psi, packet, TS_SIZE, NULL, NULL);
+    tsn->pcr_pid = tsn_get_pcr_pid(tsn->psi, tsn->video_pid);
+    return TRUE;
+}
+
+static void tsn_set_video_pid(TsSnipper *tsn, PidInfo *pidinfo)
+{
+    if (!tsn->video_pid) {
+        tsn->video_pid = pidinfo->pid;
+        tsn->video_pidtype = pidinfo->type;
+        tsn->pcr_pid = tsn_get_pcr_pid(tsn->psi, tsn->video_pid);
+    }
 }
 
 static bool tsn_handle_packet(PidInfo *pidinfo, const uint8_t *packet, const size_t offset, TsSnipper *tsn)
@@ -376,99 +781,1382 @@ static bool tsn_handle_packet(PidInfo *pidinfo, const uint8_t *packet, const siz
     if (!tsn)
         return true;
     tsn->bytes_read = offset;
-    g_checksum_update(tsn->checksum, packet, TS_SIZE);
+    stream_timeline_writer_add_packet(tsn->timeline_writer, offset,
+                                      ts_get_pid(packet), ts_get_unitstart(packet));
+    signal_parser_push_packet(tsn->signal_parser, packet, offset);
+    if (!tsn_handle_psi(tsn, packet) && tsn->pcr_pid && ts_get_pid(packet) == tsn->pcr_pid)
+        tsn_indexer_pcr_packet(&tsn->indexer, packet, offset);
     if (!pidinfo)
         return true;
 
     if (pidinfo->type == PID_TYPE_VIDEO_13818) {
-        if (!tsn->video_pid)
-            tsn->video_pid = pidinfo->pid;
-        _tsn_handle_pes(tsn, pidinfo, tsn->analyzer_client_id, packet, offset,
-                (PESFinishedFunc)pes_data_analyze_video_13818, tsn);
+        tsn_set_video_pid(tsn, pidinfo);
+        _tsn_handle_pes(tsn, pidinfo, tsn->analyzer_client_id, tsn->analyze_arena, &tsn->indexer, packet, offset,
+                (PESPayloadFunc)pes_data_scan_payload_13818,
+                (PESFinishedFunc)pes_data_analyze_video_13818, &tsn->indexer);
     }
     else if (pidinfo->type == PID_TYPE_VIDEO_14496) {
-        if (!tsn->video_pid)
-            tsn->video_pid = pidinfo->pid;
-        _tsn_handle_pes(tsn, pidinfo, tsn->analyzer_client_id, packet, offset,
-                (PESFinishedFunc)pes_data_analyze_video_14496, tsn);
+        tsn_set_video_pid(tsn, pidinfo);
+        _tsn_handle_pes(tsn, pidinfo, tsn->analyzer_client_id, tsn->analyze_arena, &tsn->indexer, packet, offset,
+                (PESPayloadFunc)pes_data_scan_payload_14496,
+                (PESFinishedFunc)pes_data_analyze_video_14496, &tsn->indexer);
     }
 
+    if (!tsn->video_pes && tsn->video_pid && pidinfo->pid == tsn->video_pid)
+        tsn->video_pes = pid_info_get_private_data(pidinfo, tsn->analyzer_client_id);
+
     return true;
 }
 
-bool tsn_open_file(TsSnipper *tsn, const char *filename)
+static void tsn_video_pes_funcs(PidType pidtype, PESPayloadFunc *payload_cb, PESFinishedFunc *finished_cb)
 {
-    struct stat st;
-    if (stat(filename, &st) != 0)
-        return false;
+    if (pidtype == PID_TYPE_VIDEO_13818) {
+        *payload_cb = (PESPayloadFunc)pes_data_scan_payload_13818;
+        *finished_cb = (PESFinishedFunc)pes_data_analyze_video_13818;
+    }
+    else {
+        *payload_cb = (PESPayloadFunc)pes_data_scan_payload_14496;
+        *finished_cb = (PESFinishedFunc)pes_data_analyze_video_14496;
+    }
+}
 
-    if ((tsn->file = fopen(filename, "r")) == NULL) {
-        perror("Could not open file");
-        return false;
+static gboolean tsn_video_pidtype_for_stream_type(guint8 stream_type, PidType *pidtype)
+{
+    switch (stream_type) {
+        case 0x02:
+            *pidtype = PID_TYPE_VIDEO_13818;
+            return TRUE;
+        case 0x1b:
+            *pidtype = PID_TYPE_VIDEO_14496;
+            return TRUE;
+        default:
+            return FALSE;
     }
+}
 
-    tsn->file_size = st.st_size;
+/* PID prefilter.
+ * Only the packets of the video pid matter for the index. Once PAT/PMT have named it, buffers
+ * are split into packets here, and all other packets are dropped by their pid without going
+ * through the analyzer. Only the first video pid is indexed then, like in the chunked analysis.
+ * PAT and PMT packets still go through a PSI parser, so that the filter follows the video to
+ * another pid when a new PMT version drops it, e.g., after a service switch in a recording.
+ * The packets of the PMT's PCR pid are passed on as well, if the video does not carry the PCR.
+ * The filter starts on a packet boundary, so that the analyzer holds no partial packet. */
 
-    return true;
-}
+typedef void (*TsnPacketFunc)(const guint8 *packet, gsize offset, gpointer userdata);
+/* The filter passes the packets of another pid from now on. */
+typedef void (*TsnPidSwitchFunc)(guint16 pid, PidType pidtype, gpointer userdata);
 
-void tsn_close_file(TsSnipper *tsn)
+typedef struct {
+    gboolean active;
+    guint16 pid;
+    gsize offset; /* Offset of the next byte. */
+    guint8 carry[TS_SIZE]; /* Incomplete packet at the end of the last buffer. */
+    gsize carry_len;
+    StreamTimelineWriter *timeline; /* Counts every packet if not NULL. */
+    SignalParser *signals; /* Gets the packets of the other pids if not NULL. */
+    TsDemux *psi; /* Follows PMT updates if not NULL. */
+    TsnPidSwitchFunc switch_func;
+    gboolean pid_listed; /* The PMT pmt_pid listed pid as video. */
+    guint16 pmt_pid;
+    guint16 pcr_pid; /* Also passed to func if not 0, only known with psi. */
+} TsnPidFilter;
+
+static gboolean tsn_pid_filter_start(TsnPidFilter *filter,
+                                     TsSnipper *tsn,
+                                     gsize offset,
+                                     StreamTimelineWriter *timeline,
+                                     SignalParser *signals,
+                                     TsDemux *psi,
+                                     TsnPidSwitchFunc switch_func)
 {
-    g_mutex_lock(&tsn->file_lock);
-    if (tsn->file)
-        fclose(tsn->file);
-    tsn->file = NULL;
-    g_mutex_unlock(&tsn->file_lock);
+    if (filter->active || !tsn->video_pid || offset % TS_SIZE != 0)
+        return filter->active;
+
+    memset(filter, 0, sizeof(TsnPidFilter));
+    filter->active = TRUE;
+    filter->pid = tsn->video_pid;
+    filter->offset = offset;
+    filter->timeline = timeline;
+    filter->signals = signals;
+    filter->psi = psi;
+    filter->switch_func = switch_func;
+    if (psi)
+        filter->pcr_pid = tsn_get_pcr_pid(psi, filter->pid);
+    return TRUE;
 }
 
-void tsn_analyze_file(TsSnipper *tsn)
+static void tsn_pid_filter_handle_psi(TsnPidFilter *filter, const guint8 *packet, gpointer userdata)
 {
-    if (!tsn->file)
-        return;
+    PidType pidtype;
+    guint16 pid;
 
-    tsn->state = TsSnipperStateAnalyzing;
+    ts_demux_push(filter->psi, packet, TS_SIZE, NULL, NULL);
+    filter->pcr_pid = tsn_get_pcr_pid(filter->psi, filter->pid);
 
-    tsn->out.pts_stream_first = PES_FRAME_TS_INVALID;
-    tsn->out.pcr_stream_first = PES_FRAME_TS_INVALID;
+    if (ts_demux_get_pid_type(filter->psi, filter->pid) == TsDemuxPidVideo) {
+        filter->pid_listed = TRUE;
+        filter->pmt_pid = ts_demux_get_pmt_pid(filter->psi, filter->pid);
+        return;
+    }
+    /* Until the PMT was seen once, the PSI is just incomplete. */
+    if (!filter->pid_listed)
+        return;
 
-    static TsAnalyzerClass tscls = {
-        .handle_packet = (TsHandlePacketFunc)tsn_handle_packet,
-    };
-    TsAnalyzer *ts_analyzer = ts_analyzer_new(&tscls, tsn);
+    /* The PMT dropped the pid, continue with the video of the same program. */
+    for (pid = 0; pid < TS_DEMUX_PIDS; ++pid) {
+        if (ts_demux_get_pmt_pid(filter->psi, pid) == filter->pmt_pid &&
+                tsn_video_pidtype_for_stream_type(ts_demux_get_stream_type(filter->psi, pid), &pidtype))
+            break;
+    }
+    if (pid == TS_DEMUX_PIDS)
+        return;
 
-    ts_analyzer_set_pid_info_manager(ts_analyzer, tsn->pmgr);
+    filter->pid = pid;
+    filter->pcr_pid = tsn_get_pcr_pid(filter->psi, pid);
+    if (filter->switch_func)
+        filter->switch_func(pid, pidtype, userdata);
+}
 
-    tsn_read_buffered(tsn,
+static inline void tsn_pid_filter_packet(TsnPidFilter *filter,
+                                         const guint8 *packet,
+                                         TsnPacketFunc func,
+                                         gpointer userdata)
+{
+    guint16 pid = ts_get_pid(packet);
+    TsDemuxPidType type;
+
+    if (filter->timeline)
+        stream_timeline_writer_add_packet(filter->timeline, filter->offset, pid, ts_get_unitstart(packet));
+    if (pid == filter->pid) {
+        func(packet, filter->offset, userdata);
+        return;
+    }
+    if (filter->signals)
+        signal_parser_push_packet(filter->signals, packet, filter->offset);
+    if (G_UNLIKELY(pid == filter->pcr_pid) && filter->pcr_pid)
+        func(packet, filter->offset, userdata);
+    else if (filter->psi) {
+        type = ts_demux_get_pid_type(filter->psi, pid);
+        if (G_UNLIKELY(type == TsDemuxPidPat || type == TsDemuxPidPmt))
+            tsn_pid_filter_handle_psi(filter, packet, userdata);
+    }
+}
+
+static void tsn_pid_filter_push(TsnPidFilter *filter,
+                                const guint8 *data,
+                                gsize length,
+                                TsnPacketFunc func,
+                                gpointer userdata)
+{
+    const guint8 *end = data + length;
+    const guint8 *next;
+    gsize take;
+
+    if (filter->carry_len > 0) {
+        take = MIN(length, TS_SIZE - filter->carry_len);
+        memcpy(filter->carry + filter->carry_len, data, take);
+        filter->carry_len += take;
+        data += take;
+        if (filter->carry_len < TS_SIZE)
+            return;
+        if (filter->carry[0] == 0x47)
+            tsn_pid_filter_packet(filter, filter->carry, func, userdata);
+        filter->offset += TS_SIZE;
+        filter->carry_len = 0;
+    }
+
+    while (end - data >= TS_SIZE) {
+        if (G_UNLIKELY(data[0] != 0x47)) {
+            /* Lost sync, continue at the next sync byte. */
+            next = memchr(data + 1, 0x47, end - data - 1);
+            take = next ? (gsize)(next - data) : (gsize)(end - data);
+            filter->offset += take;
+            data += take;
+            continue;
+        }
+        tsn_pid_filter_packet(filter, data, func, userdata);
+        filter->offset += TS_SIZE;
+        data += TS_SIZE;
+    }
+
+    filter->carry_len = end - data;
+    memcpy(filter->carry, data, filter->carry_len);
+}
+
+static void _tsn_filter_handle_video(const guint8 *packet, gsize offset, TsSnipper *tsn)
+{
+    PESPayloadFunc payload_cb;
+    PESFinishedFunc finished_cb;
+
+    if (ts_get_pid(packet) != tsn->video_pid) {
+        tsn_indexer_pcr_packet(&tsn->indexer, packet, offset);
+        return;
+    }
+
+    tsn_video_pes_funcs(tsn->video_pidtype, &payload_cb, &finished_cb);
+    pes_data_push_packet(tsn->video_pes, &tsn->indexer, packet, offset,
+                         payload_cb, finished_cb, &tsn->indexer);
+}
+
+static void _tsn_filter_switch_video(guint16 pid, PidType pidtype, TsSnipper *tsn)
+{
+    tsn->video_pid = pid;
+    tsn->video_pidtype = pidtype;
+    /* The analyzer never saw the pid, so there is no PES state to continue. */
+    pes_data_free(tsn->filter_pes);
+    tsn->filter_pes = pes_data_new(tsn->analyze_arena);
+    tsn->video_pes = tsn->filter_pes;
+}
+
+/* Reading for the analysis, switches to the prefilter once the video pid is known. */
+struct TsnAnalyzeContext {
+    TsSnipper *tsn;
+    TsAnalyzer *analyzer;
+    InputHash *hash; /* Feed the buffers to the hash if not NULL. */
+    gsize offset; /* Bytes pushed so far. */
+    TsnPidFilter filter;
+};
+
+static gboolean _tsn_analyze_push_buffer(const guint8 *data, gsize length, struct TsnAnalyzeContext *ctx)
+{
+    TsSnipper *tsn = ctx->tsn;
+
+    if (ctx->hash)
+        input_hash_feed(ctx->hash, data, length);
+
+    if (tsn->video_pes && tsn_pid_filter_start(&ctx->filter, tsn, ctx->offset,
+                                                   tsn->timeline_writer, tsn->signal_parser, tsn->psi,
+                                                   (TsnPidSwitchFunc)_tsn_filter_switch_video)) {
+        tsn_pid_filter_push(&ctx->filter, data, length, (TsnPacketFunc)_tsn_filter_handle_video, tsn);
+        tsn->bytes_read = ctx->filter.offset;
+    }
+    else {
+        ts_analyzer_push_buffer(ctx->analyzer, (uint8_t *)data, length);
+    }
+    ctx->offset += length;
+
+    return TRUE;
+}
+
+bool tsn_open_file(TsSnipper *tsn, const char *filename)
+{
+    if ((tsn->input = ts_input_open(filename)) == NULL)
+        return false;
+
+    tsn->file_size = ts_input_get_size(tsn->input);
+
+    return true;
+}
+
+void tsn_close_file(TsSnipper *tsn)
+{
+    /* The hash may still be reading the input. */
+    if (tsn->hash)
+        input_hash_stop(tsn->hash);
+    ts_input_close(tsn->input);
+    tsn->input = NULL;
+}
+
+/* Forget everything a previous analysis found. */
+static void tsn_reset_index(TsSnipper *tsn)
+{
+    g_mutex_lock(&tsn->data_lock);
+    frame_index_clear(tsn->frames);
+    pcr_map_clear(tsn->pcrs);
+    stream_timeline_writer_reset(tsn->timeline_writer);
+    stream_timeline_clear(tsn->timeline);
+    signal_parser_reset(tsn->signal_parser);
+    signal_index_clear(tsn->signals);
+    tsn->index_complete = FALSE;
+    tsn->index_cached = FALSE;
+    g_mutex_unlock(&tsn->data_lock);
+
+    tsn_indexer_init(&tsn->indexer, tsn, FALSE);
+    pid_info_manager_clear_private_data(tsn->pmgr, tsn->analyzer_client_id);
+
+    tsn->bytes_read = 0;
+    tsn->video_pid = 0;
+    tsn->pcr_pid = 0;
+    tsn->video_pes = NULL;
+    pes_data_free(tsn->filter_pes);
+    tsn->filter_pes = NULL;
+    ts_demux_free(tsn->psi);
+    tsn->psi = ts_demux_new();
+    tsn->out.pts_stream_first = PES_FRAME_TS_INVALID;
+    tsn->out.pcr_stream_first = PES_FRAME_TS_INVALID;
+}
+
+static guint tsn_get_analyze_threads(TsSnipper *tsn)
+{
+    return tsn->analyze_threads ? tsn->analyze_threads : g_get_num_processors();
+}
+
+/* The pipeline has not been measured against the sequential pass, only use it on request. */
+static gboolean tsn_use_pipeline(TsSnipper *tsn)
+{
+    return tsn->analyze_threads >= 2;
+}
+
+/* Pipelined analysis.
+ * Inputs that cannot be split into chunks are analyzed in three stages on separate threads,
+ * joined by bounded rings: the reader copies the input to buffers, the parser runs the analyzer
+ * on them and passes the packets of the video pids and the PCR pid on in batches, and the
+ * detector tracks their
+ * PES units and finds the frames. A full ring blocks the stage before it. The detector sees the
+ * packets in stream order and is the only writer of the index, so the result is the same as
+ * with tsn_handle_packet(). */
+
+#define TSN_PIPELINE_BUFFER_SIZE (188 * 1024)
+#define TSN_PIPELINE_BUFFERS (16)
+#define TSN_PIPELINE_BATCH_SIZE (256)
+#define TSN_PIPELINE_BATCHES (16)
+
+typedef struct {
+    gsize length;
+    guint8 data[TSN_PIPELINE_BUFFER_SIZE];
+} TsnPipelineBuffer;
+
+typedef struct {
+    gsize offset;
+    guint16 pid;
+    PidType pidtype;
+    gboolean pcr_only; /* Of the PCR pid, only its PCR is used. */
+    guint8 data[TS_SIZE];
+} TsnPipelinePacket;
+
+typedef struct {
+    guint count;
+    TsnPipelinePacket packets[TSN_PIPELINE_BATCH_SIZE];
+} TsnPipelineBatch;
+
+typedef struct {
+    TsSnipper *tsn;
+    InputHash *hash; /* Feed the buffers to the hash if not NULL. */
+
+    SpscRing *buffers; /* [TsnPipelineBuffer] reader -> parser */
+    SpscRing *batches; /* [TsnPipelineBatch] parser -> detector */
+
+    GThread *parser;
+    TsnPipelineBatch *batch; /* Batch being filled by the parser, NULL if none. */
+    gsize offset; /* Bytes parsed so far. */
+    TsnPidFilter filter;
+    StreamTimelineWriter *timeline; /* Packets are counted by the parser. */
+    SignalParser *signals; /* Also used by the parser. */
+
+    GThread *detector;
+    GHashTable *pes; /* [pid -> PESData *] Only used by the detector. */
+} TsnPipeline;
+
+static gboolean _tsn_pipeline_push_buffer(const guint8 *data, gsize length, TsnPipeline *pl)
+{
+    TsnPipelineBuffer *buffer;
+    gsize chunk;
+
+    if (pl->hash)
+        input_hash_feed(pl->hash, data, length);
+
+    while (length > 0) {
+        buffer = spsc_ring_push_begin(pl->buffers);
+        chunk = MIN(length, TSN_PIPELINE_BUFFER_SIZE);
+        memcpy(buffer->data, data, chunk);
+        buffer->length = chunk;
+        spsc_ring_push_end(pl->buffers);
+        data += chunk;
+        length -= chunk;
+    }
+    return TRUE;
+}
+
+static void tsn_pipeline_flush_batch(TsnPipeline *pl)
+{
+    if (pl->batch) {
+        spsc_ring_push_end(pl->batches);
+        pl->batch = NULL;
+    }
+}
+
+static void tsn_pipeline_add_packet(TsnPipeline *pl,
+                                    const uint8_t *packet,
+                                    gsize offset,
+                                    guint16 pid,
+                                    PidType pidtype,
+                                    gboolean pcr_only)
+{
+    if (!pl->batch) {
+        pl->batch = spsc_ring_push_begin(pl->batches);
+        pl->batch->count = 0;
+    }
+    TsnPipelinePacket *p = &pl->batch->packets[pl->batch->count++];
+    p->offset = offset;
+    p->pid = pid;
+    p->pidtype = pidtype;
+    p->pcr_only = pcr_only;
+    memcpy(p->data, packet, TS_SIZE);
+
+    if (pl->batch->count == TSN_PIPELINE_BATCH_SIZE)
+        tsn_pipeline_flush_batch(pl);
+}
+
+static bool tsn_pipeline_handle_packet(PidInfo *pidinfo, const uint8_t *packet, const size_t offset, TsnPipeline *pl)
+{
+    TsSnipper *tsn = pl->tsn;
+
+    tsn->bytes_read = offset;
+    stream_timeline_writer_add_packet(pl->timeline, offset, ts_get_pid(packet), ts_get_unitstart(packet));
+    signal_parser_push_packet(pl->signals, packet, offset);
+    if (!tsn_handle_psi(tsn, packet) && tsn->pcr_pid && ts_get_pid(packet) == tsn->pcr_pid)
+        tsn_pipeline_add_packet(pl, packet, offset, tsn->pcr_pid, tsn->video_pidtype, TRUE);
+    if (!pidinfo ||
+            (pidinfo->type != PID_TYPE_VIDEO_13818 && pidinfo->type != PID_TYPE_VIDEO_14496))
+        return true;
+
+    tsn_set_video_pid(tsn, pidinfo);
+
+    tsn_pipeline_add_packet(pl, packet, offset, pidinfo->pid, pidinfo->type, FALSE);
+
+    return true;
+}
+
+static void _tsn_pipeline_filter_handle_video(const guint8 *packet, gsize offset, TsnPipeline *pl)
+{
+    guint16 pid = ts_get_pid(packet);
+    tsn_pipeline_add_packet(pl, packet, offset, pid, pl->tsn->video_pidtype, pid != pl->filter.pid);
+}
+
+static void _tsn_pipeline_filter_switch_video(guint16 pid, PidType pidtype, TsnPipeline *pl)
+{
+    /* The detector starts a PES state for the new pid. */
+    pl->tsn->video_pid = pid;
+    pl->tsn->video_pidtype = pidtype;
+}
+
+static gpointer tsn_pipeline_parser_thread(TsnPipeline *pl)
+{
+    static TsAnalyzerClass tscls = {
+        .handle_packet = (TsHandlePacketFunc)tsn_pipeline_handle_packet,
+    };
+    TsAnalyzer *ts_analyzer = ts_analyzer_new(&tscls, pl);
+    TsnPipelineBuffer *buffer;
+
+    ts_analyzer_set_pid_info_manager(ts_analyzer, pl->tsn->pmgr);
+
+    while ((buffer = spsc_ring_pop_begin(pl->buffers)) != NULL) {
+        if (tsn_pid_filter_start(&pl->filter, pl->tsn, pl->offset, pl->timeline, pl->signals, pl->tsn->psi,
+                                 (TsnPidSwitchFunc)_tsn_pipeline_filter_switch_video)) {
+            tsn_pid_filter_push(&pl->filter, buffer->data, buffer->length,
+                                (TsnPacketFunc)_tsn_pipeline_filter_handle_video, pl);
+            pl->tsn->bytes_read = pl->filter.offset;
+        }
+        else {
+            ts_analyzer_push_buffer(ts_analyzer, buffer->data, buffer->length);
+        }
+        pl->offset += buffer->length;
+        spsc_ring_pop_end(pl->buffers);
+        /* Do not hold back packets if the reader has to wait for the input, e.g., when following. */
+        tsn_pipeline_flush_batch(pl);
+    }
+
+    tsn_pipeline_flush_batch(pl);
+    spsc_ring_close(pl->batches);
+
+    ts_analyzer_free(ts_analyzer);
+
+    return NULL;
+}
+
+static gpointer tsn_pipeline_detector_thread(TsnPipeline *pl)
+{
+    TsnIndexer *indexer = &pl->tsn->indexer;
+    TsnPipelineBatch *batch;
+    TsnPipelinePacket *p;
+    PESData *pes;
+    PESPayloadFunc payload_cb;
+    PESFinishedFunc finished_cb;
+    guint j;
+
+    while ((batch = spsc_ring_pop_begin(pl->batches)) != NULL) {
+        for (j = 0; j < batch->count; ++j) {
+            p = &batch->packets[j];
+            if (p->pcr_only) {
+                tsn_indexer_pcr_packet(indexer, p->data, p->offset);
+                continue;
+            }
+            pes = g_hash_table_lookup(pl->pes, GUINT_TO_POINTER(p->pid));
+            if (!pes) {
+                pes = pes_data_new(pl->tsn->analyze_arena);
+                g_hash_table_insert(pl->pes, GUINT_TO_POINTER(p->pid), pes);
+            }
+            tsn_video_pes_funcs(p->pidtype, &payload_cb, &finished_cb);
+            pes_data_push_packet(pes, indexer, p->data, p->offset, payload_cb, finished_cb, indexer);
+        }
+        spsc_ring_pop_end(pl->batches);
+    }
+
+    return NULL;
+}
+
+static void tsn_pipeline_start(TsnPipeline *pl, TsSnipper *tsn, InputHash *hash)
+{
+    memset(pl, 0, sizeof(TsnPipeline));
+    pl->tsn = tsn;
+    pl->hash = hash;
+    pl->buffers = spsc_ring_new(TSN_PIPELINE_BUFFERS, sizeof(TsnPipelineBuffer));
+    pl->batches = spsc_ring_new(TSN_PIPELINE_BATCHES, sizeof(TsnPipelineBatch));
+    pl->pes = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)pes_data_free);
+    pl->timeline = stream_timeline_writer_new(tsn->timeline);
+    pl->signals = signal_parser_new(tsn->signals);
+
+    pl->detector = g_thread_new("tsn-detector", (GThreadFunc)tsn_pipeline_detector_thread, pl);
+    pl->parser = g_thread_new("tsn-parser", (GThreadFunc)tsn_pipeline_parser_thread, pl);
+}
+
+/* No more input, wait until everything pushed is indexed. */
+static void tsn_pipeline_finish(TsnPipeline *pl)
+{
+    spsc_ring_close(pl->buffers);
+    g_thread_join(pl->parser);
+    g_thread_join(pl->detector);
+
+    spsc_ring_free(pl->buffers);
+    spsc_ring_free(pl->batches);
+    g_hash_table_destroy(pl->pes);
+    stream_timeline_writer_free(pl->timeline);
+    signal_parser_free(pl->signals);
+    memset(pl, 0, sizeof(TsnPipeline));
+}
+
+static void tsn_analyze_file_pipelined(TsSnipper *tsn, gboolean feed_hash)
+{
+    TsnPipeline pl;
+
+    tsn_pipeline_start(&pl, tsn, feed_hash ? tsn->hash : NULL);
+
+    ts_input_read(tsn->input,
+                  0,
+                  TsInputAccessSequential,
+                  (TsInputReadFunc)_tsn_pipeline_push_buffer,
+                  &pl);
+
+    tsn_pipeline_finish(&pl);
+}
+
+static void tsn_analyze_file_sequential(TsSnipper *tsn, gboolean feed_hash)
+{
+    if (tsn_use_pipeline(tsn)) {
+        tsn_analyze_file_pipelined(tsn, feed_hash);
+        return;
+    }
+
+    static TsAnalyzerClass tscls = {
+        .handle_packet = (TsHandlePacketFunc)tsn_handle_packet,
+    };
+    TsAnalyzer *ts_analyzer = ts_analyzer_new(&tscls, tsn);
+
+    ts_analyzer_set_pid_info_manager(ts_analyzer, tsn->pmgr);
+
+    struct TsnAnalyzeContext ctx = {
+        .tsn = tsn,
+        .analyzer = ts_analyzer,
+        .hash = feed_hash ? tsn->hash : NULL
+    };
+
+    ts_input_read(tsn->input,
+                  0,
+                  TsInputAccessSequential,
+                  (TsInputReadFunc)_tsn_analyze_push_buffer,
+                  &ctx);
+
+    ts_analyzer_free(ts_analyzer);
+}
+
+/* Chunked analysis.
+ * The file is split into packet aligned chunks, which are indexed in parallel. Each chunk handles
+ * the PES units of the video pid starting inside of it, i.e., a worker skips everything up to
+ * the first unit start and reads past the end of the chunk until the next unit start to complete
+ * its last PES. The recorded pictures are then replayed in order, which gives the same index as
+ * a sequential pass. Only the first video pid is indexed this way. */
+
+/* Do not bother with chunks smaller than this. */
+#define TSN_CHUNK_MIN_SIZE (16 * 1024 * 1024)
+/* Chunks per thread, to balance differences in the bitrate. */
+#define TSN_CHUNKS_PER_THREAD (4)
+/* Give up looking for the video pid after this many bytes. */
+#define TSN_PROBE_SIZE (32 * 1024 * 1024)
+
+typedef struct {
+    TsSnipper *tsn;
+    gsize chunk_start;
+    gsize chunk_end;
+    gsize offset; /* Offset of the next packet. */
+    TsnIndexer indexer;
+    PESData *pes;
+    StreamTimelineWriter *timeline; /* Counts the packets inside the chunk. */
+    SignalIndex *signals; /* Signals starting inside the chunk, appended in order. */
+    SignalParser *signal_parser;
+    TsDemux *psi; /* PAT and PMTs seen by the chunk. */
+    guint16 pmt_pid; /* Of the video's program, 0 if unknown. */
+    gboolean synced; /* The first unit start was found. */
+    gboolean done;
+    gboolean failed; /* Lost sync or the PMT moved the video, the sequential analysis has to be used. */
+} TsnChunk;
+
+struct TsnProbe {
+    TsSnipper *tsn;
+    gsize offset;
+};
+
+static bool tsn_probe_handle_packet(PidInfo *pidinfo, const uint8_t *packet, const size_t offset, struct TsnProbe *probe)
+{
+    probe->offset = offset;
+    /* Also learns the PCR pid of the video's program. */
+    tsn_handle_psi(probe->tsn, packet);
+    if (pidinfo && (pidinfo->type == PID_TYPE_VIDEO_13818 || pidinfo->type == PID_TYPE_VIDEO_14496))
+        tsn_set_video_pid(probe->tsn, pidinfo);
+    return true;
+}
+
+static gboolean _tsn_probe_resume(struct TsnProbe *probe)
+{
+    return !probe->tsn->video_pid && probe->offset < TSN_PROBE_SIZE;
+}
+
+/* Find the video pid from PAT/PMT at the start of the stream. */
+static gboolean tsn_probe_video_pid(TsSnipper *tsn)
+{
+    struct TsnProbe probe = { .tsn = tsn, .offset = 0 };
+    static TsAnalyzerClass tscls = {
+        .handle_packet = (TsHandlePacketFunc)tsn_probe_handle_packet,
+    };
+    TsAnalyzer *ts_analyzer = ts_analyzer_new(&tscls, &probe);
+    ts_analyzer_set_pid_info_manager(ts_analyzer, tsn->pmgr);
+
+    tsn->video_pid = 0;
+    tsn->pcr_pid = 0;
+    tsn_read_buffered(tsn,
                       ts_analyzer,
                       0,
-                      NULL,
-                      NULL);
+                      TsInputAccessSequential,
+                      (TsnResumeCallback)_tsn_probe_resume,
+                      &probe,
+                      FALSE);
+
+    ts_analyzer_free(ts_analyzer);
+
+    return tsn->video_pid != 0;
+}
+
+/* Returns TRUE if a PMT of the chunk no longer lists the video pid. The prefilter of the
+ * sequential analysis follows the video to another pid then, which the chunks cannot do as
+ * they do not know the PMT at their start. */
+static gboolean tsn_chunk_handle_psi(TsnChunk *chunk, const guint8 *packet)
+{
+    TsDemuxPidType type = ts_demux_get_pid_type(chunk->psi, ts_get_pid(packet));
+    if (G_LIKELY(type != TsDemuxPidPat && type != TsDemuxPidPmt))
+        return FALSE;
+    ts_demux_push(chunk->psi, packet, TS_SIZE, NULL, NULL);
+    return ts_demux_has_pmt(chunk->psi, chunk->pmt_pid) &&
+           ts_demux_get_pid_type(chunk->psi, chunk->tsn->video_pid) != TsDemuxPidVideo;
+}
+
+static gboolean _tsn_chunk_handle_buffer(const guint8 *data, gsize length, TsnChunk *chunk)
+{
+    TsSnipper *tsn = chunk->tsn;
+    PESPayloadFunc payload_cb;
+    PESFinishedFunc finished_cb;
+    gsize progress_start = MIN(chunk->offset, chunk->chunk_end);
+    const guint8 *packet;
+
+    tsn_video_pes_funcs(tsn->video_pidtype, &payload_cb, &finished_cb);
+
+    /* Buffers are multiples of the packet size, a rest can only occur at the end of the file. */
+    for (packet = data; packet + TS_SIZE <= data + length; packet += TS_SIZE, chunk->offset += TS_SIZE) {
+        if (packet[0] != 0x47) {
+            chunk->failed = TRUE;
+            break;
+        }
+        if (chunk->offset < chunk->chunk_end)
+            stream_timeline_writer_add_packet(chunk->timeline, chunk->offset,
+                                              ts_get_pid(packet), ts_get_unitstart(packet));
+        if (ts_get_pid(packet) != tsn->video_pid) {
+            /* Sections crossing the start of the chunk are lost, they are repeated anyway. */
+            if (chunk->offset < chunk->chunk_end)
+                signal_parser_push_packet(chunk->signal_parser, packet, chunk->offset);
+            if (chunk->offset < chunk->chunk_end && tsn->pcr_pid && ts_get_pid(packet) == tsn->pcr_pid)
+                tsn_indexer_pcr_packet(&chunk->indexer, packet, chunk->offset);
+            if (chunk->pmt_pid && tsn_chunk_handle_psi(chunk, packet)) {
+                chunk->failed = TRUE;
+                break;
+            }
+            continue;
+        }
+        if (ts_get_unitstart(packet)) {
+            if (chunk->offset >= chunk->chunk_end) {
+                /* Belongs to the next chunk, only completes our last PES. */
+                pes_data_finish(chunk->pes, chunk->offset, finished_cb, &chunk->indexer);
+                chunk->done = TRUE;
+                break;
+            }
+            chunk->synced = TRUE;
+        }
+        /* Packets before the first unit start belong to the last PES of the previous chunk. */
+        if (!chunk->synced)
+            continue;
+        pes_data_push_packet(chunk->pes, &chunk->indexer, packet, chunk->offset,
+                             payload_cb, finished_cb, &chunk->indexer);
+    }
+
+    g_mutex_lock(&tsn->data_lock);
+    tsn->bytes_read += MIN(chunk->offset, chunk->chunk_end) - progress_start;
+    g_mutex_unlock(&tsn->data_lock);
+
+    return !chunk->done && !chunk->failed;
+}
+
+static void _tsn_chunk_worker(TsnChunk *chunk, TsSnipper *tsn)
+{
+    ts_input_read(tsn->input,
+                  chunk->chunk_start,
+                  TsInputAccessSequential,
+                  (TsInputReadFunc)_tsn_chunk_handle_buffer,
+                  chunk);
+}
+
+/* Returns FALSE if the file cannot be analyzed in chunks. Nothing is added to the index then. */
+static gboolean tsn_analyze_file_chunked(TsSnipper *tsn)
+{
+    guint threads = tsn_get_analyze_threads(tsn);
+    guint chunk_count = MIN(threads * TSN_CHUNKS_PER_THREAD, tsn->file_size / TSN_CHUNK_MIN_SIZE);
+    guint j, k;
+    gboolean success = TRUE;
+
+    /* Workers read concurrently, this is only possible with a mapping. */
+    if (threads < 2 || chunk_count < 2 || !ts_input_is_mapped(tsn->input))
+        return FALSE;
+    if (!tsn_probe_video_pid(tsn))
+        return FALSE;
+
+    gsize chunk_size = tsn->file_size / chunk_count;
+    chunk_size -= chunk_size % TS_SIZE;
+
+    TsnChunk *chunks = g_new0(TsnChunk, chunk_count);
+    for (j = 0; j < chunk_count; ++j) {
+        chunks[j].tsn = tsn;
+        chunks[j].chunk_start = j * chunk_size;
+        chunks[j].chunk_end = j + 1 < chunk_count ? (j + 1) * chunk_size : tsn->file_size;
+        chunks[j].offset = chunks[j].chunk_start;
+        /* Nothing before the first chunk, so everything belongs to it. */
+        chunks[j].synced = (j == 0);
+        chunks[j].pes = pes_data_new(tsn->analyze_arena);
+        chunks[j].timeline = stream_timeline_writer_new(tsn->timeline);
+        chunks[j].signals = signal_index_new();
+        chunks[j].signal_parser = signal_parser_new(chunks[j].signals);
+        chunks[j].psi = ts_demux_new();
+        chunks[j].pmt_pid = ts_demux_get_pmt_pid(tsn->psi, tsn->video_pid);
+        tsn_indexer_init(&chunks[j].indexer, tsn, TRUE);
+    }
+
+    GThreadPool *pool = g_thread_pool_new((GFunc)_tsn_chunk_worker, tsn, threads, FALSE, NULL);
+    for (j = 0; j < chunk_count; ++j)
+        g_thread_pool_push(pool, &chunks[j], NULL);
+
+    /* Wait for all chunks. */
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    for (j = 0; j < chunk_count; ++j) {
+        if (chunks[j].failed)
+            success = FALSE;
+    }
+
+    /* Stitch the chunks. */
+    for (j = 0; success && j < chunk_count; ++j) {
+        for (k = 0; k < chunks[j].indexer.timestamps->len; ++k) {
+            TsnTimestampEvent *ev = &g_array_index(chunks[j].indexer.timestamps, TsnTimestampEvent, k);
+            tso_check_first_pcr_pts(&tsn->out, ev->pcr, ev->pts);
+        }
+        for (k = 0; k < chunks[j].indexer.pcrs->len; ++k) {
+            PcrMapEntry *entry = &g_array_index(chunks[j].indexer.pcrs, PcrMapEntry, k);
+            pcr_map_add(tsn->pcrs, entry->offset, entry->pcr);
+        }
+        for (k = 0; k < chunks[j].indexer.pictures->len; ++k) {
+            tsn_indexer_apply_picture(&tsn->indexer,
+                    &g_array_index(chunks[j].indexer.pictures, TsnPictureEvent, k));
+        }
+        signal_index_append(tsn->signals, chunks[j].signals);
+    }
+
+    for (j = 0; j < chunk_count; ++j) {
+        tsn_indexer_clear(&chunks[j].indexer);
+        pes_data_free(chunks[j].pes);
+        stream_timeline_writer_free(chunks[j].timeline);
+        signal_parser_free(chunks[j].signal_parser);
+        ts_demux_free(chunks[j].psi);
+        signal_index_free(chunks[j].signals);
+    }
+    g_free(chunks);
+
+    return success;
+}
+
+/* Follow mode.
+ * The analyzer and PES state are kept while waiting for the input to grow, so only appended
+ * data is read. */
+
+#define TSN_FOLLOW_POLL_INTERVAL (1000) /* ms */
+
+/* Wait for the next poll. Returns FALSE if the follow mode was left. */
+static gboolean tsn_follow_wait(TsSnipper *tsn)
+{
+    gint64 end_time = g_get_monotonic_time() + TSN_FOLLOW_POLL_INTERVAL * G_TIME_SPAN_MILLISECOND;
+
+    g_mutex_lock(&tsn->data_lock);
+    while (tsn->follow && g_cond_wait_until(&tsn->follow_cond, &tsn->data_lock, end_time));
+    gboolean follow = tsn->follow;
+    g_mutex_unlock(&tsn->data_lock);
+
+    return follow;
+}
+
+/* Pick up data appended to the input. */
+static void tsn_refresh_input(TsSnipper *tsn)
+{
+    if (ts_input_refresh(tsn->input)) {
+        /* The fingerprint covers the size and the tail. */
+        g_mutex_lock(&tsn->data_lock);
+        tsn->have_fingerprint = FALSE;
+        g_mutex_unlock(&tsn->data_lock);
+    }
+    tsn->file_size = ts_input_get_size(tsn->input);
+}
+
+/* Pass everything appended since offset to func. */
+static void tsn_follow_read(TsSnipper *tsn, TsInputReadFunc func, gpointer userdata, gsize *offset)
+{
+    tsn_refresh_input(tsn);
+
+    /* Only complete packets, the recorder may be in the middle of writing one. */
+    gsize end = tsn->file_size - (tsn->file_size - *offset) % TS_SIZE;
+    if (end <= *offset)
+        return;
+
+    ts_input_read_range(tsn->input,
+                        *offset,
+                        end - *offset,
+                        TsInputAccessSequential,
+                        func,
+                        userdata);
+    *offset = end;
+}
+
+static void tsn_analyze_file_follow_pipelined(TsSnipper *tsn)
+{
+    TsnPipeline pl;
+    gsize offset = 0;
+
+    tsn_pipeline_start(&pl, tsn, NULL);
+
+    do {
+        tsn_follow_read(tsn, (TsInputReadFunc)_tsn_pipeline_push_buffer, &pl, &offset);
+    } while (tsn_follow_wait(tsn));
+
+    /* Data appended during the last wait. */
+    tsn_follow_read(tsn, (TsInputReadFunc)_tsn_pipeline_push_buffer, &pl, &offset);
+
+    tsn_pipeline_finish(&pl);
+}
+
+static void tsn_analyze_file_follow(TsSnipper *tsn)
+{
+    if (tsn_use_pipeline(tsn)) {
+        tsn_analyze_file_follow_pipelined(tsn);
+        return;
+    }
+
+    static TsAnalyzerClass tscls = {
+        .handle_packet = (TsHandlePacketFunc)tsn_handle_packet,
+    };
+    TsAnalyzer *ts_analyzer = ts_analyzer_new(&tscls, tsn);
+
+    ts_analyzer_set_pid_info_manager(ts_analyzer, tsn->pmgr);
+
+    struct TsnAnalyzeContext ctx = {
+        .tsn = tsn,
+        .analyzer = ts_analyzer,
+        .hash = NULL
+    };
+    gsize offset = 0;
+
+    do {
+        tsn_follow_read(tsn, (TsInputReadFunc)_tsn_analyze_push_buffer, &ctx, &offset);
+    } while (tsn_follow_wait(tsn));
+
+    /* Data appended during the last wait. */
+    tsn_follow_read(tsn, (TsInputReadFunc)_tsn_analyze_push_buffer, &ctx, &offset);
+
+    ts_analyzer_free(ts_analyzer);
+}
+
+/* Sparse mode.
+ * Instead of reading the whole input, the PCR is sampled at a few positions, which gives a coarse
+ * map from time to offset. I frames are found on demand by scanning forward from a position, and
+ * the results are kept, so that later requests close to them need no read. */
+
+/* Evenly spread samples, plus one at the end of the input. */
+#define TSN_SPARSE_PCR_SAMPLES (64)
+#define TSN_SPARSE_SAMPLE_SIZE (188 * 1024)
+/* Give up looking for an I frame after this many bytes. */
+#define TSN_SPARSE_SCAN_WINDOW (8 * 1024 * 1024)
+
+typedef struct {
+    gsize scan_start; /* No other I frame starts between scan_start and the frame. */
+    PESFrameInfo frame;
+} TsnSparseFrame;
+
+struct TsnSparseWindow {
+    guint8 *buffer;
+    gsize filled;
+    gsize length;
+};
+
+static gboolean _tsn_sparse_read_window(const guint8 *data, gsize length, struct TsnSparseWindow *window)
+{
+    length = MIN(length, window->length - window->filled);
+    memcpy(window->buffer + window->filled, data, length);
+    window->filled += length;
+    return window->filled < window->length;
+}
+
+/* Returns the first PCR of the PCR pid in the window, or PES_FRAME_TS_INVALID. */
+static guint64 tsn_sparse_window_get_pcr(TsSnipper *tsn, const guint8 *data, gsize length, gsize *pcr_offset)
+{
+    const guint8 *packet;
+    const guint8 *end;
+    gsize start;
+
+    /* Find three consecutive sync bytes. */
+    for (start = 0; start < TS_SIZE && start + 3 * TS_SIZE <= length; ++start) {
+        if (data[start] == 0x47 && data[start + TS_SIZE] == 0x47 && data[start + 2 * TS_SIZE] == 0x47)
+            break;
+    }
+    if (start == TS_SIZE || start + 3 * TS_SIZE > length)
+        return PES_FRAME_TS_INVALID;
+    end = data + length - (length - start) % TS_SIZE;
+
+    /* Prefer the PCR of the video, otherwise take the first one seen. */
+    if (!tsn->sparse_pcr_pid) {
+        for (packet = data + start; packet < end && packet[0] == 0x47; packet += TS_SIZE) {
+            if (!ts_has_adaptation(packet) || !tsaf_has_pcr(packet))
+                continue;
+            if (!tsn->sparse_pcr_pid)
+                tsn->sparse_pcr_pid = ts_get_pid(packet);
+            if (ts_get_pid(packet) == tsn->video_pid) {
+                tsn->sparse_pcr_pid = tsn->video_pid;
+                break;
+            }
+        }
+    }
+
+    if (!tsn->sparse_pcr_pid)
+        return PES_FRAME_TS_INVALID;
+
+    for (packet = data + start; packet < end && packet[0] == 0x47; packet += TS_SIZE) {
+        if (ts_get_pid(packet) != tsn->sparse_pcr_pid ||
+                !ts_has_adaptation(packet) || !tsaf_has_pcr(packet))
+            continue;
+        *pcr_offset = packet - data;
+        return tsaf_get_pcr(packet) * 300 + tsaf_get_pcrext(packet);
+    }
+
+    return PES_FRAME_TS_INVALID;
+}
+
+static void tsn_sparse_sample_pcrs(TsSnipper *tsn)
+{
+    struct TsnSparseWindow window = {
+        .buffer = g_malloc(TSN_SPARSE_SAMPLE_SIZE)
+    };
+    gsize last = tsn->file_size > TSN_SPARSE_SAMPLE_SIZE ? tsn->file_size - TSN_SPARSE_SAMPLE_SIZE : 0;
+    gsize offset, pcr_offset;
+    guint64 pcr;
+    guint j;
+
+    for (j = 0; j <= TSN_SPARSE_PCR_SAMPLES; ++j) {
+        offset = MIN(tsn->file_size / TSN_SPARSE_PCR_SAMPLES * j, last);
+        window.filled = 0;
+        window.length = MIN(TSN_SPARSE_SAMPLE_SIZE, tsn->file_size - offset);
+        if (window.length == 0)
+            break;
+        ts_input_read(tsn->input, offset, TsInputAccessRandom,
+                      (TsInputReadFunc)_tsn_sparse_read_window, &window);
+        pcr = tsn_sparse_window_get_pcr(tsn, window.buffer, window.filled, &pcr_offset);
+        if (pcr != PES_FRAME_TS_INVALID)
+            pcr_map_add(tsn->sparse_pcrs, offset + pcr_offset, pcr);
+        tsn->bytes_read = offset + window.filled;
+    }
+
+    g_free(window.buffer);
+}
+
+struct TsnSparseScan {
+    TsnPidFilter filter;
+    TsnIndexer indexer;
+    PesArena *arena;
+    PESData *pes;
+    PESPayloadFunc payload_cb;
+    PESFinishedFunc finished_cb;
+    gboolean synced; /* The first unit start was found. */
+    gboolean found;
+};
+
+static void _tsn_sparse_scan_packet(const guint8 *packet, gsize offset, struct TsnSparseScan *scan)
+{
+    if (scan->found)
+        return;
+    if (ts_get_unitstart(packet))
+        scan->synced = TRUE;
+    if (!scan->synced)
+        return;
+
+    pes_data_push_packet(scan->pes, &scan->indexer, packet, offset,
+                         scan->payload_cb, scan->finished_cb, &scan->indexer);
+
+    GArray *pictures = scan->indexer.pictures;
+    if (pictures->len > 0 && g_array_index(pictures, TsnPictureEvent, pictures->len - 1).type == TsnPictureI)
+        scan->found = TRUE;
+}
+
+static gboolean _tsn_sparse_scan_buffer(const guint8 *data, gsize length, struct TsnSparseScan *scan)
+{
+    tsn_pid_filter_push(&scan->filter, data, length, (TsnPacketFunc)_tsn_sparse_scan_packet, scan);
+    return !scan->found;
+}
+
+/* Find the first I frame starting at or after offset. */
+static gboolean tsn_sparse_scan(TsSnipper *tsn, gsize offset, PESFrameInfo *frame_info)
+{
+    struct TsnSparseScan scan;
+    memset(&scan, 0, sizeof(struct TsnSparseScan));
+
+    offset -= offset % TS_SIZE;
+    if (offset >= tsn->file_size || !tsn_pid_filter_start(&scan.filter, tsn, offset, NULL, NULL, NULL, NULL))
+        return FALSE;
+
+    tsn_indexer_init(&scan.indexer, tsn, TRUE);
+    /* Own arena, scans may run next to the analysis. */
+    scan.arena = pes_arena_new();
+    scan.pes = pes_data_new(scan.arena);
+    tsn_video_pes_funcs(tsn->video_pidtype, &scan.payload_cb, &scan.finished_cb);
+
+    ts_input_read_range(tsn->input,
+                        offset,
+                        TSN_SPARSE_SCAN_WINDOW,
+                        TsInputAccessRandom,
+                        (TsInputReadFunc)_tsn_sparse_scan_buffer,
+                        &scan);
+
+    if (scan.found) {
+        /* Same as tsn_indexer_apply_picture(), starting without a dangling B frame. */
+        gboolean dangling_present = FALSE;
+        gsize dangling_start = 0;
+        guint k;
+        for (k = 0; k + 1 < scan.indexer.pictures->len; ++k) {
+            TsnPictureEvent *pic = &g_array_index(scan.indexer.pictures, TsnPictureEvent, k);
+            if (pic->type == TsnPictureB && !dangling_present) {
+                dangling_start = pic->packet_start;
+                dangling_present = TRUE;
+            }
+            else if (pic->type == TsnPictureP) {
+                dangling_present = FALSE;
+            }
+        }
+        TsnPictureEvent *pic = &g_array_index(scan.indexer.pictures, TsnPictureEvent, k);
+        frame_info->frame_number = PES_FRAME_ID_INVALID;
+        frame_info->stream_offset_start = pic->packet_start;
+        frame_info->stream_offset_end = pic->packet_end;
+        frame_info->stream_offset_dangling_bframe = dangling_present ? dangling_start : pic->packet_start;
+        frame_info->pts = pic->pts;
+        frame_info->dts = pic->dts;
+        frame_info->pcr = pic->pcr;
+        frame_info->pidtype = pic->pidtype;
+        frame_info->pid = pic->pid;
+
+        /* The writer needs the first pcr/pts pair of the stream. */
+        if (offset == 0) {
+            for (k = 0; k < scan.indexer.timestamps->len; ++k) {
+                TsnTimestampEvent *ev = &g_array_index(scan.indexer.timestamps, TsnTimestampEvent, k);
+                tso_check_first_pcr_pts(&tsn->out, ev->pcr, ev->pts);
+            }
+        }
+    }
+
+    tsn_indexer_clear(&scan.indexer);
+    pes_data_free(scan.pes);
+    pes_arena_free(scan.arena);
+
+    return scan.found;
+}
+
+static gboolean tsn_sparse_lookup(TsSnipper *tsn, gsize offset, PESFrameInfo *frame_info, guint *position)
+{
+    TsnSparseFrame *frames = (TsnSparseFrame *)tsn->sparse_frames->data;
+    guint lo = 0, hi = tsn->sparse_frames->len, mid;
+
+    /* First frame with scan_start > offset. */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (frames[mid].scan_start <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *position = lo;
+    if (lo == 0 || offset > frames[lo - 1].frame.stream_offset_start)
+        return FALSE;
+    *frame_info = frames[lo - 1].frame;
+    return TRUE;
+}
+
+static void tsn_sparse_insert(TsSnipper *tsn, gsize offset, const PESFrameInfo *frame_info)
+{
+    guint position;
+    PESFrameInfo found;
+
+    g_mutex_lock(&tsn->data_lock);
+    if (!tsn_sparse_lookup(tsn, offset, &found, &position)) {
+        TsnSparseFrame *next = position < tsn->sparse_frames->len
+            ? &g_array_index(tsn->sparse_frames, TsnSparseFrame, position)
+            : NULL;
+        if (next && next->frame.stream_offset_start == frame_info->stream_offset_start) {
+            /* Found before from a later position. */
+            next->scan_start = offset;
+        }
+        else {
+            TsnSparseFrame frame = { .scan_start = offset, .frame = *frame_info };
+            g_array_insert_val(tsn->sparse_frames, position, frame);
+        }
+    }
+    g_mutex_unlock(&tsn->data_lock);
+}
+
+/* The index is written to the cache once both the analysis and the hash are done. */
+static void tsn_write_index_cache(TsSnipper *tsn, const gchar *sha1sum)
+{
+    g_mutex_lock(&tsn->data_lock);
+    if (tsn->use_index_cache && tsn->index_complete && !tsn->index_cached) {
+        IndexCacheInfo info = {
+            .video_pid = tsn->video_pid,
+            .video_pidtype = tsn->video_pidtype,
+            .pcr_first = tsn->out.pcr_stream_first,
+            .pts_first = tsn->out.pts_stream_first
+        };
+        g_strlcpy(info.sha1, sha1sum, sizeof(info.sha1));
+        tsn->index_cached = index_cache_write(tsn->filename, &info, tsn->frames, tsn->pcrs,
+                                              tsn->timeline, tsn->signals);
+    }
+    g_mutex_unlock(&tsn->data_lock);
+}
 
-    ts_analyzer_free(ts_analyzer);
+static void _tsn_hash_done(const gchar *sha1sum, TsSnipper *tsn)
+{
+    tsn_write_index_cache(tsn, sha1sum);
+}
+
+static gboolean tsn_read_index_cache(TsSnipper *tsn)
+{
+    IndexCacheInfo info;
+    memset(&info, 0, sizeof(IndexCacheInfo));
+
+    tsn_reset_index(tsn);
+
+    g_mutex_lock(&tsn->data_lock);
+    gboolean success = index_cache_read(tsn->filename, &info, tsn->frames, tsn->pcrs,
+                                        tsn->timeline, tsn->signals);
+    /* Only complete caches are written, but do not trust a missing checksum. */
+    if (success && info.sha1[0] == '\0')
+        success = FALSE;
+    if (success) {
+        tsn->index_complete = TRUE;
+        tsn->index_cached = TRUE;
+    }
+    else {
+        frame_index_clear(tsn->frames);
+        pcr_map_clear(tsn->pcrs);
+        stream_timeline_clear(tsn->timeline);
+        signal_index_clear(tsn->signals);
+    }
+    g_mutex_unlock(&tsn->data_lock);
+
+    if (!success)
+        return FALSE;
+
+    tsn->video_pid = info.video_pid;
+    tsn->video_pidtype = info.video_pidtype;
+    tsn->out.pcr_stream_first = info.pcr_first;
+    tsn->out.pts_stream_first = info.pts_first;
+    tsn->bytes_read = tsn->file_size;
+    input_hash_set_digest(tsn->hash, info.sha1);
+
+    return TRUE;
+}
+
+static void tsn_analyze_finish(TsSnipper *tsn)
+{
+    stream_timeline_writer_flush(tsn->timeline_writer);
+
+    /* The PES states are not needed anymore, release them at once. */
+    pid_info_manager_clear_private_data(tsn->pmgr, tsn->analyzer_client_id);
+    tsn->video_pes = NULL;
+    pes_data_free(tsn->filter_pes);
+    tsn->filter_pes = NULL;
+    pes_arena_reset(tsn->analyze_arena, TSN_ARENA_KEEP);
+
+    g_mutex_lock(&tsn->data_lock);
+    tsn->index_complete = TRUE;
+    g_mutex_unlock(&tsn->data_lock);
+
+    /* Otherwise the cache is written when the hash is done. */
+    gchar *sha1sum = input_hash_get_digest(tsn->hash);
+    if (sha1sum)
+        tsn_write_index_cache(tsn, sha1sum);
+    g_free(sha1sum);
 
     tsn->state = TsSnipperStateReady;
 }
 
+void tsn_analyze_file(TsSnipper *tsn)
+{
+    if (!tsn->input)
+        return;
+
+    tsn->state = TsSnipperStateAnalyzing;
+
+    gboolean follow = ts_snipper_get_follow(tsn);
+
+    /* A cache of a growing input is outdated anyway. */
+    if (!follow && tsn->use_index_cache && tsn_read_index_cache(tsn)) {
+        tsn->state = TsSnipperStateReady;
+        return;
+    }
+
+    tsn_reset_index(tsn);
+
+    if (follow) {
+        tsn_analyze_file_follow(tsn);
+        /* The input is complete only now. */
+        input_hash_start(tsn->hash, tsn->input, FALSE);
+    }
+    else {
+        /* Mapped input is read by the hash thread itself, only the chunked analysis may use it.
+         * Otherwise, the file is only read once. */
+        gboolean feed_hash = input_hash_start(tsn->hash, tsn->input, !ts_input_is_mapped(tsn->input));
+
+        if (feed_hash || !tsn_analyze_file_chunked(tsn)) {
+            tsn_reset_index(tsn);
+            tsn_analyze_file_sequential(tsn, feed_hash);
+        }
+
+        input_hash_end_feed(tsn->hash);
+    }
+
+    tsn_analyze_finish(tsn);
+}
+
+/* Cooperative analysis.
+ * The analyzer and the read position are kept between the steps, each step reads the next
+ * part of the input on the calling thread. */
+
+struct _TsnAnalyzeStep {
+    TsAnalyzer *analyzer;
+    struct TsnAnalyzeContext ctx;
+    gsize offset; /* Offset of the next read. */
+    gboolean follow;
+};
+
+/* Returns FALSE if nothing is left to do, e.g., because the index was read from the cache. */
+static gboolean tsn_analyze_step_begin(TsSnipper *tsn)
+{
+    static TsAnalyzerClass tscls = {
+        .handle_packet = (TsHandlePacketFunc)tsn_handle_packet,
+    };
+
+    tsn->state = TsSnipperStateAnalyzing;
+
+    gboolean follow = ts_snipper_get_follow(tsn);
+
+    if (!follow && tsn->use_index_cache && tsn_read_index_cache(tsn)) {
+        tsn->state = TsSnipperStateReady;
+        return FALSE;
+    }
+
+    tsn_reset_index(tsn);
+
+    TsnAnalyzeStep *step = g_new0(TsnAnalyzeStep, 1);
+    step->analyzer = ts_analyzer_new(&tscls, tsn);
+    ts_analyzer_set_pid_info_manager(step->analyzer, tsn->pmgr);
+    step->ctx.tsn = tsn;
+    step->ctx.analyzer = step->analyzer;
+    step->follow = follow;
+    /* The hash of a growing input is started once it is complete. */
+    if (!follow && input_hash_start(tsn->hash, tsn->input, !ts_input_is_mapped(tsn->input)))
+        step->ctx.hash = tsn->hash;
+
+    tsn->step = step;
+
+    return TRUE;
+}
+
+static void tsn_analyze_step_free(TsSnipper *tsn)
+{
+    if (tsn->step) {
+        ts_analyzer_free(tsn->step->analyzer);
+        g_free(tsn->step);
+        tsn->step = NULL;
+    }
+}
+
+static void tsn_analyze_step_end(TsSnipper *tsn)
+{
+    if (tsn->step->follow)
+        input_hash_start(tsn->hash, tsn->input, FALSE);
+    else
+        input_hash_end_feed(tsn->hash);
+
+    tsn_analyze_step_free(tsn);
+    tsn_analyze_finish(tsn);
+}
+
 TsSnipper *ts_snipper_new(const gchar *filename)
 {
     TsSnipper *tsn = g_malloc0(sizeof(TsSnipper));
     tsn->filename = g_canonicalize_filename(filename, NULL);
-    tsn->checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    tsn->hash = input_hash_new();
+    input_hash_set_done_func(tsn->hash, (InputHashDoneFunc)_tsn_hash_done, tsn);
+    tsn->use_index_cache = TRUE;
     if (!tsn_open_file(tsn, tsn->filename))
         goto err;
 
     tsn->pmgr = pid_info_manager_new();
     tsn->analyzer_client_id = pid_info_manager_register_client(tsn->pmgr);
-    tsn->random_access_client_id = pid_info_manager_register_client(tsn->pmgr);
-    tsn->out.writer_client_id = pid_info_manager_register_client(tsn->pmgr);
+    tsn->out.pids = g_new0(WriterPidInfo, TSO_PIDS);
+    tsn->out.pids_seen = g_new(guint16, TSO_PIDS);
+
+    tsn->frames = frame_index_new();
+    tsn->pcrs = pcr_map_new();
+    pcr_map_set_interval(tsn->pcrs, TSN_PCR_TABLE_INTERVAL);
+    tsn->timeline = stream_timeline_new(TSN_TIMELINE_BUCKET_SIZE);
+    tsn->timeline_writer = stream_timeline_writer_new(tsn->timeline);
+    tsn->signals = signal_index_new();
+    tsn->signal_parser = signal_parser_new(tsn->signals);
+    tsn->analyze_arena = pes_arena_new();
+    tsn->random_access_arena = pes_arena_new();
+    tsn->psi = ts_demux_new();
+    tsn->sparse_pcrs = pcr_map_new();
+    tsn->sparse_frames = g_array_new(FALSE, FALSE, sizeof(TsnSparseFrame));
+
+    tsn_indexer_init(&tsn->indexer, tsn, FALSE);
 
-    tsn->frame_infos = g_array_sized_new(FALSE, /* zero-terminated? */
-                                   TRUE,  /* Clear when allocated? */
-                                   sizeof(PESFrameInfo), /* Size of single element */
-                                   1024 /* preallocated number of elements */);
-
-    g_mutex_init(&tsn->file_lock);
     g_mutex_init(&tsn->data_lock);
+    g_cond_init(&tsn->follow_cond);
 
     tsn->state = TsSnipperStateInitialized;
 
@@ -484,13 +2172,31 @@ err:
 void ts_snipper_destroy(TsSnipper *tsn)
 {
     if (tsn) {
+        tsn_analyze_step_free(tsn);
         tsn_close_file(tsn);
         g_free(tsn->filename);
-        g_checksum_free(tsn->checksum);
+        input_hash_free(tsn->hash);
+        frame_index_free(tsn->frames);
+        pcr_map_free(tsn->pcrs);
+        stream_timeline_writer_free(tsn->timeline_writer);
+        stream_timeline_free(tsn->timeline);
+        signal_parser_free(tsn->signal_parser);
+        signal_index_free(tsn->signals);
+        if (tsn->pmgr) {
+            /* The PES states live in the arena. */
+            pid_info_manager_clear_private_data(tsn->pmgr, tsn->analyzer_client_id);
+        }
+        pes_data_free(tsn->filter_pes);
+        pes_arena_free(tsn->analyze_arena);
+        pes_arena_free(tsn->random_access_arena);
+        ts_demux_free(tsn->psi);
+        pcr_map_free(tsn->sparse_pcrs);
+        if (tsn->sparse_frames)
+            g_array_free(tsn->sparse_frames, TRUE);
 
         g_list_free_full(tsn->out.slices, g_free);
-        if (tsn->out.disabled_pids)
-            g_array_free(tsn->out.disabled_pids, TRUE);
+        g_free(tsn->out.pids);
+        g_free(tsn->out.pids_seen);
 
         g_free(tsn);
     }
@@ -515,11 +2221,63 @@ const gchar *ts_snipper_get_filename(TsSnipper *tsn)
     return tsn ? tsn->filename : NULL;
 }
 
-const gchar *ts_snipper_get_sha1sum(TsSnipper *tsn)
+gchar *ts_snipper_get_sha1sum(TsSnipper *tsn)
+{
+    if (!tsn)
+        return NULL;
+    return input_hash_get_digest(tsn->hash);
+}
+
+gchar *ts_snipper_wait_sha1sum(TsSnipper *tsn)
 {
-    if (!tsn || tsn->state != TsSnipperStateReady)
+    if (!tsn)
         return NULL;
-    return g_checksum_get_string(tsn->checksum);
+    return input_hash_wait(tsn->hash);
+}
+
+gboolean ts_snipper_get_fingerprint(TsSnipper *tsn, InputFingerprint *fingerprint)
+{
+    g_return_val_if_fail(tsn != NULL, FALSE);
+    g_return_val_if_fail(fingerprint != NULL, FALSE);
+
+    g_mutex_lock(&tsn->data_lock);
+    gboolean success = tsn->have_fingerprint;
+    if (success)
+        *fingerprint = tsn->fingerprint;
+    g_mutex_unlock(&tsn->data_lock);
+
+    if (success)
+        return TRUE;
+    if (!tsn->input)
+        return FALSE;
+
+    /* Read the samples without blocking analysis and the slice functions. */
+    InputFingerprint computed;
+    if (!input_fingerprint_compute(tsn->input, &computed))
+        return FALSE;
+
+    g_mutex_lock(&tsn->data_lock);
+    /* Only keep it if the input did not grow in the meantime. */
+    if (computed.size == ts_input_get_size(tsn->input)) {
+        tsn->fingerprint = computed;
+        tsn->have_fingerprint = TRUE;
+    }
+    g_mutex_unlock(&tsn->data_lock);
+
+    *fingerprint = computed;
+    return TRUE;
+}
+
+gboolean ts_snipper_get_sha1_status(TsSnipper *tsn, gsize *bytes_hashed, gsize *bytes_total)
+{
+    g_return_val_if_fail(tsn != NULL, FALSE);
+    return input_hash_get_status(tsn->hash, bytes_hashed, bytes_total);
+}
+
+gboolean ts_snipper_get_sha1_failed(TsSnipper *tsn)
+{
+    g_return_val_if_fail(tsn != NULL, TRUE);
+    return input_hash_has_failed(tsn->hash);
 }
 
 gboolean ts_snipper_get_analyze_status(TsSnipper *tsn, gsize *bytes_read, gsize *bytes_total)
@@ -538,6 +2296,39 @@ gboolean ts_snipper_get_write_status(TsSnipper *tsn, gsize *bytes_read, gsize *b
     return TRUE;
 }
 
+void ts_snipper_set_follow(TsSnipper *tsn, gboolean follow)
+{
+    g_return_if_fail(tsn != NULL);
+
+    g_mutex_lock(&tsn->data_lock);
+    tsn->follow = follow;
+    g_cond_broadcast(&tsn->follow_cond);
+    g_mutex_unlock(&tsn->data_lock);
+}
+
+gboolean ts_snipper_get_follow(TsSnipper *tsn)
+{
+    g_return_val_if_fail(tsn != NULL, FALSE);
+
+    g_mutex_lock(&tsn->data_lock);
+    gboolean follow = tsn->follow;
+    g_mutex_unlock(&tsn->data_lock);
+
+    return follow;
+}
+
+void ts_snipper_set_index_cache(TsSnipper *tsn, gboolean use_cache)
+{
+    g_return_if_fail(tsn != NULL);
+    tsn->use_index_cache = use_cache;
+}
+
+void ts_snipper_set_analyze_threads(TsSnipper *tsn, guint threads)
+{
+    g_return_if_fail(tsn != NULL);
+    tsn->analyze_threads = threads;
+}
+
 void ts_snipper_analyze(TsSnipper *tsn)
 {
     if (tsn && (tsn->state == TsSnipperStateInitialized || tsn->state == TsSnipperStateReady)) {
@@ -545,64 +2336,402 @@ void ts_snipper_analyze(TsSnipper *tsn)
     }
 }
 
+gboolean ts_snipper_analyze_step(TsSnipper *tsn, gsize byte_budget)
+{
+    g_return_val_if_fail(tsn != NULL, FALSE);
+
+    if (!tsn->input)
+        return FALSE;
+    if (!tsn->step) {
+        if (tsn->state != TsSnipperStateInitialized && tsn->state != TsSnipperStateReady)
+            return FALSE;
+        if (!tsn_analyze_step_begin(tsn))
+            return FALSE;
+    }
+
+    TsnAnalyzeStep *step = tsn->step;
+    gsize end = tsn->file_size;
+    /* Checked before looking for new data, so that data appended up to now is read. */
+    gboolean follow = step->follow && ts_snipper_get_follow(tsn);
+
+    if (step->follow) {
+        tsn_refresh_input(tsn);
+        /* Only complete packets, the recorder may be in the middle of writing one. */
+        end = tsn->file_size - (tsn->file_size - step->offset) % TS_SIZE;
+    }
+
+    gsize length = MAX(byte_budget - byte_budget % TS_SIZE, TS_SIZE);
+    if (step->offset < end) {
+        length = MIN(length, end - step->offset);
+        ts_input_read_range(tsn->input,
+                            step->offset,
+                            length,
+                            TsInputAccessSequential,
+                            (TsInputReadFunc)_tsn_analyze_push_buffer,
+                            &step->ctx);
+        step->offset += length;
+    }
+
+    /* While following, wait for the input to grow. */
+    if (step->offset < end || follow)
+        return TRUE;
+
+    tsn_analyze_step_end(tsn);
+
+    return FALSE;
+}
+
+void ts_snipper_analyze_sparse(TsSnipper *tsn)
+{
+    if (!tsn || !tsn->input ||
+            (tsn->state != TsSnipperStateInitialized && tsn->state != TsSnipperStateReady))
+        return;
+
+    tsn->state = TsSnipperStateAnalyzing;
+
+    tsn_reset_index(tsn);
+    g_mutex_lock(&tsn->data_lock);
+    g_array_set_size(tsn->sparse_frames, 0);
+    g_mutex_unlock(&tsn->data_lock);
+    pcr_map_clear(tsn->sparse_pcrs);
+    tsn->sparse_pcr_pid = 0;
+
+    if (tsn_probe_video_pid(tsn)) {
+        PESFrameInfo frame_info;
+        /* Also gets the first pcr/pts pair. */
+        if (tsn_sparse_scan(tsn, 0, &frame_info))
+            tsn_sparse_insert(tsn, 0, &frame_info);
+        tsn_sparse_sample_pcrs(tsn);
+    }
+
+    tsn->state = TsSnipperStateReady;
+}
+
+gsize ts_snipper_estimate_offset(TsSnipper *tsn, gdouble position)
+{
+    g_return_val_if_fail(tsn != NULL, 0);
+
+    gsize offset;
+    /* The seek table of a full analysis is more accurate. */
+    PcrMap *map = pcr_map_get_count(tsn->pcrs) > 1 ? tsn->pcrs : tsn->sparse_pcrs;
+    position = CLAMP(position, 0.0, 1.0);
+    if (!pcr_map_time_to_offset(map, (guint64)(position * pcr_map_get_duration(map)), &offset))
+        offset = (gsize)(position * tsn->file_size);
+    offset = MIN(offset, tsn->file_size);
+
+    return offset - offset % TS_SIZE;
+}
+
+gboolean ts_snipper_get_offset_for_time(TsSnipper *tsn, guint64 time, gsize *offset)
+{
+    g_return_val_if_fail(tsn != NULL, FALSE);
+
+    PcrMapEntry entry;
+    if (!pcr_map_lookup(tsn->pcrs, time * 300, &entry))
+        return FALSE;
+    if (offset)
+        *offset = entry.offset;
+    return TRUE;
+}
+
+guint64 ts_snipper_get_duration(TsSnipper *tsn)
+{
+    g_return_val_if_fail(tsn != NULL, 0);
+
+    PcrMap *map = pcr_map_get_count(tsn->pcrs) > 1 ? tsn->pcrs : tsn->sparse_pcrs;
+    return pcr_map_get_duration(map) / 300;
+}
+
+guint ts_snipper_get_timeline_length(TsSnipper *tsn)
+{
+    g_return_val_if_fail(tsn != NULL, 0);
+    return stream_timeline_get_bucket_count(tsn->timeline);
+}
+
+guint16 *ts_snipper_get_timeline_pids(TsSnipper *tsn, guint *count)
+{
+    g_return_val_if_fail(tsn != NULL, NULL);
+    return stream_timeline_get_pids(tsn->timeline, count);
+}
+
+gboolean ts_snipper_get_timeline_entry(TsSnipper *tsn,
+                                       guint bucket,
+                                       guint16 pid,
+                                       TsSnipperTimelineEntry *entry)
+{
+    g_return_val_if_fail(tsn != NULL, FALSE);
+    g_return_val_if_fail(entry != NULL, FALSE);
+
+    StreamTimelineCounts counts;
+    if (!stream_timeline_get_counts(tsn->timeline, bucket, pid, &counts))
+        return FALSE;
+
+    gsize bucket_size = stream_timeline_get_bucket_size(tsn->timeline);
+    guint64 pcr_start, pcr_end;
+
+    memset(entry, 0, sizeof(TsSnipperTimelineEntry));
+    entry->offset_start = (gsize)bucket * bucket_size;
+    entry->offset_end = MIN(entry->offset_start + bucket_size, tsn->file_size);
+    entry->packets = counts.packets;
+    entry->units = counts.units;
+    entry->time_start = PES_FRAME_TS_INVALID;
+    entry->time_end = PES_FRAME_TS_INVALID;
+
+    if (pcr_map_offset_to_time(tsn->pcrs, entry->offset_start, &pcr_start) &&
+            pcr_map_offset_to_time(tsn->pcrs, entry->offset_end, &pcr_end)) {
+        entry->time_start = pcr_start / 300;
+        entry->time_end = pcr_end / 300;
+        if (pcr_end > pcr_start)
+            entry->bitrate = (guint64)counts.packets * TS_SIZE * 8 * 27000000 / (pcr_end - pcr_start);
+    }
+
+    /* Each picture of the video is a PES. */
+    entry->iframes = stream_timeline_get_iframes(tsn->timeline, bucket);
+    if (entry->iframes > 0 && tsn->video_pid &&
+            stream_timeline_get_counts(tsn->timeline, bucket, tsn->video_pid, &counts))
+        entry->gop_length = (gdouble)counts.units / entry->iframes;
+
+    return TRUE;
+}
+
+gboolean ts_snipper_find_iframe_near(TsSnipper *tsn, gsize offset, PESFrameInfo *frame_info)
+{
+    g_return_val_if_fail(tsn != NULL, FALSE);
+    g_return_val_if_fail(frame_info != NULL, FALSE);
+
+    if (!tsn->input || !tsn->video_pid)
+        return FALSE;
+
+    guint position;
+    g_mutex_lock(&tsn->data_lock);
+    gboolean found = tsn_sparse_lookup(tsn, offset, frame_info, &position);
+    g_mutex_unlock(&tsn->data_lock);
+    if (found)
+        return TRUE;
+
+    if (!tsn_sparse_scan(tsn, offset, frame_info))
+        return FALSE;
+    tsn_sparse_insert(tsn, offset, frame_info);
+
+    return TRUE;
+}
+
 guint32 ts_snipper_get_iframe_count(TsSnipper *tsn)
 {
-    return tsn->iframe_count;
+    return tsn ? frame_index_get_count(tsn->frames) : 0;
 }
 
 bool ts_snipper_get_iframe_info(TsSnipper *tsn, PESFrameInfo *frame_info, guint32 frame_id)
 {
-    if (!tsn || tsn->iframe_count <= frame_id)
-        return false;
-    if (frame_info) {
-        g_mutex_lock(&tsn->data_lock);
-        *frame_info = g_array_index(tsn->frame_infos, PESFrameInfo, frame_id);
-        g_mutex_unlock(&tsn->data_lock);
+    return tsn && frame_index_get(tsn->frames, frame_id, frame_info);
+}
+
+/* PTS are 33 bit. Relative to the first I frame, they increase across a wraparound, as long as
+ * the stream is shorter than half the period (13 hours). */
+#define TSN_PTS_MASK ((G_GUINT64_CONSTANT(1) << 33) - 1)
+
+static gboolean tsn_get_iframe_pts(TsSnipper *tsn, guint32 frame_id, guint64 pts_first, guint64 *pts)
+{
+    PESFrameInfo frame_info;
+    if (!frame_index_get(tsn->frames, frame_id, &frame_info) || frame_info.pts == PES_FRAME_TS_INVALID)
+        return FALSE;
+    *pts = (frame_info.pts - pts_first) & TSN_PTS_MASK;
+    return TRUE;
+}
+
+guint32 ts_snipper_find_iframe_by_pts(TsSnipper *tsn, guint64 pts, TsSnipperSeek seek)
+{
+    g_return_val_if_fail(tsn != NULL, PES_FRAME_ID_INVALID);
+
+    guint32 count = frame_index_get_count(tsn->frames);
+    PESFrameInfo first;
+    if (count == 0 || !frame_index_get(tsn->frames, 0, &first) || first.pts == PES_FRAME_TS_INVALID)
+        return PES_FRAME_ID_INVALID;
+
+    guint64 target = (pts - first.pts) & TSN_PTS_MASK;
+    guint64 rel_before = 0, rel_after = 0;
+    guint32 lo = 0, hi = count, mid;
+
+    /* Beyond half the period it is before the first frame. */
+    if (target <= TSN_PTS_MASK / 2) {
+        /* First frame with a pts after target. */
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (!tsn_get_iframe_pts(tsn, mid, first.pts, &rel_after))
+                return PES_FRAME_ID_INVALID;
+            if (rel_after <= target)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+    }
+
+    guint32 before = lo > 0 ? lo - 1 : PES_FRAME_ID_INVALID;
+    guint32 after = lo < count ? lo : PES_FRAME_ID_INVALID;
+    if (before != PES_FRAME_ID_INVALID && !tsn_get_iframe_pts(tsn, before, first.pts, &rel_before))
+        return PES_FRAME_ID_INVALID;
+    if (after != PES_FRAME_ID_INVALID && !tsn_get_iframe_pts(tsn, after, first.pts, &rel_after))
+        return PES_FRAME_ID_INVALID;
+    /* A frame exactly at target is both before and after. */
+    if (before != PES_FRAME_ID_INVALID && rel_before == target)
+        after = before;
+
+    switch (seek) {
+        case TsSnipperSeekBefore:
+            return before;
+        case TsSnipperSeekAfter:
+            return after;
+        case TsSnipperSeekNearest:
+        default:
+            if (before == PES_FRAME_ID_INVALID)
+                return after;
+            if (after == PES_FRAME_ID_INVALID)
+                return before;
+            return (target - rel_before <= rel_after - target) ? before : after;
+    }
+}
+
+guint32 ts_snipper_find_iframe_by_time(TsSnipper *tsn, guint64 time, TsSnipperSeek seek)
+{
+    g_return_val_if_fail(tsn != NULL, PES_FRAME_ID_INVALID);
+
+    guint64 pts_first = tsn->out.pts_stream_first;
+    if (pts_first == PES_FRAME_TS_INVALID) {
+        PESFrameInfo first;
+        if (!frame_index_get(tsn->frames, 0, &first))
+            return PES_FRAME_ID_INVALID;
+        pts_first = first.pts;
+    }
+
+    return ts_snipper_find_iframe_by_pts(tsn, (pts_first + time) & TSN_PTS_MASK, seek);
+}
+
+guint32 ts_snipper_add_slice_by_time(TsSnipper *tsn, guint64 time_begin, guint64 time_end)
+{
+    g_return_val_if_fail(tsn != NULL, TS_SLICE_ID_INVALID);
+    if (time_end <= time_begin)
+        return TS_SLICE_ID_INVALID;
+
+    guint32 frame_begin = ts_snipper_find_iframe_by_time(tsn, time_begin, TsSnipperSeekAfter);
+    if (frame_begin == PES_FRAME_ID_INVALID)
+        return TS_SLICE_ID_INVALID;
+    /* Until the end if there is no I frame after time_end. */
+    guint32 frame_end = ts_snipper_find_iframe_by_time(tsn, time_end, TsSnipperSeekAfter);
+    if (frame_end == frame_begin)
+        return TS_SLICE_ID_INVALID;
+
+    return ts_snipper_add_slice(tsn, frame_begin, frame_end);
+}
+
+/* PTS of the video at an offset, from the PCR there. The PTS runs ahead of the PCR by the
+ * decoder delay, which is taken from the first pcr/pts pair. */
+static gboolean tsn_offset_to_pts(TsSnipper *tsn, gsize offset, guint64 *pts)
+{
+    PcrMapEntry first;
+    guint64 time;
+
+    if (tsn->out.pcr_stream_first == PES_FRAME_TS_INVALID ||
+            tsn->out.pts_stream_first == PES_FRAME_TS_INVALID ||
+            !pcr_map_get(tsn->pcrs, 0, &first) ||
+            !pcr_map_offset_to_time(tsn->pcrs, offset, &time))
+        return FALSE;
+
+    *pts = ((first.pcr + time) / 300 + tsn->out.pts_stream_first - tsn->out.pcr_stream_first / 300)
+           & TSN_PTS_MASK;
+    return TRUE;
+}
+
+guint ts_snipper_get_signal_count(TsSnipper *tsn)
+{
+    g_return_val_if_fail(tsn != NULL, 0);
+    return signal_index_get_marker_count(tsn->signals);
+}
+
+gboolean ts_snipper_get_signal(TsSnipper *tsn, guint index, TsSnipperSignal *signal)
+{
+    g_return_val_if_fail(tsn != NULL, FALSE);
+    g_return_val_if_fail(signal != NULL, FALSE);
+
+    SignalMarker marker;
+    SignalClock clock;
+
+    if (!signal_index_get_marker(tsn->signals, index, &marker))
+        return FALSE;
+
+    memset(signal, 0, sizeof(TsSnipperSignal));
+    signal->type = (TsSnipperSignalType)marker.type;
+    signal->pid = marker.pid;
+    signal->service_id = marker.service_id;
+    signal->id = marker.id;
+    signal->offset = marker.offset;
+    signal->utc_start = marker.utc_start;
+    signal->pts = marker.pts;
+    signal->duration = marker.duration;
+    signal->frame_begin = PES_FRAME_ID_INVALID;
+    signal->frame_end = PES_FRAME_ID_INVALID;
+
+    if (marker.type == SignalMarkerEvent) {
+        /* The start of the event on the clock of the stream, or where it became present. */
+        if (signal_index_find_clock(tsn->signals, marker.utc_start, &clock) &&
+                tsn_offset_to_pts(tsn, clock.offset, &signal->pts))
+            signal->pts = (signal->pts + (guint64)((marker.utc_start - clock.utc) * 90000)) & TSN_PTS_MASK;
+        else if (!tsn_offset_to_pts(tsn, marker.offset, &signal->pts))
+            signal->pts = PES_FRAME_TS_INVALID;
+    }
+    else if (signal->pts == PES_FRAME_TS_INVALID) {
+        /* Splice immediately. */
+        if (!tsn_offset_to_pts(tsn, marker.offset, &signal->pts))
+            signal->pts = PES_FRAME_TS_INVALID;
     }
-    return true;
+
+    if (signal->pts != PES_FRAME_TS_INVALID) {
+        signal->frame_begin = ts_snipper_find_iframe_by_pts(tsn, signal->pts, TsSnipperSeekNearest);
+        if (signal->duration > 0)
+            signal->frame_end = ts_snipper_find_iframe_by_pts(tsn,
+                                                              (signal->pts + signal->duration) & TSN_PTS_MASK,
+                                                              TsSnipperSeekNearest);
+    }
+
+    return TRUE;
 }
 
+/* An I frame ends within this many bytes, even with a high bitrate and much other data. */
+#define TSN_IFRAME_READ_SIZE (8 * 1024 * 1024)
+
 struct FindIFrameInfo {
     TsSnipper *tsn;
     gboolean package_found;
 
+    TsnPidFilter filter;
+    PESData *pes;
+
     uint8_t *pes_data;
     size_t pes_size;
 };
 
 void _ts_get_iframe_handle_pes(PESData *pes, struct FindIFrameInfo *fifi)
 {
-    if (!fifi->package_found && pes->data->len > 0 && pes->have_start && pes->complete) {
+    if (!fifi->package_found && pes->data && pes->data_len > 0 && pes->have_start && pes->complete) {
         fifi->package_found = true;
-#if GLIB_CHECK_VERSION(2,64,0)
-        fifi->pes_data = g_byte_array_steal(pes->data, &fifi->pes_size);
-#else
-        fifi->pes_size = pes->data->len;
-        fifi->pes_data = g_byte_array_free(pes->data, FALSE);
-        pes->data = g_byte_array_new();
-#endif
+        /* The buffer belongs to the arena, the caller gets a copy. */
+        fifi->pes_size = pes->data_len;
+        fifi->pes_data = g_malloc(pes->data_len);
+        memcpy(fifi->pes_data, pes->data, pes->data_len);
     }
 }
 
-static bool _ts_get_iframe_handle_packet(PidInfo *pidinfo, const uint8_t *packet, const size_t offset, struct FindIFrameInfo *fifi)
+static void _ts_get_iframe_handle_packet(const guint8 *packet, gsize offset, struct FindIFrameInfo *fifi)
 {
-    if (!pidinfo || !fifi)
-        return false;
-
-    if (pidinfo->type == PID_TYPE_VIDEO_13818 || pidinfo->type == PID_TYPE_VIDEO_14496) {
-        _tsn_handle_pes(fifi->tsn, pidinfo, fifi->tsn->random_access_client_id, packet, offset,
-                (PESFinishedFunc)_ts_get_iframe_handle_pes, fifi);
-        if (fifi->package_found) {
-            pid_info_clear_private_data(pidinfo, fifi->tsn->random_access_client_id);
-            return false;
-        }
-    }
-    return true;
+    if (fifi->package_found)
+        return;
+    pes_data_push_packet(fifi->pes, NULL, packet, offset,
+                         NULL, (PESFinishedFunc)_ts_get_iframe_handle_pes, fifi);
 }
 
-/* Check if an I frame was found or if the search continues. */
-static gboolean _ts_fifi_resume(struct FindIFrameInfo *fifi)
+/* Read until the I frame is complete. */
+static gboolean _ts_get_iframe_push_buffer(const guint8 *data, gsize length, struct FindIFrameInfo *fifi)
 {
+    tsn_pid_filter_push(&fifi->filter, data, length, (TsnPacketFunc)_ts_get_iframe_handle_packet, fifi);
     return !fifi->package_found;
 }
 
@@ -610,41 +2739,57 @@ void ts_snipper_get_iframe(TsSnipper *tsn, guint8 **data, gsize *length, guint32
 {
     if (!data)
         return;
-    if (!tsn || tsn->iframe_count <= frame_id || !tsn->file) {
+    PESFrameInfo frame_info;
+    if (!tsn || !frame_index_get(tsn->frames, frame_id, &frame_info)) {
         *data = NULL;
         if (length) *length = 0;
+        return;
     }
 
-    g_mutex_lock(&tsn->data_lock);
-    PESFrameInfo *frame_info = &g_array_index(tsn->frame_infos, PESFrameInfo, frame_id);
-    g_mutex_unlock(&tsn->data_lock);
+    ts_snipper_get_iframe_at(tsn, &frame_info, data, length);
+}
+
+void ts_snipper_get_iframe_at(TsSnipper *tsn, const PESFrameInfo *frame_info, guint8 **data, gsize *length)
+{
+    if (!data)
+        return;
+    /* The frame knows its pid, pid types from PAT/PMT are not needed. They are missing after
+     * reading the cache, and the video may have moved to another pid later. */
+    if (!tsn || !tsn->input || !frame_info || !frame_info->pid ||
+            frame_info->stream_offset_start >= tsn->file_size) {
+        *data = NULL;
+        if (length) *length = 0;
+        return;
+    }
 
     struct FindIFrameInfo fifi;
     memset(&fifi, 0, sizeof(struct FindIFrameInfo));
     fifi.tsn = tsn;
-
-    static TsAnalyzerClass tscls = {
-        .handle_packet = (TsHandlePacketFunc)_ts_get_iframe_handle_packet
-    };
-    TsAnalyzer *ts_analyzer = ts_analyzer_new(&tscls, &fifi);
-    ts_analyzer_set_pid_info_manager(ts_analyzer, tsn->pmgr);
-
-    tsn_read_buffered(tsn,
-                      ts_analyzer,
-                      frame_info->stream_offset_start,
-                      (TsnResumeCallback)_ts_fifi_resume,
-                      &fifi);
-
-    ts_analyzer_free(ts_analyzer);
+    /* The frame starts on a packet, no matter how the file is aligned. */
+    fifi.filter.active = TRUE;
+    fifi.filter.pid = frame_info->pid;
+    fifi.filter.offset = frame_info->stream_offset_start;
+    fifi.pes = pes_data_new(tsn->random_access_arena);
+
+    ts_input_read_range(tsn->input,
+                        frame_info->stream_offset_start,
+                        MIN(TSN_IFRAME_READ_SIZE, tsn->file_size - frame_info->stream_offset_start),
+                        TsInputAccessRandom,
+                        (TsInputReadFunc)_ts_get_iframe_push_buffer,
+                        &fifi);
 
     if (fifi.package_found) {
         *data = fifi.pes_data;
         if (length) *length = fifi.pes_size;
     }
     else {
-        /* Reset private data. */
-        pid_info_manager_clear_private_data(tsn->pmgr, tsn->random_access_client_id);
+        *data = NULL;
+        if (length) *length = 0;
     }
+
+    /* Release the reassembly buffers at once. */
+    pes_data_free(fifi.pes);
+    pes_arena_reset(tsn->random_access_arena, TSN_ARENA_KEEP);
 }
 
 static gint ts_slice_compare(TsSlice *a, TsSlice *b)
@@ -654,17 +2799,15 @@ static gint ts_slice_compare(TsSlice *a, TsSlice *b)
     return (gint)(a->begin - b->begin);
 }
 
-/* Merge overlapping slices. */
-void ts_snipper_merge_slices(TsSnipper *tsn)
+/* Merge overlapping slices of a sorted list. */
+static GList *tsn_merge_slice_list(GList *slices)
 {
-    g_mutex_lock(&tsn->data_lock);
-
     GList *linkA, *linkB;
     TsSlice *A, *B;
     /* Slices are always sorted such that A.begin <= B.begin
      * If B.begin > A.end => nothing to do, proceed with next pair.
      * If B.begin <= A.end => merge slices (min(A.begin,B.begin)=A.begin, max(A.end,B.end))*/
-    linkA = tsn->out.slices;
+    linkA = slices;
     while (linkA != NULL && (linkB = g_list_next(linkA)) != NULL) {
         A = (TsSlice *)linkA->data;
         B = (TsSlice *)linkB->data;
@@ -681,18 +2824,61 @@ void ts_snipper_merge_slices(TsSnipper *tsn)
                 A->pcr_end = B->pcr_end;
             }
             g_free(B);
-            tsn->out.slices = g_list_delete_link(tsn->out.slices, linkB);
+            slices = g_list_delete_link(slices, linkB);
         }
     }
 
+    return slices;
+}
+
+/* Merge overlapping slices. */
+void ts_snipper_merge_slices(TsSnipper *tsn)
+{
+    g_mutex_lock(&tsn->data_lock);
+    tsn->out.slices = tsn_merge_slice_list(tsn->out.slices);
     g_mutex_unlock(&tsn->data_lock);
 }
 
-guint32 ts_snipper_add_slice(TsSnipper *tsn, guint32 frame_begin, guint32 frame_end)
+static void tsn_slice_set(TsSlice *slice,
+                          guint32 frame_begin,
+                          const PESFrameInfo *fi_begin,
+                          guint32 frame_end,
+                          const PESFrameInfo *fi_end)
+{
+    /* Also ignore dangling, B frames, which relate to this I frame, i.e., B frames immediately before
+     * the I frame */
+    slice->begin = fi_begin->stream_offset_dangling_bframe/*fi_begin->stream_offset_start*/;
+    slice->begin_frame = frame_begin;
+    slice->pts_begin = fi_begin->pts;
+    slice->pcr_begin = fi_begin->pcr;
+
+    slice->end = fi_end->stream_offset_start;
+    slice->end_frame = frame_end;
+    slice->pts_end = fi_end->pts;
+    slice->pcr_end = fi_end->pcr;
+    slice->id = TS_SLICE_ID_INVALID;
+}
+
+static guint32 tsn_insert_slice(TsSnipper *tsn, const TsSlice *slice)
+{
+    TsSlice *added = g_new(TsSlice, 1);
+    *added = *slice;
+
+    g_mutex_lock(&tsn->data_lock);
+    guint32 slice_id = tsn->out.next_slice_id++;
+    added->id = slice_id; /* slice might become invalid after merging. */
+
+    tsn->out.slices = g_list_insert_sorted(tsn->out.slices, added, (GCompareFunc)ts_slice_compare);
+    g_mutex_unlock(&tsn->data_lock);
+
+    ts_snipper_merge_slices(tsn);
+
+    return slice_id;
+}
+
+/* Fill slice from the I frames, without adding it. */
+static gboolean tsn_slice_init(TsSnipper *tsn, TsSlice *slice, guint32 frame_begin, guint32 frame_end)
 {
-    if (!tsn)
-        return TS_SLICE_ID_INVALID;
-    /* FIXME Handle overlapping slices. */
     PESFrameInfo fi_begin;
     PESFrameInfo fi_end;
     if (frame_begin == PES_FRAME_ID_INVALID) {
@@ -701,48 +2887,69 @@ guint32 ts_snipper_add_slice(TsSnipper *tsn, guint32 frame_begin, guint32 frame_
         fi_begin.pts = PES_FRAME_TS_INVALID;
         fi_begin.pcr = PES_FRAME_TS_INVALID;
     }
-    else if (!ts_snipper_get_iframe_info(tsn, &fi_begin, frame_begin) && frame_begin != tsn->iframe_count) {
-        return TS_SLICE_ID_INVALID;
+    else if (!ts_snipper_get_iframe_info(tsn, &fi_begin, frame_begin) && frame_begin != ts_snipper_get_iframe_count(tsn)) {
+        return FALSE;
     }
-    else if (frame_begin == tsn->iframe_count) {
+    else if (frame_begin == ts_snipper_get_iframe_count(tsn)) {
         if (!ts_snipper_get_iframe_info(tsn, &fi_begin, frame_begin - 1))
-            return TS_SLICE_ID_INVALID;
+            return FALSE;
         fi_begin.stream_offset_start = fi_begin.stream_offset_end;
         fi_begin.pts = PES_FRAME_TS_INVALID;
         fi_begin.pcr = PES_FRAME_TS_INVALID;
     }
-    if (frame_end == PES_FRAME_ID_INVALID || frame_end + 1 == tsn->iframe_count) {
+    if (frame_end == PES_FRAME_ID_INVALID || frame_end + 1 == ts_snipper_get_iframe_count(tsn)) {
         fi_end.stream_offset_start = tsn->file_size;
         fi_end.pts = PES_FRAME_TS_INVALID;
         fi_end.pcr = PES_FRAME_TS_INVALID;
     }
     else if (!ts_snipper_get_iframe_info(tsn, &fi_end, frame_end)) {
-        return TS_SLICE_ID_INVALID;
+        return FALSE;
     }
 
-    TsSlice *slice = g_new(TsSlice, 1);
-    /* Also ignore dangling, B frames, which relate to this I frame, i.e., B frames immediately before
-     * the I frame */
-    slice->begin = fi_begin.stream_offset_dangling_bframe/*fi_begin.stream_offset_start*/;
-    slice->begin_frame = frame_begin;
-    slice->pts_begin = fi_begin.pts;
-    slice->pcr_begin = fi_begin.pcr;
-
-    slice->end = fi_end.stream_offset_start;
-    slice->end_frame = frame_end;
-    slice->pts_end = fi_end.pts;
-    slice->pcr_end = fi_end.pcr;
+    tsn_slice_set(slice, frame_begin, &fi_begin, frame_end, &fi_end);
+    return TRUE;
+}
 
-    g_mutex_lock(&tsn->data_lock);
-    guint32 slice_id = tsn->out.next_slice_id++;
-    slice->id = slice_id; /* slice might become invalid after merging. */
+guint32 ts_snipper_add_slice(TsSnipper *tsn, guint32 frame_begin, guint32 frame_end)
+{
+    if (!tsn)
+        return TS_SLICE_ID_INVALID;
+    /* FIXME Handle overlapping slices. */
+    TsSlice slice;
+    if (!tsn_slice_init(tsn, &slice, frame_begin, frame_end))
+        return TS_SLICE_ID_INVALID;
 
-    tsn->out.slices = g_list_insert_sorted(tsn->out.slices, slice, (GCompareFunc)ts_slice_compare);
-    g_mutex_unlock(&tsn->data_lock);
+    return tsn_insert_slice(tsn, &slice);
+}
 
-    ts_snipper_merge_slices(tsn);
+guint32 ts_snipper_add_slice_at(TsSnipper *tsn, const PESFrameInfo *begin, const PESFrameInfo *end)
+{
+    if (!tsn)
+        return TS_SLICE_ID_INVALID;
+    PESFrameInfo fi_begin;
+    PESFrameInfo fi_end;
+    if (begin) {
+        fi_begin = *begin;
+    }
+    else {
+        fi_begin.stream_offset_dangling_bframe = 0;
+        fi_begin.pts = PES_FRAME_TS_INVALID;
+        fi_begin.pcr = PES_FRAME_TS_INVALID;
+    }
+    if (end) {
+        fi_end = *end;
+    }
+    else {
+        fi_end.stream_offset_start = tsn->file_size;
+        fi_end.pts = PES_FRAME_TS_INVALID;
+        fi_end.pcr = PES_FRAME_TS_INVALID;
+    }
+    if (fi_end.stream_offset_start <= fi_begin.stream_offset_dangling_bframe)
+        return TS_SLICE_ID_INVALID;
 
-    return slice_id;
+    TsSlice slice;
+    tsn_slice_set(&slice, PES_FRAME_ID_INVALID, &fi_begin, PES_FRAME_ID_INVALID, &fi_end);
+    return tsn_insert_slice(tsn, &slice);
 }
 
 static gint _ts_snipper_slice_compare_frame_in_range(TsSlice *slice, guint32 frame_id)
@@ -813,74 +3020,60 @@ void ts_snipper_enum_slices(TsSnipper *tsn, TsSnipperEnumSlicesFunc callback, gp
     g_mutex_unlock(&tsn->data_lock);
 }
 
-static void tso_pid_writer_infos_init(TsSnipperOutput *tso, PidInfoManager *pmgr)
-{
-    tso->pid_count = pid_info_manager_get_pid_count(pmgr);
-    tso->pid_writer_infos = g_new0(WriterPidInfo, tso->pid_count);
-    tso->pids_seen = 0;
-    gsize j;
-    for (j = 0; j < tso->pid_count; ++j)
-        tso->pid_writer_infos[j].pts_last = PES_FRAME_TS_INVALID;
-}
-
-static void tso_pid_writer_infos_cleanup(TsSnipperOutput *tso, PidInfoManager *pmgr)
+/* Forget the state of the last write, the disabled pids stay. */
+static void tso_pid_writer_infos_init(TsSnipperOutput *tso)
 {
-    pid_info_manager_clear_private_data(pmgr, tso->writer_client_id);
-    g_free(tso->pid_writer_infos);
-    tso->pid_writer_infos = NULL;
+    guint pid;
+    for (pid = 0; pid < TSO_PIDS; ++pid) {
+        tso->pids[pid].action = WPAIgnore;
+        tso->pids[pid].continuity = 0;
+        tso->pids[pid].seen = 0;
+        tso->pids[pid].pts_last = PES_FRAME_TS_INVALID;
+    }
     tso->pid_count = 0;
+    tso->pid_action = WPAIgnore;
 }
 
 static void tso_pid_writer_infos_reset(TsSnipperOutput *tso, WriterPidAction action)
 {
-    gsize j;
+    guint j;
     for (j = 0; j < tso->pid_count; ++j) {
-        tso->pid_writer_infos[j].action = action;
+        tso->pids[tso->pids_seen[j]].action = action;
     }
+    tso->pid_action = action;
 }
 
-static WriterPidInfo *tso_pid_writer_infos_get_for_pid(TsSnipperOutput *tso, PidInfo *pidinfo)
+static inline WriterPidInfo *tso_pid_writer_infos_get_for_pid(TsSnipperOutput *tso, const TsDemuxPacket *packet)
 {
-    /* We could handle this without private data, but this way we gain faster access (no searching). */
-    WriterPidInfo *info = pid_info_get_private_data(pidinfo, tso->writer_client_id);
-    if (info == NULL) {
-        /* pids_seen cannot be larger than pid_count */
+    guint16 pid = packet->pid & (TSO_PIDS - 1);
+    WriterPidInfo *info = &tso->pids[pid];
+    if (G_UNLIKELY(!info->seen)) {
         /* First occurrence of this pid */
-        info = &tso->pid_writer_infos[tso->pids_seen++];
-        pid_info_set_private_data(pidinfo, tso->writer_client_id, info, NULL);
+        info->seen = 1;
+        info->action = tso->pid_action;
+        tso->pids_seen[tso->pid_count++] = pid;
     }
 
     return info;
 }
 
-static gboolean tso_packet_is_pes(PidInfo *pidinfo)
+/* Like tso_pid_writer_infos_get_for_pid(), but NULL if the pid was not seen yet or is unknown. */
+static inline WriterPidInfo *tso_pid_writer_infos_lookup(TsSnipperOutput *tso, const TsDemuxPacket *packet)
 {
-    return (pidinfo &&
-            (pidinfo->type == PID_TYPE_VIDEO_14496 ||
-             pidinfo->type == PID_TYPE_VIDEO_13818 ||
-             pidinfo->type == PID_TYPE_VIDEO_11172 ||
-             pidinfo->type == PID_TYPE_AUDIO_13818 ||
-             pidinfo->type == PID_TYPE_AUDIO_11172 ||
-             pidinfo->type == PID_TYPE_TELETEXT));
+    if (packet->type == TsDemuxPidUnknown)
+        return NULL;
+    WriterPidInfo *info = &tso->pids[packet->pid & (TSO_PIDS - 1)];
+    return info->seen ? info : NULL;
 }
 
-static gboolean tso_packet_is_video(PidInfo *pidinfo)
+static inline gboolean tso_packet_is_pes(const TsDemuxPacket *packet)
 {
-    return (pidinfo &&
-            (pidinfo->type == PID_TYPE_VIDEO_14496 ||
-             pidinfo->type == PID_TYPE_VIDEO_13818 ||
-             pidinfo->type == PID_TYPE_VIDEO_11172));
+    return (packet->type == TsDemuxPidVideo || packet->type == TsDemuxPidPes);
 }
 
-static inline gint64 tso_get_pes_pts(PidInfo *pidinfo, const uint8_t *packet)
+static inline gboolean tso_packet_is_video(const TsDemuxPacket *packet)
 {
-    if (!tso_packet_is_pes(pidinfo) || !ts_get_unitstart(packet))
-        return PES_FRAME_TS_INVALID;
-    size_t pes_offset = ts_has_adaptation(packet) ? 5 + packet[4] : 4;
-    const uint8_t *pes = packet + pes_offset;
-    if (!pes_has_pts(pes))
-        return PES_FRAME_TS_INVALID;
-    return pes_get_pts(pes);
+    return (packet->type == TsDemuxPidVideo);
 }
 
 #if 0
@@ -900,37 +3093,33 @@ static void tso_update_timestamps_delta(TsSnipperOutput *tso,
 }
 #endif
 
-static void tso_update_pes_pts(PidInfo *pidinfo, const uint8_t *packet, TsSnipperOutput *tso)
+static void tso_update_pes_pts(const TsDemuxPacket *packet, TsSnipperOutput *tso)
 {
-    gint64 pts = tso_get_pes_pts(pidinfo, packet);
-    if (pts == PES_FRAME_TS_INVALID)
+    if (packet->pts == PES_FRAME_TS_INVALID)
         return;
-    WriterPidInfo *info = pid_info_get_private_data(pidinfo, tso->writer_client_id);
+    WriterPidInfo *info = tso_pid_writer_infos_lookup(tso, packet);
     if (!info)
         return;
-    info->pts_last = pts;
+    info->pts_last = packet->pts;
 }
 
 /* Rewrite on basis of pcr differences. */
-static void tso_rewrite_timestamps(TsSnipperOutput *tso, PidInfo *pidinfo, uint8_t *packet)
+static void tso_rewrite_timestamps(TsSnipperOutput *tso, const TsDemuxPacket *desc, uint8_t *packet, gint64 pcr_delta)
 {
     gint64 tstmp;
-    size_t pes_offset = 4;
-    if (ts_has_adaptation(packet)) {
-        pes_offset += 1 + packet[4];
-        if (tsaf_has_pcr(packet) && tso->pcr_present) {
-            tstmp = tsaf_get_pcr(packet) * 300 + tsaf_get_pcrext(packet) - tso->pcr_delta;
-            tsaf_set_pcr(packet, tstmp / 300);
-            tsaf_set_pcrext(packet, tstmp % 300);
-        }
+    if (ts_has_adaptation(packet) && tsaf_has_pcr(packet) && tso->pcr_present) {
+        tstmp = tsaf_get_pcr(packet) * 300 + tsaf_get_pcrext(packet) - pcr_delta;
+        tsaf_set_pcr(packet, tstmp / 300);
+        tsaf_set_pcrext(packet, tstmp % 300);
     }
 
-    if (!ts_get_unitstart(packet) || !tso_packet_is_pes(pidinfo)) {
+    /* Only PES headers found by the demuxer. */
+    if (desc->pts == PES_FRAME_TS_INVALID) {
         return;
     }
-    uint8_t *pes = packet + pes_offset;
+    uint8_t *pes = packet + desc->pes_offset;
     /* pcr has a frequency of 300 higher than pts/dts */
-    gint64 delta = tso->pcr_delta / 300;
+    gint64 delta = pcr_delta / 300;
     if (pes_has_pts(pes)) {
 #if DEBUG 
         fprintf(stderr, "[%3u] rewrite %" G_GINT64_FORMAT " -> %" G_GINT64_FORMAT "\n",
@@ -943,104 +3132,119 @@ static void tso_rewrite_timestamps(TsSnipperOutput *tso, PidInfo *pidinfo, uint8
     }
 }
 
-static void tso_rewrite_continuity(TsSnipperOutput *tso, PidInfo *pidinfo, uint8_t *packet)
+static void tso_rewrite_continuity(TsSnipperOutput *tso, const TsDemuxPacket *desc, uint8_t *packet)
 {
-    WriterPidInfo *info = pid_info_get_private_data(pidinfo, tso->writer_client_id);
+    WriterPidInfo *info = tso_pid_writer_infos_lookup(tso, desc);
     if (!info)
         return;
     /* Only increment when payload present. */
     /* FIXME original duplicates should stay this way. */
-    if (ts_has_payload(packet)) {
+    if (desc->has_payload) {
         info->continuity = (info->continuity + 1) & 0x0f;
     }
     packet[3] = (packet[3] & 0xf0) | (info->continuity);
 }
 
-static gboolean tso_check_pes_timestamp(PidInfo *pidinfo, const uint8_t *packet, TsSnipperOutput *tso)
+static gboolean tso_check_pes_timestamp(const TsDemuxPacket *packet, TsSnipperOutput *tso)
 {
     /* Not enough data to check timestamp. So we are fine. */
-    if (tso->pts_cut == PES_FRAME_TS_INVALID /*|| !tso_packet_is_video(pidinfo)*/)
+    if (tso->pts_cut == PES_FRAME_TS_INVALID /*|| !tso_packet_is_video(packet)*/)
         return TRUE;
-    gint64 pts = tso_get_pes_pts(pidinfo, packet);
-    if (pts == PES_FRAME_TS_INVALID)
+    if (packet->pts == PES_FRAME_TS_INVALID)
         return TRUE;
     /* Adapt to tolerance between pcr and pts in video */
-    gint64 pts_pcr_tolerance = tso_packet_is_video(pidinfo) ? 0 : tso->pts_delta_tolerance;
+    gint64 pts_pcr_tolerance = tso_packet_is_video(packet) ? 0 : tso->pts_delta_tolerance;
 
-    return (pts + pts_pcr_tolerance >= tso->pts_cut);
+    return (packet->pts + pts_pcr_tolerance >= tso->pts_cut);
 }
 
-static gboolean tso_check_pes_timestamp_in_active_slice(PidInfo *pidinfo, const uint8_t *packet, TsSnipperOutput *tso)
+static gboolean tso_check_pes_timestamp_in_active_slice(const TsDemuxPacket *packet, TsSnipperOutput *tso)
 {
     /* If we are not in a slice, or this is video, simply ignore it. */
     if (!tso->in_slice || tso->active_slice == NULL
             || TS_SLICE(tso->active_slice->data)->pts_begin == PES_FRAME_TS_INVALID
             || TS_SLICE(tso->active_slice->data)->pts_end == PES_FRAME_TS_INVALID
-            || tso_packet_is_video(pidinfo))
+            || tso_packet_is_video(packet))
         return TRUE;
-    gint64 pts = tso_get_pes_pts(pidinfo, packet);
-    if (pts == PES_FRAME_TS_INVALID)
+    if (packet->pts == PES_FRAME_TS_INVALID)
         return TRUE;
 
-   return (pts >= TS_SLICE(tso->active_slice->data)->pts_begin
-            && pts < TS_SLICE(tso->active_slice->data)->pts_end);
+   return (packet->pts >= TS_SLICE(tso->active_slice->data)->pts_begin
+            && packet->pts < TS_SLICE(tso->active_slice->data)->pts_end);
 }
 
-static gboolean tso_is_pid_disabled(TsSnipperOutput *tso, guint16 pid)
+static inline gboolean tso_is_pid_disabled(TsSnipperOutput *tso, guint16 pid)
 {
-    if (tso->disabled_pids == NULL)
-        return FALSE;
-    guint i;
-    for (i = 0; i < tso->disabled_pids->len; ++i) {
-        if (g_array_index(tso->disabled_pids, guint16, i) == pid)
-            return TRUE;
-    }
-    return FALSE;
+    return tso->pids[pid & (TSO_PIDS - 1)].disabled;
 }
 
-static gboolean tso_should_write_packet(PidInfo *pidinfo, const uint8_t *packet, TsSnipperOutput *tso)
+static gboolean tso_should_write_packet(const TsDemuxPacket *packet, TsSnipperOutput *tso)
 {
-    if (tso_is_pid_disabled(tso, ts_get_pid(packet))) {
+    if (tso_is_pid_disabled(tso, packet->pid)) {
         return FALSE;
     }
-    if (!pidinfo) {
-        return TRUE;
+    if (packet->type == TsDemuxPidUnknown) {
+        /* Not in PAT/PMT, so there are no units to finish: cut like the rest of the slice. */
+        return !tso->in_slice;
     }
-    WriterPidInfo *info = tso_pid_writer_infos_get_for_pid(tso, pidinfo);
-#if DEBUG
-    gint64 debug_pts;
-#endif
+    WriterPidInfo *info = tso_pid_writer_infos_get_for_pid(tso, packet);
 
     if (!tso->in_slice) {
-        if (info->action == WPAIgnoreUntilUnitStart && ts_get_unitstart(packet)) {
+        if (info->action == WPAIgnoreUntilUnitStart && packet->unit_start) {
             info->action = WPAWrite;
         }
         /* Check whether the timestamp is after the last cut, if not, wait until the next unit. */
-        if (!tso_check_pes_timestamp(pidinfo, packet, tso)) {
+        if (!tso_check_pes_timestamp(packet, tso)) {
             info->action = WPAIgnoreUntilUnitStart;
         }
 #if DEBUG
-        if ((debug_pts = tso_get_pes_pts(pidinfo, packet)) != PES_FRAME_TS_INVALID)
+        if (packet->pts != PES_FRAME_TS_INVALID)
             fprintf(stderr, "[%3u] %c packet out of slice: %" G_GINT64_FORMAT "\n",
-                    ts_get_pid(packet), info->action == WPAWrite ? 'W' : 'I', debug_pts);
+                    packet->pid, info->action == WPAWrite ? 'W' : 'I', packet->pts);
 #endif
          /* Already set to write or NULL packet. */
-        return (info->action == WPAWrite || pidinfo->pid == 0x1FFF);
+        return (info->action == WPAWrite || packet->pid == 0x1FFF);
     }
     else {
-        if (info->action == WPAWriteUntilUnitStart && ts_get_unitstart(packet)) {
+        if (info->action == WPAWriteUntilUnitStart && packet->unit_start) {
             info->action = WPAIgnore;
         }
-        if (!tso_check_pes_timestamp_in_active_slice(pidinfo, packet, tso)) {
+        if (!tso_check_pes_timestamp_in_active_slice(packet, tso)) {
             info->action = WPAWriteUntilUnitStart;
         }
 #if DEBUG
-        if ((debug_pts = tso_get_pes_pts(pidinfo, packet)) != PES_FRAME_TS_INVALID)
+        if (packet->pts != PES_FRAME_TS_INVALID)
             fprintf(stderr, "[%3u] %c packet in slice    : %" G_GINT64_FORMAT "\n",
-                    ts_get_pid(packet), info->action == WPAIgnore ? 'I' : 'W', debug_pts);
+                    packet->pid, info->action == WPAIgnore ? 'I' : 'W', packet->pts);
 #endif
-        return !(info->action == WPAIgnore || pidinfo->pid == 0x1FFF);
+        return !(info->action == WPAIgnore || packet->pid == 0x1FFF);
+    }
+}
+
+/* PCR removed with a slice in 27 MHz. */
+static gint64 tso_get_slice_pcr_delta(TsSnipperOutput *tso, const TsSlice *slice)
+{
+    return slice->pcr_begin != PES_FRAME_TS_INVALID
+        ? (gint64)(slice->pcr_end - slice->pcr_begin)
+        : (gint64)(slice->pcr_end - tso->pcr_stream_first);
+}
+
+/* Append a packet to the output buffer and patch it. */
+static gboolean tso_push_packet(TsSnipperOutput *tso, const TsDemuxPacket *packet, gint64 pcr_delta)
+{
+    memcpy(tso->buffer + tso->buffer_filled, packet->data, TS_SIZE);
+    tso_rewrite_timestamps(tso, packet, tso->buffer + tso->buffer_filled, pcr_delta);
+    tso_rewrite_continuity(tso, packet, tso->buffer + tso->buffer_filled);
+
+    tso->buffer_filled += TS_SIZE;
+
+    /* Flush buffer to writer if there is no more space for another packet available. */
+    if (tso->buffer_filled + TS_SIZE > tso->buffer_size) {
+        tso->writer_result = tso->writer(tso->buffer, tso->buffer_filled, tso->writer_data);
+        tso->buffer_filled = 0;
     }
+
+    return tso->writer_result;
 }
 
 /* Check whether the given offset is inside the active slice. Move active slice forward, if necessary. */
@@ -1059,8 +3263,23 @@ static gboolean tsn_check_offset_in_slice(TsSnipperOutput *tso, const size_t off
     return (offset >= ((TsSlice *)tso->active_slice->data)->begin);
 }
 
-static bool tsn_output_handle_packet(PidInfo *pidinfo, const uint8_t *packet, const size_t offset, TsSnipperOutput *tso)
+static gboolean tsn_output_handle_packet(const TsDemuxPacket *packet, TsSnipperOutput *tso)
 {
+    const size_t offset = packet->offset;
+
+    /* Inside a kept range, only pids not writing yet need the checks below. Units still before the
+     * last cut, e.g., leading B pictures, are found by their PTS and take the full path as well,
+     * so that the result does not depend on when copying started. */
+    if (tso->copy) {
+        tso->bytes_read = offset;
+        if (tso_is_pid_disabled(tso, packet->pid))
+            return tso->writer_result;
+        if (packet->type == TsDemuxPidUnknown || packet->pid == 0x1FFF ||
+                (tso_pid_writer_infos_get_for_pid(tso, packet)->action == WPAWrite &&
+                 tso_check_pes_timestamp(packet, tso)))
+            return tso_push_packet(tso, packet, tso->cut_range->pcr_delta);
+    }
+
     /* if not in slice, or first PAT/PMT push to buffer. */
     gboolean in_slice = tsn_check_offset_in_slice(tso, offset);
     if (tso->in_slice && !in_slice) {
@@ -1080,9 +3299,7 @@ static bool tsn_output_handle_packet(PidInfo *pidinfo, const uint8_t *packet, co
         tso->pts_cut = ((TsSlice *)tso->active_slice->data)->pts_end;
         /* FIXME: Use the accumulator, but take the correct pcr, i.e., not already the last
          * before each slice. */
-        tso->pcr_delta_accumulator = TS_SLICE(tso->active_slice->data)->pcr_begin != PES_FRAME_TS_INVALID
-            ? TS_SLICE(tso->active_slice->data)->pcr_end - TS_SLICE(tso->active_slice->data)->pcr_begin
-            : TS_SLICE(tso->active_slice->data)->pcr_end - tso->pcr_stream_first;
+        tso->pcr_delta_accumulator = tso_get_slice_pcr_delta(tso, TS_SLICE(tso->active_slice->data));
         tso->pts_delta_tolerance = TS_SLICE(tso->active_slice->data)->pcr_begin != PES_FRAME_TS_INVALID
             ? TS_SLICE(tso->active_slice->data)->pts_end - TS_SLICE(tso->active_slice->data)->pts_begin
               - tso->pcr_delta_accumulator / 300
@@ -1100,48 +3317,328 @@ static bool tsn_output_handle_packet(PidInfo *pidinfo, const uint8_t *packet, co
                 tso->pcr_delta_accumulator / 300);
 #endif
     }
-    gboolean write_packet = tso_should_write_packet(pidinfo, packet, tso);
+    gboolean write_packet = tso_should_write_packet(packet, tso);
     tso->bytes_read = offset;
 
     /* Check that we do not ignore pat/pmt */
-    if (pidinfo) {
-        if (!tso->have_pat && pidinfo->type == PID_TYPE_PAT) {
-            write_packet = TRUE;
-            tso->have_pat = 1;
-        }
-        else if (!tso->have_pmt && pidinfo->type == PID_TYPE_PMT) {
-            write_packet = TRUE;
-            tso->have_pmt = 1;
-        }
+    if (!tso->have_pat && packet->type == TsDemuxPidPat) {
+        write_packet = TRUE;
+        tso->have_pat = 1;
+    }
+    else if (!tso->have_pmt && packet->type == TsDemuxPidPmt) {
+        write_packet = TRUE;
+        tso->have_pmt = 1;
     }
 
 #if 0
-    tso_update_timestamps_delta(tso, packet);
+    tso_update_timestamps_delta(tso, packet->data);
 #endif
-    tso_update_pes_pts(pidinfo, packet, tso);
+    tso_update_pes_pts(packet, tso);
 
     if (!write_packet)
         return tso->writer_result;
 
-    /* push packet to buffer */
-    memcpy(tso->buffer + tso->buffer_filled, packet, TS_SIZE);
-    tso_rewrite_timestamps(tso, pidinfo, tso->buffer + tso->buffer_filled);
-    tso_rewrite_continuity(tso, pidinfo, tso->buffer + tso->buffer_filled);
+    return tso_push_packet(tso, packet, tso->pcr_delta);
+}
 
-    tso->buffer_filled += TS_SIZE;
+static void tsn_output_handle_batch(const TsDemuxPacket *packets, guint count, TsSnipperOutput *tso)
+{
+    guint j;
+    for (j = 0; j < count && tso->writer_result; ++j) {
+        tsn_output_handle_packet(&packets[j], tso);
+    }
+}
 
-    /* Flush buffer to writer if there is no more space for another packet available. */
-    if (tso->buffer_filled + TS_SIZE > tso->buffer_size) {
-        tso->writer_result = tso->writer(tso->buffer, tso->buffer_filled, tso->writer_data);
-        tso->buffer_filled = 0;
+/* Check whether the rest of the active slice may be skipped: PAT and PMT were written, every
+ * pid has finished the units begun before the slice and ignores its packets, and every stream
+ * listed in a PMT was seen. A stream first appearing inside the slice is not skipped before it
+ * could be checked. */
+static gboolean tso_pid_writer_infos_settled(TsSnipperOutput *tso, TsDemux *demux)
+{
+    if (!tso->in_slice || !tso->have_pat || !tso->have_pmt)
+        return FALSE;
+    guint16 pid;
+    guint j;
+    for (j = 0; j < tso->pid_count; ++j) {
+        pid = tso->pids_seen[j];
+        /* Null packets have no units, they are ignored in slices anyway. */
+        if (tso->pids[pid].action != WPAIgnore && pid != 0x1FFF)
+            return FALSE;
+    }
+    for (pid = 0; pid < TSO_PIDS; ++pid) {
+        if (!tso->pids[pid].seen && ts_demux_get_pmt_pid(demux, pid) != 0)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* Check whether the remaining packets of a kept range may be copied: every pid is back to
+ * writing after the cut before the range. */
+static gboolean tso_pid_writer_infos_writing(TsSnipperOutput *tso)
+{
+    if (tso->in_slice || !tso->have_pat || !tso->have_pmt)
+        return FALSE;
+    guint16 pid;
+    guint j;
+    for (j = 0; j < tso->pid_count; ++j) {
+        pid = tso->pids_seen[j];
+        if (tso->pids[pid].action != WPAWrite && pid != 0x1FFF)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* Cut plan.
+ * Before writing, the slices are compiled into consecutive byte ranges covering the input, each
+ * with the PCR removed before it. Only the ranges around the cuts need the per-packet checks of
+ * tsn_output_handle_packet(). The inside of a slice is not read: reading continues into a slice
+ * until all pids are settled, and resumes a guard window before its end, where units of the
+ * following content, e.g., audio ahead of the video, are muxed. Once all pids write again in a
+ * kept range, its packets are only copied and patched. The demuxer is moved to each range read,
+ * so packets carry their offsets in the input. */
+
+/* Guard window before the end of a slice, 2 s, or bytes if there is no PCR seek table. */
+#define TSN_WRITE_GUARD_TIME (2 * G_GUINT64_CONSTANT(27000000))
+#define TSN_WRITE_GUARD_SIZE (188 * 16384)
+/* Bytes read at once while waiting for the pids to settle. */
+#define TSN_WRITE_SETTLE_STEP (188 * 1024)
+
+static PcrMap *tsn_get_pcr_map(TsSnipper *tsn)
+{
+    return pcr_map_get_count(tsn->pcrs) > 1 ? tsn->pcrs : tsn->sparse_pcrs;
+}
+
+/* Offset to resume reading in slice, on a packet boundary relative to its begin. */
+static gsize tsn_write_get_resume_offset(TsSnipper *tsn, const TsSlice *slice)
+{
+    /* Nothing follows the last slice. */
+    if (slice->end >= tsn->file_size)
+        return tsn->file_size;
+
+    PcrMap *map = tsn_get_pcr_map(tsn);
+    guint64 time;
+    gsize resume;
+    if (!pcr_map_offset_to_time(map, slice->end, &time) ||
+            !pcr_map_time_to_offset(map, time > TSN_WRITE_GUARD_TIME ? time - TSN_WRITE_GUARD_TIME : 0,
+                                    &resume))
+        resume = slice->end > TSN_WRITE_GUARD_SIZE ? slice->end - TSN_WRITE_GUARD_SIZE : 0;
+    /* The seek table is thinned, make sure there is a guard window at all. */
+    resume = MIN(resume, slice->end > TSN_WRITE_SETTLE_STEP ? slice->end - TSN_WRITE_SETTLE_STEP : 0);
+
+    if (resume <= slice->begin)
+        return slice->begin;
+    return resume - (resume - slice->begin) % TS_SIZE;
+}
+
+static void tsn_cut_plan_add(GArray *plan, TsnCutType type, gsize begin, gsize end, gint64 pcr_delta)
+{
+    if (begin >= end)
+        return;
+    TsnCutRange range = { .type = type, .begin = begin, .end = end, .pcr_delta = pcr_delta };
+    g_array_append_val(plan, range);
+}
+
+static TsSlice *tsn_slice_copy(const TsSlice *slice)
+{
+    TsSlice *copy = g_new(TsSlice, 1);
+    *copy = *slice;
+    return copy;
+}
+
+/* Copy the slices and add the implicit cuts, i.e., everything before the first and after the last
+ * I frame. Free with g_list_free_full(slices, g_free). */
+static GList *tsn_get_write_slices(TsSnipper *tsn)
+{
+    GList *slices = NULL;
+    GList *tmp;
+    TsSlice head, tail;
+    gboolean have_head = tsn_slice_init(tsn, &head, PES_FRAME_ID_INVALID, 0);
+    gboolean have_tail = tsn_slice_init(tsn, &tail, ts_snipper_get_iframe_count(tsn), PES_FRAME_ID_INVALID);
+
+    g_mutex_lock(&tsn->data_lock);
+    for (tmp = tsn->out.slices; tmp; tmp = g_list_next(tmp))
+        slices = g_list_prepend(slices, tsn_slice_copy(tmp->data));
+    g_mutex_unlock(&tsn->data_lock);
+
+    slices = g_list_reverse(slices);
+    if (have_head)
+        slices = g_list_insert_sorted(slices, tsn_slice_copy(&head), (GCompareFunc)ts_slice_compare);
+    if (have_tail)
+        slices = g_list_insert_sorted(slices, tsn_slice_copy(&tail), (GCompareFunc)ts_slice_compare);
+
+    return tsn_merge_slice_list(slices);
+}
+
+/* Compile the slices from tsn_get_write_slices() into a plan. Free with g_array_free(). */
+static GArray *tsn_compile_cut_plan(TsSnipper *tsn, GList *slices)
+{
+    GArray *plan = g_array_new(FALSE, FALSE, sizeof(TsnCutRange));
+    TsSlice *slice;
+    GList *tmp;
+    gsize pos = 0;
+    gsize resume;
+    gint64 pcr_delta = 0;
+
+    for (tmp = slices; tmp && pos < tsn->file_size; tmp = g_list_next(tmp)) {
+        slice = TS_SLICE(tmp->data);
+        /* Merged slices do not overlap. */
+        if (slice->end <= pos)
+            continue;
+        tsn_cut_plan_add(plan, TsnCutKeep, pos, MIN(slice->begin, tsn->file_size), pcr_delta);
+        resume = tsn_write_get_resume_offset(tsn, slice);
+        tsn_cut_plan_add(plan, TsnCutEnter, MAX(slice->begin, pos), resume, pcr_delta);
+        tsn_cut_plan_add(plan, TsnCutLeave, resume, MIN(slice->end, tsn->file_size), pcr_delta);
+        pcr_delta += tso_get_slice_pcr_delta(&tsn->out, slice);
+        pos = slice->end;
     }
+    tsn_cut_plan_add(plan, TsnCutKeep, pos, tsn->file_size, pcr_delta);
+
+    return plan;
+}
+
+struct TsnWriteContext {
+    TsDemux *demux;
+    TsSnipperOutput *tso;
+};
+
+static gboolean _tsn_write_push_buffer(const guint8 *data, gsize length, struct TsnWriteContext *ctx)
+{
+    TsSnipperOutput *tso = ctx->tso;
+
+    ts_demux_push(ctx->demux, data, length, (TsDemuxBatchFunc)tsn_output_handle_batch, tso);
+    if (!tso->copy && tso->cut_range->type == TsnCutKeep)
+        tso->copy = tso_pid_writer_infos_writing(tso);
 
     return tso->writer_result;
 }
 
+static gboolean _tsn_write_probe_buffer(const guint8 *data, gsize length, TsDemux *demux)
+{
+    ts_demux_push(demux, data, length, NULL, NULL);
+    return !ts_demux_has_programs(demux);
+}
+
+static void tsn_write_read(TsSnipper *tsn, TsDemux *demux)
+{
+    struct TsnWriteContext ctx = {
+        .demux = demux,
+        .tso = &tsn->out
+    };
+    TsSnipperOutput *tso = &tsn->out;
+    const TsnCutRange *range;
+    gsize pos, end;
+    guint j;
+
+    /* Know the pids before the first packet is written. */
+    ts_input_read_range(tsn->input,
+                        0,
+                        MIN(TSN_PROBE_SIZE, tsn->file_size),
+                        TsInputAccessSequential,
+                        (TsInputReadFunc)_tsn_write_probe_buffer,
+                        demux);
+
+    for (j = 0; j < tso->plan->len && tso->writer_result; ++j) {
+        range = &g_array_index(tso->plan, TsnCutRange, j);
+        tso->cut_range = range;
+        tso->copy = 0;
+        ts_demux_seek(demux, range->begin);
+
+        for (pos = range->begin; pos < range->end && tso->writer_result; pos = end) {
+            if (range->type == TsnCutEnter && tso_pid_writer_infos_settled(tso, demux))
+                break;
+            end = range->type == TsnCutEnter ? MIN(pos + TSN_WRITE_SETTLE_STEP, range->end) : range->end;
+
+            ts_input_read_range(tsn->input,
+                                pos,
+                                end - pos,
+                                TsInputAccessSequential,
+                                (TsInputReadFunc)_tsn_write_push_buffer,
+                                &ctx);
+        }
+    }
+    tso->copy = 0;
+    tso->cut_range = NULL;
+    tso->bytes_read = tsn->file_size;
+}
+
+/* Estimate the packets of the disabled pids in [begin, end) from the timeline. */
+static guint64 tsn_count_disabled_packets(TsSnipper *tsn, GArray *disabled, gsize begin, gsize end)
+{
+    if (begin >= end)
+        return 0;
+
+    gsize bucket_size = stream_timeline_get_bucket_size(tsn->timeline);
+    StreamTimelineCounts counts;
+    gdouble packets = 0;
+    gsize bucket_begin, overlap;
+    guint bucket, pid, j;
+
+    for (j = 0; j < disabled->len; ++j) {
+        pid = g_array_index(disabled, guint16, j);
+        for (bucket = begin / bucket_size; bucket <= (end - 1) / bucket_size; ++bucket) {
+            if (!stream_timeline_get_counts(tsn->timeline, bucket, pid, &counts))
+                break;
+            bucket_begin = (gsize)bucket * bucket_size;
+            overlap = MIN(end, bucket_begin + bucket_size) - MAX(begin, bucket_begin);
+            packets += (gdouble)counts.packets * overlap / bucket_size;
+        }
+    }
+
+    return (guint64)packets;
+}
+
+gboolean ts_snipper_get_output_info(TsSnipper *tsn, TsSnipperOutputInfo *info)
+{
+    g_return_val_if_fail(tsn != NULL, FALSE);
+    g_return_val_if_fail(info != NULL, FALSE);
+
+    if (!tsn->input || tsn->state != TsSnipperStateReady)
+        return FALSE;
+
+    /* Like ts_snipper_write(). */
+    GList *slices = tsn_get_write_slices(tsn);
+    GArray *plan = tsn_compile_cut_plan(tsn, slices);
+    g_list_free_full(slices, g_free);
+
+    PcrMap *map = tsn_get_pcr_map(tsn);
+    TsnCutRange *range;
+    guint64 time_begin, time_end;
+    guint64 disabled_size;
+    guint16 pid;
+    guint j;
+
+    /* Only walk the timeline of the few disabled pids. */
+    GArray *disabled = g_array_new(FALSE, FALSE, sizeof(guint16));
+    for (j = 0; j < TSO_PIDS; ++j) {
+        if (tsn->out.pids[j].disabled) {
+            pid = j;
+            g_array_append_val(disabled, pid);
+        }
+    }
+
+    memset(info, 0, sizeof(TsSnipperOutputInfo));
+    for (j = 0; j < plan->len; ++j) {
+        range = &g_array_index(plan, TsnCutRange, j);
+        if (range->type != TsnCutKeep)
+            continue;
+        ++info->ranges;
+        disabled_size = tsn_count_disabled_packets(tsn, disabled, range->begin, range->end) * TS_SIZE;
+        info->size_estimate += range->end - range->begin - MIN(disabled_size, range->end - range->begin);
+        if (pcr_map_offset_to_time(map, range->begin, &time_begin) &&
+                pcr_map_offset_to_time(map, range->end, &time_end))
+            info->duration += time_end - time_begin;
+    }
+    info->duration /= 300;
+
+    g_array_free(disabled, TRUE);
+    g_array_free(plan, TRUE);
+
+    return TRUE;
+}
+
 gboolean ts_snipper_write(TsSnipper *tsn, TsSnipperWriteFunc writer, gpointer userdata)
 {
-    if (!tsn || !writer || !tsn->file)
+    if (!tsn || !writer || !tsn->input)
         return FALSE;
 
     if (tsn->state != TsSnipperStateReady)
@@ -1162,40 +3659,32 @@ gboolean ts_snipper_write(TsSnipper *tsn, TsSnipperWriteFunc writer, gpointer us
     tsn->out.pcr_present = 0;
     tsn->out.pcr_delta = 0;
 
-    guint32 tmp_start_slice = ts_snipper_add_slice(tsn, -1, 0);
-    guint32 tmp_end_slice = ts_snipper_add_slice(tsn, tsn->iframe_count, -1);
+    tsn->out.write_slices = tsn_get_write_slices(tsn);
+    tsn->out.active_slice = tsn->out.write_slices;
+    tsn->out.plan = tsn_compile_cut_plan(tsn, tsn->out.write_slices);
 
-    tsn->out.active_slice = tsn->out.slices;
+    tso_pid_writer_infos_init(&tsn->out);
 
-    tso_pid_writer_infos_init(&tsn->out, tsn->pmgr);
-    tso_pid_writer_infos_reset(&tsn->out, WPAIgnore);
+    TsDemux *demux = ts_demux_new();
 
-    static TsAnalyzerClass tscls = {
-        .handle_packet = (TsHandlePacketFunc)tsn_output_handle_packet
-    };
-    TsAnalyzer *ts_analyzer = ts_analyzer_new(&tscls, &tsn->out);
-
-    ts_analyzer_set_pid_info_manager(ts_analyzer, tsn->pmgr);
-
-    tsn_read_buffered(tsn,
-                      ts_analyzer,
-                      0,
-                      NULL,
-                      NULL);
+    tsn_write_read(tsn, demux);
 
     /* Write rest of buffer. */
     if (tsn->out.writer_result && tsn->out.buffer_filled > 0) {
         tsn->out.writer_result = writer(tsn->out.buffer, tsn->out.buffer_filled, userdata);
     }
 
-    tso_pid_writer_infos_cleanup(&tsn->out, tsn->pmgr);
-    ts_analyzer_free(ts_analyzer);
+    ts_demux_free(demux);
     tsn->out.buffer_size = 0;
     g_free(tsn->out.buffer);
     tsn->out.buffer = NULL;
 
-    ts_snipper_delete_slice(tsn, tmp_start_slice);
-    ts_snipper_delete_slice(tsn, tmp_end_slice);
+    g_array_free(tsn->out.plan, TRUE);
+    tsn->out.plan = NULL;
+
+    tsn->out.active_slice = NULL;
+    g_list_free_full(tsn->out.write_slices, g_free);
+    tsn->out.write_slices = NULL;
 
     tsn->state = TsSnipperStateReady;
 
@@ -1211,27 +3700,14 @@ TsSnipperState ts_snipper_get_state(TsSnipper *tsn)
 
 void ts_snipper_disable_pid(TsSnipper *snipper, guint16 pid)
 {
-    if (snipper == NULL)
-        return;
-    if (snipper->out.disabled_pids == NULL) {
-        snipper->out.disabled_pids = g_array_new(FALSE, FALSE, sizeof(guint16));
-    }
-
-    /* Check that pid is not already set as disabled. */
-    if (tso_is_pid_disabled(&snipper->out, pid))
+    if (snipper == NULL || pid >= TSO_PIDS)
         return;
-    g_array_append_val(snipper->out.disabled_pids, pid);
+    snipper->out.pids[pid].disabled = 1;
 }
 
 void ts_snipper_enable_pid(TsSnipper *snipper, guint16 pid)
 {
-    if (snipper == NULL || snipper->out.disabled_pids == NULL)
+    if (snipper == NULL || pid >= TSO_PIDS)
         return;
-    guint i;
-    for (i = 0; i < snipper->out.disabled_pids->len; ++i) {
-        if (g_array_index(snipper->out.disabled_pids, guint16, i) == pid) {
-            g_array_remove_index_fast(snipper->out.disabled_pids, i);
-            return;
-        }
-    }
+    snipper->out.pids[pid].disabled = 0;
 }
@@ -2,6 +2,7 @@
 
 #include <glib.h>
 #include "pes-frame-info.h"
+#include "input-fingerprint.h"
 
 typedef struct _TsSnipper TsSnipper;
 
@@ -15,8 +16,18 @@ void ts_snipper_ref(TsSnipper *snipper);
 void ts_snipper_unref(TsSnipper *snipper);
 
 const gchar *ts_snipper_get_filename(TsSnipper *tsn);
-/* After analyze */
-const gchar *ts_snipper_get_sha1sum(TsSnipper *tsn);
+/* The SHA-1 is computed on a separate thread during and possibly after analyze. NULL until
+ * it is done. The caller frees the copy with g_free(). */
+gchar *ts_snipper_get_sha1sum(TsSnipper *tsn);
+/* Block until the SHA-1 is done. NULL if the file was not analyzed. Free with g_free(). */
+gchar *ts_snipper_wait_sha1sum(TsSnipper *tsn);
+/* Progress of the SHA-1, returns TRUE once it is done. */
+gboolean ts_snipper_get_sha1_status(TsSnipper *tsn, gsize *bytes_hashed, gsize *bytes_total);
+/* TRUE if the SHA-1 will not be done, e.g., the input could not be read completely. */
+gboolean ts_snipper_get_sha1_failed(TsSnipper *tsn);
+/* Quick fingerprint of the input, only reads a few samples. Computed on first use,
+ * does not need analyze. */
+gboolean ts_snipper_get_fingerprint(TsSnipper *tsn, InputFingerprint *fingerprint);
 
 guint32 ts_snipper_get_iframe_count(TsSnipper *tsn);
 
@@ -24,6 +35,21 @@ bool ts_snipper_get_iframe_info(TsSnipper *tsn, PESFrameInfo *frame_info, guint3
 
 void ts_snipper_get_iframe(TsSnipper *tsn, guint8 **data, gsize *length, guint32 frame_id);
 
+typedef enum {
+    TsSnipperSeekBefore = 0, /* Last I frame at or before the time. */
+    TsSnipperSeekAfter = 1, /* First I frame at or after the time. */
+    TsSnipperSeekNearest = 2
+} TsSnipperSeek;
+
+/* Find an I frame by its PTS (90 kHz, 33 bit) with a binary search of the index. Handles a
+ * wraparound of the PTS, but not discontinuities. Returns PES_FRAME_ID_INVALID if there is
+ * no such frame. */
+guint32 ts_snipper_find_iframe_by_pts(TsSnipper *tsn, guint64 pts, TsSnipperSeek seek);
+/* Same for the media time (90 kHz) since the first PTS of the stream. */
+guint32 ts_snipper_find_iframe_by_time(TsSnipper *tsn, guint64 time, TsSnipperSeek seek);
+/* Same for a frame that is not in the index, e.g., from ts_snipper_find_iframe_near(). */
+void ts_snipper_get_iframe_at(TsSnipper *tsn, const PESFrameInfo *frame_info, guint8 **data, gsize *length);
+
 #define TS_SLICE_ID_INVALID ((guint32)(-1))
 /** A slice in the stream, i.e., a section that is to be cut out. */
 typedef struct {
@@ -49,6 +75,19 @@ typedef struct {
  */
 guint32 ts_snipper_add_slice(TsSnipper *tsn, guint32 frame_begin, guint32 frame_end);
 
+/** Cut between I frames that are not in the index, e.g., from ts_snipper_find_iframe_near().
+ *  The frame ids of the slice are PES_FRAME_ID_INVALID.
+ *  @param[in] begin The first frame of the slice or NULL to cut from start.
+ *  @param[in] end The frame following the slice or NULL to cut until the end.
+ */
+guint32 ts_snipper_add_slice_at(TsSnipper *tsn, const PESFrameInfo *begin, const PESFrameInfo *end);
+
+/** Cut by media time (90 kHz) since the first PTS of the stream. The slice starts at the first
+ *  I frame at or after time_begin and ends at the first I frame at or after time_end, or at the
+ *  end of the stream if there is none.
+ */
+guint32 ts_snipper_add_slice_by_time(TsSnipper *tsn, guint64 time_begin, guint64 time_end);
+
 /** Find a slice containing the given frame id.
  */
 guint32 ts_snipper_find_slice_for_frame(TsSnipper *tsn, TsSlice *slice, guint32 frame_id, gboolean include_end);
@@ -66,11 +105,126 @@ typedef gboolean (*TsSnipperWriteFunc)(guint8 *, gsize, gpointer);
 /** Write filtered output to buffer and call writer.*/
 gboolean ts_snipper_write(TsSnipper *tsn, TsSnipperWriteFunc writer, gpointer userdata);
 
+/* Estimated output of ts_snipper_write() with the current slices and pids, computed from the
+ * cut plan without reading the input. */
+typedef struct {
+    gsize size_estimate; /* Bytes kept. Packets of disabled pids are prorated from the timeline
+                            buckets, packets written at the cuts to finish units are missing. */
+    guint64 duration; /* 90 kHz, 0 without a PCR seek table. */
+    guint ranges; /* Number of kept byte ranges. */
+} TsSnipperOutputInfo;
+
+/* Only possible when ts_snipper_write() is. */
+gboolean ts_snipper_get_output_info(TsSnipper *tsn, TsSnipperOutputInfo *info);
+
 gboolean ts_snipper_get_analyze_status(TsSnipper *tsn, gsize *bytes_read, gsize *bytes_total);
 gboolean ts_snipper_get_write_status(TsSnipper *tsn, gsize *bytes_read, gsize *bytes_total);
 
 void ts_snipper_analyze(TsSnipper *tsn);
 
+/* Analyze the next byte_budget bytes of the input (at least one packet) on the calling thread
+ * and return, so that the analysis of several files can be interleaved, e.g., from the main loop.
+ * The first step starts the analysis, all state is kept in the snipper until it is done. The
+ * state is TsSnipperStateAnalyzing in between, ts_snipper_analyze() is not possible then.
+ * While following the input, steps keep returning TRUE and read nothing if the input did not
+ * grow, the caller should not call it in a busy loop then.
+ * Returns TRUE if there is more to do. */
+gboolean ts_snipper_analyze_step(TsSnipper *tsn, gsize byte_budget);
+
+/* Sparse mode, instead of ts_snipper_analyze() for quick edits of large inputs. Only finds the
+ * video pid and samples the PCR at a few positions, the index stays empty. I frames are then
+ * found on demand with ts_snipper_find_iframe_near() and cut with ts_snipper_add_slice_at(). */
+void ts_snipper_analyze_sparse(TsSnipper *tsn);
+
+/* Estimate the offset of a position (0.0 to 1.0) of the duration from the sampled PCR, or of
+ * the size if it was not sampled. */
+gsize ts_snipper_estimate_offset(TsSnipper *tsn, gdouble position);
+
+/* Offset of a packet at most 100 ms before the media time (90 kHz) since the first PCR, from
+ * the PCR seek table of the analysis. Reading from there finds any position with one short read.
+ * Returns FALSE if the input was not analyzed. */
+gboolean ts_snipper_get_offset_for_time(TsSnipper *tsn, guint64 time, gsize *offset);
+
+/* Duration of the input (90 kHz) from the PCR, 0 if unknown. */
+guint64 ts_snipper_get_duration(TsSnipper *tsn);
+
+/* Timeline of the analysis. The input is divided into buckets of a fixed size, for each of
+ * which the packets, the PES units and the I frames are counted. Cached with the index. */
+#define TS_SNIPPER_ALL_PIDS (0xffff)
+
+typedef struct {
+    gsize offset_start;
+    gsize offset_end;
+    guint64 time_start; /* 90 kHz since the first PCR, PES_FRAME_TS_INVALID if unknown. */
+    guint64 time_end;
+    guint32 packets;
+    guint32 units; /* PES units (or sections) started. */
+    guint64 bitrate; /* bit/s, 0 if the duration is unknown. */
+    guint32 iframes; /* I frames starting in the bucket, for all pids. */
+    gdouble gop_length; /* Pictures per I frame, 0 without I frames. */
+} TsSnipperTimelineEntry;
+
+/* Number of buckets of the timeline. */
+guint ts_snipper_get_timeline_length(TsSnipper *tsn);
+/* Pids in the timeline, free with g_free(). */
+guint16 *ts_snipper_get_timeline_pids(TsSnipper *tsn, guint *count);
+/* Statistics of a pid, or of all with TS_SNIPPER_ALL_PIDS, in a bucket. Returns FALSE if there
+ * is no such bucket. */
+gboolean ts_snipper_get_timeline_entry(TsSnipper *tsn,
+                                       guint bucket,
+                                       guint16 pid,
+                                       TsSnipperTimelineEntry *entry);
+
+/* Signals found by the analysis: EIT present/following events and SCTE-35 splices. They are
+ * mapped to the nearest I frames, which gives candidates for slices. Cached with the index. */
+typedef enum {
+    TsSnipperSignalEvent = 0, /* A new present event in the EIT. */
+    TsSnipperSignalSpliceOut = 1, /* SCTE-35 splice_insert out of the network, e.g., a break starts. */
+    TsSnipperSignalSpliceIn = 2, /* SCTE-35 splice_insert back into the network. */
+    TsSnipperSignalTime = 3 /* SCTE-35 time_signal. */
+} TsSnipperSignalType;
+
+typedef struct {
+    TsSnipperSignalType type;
+    guint16 pid;
+    guint16 service_id; /* EIT only. */
+    guint32 id; /* event_id or splice_event_id. */
+    gsize offset; /* Where the signal was found. */
+    gint64 utc_start; /* EIT only, start of the event in seconds since the epoch. */
+    guint64 pts; /* Signalled point (90 kHz), PES_FRAME_TS_INVALID if unknown. EIT start times are
+                    placed with TDT/TOT if present, otherwise where the event became present. */
+    guint64 duration; /* Of the event or break (90 kHz), 0 if unknown. */
+    guint32 frame_begin; /* I frame nearest to pts, PES_FRAME_ID_INVALID if none. */
+    guint32 frame_end; /* I frame nearest to the end if the duration is known. */
+} TsSnipperSignal;
+
+guint ts_snipper_get_signal_count(TsSnipper *tsn);
+/* Returns FALSE if there is no such signal. */
+gboolean ts_snipper_get_signal(TsSnipper *tsn, guint index, TsSnipperSignal *signal);
+
+/* Find the first I frame starting at or after offset by scanning the input from there, the
+ * result is cached. The frame number is PES_FRAME_ID_INVALID.
+ * Returns FALSE if there is none within a few megabytes. */
+gboolean ts_snipper_find_iframe_near(TsSnipper *tsn, gsize offset, PESFrameInfo *frame_info);
+
+/* Number of threads used by ts_snipper_analyze(). Large mapped files are split into chunks
+ * which are indexed in parallel. 0 uses one thread per processor for the chunks (default),
+ * 1 forces a single sequential pass. Other inputs and follow mode are read sequentially,
+ * unless 2 or more threads are set explicitly: then they are read, parsed and indexed in a
+ * pipeline on separate threads. */
+void ts_snipper_set_analyze_threads(TsSnipper *tsn, guint threads);
+
+/* Whether ts_snipper_analyze() uses the index cache (<input>.tsidx or in the user cache
+ * directory). If the input did not change since the last analysis, the index is read from
+ * the cache instead of reading the whole input. Enabled by default. */
+void ts_snipper_set_index_cache(TsSnipper *tsn, gboolean use_cache);
+
+/* Follow the input while it grows, e.g., while it is still being recorded. If set,
+ * ts_snipper_analyze() keeps indexing appended data until it is unset again. New I frames
+ * are available as soon as they are found. The SHA-1 is computed afterwards. */
+void ts_snipper_set_follow(TsSnipper *tsn, gboolean follow);
+gboolean ts_snipper_get_follow(TsSnipper *tsn);
+
 typedef enum {
     TsSnipperStateUnknown = 0,
     TsSnipperStateInitialized = 1,